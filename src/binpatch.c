@@ -0,0 +1,648 @@
+// binpatch.c - GIT binary patch hunks: base85, inflate and delta, decoded as their lines come (C99 only)
+// Memory stays bounded by the 32 KB inflate window, whatever the size of the files
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "binpatch.h"
+
+#define STEP_BITS   48      /* input bits that always suffice for one inflate step */
+#define ADLER_MOD   65521
+#define ADLER_NMAX  5552    /* bytes summed before the sums may overflow 32 bits */
+
+enum {
+    INFLATE_HEADER,
+    INFLATE_BLOCK,
+    INFLATE_STORED_HEADER,
+    INFLATE_STORED,
+    INFLATE_DYNAMIC,
+    INFLATE_CODE_LENGTH_CODES,
+    INFLATE_CODE_LENGTHS,
+    INFLATE_CODES,
+    INFLATE_TRAILER,
+    INFLATE_DONE
+};
+
+enum { DELTA_BASE_SIZE, DELTA_RESULT_SIZE, DELTA_OP, DELTA_COPY_ARGS, DELTA_INSERT };
+
+static const uint16_t length_base[29] = { 3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                          31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                          2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dist_base[30] = { 1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,    65,    97,    129,
+                                        193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                        6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+/* order the code length code lengths come in */
+static const uint8_t length_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static int fail(binpatch_t* bp, const char* error) {
+    if (bp->error == NULL)
+        bp->error = error;
+    return 1;
+}
+
+/*
+ *  RESULT
+ */
+
+/* Writes result bytes, or compares them with the expected stream */
+static int result_write(binpatch_t* bp, const char* data, size_t length) {
+    bp->written += length;
+    if (bp->expect == NULL) {
+        if (bp->hash != NULL)
+            blobhash_update(bp->hash, data, length);
+        if (length > 0 && bp->out->write(bp->out, (char*)data, 1, length) != (long)length)
+            return fail(bp, "write error");
+        return 0;
+    }
+    char* expected = bp->copy_buffer + BINPATCH_COPY_BUFFER;
+    while (length > 0) {
+        size_t n = length < BINPATCH_COPY_BUFFER ? length : BINPATCH_COPY_BUFFER;
+        if (bp->expect->read(bp->expect, expected, 1, n) != (long)n || memcmp(expected, data, n) != 0)
+            return fail(bp, "the file differs");
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/* Index of the next argument byte of the copy instruction, 7 if it has no more */
+static unsigned int delta_next_arg(const binpatch_t* bp) {
+    unsigned int arg = bp->copy_arg;
+    while (arg < 7 && !(bp->copy_mask & (1u << arg)))
+        ++arg;
+    return arg;
+}
+
+/* Copies the span of the base file a copy instruction names, a chunk at a time */
+static int delta_copy(binpatch_t* bp) {
+    size_t offset = bp->copy_offset;
+    size_t size = bp->copy_size != 0 ? bp->copy_size : 0x10000;
+    if (offset > bp->base_size || size > bp->base_size - offset)
+        return fail(bp, "delta copies past the end of the base file");
+    if (size > bp->result_size - bp->written)
+        return fail(bp, "delta result is longer than it says");
+    if (bp->base->seekg(bp->base, offset, SEEK_SET) != 0)
+        return fail(bp, "cannot seek in the base file");
+    while (size > 0) {
+        size_t n = size < BINPATCH_COPY_BUFFER ? size : BINPATCH_COPY_BUFFER;
+        if (bp->base->read(bp->base, bp->copy_buffer, 1, n) != (long)n)
+            return fail(bp, "read error in the base file");
+        if (result_write(bp, bp->copy_buffer, n) != 0)
+            return 1;
+        size -= n;
+    }
+    return 0;
+}
+
+/* Runs the delta instructions in the inflated bytes; an instruction may span calls */
+static int delta_run(binpatch_t* bp, const unsigned char* data, size_t length) {
+    size_t i = 0;
+    while (i < length) {
+        switch (bp->delta_state) {
+        case DELTA_BASE_SIZE:
+        case DELTA_RESULT_SIZE: {
+            /* 7 bits a byte, lowest first, the high bit set on all but the last */
+            unsigned char c = data[i++];
+            if (bp->varint_shift >= 8 * sizeof(size_t))
+                return fail(bp, "corrupt delta header");
+            bp->varint |= (size_t)(c & 0x7f) << bp->varint_shift;
+            bp->varint_shift += 7;
+            if (c & 0x80)
+                break;
+            if (bp->delta_state == DELTA_BASE_SIZE && bp->varint != bp->base_size)
+                return fail(bp, "delta is not made against this base file, the size differs");
+            if (bp->delta_state == DELTA_RESULT_SIZE && bp->hash != NULL)
+                blobhash_begin(bp->hash, bp->varint);
+            if (bp->delta_state == DELTA_RESULT_SIZE)
+                bp->result_size = bp->varint;
+            bp->delta_state = bp->delta_state == DELTA_BASE_SIZE ? DELTA_RESULT_SIZE : DELTA_OP;
+            bp->varint = 0;
+            bp->varint_shift = 0;
+            break;
+        }
+        case DELTA_OP: {
+            unsigned char c = data[i++];
+            if (c & 0x80) {
+                bp->copy_mask = c;
+                bp->copy_arg = 0;
+                bp->copy_offset = bp->copy_size = 0;
+                bp->delta_state = DELTA_COPY_ARGS;
+            } else if (c != 0) {
+                bp->insert_left = c;
+                bp->delta_state = DELTA_INSERT;
+            } else {
+                return fail(bp, "reserved delta instruction");
+            }
+            break;
+        }
+        case DELTA_COPY_ARGS: {
+            unsigned int arg = delta_next_arg(bp);
+            size_t value = data[i++];
+            if (arg < 4)
+                bp->copy_offset |= value << (8 * arg);
+            else
+                bp->copy_size |= value << (8 * (arg - 4));
+            bp->copy_arg = arg + 1;
+            break;
+        }
+        case DELTA_INSERT: {
+            size_t n = length - i < bp->insert_left ? length - i : bp->insert_left;
+            if (n > bp->result_size - bp->written)
+                return fail(bp, "delta result is longer than it says");
+            if (result_write(bp, (const char*)data + i, n) != 0)
+                return 1;
+            i += n;
+            bp->insert_left -= n;
+            if (bp->insert_left == 0)
+                bp->delta_state = DELTA_OP;
+            break;
+        }
+        }
+
+        /* a copy is done as soon as its last argument byte is in */
+        if (bp->delta_state == DELTA_COPY_ARGS && delta_next_arg(bp) == 7) {
+            if (delta_copy(bp) != 0)
+                return 1;
+            bp->delta_state = DELTA_OP;
+        }
+    }
+    return 0;
+}
+
+/*
+ *  INFLATE
+ */
+
+static void adler_update(binpatch_t* bp, const unsigned char* data, size_t length) {
+    uint32_t a = bp->adler_a, b = bp->adler_b;
+    while (length > 0) {
+        size_t n = length < ADLER_NMAX ? length : ADLER_NMAX;
+        length -= n;
+        while (n-- > 0) {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+    }
+    bp->adler_a = a;
+    bp->adler_b = b;
+}
+
+/* Passes the window bytes not passed on yet to the literal or delta stage */
+static int inflate_flush(binpatch_t* bp) {
+    size_t length = bp->window_pos - bp->window_flushed;
+    const unsigned char* data = bp->window + bp->window_flushed;
+    if (bp->window_pos == BINPATCH_WINDOW)
+        bp->window_pos = 0;
+    bp->window_flushed = bp->window_pos;
+    if (length == 0)
+        return 0;
+
+    adler_update(bp, data, length);
+    if (bp->kind == BINPATCH_LITERAL)
+        return result_write(bp, (const char*)data, length);
+    return delta_run(bp, data, length);
+}
+
+static int inflate_emit(binpatch_t* bp, unsigned char c) {
+    if (bp->inflated == bp->size)
+        return fail(bp, "more data than the hunk header says");
+    ++bp->inflated;
+    bp->window[bp->window_pos++] = c;
+    return bp->window_pos == BINPATCH_WINDOW ? inflate_flush(bp) : 0;
+}
+
+static size_t input_bits(const binpatch_t* bp) {
+    return bp->bit_count + 8 * (bp->input_length - bp->input_pos);
+}
+
+/* Moves input bytes into the bit buffer until it holds `n` bits. Returns 0 if the input runs out first */
+static int bits_need(binpatch_t* bp, unsigned int n) {
+    while (bp->bit_count < n) {
+        if (bp->input_pos == bp->input_length)
+            return 0;
+        bp->bits |= (uint64_t)bp->input[bp->input_pos++] << bp->bit_count;
+        bp->bit_count += 8;
+    }
+    return 1;
+}
+
+static uint32_t bits_take(binpatch_t* bp, unsigned int n) {
+    uint32_t value = (uint32_t)(bp->bits & (((uint64_t)1 << n) - 1));
+    bp->bits >>= n;
+    bp->bit_count -= n;
+    return value;
+}
+
+#define TAKE(value, n)                                          \
+    do {                                                        \
+        if (!bits_need(bp, (n)))                                \
+            return fail(bp, "deflate stream is cut short");     \
+        (value) = bits_take(bp, (n));                           \
+    } while (0)
+
+/* huffman_build:
+ *  Makes the code of the given code lengths, 0 for an unused symbol.
+ *
+ * Returns 0 on success, non-0 if the lengths are no prefix code
+ */
+static int huffman_build(binpatch_huffman_t* h, const unsigned char* lengths, unsigned int n) {
+    memset(h->counts, 0, sizeof(h->counts));
+    for (unsigned int i = 0; i < n; ++i)
+        ++h->counts[lengths[i]];
+    h->counts[0] = 0;
+
+    int left = 1;   /* codes of the current length not taken yet */
+    for (unsigned int len = 1; len < 16; ++len) {
+        left = 2 * left - h->counts[len];
+        if (left < 0)
+            return 1;
+    }
+
+    uint16_t offsets[16];
+    offsets[1] = 0;
+    for (unsigned int len = 1; len < 15; ++len)
+        offsets[len + 1] = (uint16_t)(offsets[len] + h->counts[len]);
+    for (unsigned int i = 0; i < n; ++i)
+        if (lengths[i] != 0)
+            h->symbols[offsets[lengths[i]]++] = (uint16_t)i;
+
+    /* short codes: every table index their bits start, reversed, as the bits come first bit lowest */
+    memset(h->fast, 0, sizeof(h->fast));
+    unsigned int code = 0, index = 0;
+    for (unsigned int len = 1; len <= BINPATCH_FAST_BITS; ++len) {
+        for (unsigned int k = 0; k < h->counts[len]; ++k, ++code, ++index) {
+            unsigned int reversed = 0;
+            for (unsigned int b = 0; b < len; ++b)
+                reversed |= ((code >> b) & 1u) << (len - 1 - b);
+            for (unsigned int f = reversed; f < (1u << BINPATCH_FAST_BITS); f += 1u << len)
+                h->fast[f] = (uint16_t)(h->symbols[index] << 4 | len);
+        }
+        code <<= 1;
+    }
+    return 0;
+}
+
+/* Decodes a symbol, -1 if the bits are no code or the input runs out */
+static int huffman_decode(binpatch_t* bp, const binpatch_huffman_t* h) {
+    bits_need(bp, 15);  /* fewer at the end of the input, the code may still be shorter */
+    unsigned int entry = h->fast[bp->bits & ((1u << BINPATCH_FAST_BITS) - 1)];
+    if (entry != 0 && (entry & 15) <= bp->bit_count) {
+        bits_take(bp, entry & 15);
+        return (int)(entry >> 4);
+    }
+
+    /* long code: bit by bit, the codes of every length follow those one bit shorter */
+    int code = 0, first = 0, index = 0;
+    for (unsigned int len = 1; len < 16 && len <= bp->bit_count; ++len) {
+        code |= (int)((bp->bits >> (len - 1)) & 1);
+        int count = h->counts[len];
+        if (code - first < count) {
+            bits_take(bp, len);
+            return h->symbols[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static int inflate_fixed(binpatch_t* bp) {
+    unsigned char lengths[288];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    huffman_build(&bp->lit, lengths, 288);
+    memset(lengths, 5, 30);
+    huffman_build(&bp->dist, lengths, 30);
+    return 0;
+}
+
+/* inflate_step:
+ *  Decodes one piece of the deflate stream: a header, a code length or a
+ *  literal or match. Given STEP_BITS of input, a step never runs out of it.
+ *
+ * Returns 0 on success, non-0 on error
+ */
+static int inflate_step(binpatch_t* bp) {
+    uint32_t value;
+    switch (bp->state) {
+    case INFLATE_HEADER: {
+        uint32_t cmf, flg;
+        TAKE(cmf, 8);
+        TAKE(flg, 8);
+        if ((cmf & 15) != 8 || (cmf >> 4) > 7 || (cmf * 256 + flg) % 31 != 0 || (flg & 0x20))
+            return fail(bp, "no zlib stream");
+        bp->state = INFLATE_BLOCK;
+        return 0;
+    }
+    case INFLATE_BLOCK: {
+        TAKE(value, 1);
+        bp->last_block = (int)value;
+        TAKE(value, 2);
+        if (value == 0) {
+            bits_take(bp, bp->bit_count % 8);
+            bp->state = INFLATE_STORED_HEADER;
+        } else if (value == 1) {
+            inflate_fixed(bp);
+            bp->state = INFLATE_CODES;
+        } else if (value == 2) {
+            bp->state = INFLATE_DYNAMIC;
+        } else {
+            return fail(bp, "corrupt deflate block type");
+        }
+        return 0;
+    }
+    case INFLATE_STORED_HEADER: {
+        uint32_t nlen;
+        TAKE(value, 16);
+        TAKE(nlen, 16);
+        if (value != (~nlen & 0xffff))
+            return fail(bp, "corrupt stored block length");
+        bp->stored_left = value;
+        bp->state = INFLATE_STORED;
+        return 0;
+    }
+    case INFLATE_DYNAMIC: {
+        TAKE(value, 5);
+        bp->lit_count = value + 257;
+        TAKE(value, 5);
+        bp->dist_count = value + 1;
+        TAKE(value, 4);
+        bp->length_count = value + 4;
+        if (bp->lit_count > 286 || bp->dist_count > 30)
+            return fail(bp, "corrupt dynamic block header");
+        memset(bp->lengths, 0, 19);
+        bp->length_index = 0;
+        bp->state = INFLATE_CODE_LENGTH_CODES;
+        return 0;
+    }
+    case INFLATE_CODE_LENGTH_CODES: {
+        TAKE(value, 3);
+        bp->lengths[length_order[bp->length_index++]] = (unsigned char)value;
+        if (bp->length_index < bp->length_count)
+            return 0;
+        /* the code length code is kept in the distance code until that is built */
+        if (huffman_build(&bp->dist, bp->lengths, 19) != 0)
+            return fail(bp, "corrupt code length code");
+        bp->length_index = 0;
+        bp->state = INFLATE_CODE_LENGTHS;
+        return 0;
+    }
+    case INFLATE_CODE_LENGTHS: {
+        unsigned int total = bp->lit_count + bp->dist_count;
+        int symbol = huffman_decode(bp, &bp->dist);
+        if (symbol < 0)
+            return fail(bp, "corrupt code lengths");
+        if (symbol < 16) {
+            bp->lengths[bp->length_index++] = (unsigned char)symbol;
+        } else {
+            unsigned int repeat, length = 0;
+            if (symbol == 16) {
+                if (bp->length_index == 0)
+                    return fail(bp, "corrupt code lengths");
+                length = bp->lengths[bp->length_index - 1];
+                TAKE(repeat, 2);
+                repeat += 3;
+            } else if (symbol == 17) {
+                TAKE(repeat, 3);
+                repeat += 3;
+            } else {
+                TAKE(repeat, 7);
+                repeat += 11;
+            }
+            if (bp->length_index + repeat > total)
+                return fail(bp, "corrupt code lengths");
+            memset(bp->lengths + bp->length_index, (int)length, repeat);
+            bp->length_index += repeat;
+        }
+        if (bp->length_index < total)
+            return 0;
+        if (bp->lengths[256] == 0 || huffman_build(&bp->lit, bp->lengths, bp->lit_count) != 0 ||
+            huffman_build(&bp->dist, bp->lengths + bp->lit_count, bp->dist_count) != 0)
+            return fail(bp, "corrupt dynamic block codes");
+        bp->state = INFLATE_CODES;
+        return 0;
+    }
+    case INFLATE_CODES: {
+        int symbol = huffman_decode(bp, &bp->lit);
+        if (symbol < 0)
+            return fail(bp, "corrupt deflate data");
+        if (symbol < 256)
+            return inflate_emit(bp, (unsigned char)symbol);
+        if (symbol == 256) {
+            bp->state = bp->last_block ? INFLATE_TRAILER : INFLATE_BLOCK;
+            return 0;
+        }
+        symbol -= 257;
+        if (symbol >= 29)
+            return fail(bp, "corrupt deflate data");
+        TAKE(value, length_extra[symbol]);
+        unsigned int length = length_base[symbol] + value;
+
+        symbol = huffman_decode(bp, &bp->dist);
+        if (symbol < 0 || symbol >= 30)
+            return fail(bp, "corrupt deflate data");
+        TAKE(value, dist_extra[symbol]);
+        size_t distance = dist_base[symbol] + value;
+        if (distance > bp->inflated)
+            return fail(bp, "deflate match before the start of the data");
+
+        while (length-- > 0) {
+            unsigned char c = bp->window[(bp->window_pos - distance) & (BINPATCH_WINDOW - 1)];
+            if (inflate_emit(bp, c) != 0)
+                return 1;
+        }
+        return 0;
+    }
+    case INFLATE_TRAILER: {
+        uint32_t adler = 0;
+        bits_take(bp, bp->bit_count % 8);
+        for (int i = 0; i < 4; ++i) {
+            TAKE(value, 8);
+            adler = adler << 8 | value;
+        }
+        if (inflate_flush(bp) != 0)
+            return 1;
+        if (adler != (bp->adler_b << 16 | bp->adler_a))
+            return fail(bp, "checksum mismatch, the data is corrupt");
+        bp->state = INFLATE_DONE;
+        return 0;
+    }
+    }
+    return fail(bp, "data after the end of the deflate stream");
+}
+
+/* Inflates the pending input; short of the final call, only as long as a step is sure to finish */
+static int inflate_run(binpatch_t* bp, int final) {
+    while (bp->state != INFLATE_DONE) {
+        if (bp->state == INFLATE_STORED) {
+            while (bp->stored_left > 0) {
+                unsigned char c;
+                if (bp->bit_count >= 8)
+                    c = (unsigned char)bits_take(bp, 8);
+                else if (bp->input_pos < bp->input_length)
+                    c = bp->input[bp->input_pos++];
+                else
+                    break;
+                if (inflate_emit(bp, c) != 0)
+                    return 1;
+                --bp->stored_left;
+            }
+            if (bp->stored_left > 0) {
+                if (final)
+                    return fail(bp, "deflate stream is cut short");
+                break;
+            }
+            bp->state = bp->last_block ? INFLATE_TRAILER : INFLATE_BLOCK;
+            continue;
+        }
+        if (!final && input_bits(bp) < STEP_BITS)
+            break;
+        if (inflate_step(bp) != 0)
+            return 1;
+    }
+    if (bp->state == INFLATE_DONE && input_bits(bp) > 0)
+        return fail(bp, "data after the end of the deflate stream");
+
+    /* keep the few bytes left for the next line */
+    memmove(bp->input, bp->input + bp->input_pos, bp->input_length - bp->input_pos);
+    bp->input_length -= bp->input_pos;
+    bp->input_pos = 0;
+    return inflate_flush(bp);
+}
+
+/*
+ *  BASE85
+ */
+
+/* Value of a base85 digit of git's alphabet, -1 if it is none */
+static int base85_value(unsigned char c) {
+    static const char symbols[] = "!#$%&()*+-;<=>?@^_`{|}~";
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 36;
+    const char* p = c != 0 ? strchr(symbols, c) : NULL;
+    return p != NULL ? (int)(p - symbols) + 62 : -1;
+}
+
+/*
+ *  PUBLIC API
+ */
+
+int binpatch_header(const char* line, int* kind, size_t* size) {
+    const char* p;
+    if (strncmp(line, "literal ", 8) == 0) {
+        *kind = BINPATCH_LITERAL;
+        p = line + 8;
+    } else if (strncmp(line, "delta ", 6) == 0) {
+        *kind = BINPATCH_DELTA;
+        p = line + 6;
+    } else {
+        return 1;
+    }
+    if (*p < '0' || *p > '9')
+        return 1;
+    char* end;
+    *size = (size_t)strtoull(p, &end, 10);
+    return (*end == '\0' || *end == '\r' || *end == '\n') ? 0 : 1;
+}
+
+int binpatch_begin(binpatch_t* bp, int kind, size_t size, stream_wrapper_t* base, stream_wrapper_t* out,
+                   stream_wrapper_t* expect, blobhash_t* hash) {
+    char* copy_buffer = bp->copy_buffer;
+    memset(bp, 0, sizeof(binpatch_t));
+    if (copy_buffer == NULL)
+        copy_buffer = malloc(2 * BINPATCH_COPY_BUFFER);
+    if (copy_buffer == NULL)
+        return 1;
+    bp->copy_buffer = copy_buffer;
+
+    bp->kind = kind;
+    bp->size = size;
+    bp->base = base;
+    bp->out = out;
+    bp->expect = expect;
+    bp->hash = expect == NULL ? hash : NULL;
+    bp->state = INFLATE_HEADER;
+    bp->adler_a = 1;
+    bp->delta_state = DELTA_BASE_SIZE;
+    if (kind == BINPATCH_LITERAL && bp->hash != NULL)
+        blobhash_begin(bp->hash, size);
+
+    /* a delta names the size of its base, it is checked as soon as it is read */
+    if (kind == BINPATCH_DELTA) {
+        long base_size;
+        if (base == NULL || base->seekg(base, 0, SEEK_END) != 0 || (base_size = base->tellg(base)) < 0)
+            return fail(bp, "cannot seek in the base file");
+        bp->base_size = (size_t)base_size;
+    }
+    return 0;
+}
+
+int binpatch_line(binpatch_t* bp, const char* line) {
+    if (bp->error != NULL)
+        return 1;
+
+    /* the first character is the byte count: A-Z for 1-26, a-z for 27-52 */
+    size_t count;
+    if (*line >= 'A' && *line <= 'Z')
+        count = (size_t)(*line - 'A') + 1;
+    else if (*line >= 'a' && *line <= 'z')
+        count = (size_t)(*line - 'a') + 27;
+    else
+        return fail(bp, "corrupt binary patch line");
+    const unsigned char* p = (const unsigned char*)line + 1;
+
+    /* 5 digits for every 4 bytes, big endian; the last group is cut to the count */
+    unsigned char* dst = bp->input + bp->input_length;
+    for (size_t done = 0; done < count; done += 4) {
+        uint64_t group = 0;
+        for (int i = 0; i < 5; ++i) {
+            int digit = base85_value(*p++);
+            if (digit < 0)
+                return fail(bp, "corrupt binary patch line");
+            group = group * 85 + (uint64_t)digit;
+        }
+        if (group > 0xffffffffu)
+            return fail(bp, "corrupt binary patch line");
+        for (size_t i = 0; i < 4 && done + i < count; ++i)
+            *dst++ = (unsigned char)(group >> (24 - 8 * i));
+    }
+    if (*p != '\0' && *p != '\r' && *p != '\n')
+        return fail(bp, "corrupt binary patch line");
+    bp->input_length += count;
+
+    return inflate_run(bp, 0);
+}
+
+int binpatch_end(binpatch_t* bp) {
+    if (bp->error != NULL || inflate_run(bp, 1) != 0)
+        return 1;
+    if (bp->inflated != bp->size)
+        return fail(bp, "less data than the hunk header says");
+    if (bp->kind == BINPATCH_DELTA && (bp->delta_state != DELTA_OP || bp->written != bp->result_size))
+        return fail(bp, "delta is cut short");
+
+    /* compared whole: the expected stream has nothing more */
+    char c;
+    if (bp->expect != NULL && bp->expect->read(bp->expect, &c, 1, 1) != 0)
+        return fail(bp, "the file differs");
+    if (bp->hash != NULL && blobhash_end(bp->hash) != 0)
+        return fail(bp, "the result is not the blob of the index line");
+    return 0;
+}
+
+void binpatch_free(binpatch_t* bp) {
+    free(bp->copy_buffer);
+    bp->copy_buffer = NULL;
+}
@@ -0,0 +1,108 @@
+#ifndef BINPATCH_H_
+#define BINPATCH_H_
+
+#include <stdint.h>
+
+#include "blobhash.h"
+#include "csw.h"
+
+/* Kinds of GIT binary patch hunks */
+#define BINPATCH_LITERAL 1  /* the data is the whole file */
+#define BINPATCH_DELTA   2  /* the data is a git delta against the base file */
+
+#define BINPATCH_WINDOW      32768  /* deflate window, the most output an inflater looks back at */
+#define BINPATCH_FAST_BITS   10     /* Huffman codes up to this length are decoded with one lookup */
+#define BINPATCH_INPUT       128    /* inflate input waiting for enough bits, a few base85 lines */
+#define BINPATCH_COPY_BUFFER 16384  /* chunk the base file is copied by */
+
+/* Canonical Huffman code: codes are ordered by length, then by symbol */
+typedef struct binpatch_huffman {
+    uint16_t counts[16];    /* number of codes of every length */
+    uint16_t symbols[288];  /* symbols in code order */
+    uint16_t fast[1 << BINPATCH_FAST_BITS]; /* symbol << 4 | length of the short code the low bits start, 0 if none */
+} binpatch_huffman_t;
+
+/*
+ * Decoder of one hunk of a GIT binary patch. The base85 lines of the hunk are
+ * fed one at a time and decoded right away: inflated, then written out as
+ * they are (literal) or run as delta instructions that copy spans of the base
+ * file, read at the offsets they name. Nothing is kept but the inflate window
+ * and a few bytes of pending input, whatever the size of the files.
+ */
+typedef struct binpatch {
+    int kind;                   /* BINPATCH_LITERAL or BINPATCH_DELTA */
+    size_t size;                /* inflated size, from the hunk header */
+    stream_wrapper_t* base;     /* file a delta copies from */
+    stream_wrapper_t* out;      /* where the result goes */
+    stream_wrapper_t* expect;   /* if not NULL, the result is compared with it instead of written */
+    blobhash_t* hash;           /* if not NULL, the result is hashed and compared at the end */
+    const char* error;          /* why decoding failed, NULL if it did not */
+    size_t written;             /* result bytes so far */
+
+    /* inflate */
+    int state;
+    int last_block;
+    uint64_t bits;              /* input bits not used yet, first bit lowest */
+    unsigned int bit_count;
+    unsigned char input[BINPATCH_INPUT];
+    size_t input_pos, input_length;
+    uint32_t stored_left;       /* bytes left of a stored block */
+    unsigned int lit_count, dist_count, length_count, length_index;
+    unsigned char lengths[320]; /* code lengths of a dynamic block */
+    binpatch_huffman_t lit, dist;
+    unsigned char window[BINPATCH_WINDOW];
+    size_t window_pos;          /* next byte of the window, the bytes from window_flushed were not passed on */
+    size_t window_flushed;
+    size_t inflated;            /* inflated bytes so far */
+    uint32_t adler_a, adler_b;
+
+    /* delta */
+    int delta_state;
+    size_t base_size;           /* size of the base file */
+    size_t result_size;         /* size of the result, from the delta header */
+    size_t varint;              /* size being read from the delta header */
+    unsigned int varint_shift;
+    unsigned int copy_mask, copy_arg;
+    size_t copy_offset, copy_size;
+    size_t insert_left;
+    char* copy_buffer;
+} binpatch_t;
+
+/*
+ * Parses a hunk header: "literal <size>" or "delta <size>".
+ *
+ * returns 0 on success, non-0 if the line is no hunk header
+ */
+int binpatch_header(const char* line, int* kind, size_t* size);
+
+/*
+ * Starts decoding a hunk. `base` is needed by a delta only and must be
+ * seekable; `expect`, if not NULL, replaces `out`. `hash`, if not NULL, has
+ * been given the blob hash the result must have, see blobhash_init().
+ *
+ * returns 0 on success, non-0 on error (out of memory)
+ */
+int binpatch_begin(binpatch_t* bp, int kind, size_t size, stream_wrapper_t* base, stream_wrapper_t* out,
+                   stream_wrapper_t* expect, blobhash_t* hash);
+
+/*
+ * Decodes one base85 line of the hunk, EOL included or not.
+ *
+ * returns 0 on success, non-0 on error, see `error`
+ */
+int binpatch_line(binpatch_t* bp, const char* line);
+
+/*
+ * Ends the hunk: the data must have ended where the deflate stream and the
+ * sizes say. The result is complete only if this succeeds.
+ *
+ * returns 0 on success, non-0 on error, see `error`
+ */
+int binpatch_end(binpatch_t* bp);
+
+/*
+ * Frees the memory of the decoder, it may be begun again after.
+ */
+void binpatch_free(binpatch_t* bp);
+
+#endif  /* BINPATCH_H_ */
@@ -0,0 +1,217 @@
+// blobhash.c - git blob SHA-1 and SHA-256 of a file as it streams by (C99 only)
+
+#include <stdio.h>
+#include <string.h>
+
+#include "blobhash.h"
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static uint32_t load_be32(const unsigned char* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static void sha1_block(uint32_t* state, const unsigned char* block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i)
+        w[i] = load_be32(block + 4 * i);
+    for (int i = 16; i < 80; ++i)
+        w[i] = ROTL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; ++i) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        uint32_t t = ROTL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROTL(b, 30);
+        b = a;
+        a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+static void sha256_block(uint32_t* state, const unsigned char* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+        w[i] = load_be32(block + 4 * i);
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+static void hash_block(blobhash_t* h, const unsigned char* block) {
+    if (h->kinds & BLOBHASH_SHA1)
+        sha1_block(h->sha1, block);
+    if (h->kinds & BLOBHASH_SHA256)
+        sha256_block(h->sha256, block);
+}
+
+int blobhash_init(blobhash_t* h, const char* hex) {
+    memset(h, 0, sizeof(blobhash_t));
+
+    size_t n = 0;
+    int zero = 1;
+    for (; n <= BLOBHASH_HEX_MAX; ++n) {
+        char c = hex[n];
+        if (c >= 'A' && c <= 'F')
+            c = (char)(c - 'A' + 'a');
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+            break;
+        if (n < BLOBHASH_HEX_MAX)
+            h->expect[n] = c;
+        zero &= c == '0';
+    }
+    if (n < BLOBHASH_HEX_MIN || n > BLOBHASH_HEX_MAX || (n > 40 && n < 64) || zero) {
+        h->expect[0] = '\0';
+        return 1;   /* no hash, or the missing side of a created or deleted file */
+    }
+    h->expect[n] = '\0';
+    h->kinds = n == 40 ? BLOBHASH_SHA1 : n == 64 ? BLOBHASH_SHA256 : BLOBHASH_SHA1 | BLOBHASH_SHA256;
+    return 0;
+}
+
+void blobhash_reset(blobhash_t* h, unsigned int kinds) {
+    static const uint32_t sha1_init[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    static const uint32_t sha256_init[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                             0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    h->kinds = kinds;
+    memcpy(h->sha1, sha1_init, sizeof(sha1_init));
+    memcpy(h->sha256, sha256_init, sizeof(sha256_init));
+    h->length = 0;
+}
+
+void blobhash_begin(blobhash_t* h, size_t size) {
+    if (h->kinds == 0)
+        return;
+    blobhash_reset(h, h->kinds);
+
+    /* "blob <decimal size>" and its terminating NUL */
+    char header[32];
+    int length = snprintf(header, sizeof(header), "blob %llu", (unsigned long long)size);
+    blobhash_update(h, header, (size_t)length + 1);
+}
+
+void blobhash_update(blobhash_t* h, const void* data, size_t length) {
+    if (h->kinds == 0 || length == 0)
+        return;
+    const unsigned char* p = (const unsigned char*)data;
+    size_t used = (size_t)(h->length % 64);
+    h->length += length;
+
+    if (used > 0) {
+        size_t n = 64 - used < length ? 64 - used : length;
+        memcpy(h->block + used, p, n);
+        p += n;
+        length -= n;
+        if (used + n < 64)
+            return;
+        hash_block(h, h->block);
+    }
+    /* whole blocks are hashed where they are */
+    for (; length >= 64; p += 64, length -= 64)
+        hash_block(h, p);
+    memcpy(h->block, p, length);
+}
+
+/* Lowercase hex of the digest words, big endian */
+static void digest_hex(const uint32_t* state, int words, char* hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < words; ++i)
+        for (int j = 0; j < 8; ++j)
+            *hex++ = digits[(state[i] >> (28 - 4 * j)) & 0xf];
+    *hex = '\0';
+}
+
+/* Pads the last block: a 1 bit, zeros up to 8 bytes short of a block, then the length in bits */
+static void hash_finish(blobhash_t* h) {
+    unsigned char pad[72] = { 0x80 };
+    uint64_t bits = h->length * 8;
+    size_t used = (size_t)(h->length % 64);
+    size_t n = (used < 56 ? 56 : 120) - used;
+    for (int i = 0; i < 8; ++i)
+        pad[n + (size_t)i] = (unsigned char)(bits >> (56 - 8 * i));
+    blobhash_update(h, pad, n + 8);
+}
+
+int blobhash_end(blobhash_t* h) {
+    if (h->kinds == 0)
+        return 1;
+    hash_finish(h);
+
+    char hex[BLOBHASH_HEX_MAX + 1];
+    size_t length = strlen(h->expect);
+    if (h->kinds & BLOBHASH_SHA1) {
+        digest_hex(h->sha1, 5, hex);
+        if (strncmp(hex, h->expect, length) == 0)
+            return 0;
+    }
+    if (h->kinds & BLOBHASH_SHA256) {
+        digest_hex(h->sha256, 8, hex);
+        if (strncmp(hex, h->expect, length) == 0)
+            return 0;
+    }
+    return 1;
+}
+
+void blobhash_hex(blobhash_t* h, unsigned int kind, char* hex) {
+    hash_finish(h);
+    if (kind == BLOBHASH_SHA256)
+        digest_hex(h->sha256, 8, hex);
+    else
+        digest_hex(h->sha1, 5, hex);
+}
@@ -0,0 +1,67 @@
+#ifndef BLOBHASH_H_
+#define BLOBHASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Hashes of git objects */
+#define BLOBHASH_SHA1   1
+#define BLOBHASH_SHA256 2
+
+#define BLOBHASH_HEX_MAX 64     /* hex digits of a full SHA-256 */
+#define BLOBHASH_HEX_MIN 4      /* fewest digits git abbreviates a hash to */
+
+/*
+ * Git blob hash of a file, computed as the file is streamed through it and
+ * compared with the hash an `index` line names. An abbreviated hash does not
+ * tell SHA-1 from SHA-256, so both are computed for it; they take the same
+ * 64 byte blocks and share the buffer.
+ */
+typedef struct blobhash {
+    unsigned int kinds;         /* BLOBHASH_* being computed, 0 if there is nothing to verify */
+    char expect[BLOBHASH_HEX_MAX + 1];  /* lowercase hex of the index line, maybe abbreviated */
+    uint32_t sha1[5];
+    uint32_t sha256[8];
+    unsigned char block[64];    /* bytes of the block not full yet */
+    uint64_t length;            /* bytes hashed, the blob header included */
+} blobhash_t;
+
+/*
+ * Takes the hash to compare with, from an `index` line. The all-zero hash of
+ * a side that does not exist names no blob.
+ *
+ * returns 0 if `hex` names a blob, non-0 if not (then nothing is computed)
+ */
+int blobhash_init(blobhash_t* h, const char* hex);
+
+/*
+ * Starts a plain hash of the given BLOBHASH_* kinds, with no blob header and
+ * nothing to compare with; see blobhash_hex().
+ */
+void blobhash_reset(blobhash_t* h, unsigned int kinds);
+
+/*
+ * Starts the blob: its header holds the size, which has to be known before
+ * the first byte. Does nothing if there is nothing to verify.
+ */
+void blobhash_begin(blobhash_t* h, size_t size);
+
+/*
+ * Hashes the next bytes of the blob.
+ */
+void blobhash_update(blobhash_t* h, const void* data, size_t length);
+
+/*
+ * Ends the blob and compares it with the hash taken by blobhash_init().
+ *
+ * returns 0 if it matches, non-0 if not
+ */
+int blobhash_end(blobhash_t* h);
+
+/*
+ * Ends the hash and writes the lowercase hex of one of its kinds, 40 or 64
+ * digits and a NUL.
+ */
+void blobhash_hex(blobhash_t* h, unsigned int kind, char* hex);
+
+#endif  /* BLOBHASH_H_ */
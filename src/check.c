@@ -0,0 +1,155 @@
+// check.c - Checking many patches against one tree (C99 + WinAPI only)
+// Inputs are read and indexed once into a shared cache, patches are checked concurrently
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csw.h"
+#include "inputcache.h"
+#include "patch.h"
+
+typedef struct check_job {
+    const char* const* patch_paths;
+    size_t count;
+    unsigned int opts;
+    unsigned int fuzz;
+    input_cache_t* cache;
+    patch_check_result_t* results;
+    volatile LONG next;     /* next patch to take */
+} check_job_t;
+
+/* check_evt_cbk:
+ *  Serves input streams from the cache, along with their line indexes.
+ *  A dry run acquires no output streams.
+ */
+static int check_evt_cbk(patch_evt_t* evt) {
+    if (evt == NULL || evt->userdata == NULL)   /* Invalid evt or userdata */
+        return -1;
+    input_cache_t* cache = (input_cache_t*)evt->userdata;
+
+    if (evt->type == PATCH_EVT_HUNK_RESULT)
+        return 0;   /* collected with patch_get_results() */
+
+    stream_wrapper_t* sw = evt->data.stream_event.stream;
+    if (sw == NULL || evt->data.stream_event.purpose != PATCH_STREAM_PURPOSE_INPUT)
+        return -1;
+
+    switch (evt->type) {
+    case PATCH_EVT_STREAM_ACQUIRE: {
+        const input_cache_entry_t* entry = input_cache_get(cache, evt->data.stream_event.path);
+        if (entry == NULL)  /* Cannot read the file */
+            return -1;
+        evt->data.stream_event.index = &entry->lines;
+        return make_viewsw(sw, &entry->lines.mem);
+    }
+    case PATCH_EVT_STREAM_RELEASE:
+        return sw->close(sw);
+    }
+
+    return -1;  /* Unknown event, return error */
+}
+
+/* private */
+static void check_one(void* patcher, const char* patch_path, patch_check_result_t* result) {
+    memset(result, 0, sizeof(patch_check_result_t));
+    result->status = PATCH_CHECK_ERROR;
+
+    FILE* fp = fopen(patch_path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open %s\n", patch_path);
+        return;
+    }
+    stream_wrapper_t sw = { 0 };
+    make_fdsw(&sw, fp);
+
+    int stat = apply_patch(patcher, &sw);   /* closes the stream */
+
+    const patch_hunk_result_t* hunks = NULL;
+    size_t count = patch_get_results(patcher, &hunks);
+    for (size_t i = 0; i < count; ++i) {
+        if (hunks[i].status == PATCH_HUNK_APPLIED)
+            ++result->hunks_ok;
+        else if (hunks[i].status == PATCH_HUNK_ALREADY_APPLIED)
+            ++result->hunks_applied;
+        else
+            ++result->hunks_failed;
+    }
+
+    if (result->hunks_failed > 0)
+        result->status = PATCH_CHECK_FAILED;
+    else if (stat == 0)
+        result->status = PATCH_CHECK_OK;
+}
+
+/* private */
+static DWORD WINAPI check_worker(LPVOID param) {
+    check_job_t* job = (check_job_t*)param;
+
+    /* instances are not shared between threads, only the cache is */
+    void* patcher = patch_init();
+    if (patcher == NULL)
+        return 1;
+    patch_set_options(patcher, job->opts | PATCH_OPTION_DRY_RUN);
+    patch_set_fuzz(patcher, job->fuzz);
+    patch_set_path_cbk(patcher, &check_evt_cbk, job->cache);
+
+    for (;;) {
+        LONG i = InterlockedIncrement(&job->next) - 1;
+        if ((size_t)i >= job->count)
+            break;
+        check_one(patcher, job->patch_paths[i], &job->results[i]);
+    }
+
+    patch_destroy(patcher);
+    return 0;
+}
+
+int patch_check_many(const char* const* patch_paths, size_t count, unsigned int opts, unsigned int fuzz,
+                     unsigned int threads, patch_check_result_t* results) {
+    if ((patch_paths == NULL || results == NULL) && count > 0)
+        return -1;
+
+    check_job_t job = { 0 };
+    job.patch_paths = patch_paths;
+    job.count = count;
+    job.opts = opts & ~PATCH_OPTION_VERBOSE;    /* verbose output of several threads is unreadable */
+    job.fuzz = fuzz;
+    job.results = results;
+    job.cache = make_input_cache(patch_line_flags(opts), PATCH_MAX_LINE);
+    if (job.cache == NULL)
+        return -1;
+
+    if (threads == 0) {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        threads = info.dwNumberOfProcessors;
+    }
+    if (threads > count)
+        threads = (unsigned int)count;
+
+    /* the calling thread is a worker too */
+    HANDLE* handles = threads > 1 ? calloc(threads - 1, sizeof(HANDLE)) : NULL;
+    unsigned int started = 0;
+    for (; handles != NULL && started < threads - 1; ++started) {
+        handles[started] = CreateThread(NULL, 0, &check_worker, &job, 0, NULL);
+        if (handles[started] == NULL)
+            break;  /* go on with fewer threads */
+    }
+    DWORD stat = check_worker(&job);
+    for (unsigned int t = 0; t < started; ++t) {
+        WaitForSingleObject(handles[t], INFINITE);
+        CloseHandle(handles[t]);
+    }
+    free(handles);
+    input_cache_unref(job.cache);
+
+    if (stat != 0)
+        return -1;
+    for (size_t i = 0; i < count; ++i) {
+        if (results[i].status != PATCH_CHECK_OK)
+            return 1;
+    }
+    return 0;
+}
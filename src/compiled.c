@@ -0,0 +1,443 @@
+// compiled.c - Compiled patches: a diff parsed once into tables, and applied from them (C99 only)
+// The tables are checked against their size once, then used in place
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiled.h"
+#include "gitsection.h"
+
+/* Tables of a patch being compiled, see compiled.h */
+typedef struct compiler {
+    dynmem_t sections;
+    dynmem_t hunks;
+    dynmem_t lines;
+    dynmem_t payload;
+    uint32_t section_count;
+    uint32_t hunk_count;
+    uint64_t line_count;
+    int failed;         /* out of memory, the tables are incomplete */
+} compiler_t;
+
+/* Payload offset of a NUL terminated copy of the string */
+static uint64_t compiler_string(compiler_t* compiler, const char* str) {
+    return table_put(&compiler->payload, str, strlen(str) + 1, &compiler->failed);
+}
+
+/* Ends the section: its paths and git extended headers go to the section table */
+static void compiler_section(compiler_t* compiler, const git_section_t* git, const char* orig_file,
+                             const char* new_file, uint32_t first_hunk) {
+    compiled_section_t section = { 0 };
+    section.flags = (git->active ? COMPILED_GIT : 0) | (git->content ? COMPILED_CONTENT : 0) |
+                    (git->rename ? COMPILED_RENAME : 0) | (git->copy ? COMPILED_COPY : 0) |
+                    (git->deleted ? COMPILED_DELETED : 0) | (git->created ? COMPILED_CREATED : 0);
+    section.similarity = git->similarity;
+    section.old_mode = git->old_mode;
+    section.new_mode = git->new_mode;
+    section.first_hunk = first_hunk;
+    section.hunk_count = compiler->hunk_count - first_hunk;
+    section.git_old_path = compiler_string(compiler, git->old_path);
+    section.git_new_path = compiler_string(compiler, git->new_path);
+    section.old_file = compiler_string(compiler, orig_file);
+    section.new_file = compiler_string(compiler, new_file);
+    section.old_index = compiler_string(compiler, git->old_index);
+    section.new_index = compiler_string(compiler, git->new_index);
+    table_put(&compiler->sections, &section, sizeof(section), &compiler->failed);
+    ++compiler->section_count;
+}
+
+/* Adds the collected hunk: its lines, hashes and all, to the line table and the payload */
+static void compiler_hunk(compiler_t* compiler, const hunk_t* hunk) {
+    compiled_hunk_t entry = { 0 };
+    entry.start_old = hunk->start_old;
+    entry.len_old = hunk->len_old;
+    entry.start_new = hunk->start_new;
+    entry.len_new = hunk->len_new;
+    entry.first_line = compiler->line_count;
+    entry.line_count = (uint32_t)hunk->lines.count;
+    for (size_t i = 0; i < hunk->lines.count; ++i) {
+        compiled_line_t line = { 0 };
+        line.length = (uint32_t)hunk->lines.lines[i].length;
+        line.hash = hunk->lines.lines[i].hash;
+        line.kind = (uint8_t)hunk->kinds[i];
+        line.offset = table_put(&compiler->payload, lineidx_text(&hunk->lines, i), line.length, &compiler->failed);
+        table_put(&compiler->lines, &line, sizeof(line), &compiler->failed);
+    }
+    compiler->line_count += hunk->lines.count;
+    table_put(&compiler->hunks, &entry, sizeof(entry), &compiler->failed);
+    ++compiler->hunk_count;
+}
+
+/* Writes the header, the tables and the payload, one after another */
+static int compiler_write(compiler_t* compiler, unsigned int line_flags, stream_wrapper_t* out) {
+    compiled_header_t header = { 0 };
+    memcpy(header.magic, COMPILED_MAGIC, sizeof(header.magic));
+    header.version = COMPILED_VERSION;
+    header.line_flags = line_flags;
+    header.section_count = compiler->section_count;
+    header.hunk_count = compiler->hunk_count;
+    header.line_count = compiler->line_count;
+    /* the entries are whole multiples of 8 bytes, so every table stays aligned */
+    header.sections = sizeof(header);
+    header.hunks = header.sections + compiler->sections.writepos;
+    header.lines = header.hunks + compiler->hunks.writepos;
+    header.payload = header.lines + compiler->lines.writepos;
+    header.payload_size = compiler->payload.writepos;
+
+    int stat = write_span(out, (const char*)&header, sizeof(header));
+    stat |= write_span(out, compiler->sections.buf, compiler->sections.writepos);
+    stat |= write_span(out, compiler->hunks.buf, compiler->hunks.writepos);
+    stat |= write_span(out, compiler->lines.buf, compiler->lines.writepos);
+    stat |= write_span(out, compiler->payload.buf, compiler->payload.writepos);
+    if (stat != 0)
+        fprintf(stderr, "Write error while writing the compiled patch\n");
+    return stat;
+}
+
+int patch_compile(stream_wrapper_t* sw, unsigned int opts, stream_wrapper_t* out) {
+    if (sw == NULL || out == NULL)
+        return -1;
+
+    compiler_t compiler = { 0 };
+    make_dynmem(&compiler.sections, 0, 0);
+    make_dynmem(&compiler.hunks, 0, 0);
+    make_dynmem(&compiler.lines, 0, 0);
+    make_dynmem(&compiler.payload, 0, 0);
+    hunk_t hunk = { 0 };
+    make_lineidx(&hunk.lines);
+    hunk.lines.flags = patch_line_flags(opts);
+
+    char line[MAX_LINE];
+    char line_copy[MAX_LINE];
+    int has_line = 0;   /* `line` holds a line read ahead by the hunk body loop */
+    char orig_file[MAX_PATH_LEN] = {0};
+    char new_file[MAX_PATH_LEN] = {0};
+    git_section_t git = { 0 };
+    int section = 0;    /* a section is open */
+    uint32_t first_hunk = 0;
+    int stat = 0;
+
+    /* the sections are read the way apply_patch() reads them, with the sides as in the patch */
+    while (stat == 0 && !compiler.failed && (has_line || sw_fgets(sw, line, MAX_LINE))) {
+        has_line = 0;
+        strncpy(line_copy, line, MAX_LINE);
+        trim_newline(line_copy);
+
+        if (strncmp(line_copy, "diff --git ", 11) == 0) {
+            if (section)
+                compiler_section(&compiler, &git, orig_file, new_file, first_hunk);
+            git_section_begin(&git, line_copy, 0);
+            *orig_file = *new_file = '\0';
+            section = 1;
+            first_hunk = compiler.hunk_count;
+        } else if (git.active && !git.content && git_section_line(&git, line_copy, 0)) {
+            /* extended header line, kept in the section table */
+        } else if ((git.active && !git.content && strcmp(line_copy, "GIT binary patch") == 0) ||
+                   strncmp(line_copy, "Binary files ", 13) == 0) {
+            fprintf(stderr, "%s: binary patches cannot be compiled\n", git.active ? git.new_path : line_copy);
+            stat = 1;
+        } else if (strncmp(line_copy, "--- ", 4) == 0) {
+            /* a plain diff starts a section, unless it is the content of a git section */
+            if (!git.active || git.content) {
+                if (section)
+                    compiler_section(&compiler, &git, orig_file, new_file, first_hunk);
+                memset(&git, 0, sizeof(git_section_t));
+                git.similarity = -1;
+                *new_file = '\0';
+                section = 1;
+                first_hunk = compiler.hunk_count;
+            }
+            const char* after = parse_header_filename(line_copy + 4, orig_file, MAX_PATH_LEN);
+            if (git.active)
+                git_strip_prefix(orig_file);
+            else if (header_is_epoch(after))
+                strcpy(orig_file, DEV_NULL);
+        } else if (strncmp(line_copy, "+++ ", 4) == 0) {
+            if (!section) {
+                memset(&git, 0, sizeof(git_section_t));
+                git.similarity = -1;
+                section = 1;
+                first_hunk = compiler.hunk_count;
+            }
+            const char* after = parse_header_filename(line_copy + 4, new_file, MAX_PATH_LEN);
+            if (git.active)
+                git_strip_prefix(new_file);
+            else if (header_is_epoch(after))
+                strcpy(new_file, DEV_NULL);
+            git.content = 1;
+        } else if (strncmp(line, "@@ ", 3) == 0) {
+            hunk_reset(&hunk);
+            if (!git.content) {
+                fprintf(stderr, "Hunk encountered but no file header before it.\n");
+                stat = 1;
+                break;
+            }
+            if (patch_hunk_header(line, &hunk.start_old, &hunk.len_old, &hunk.start_new, &hunk.len_new) != 0) {
+                fprintf(stderr, "Malformed hunk header: %s\n", line);
+                stat = 1;
+                break;
+            }
+
+            /* the body ends with its line counts, or early at a line that is not a hunk line */
+            while (hunk.proc_old < hunk.len_old || hunk.proc_new < hunk.len_new) {
+                if (!sw_fgets(sw, line, MAX_LINE)) {
+                    fprintf(stderr, "Unexpected EOF inside hunk header at file '%s'.\n", new_file);
+                    stat = 1;
+                    break;
+                }
+                if (line[0] == '\\') {
+                    hunk_no_newline(&hunk);
+                    continue;
+                }
+                if (line[0] != ' ' && line[0] != '+' && line[0] != '-') {
+                    has_line = 1;
+                    break;
+                }
+                if (hunk_add_line(&hunk, line) != 0) {
+                    compiler.failed = 1;
+                    break;
+                }
+            }
+            if (stat == 0 && !compiler.failed && !has_line && sw_fgets(sw, line, MAX_LINE)) {
+                if (line[0] == '\\')
+                    hunk_no_newline(&hunk);
+                else
+                    has_line = 1;
+            }
+            if (stat == 0)
+                compiler_hunk(&compiler, &hunk);
+        }
+        /* other lines in patch are ignored, as apply_patch() does */
+    }
+
+    if (stat == 0 && section)
+        compiler_section(&compiler, &git, orig_file, new_file, first_hunk);
+    if (stat == 0 && compiler.failed) {
+        fprintf(stderr, "Out of memory while compiling the patch\n");
+        stat = 1;
+    }
+    if (stat == 0)
+        stat = compiler_write(&compiler, hunk.lines.flags, out);
+
+    hunk_free(&hunk);
+    dynmem_free(&compiler.sections);
+    dynmem_free(&compiler.hunks);
+    dynmem_free(&compiler.lines);
+    dynmem_free(&compiler.payload);
+    sw->close(sw);
+    return stat;
+}
+
+/* Whether `count` entries of `entry` bytes at `offset` lie within `size` bytes, aligned */
+int compiled_table_fits(uint64_t offset, uint64_t count, size_t entry, size_t size) {
+    return offset % 8 == 0 && offset <= size && count <= (size - offset) / entry;
+}
+
+/* Whether a path of the payload ends within it, and within a path buffer */
+int compiled_string_fits(const char* payload, uint64_t payload_size, uint64_t offset) {
+    if (offset >= payload_size)
+        return 0;
+    uint64_t left = payload_size - offset;
+    return memchr(payload + offset, '\0', left < MAX_PATH_LEN ? (size_t)left : MAX_PATH_LEN) != NULL;
+}
+
+/* compiled_check:
+ *  Checks the header and every table entry against the size, so the tables
+ *  are then used with no bounds checks. Only offsets and counts are compared,
+ *  no text is read.
+ *
+ * Returns the header, NULL if the data is not a compiled patch or is damaged
+ */
+static const compiled_header_t* compiled_check(const void* data, size_t size) {
+    const compiled_header_t* header = (const compiled_header_t*)data;
+    if (data == NULL || ((uintptr_t)data % 8) != 0 || size < sizeof(compiled_header_t) ||
+        memcmp(header->magic, COMPILED_MAGIC, sizeof(header->magic)) != 0 || header->version != COMPILED_VERSION)
+        return NULL;
+    if (!compiled_table_fits(header->sections, header->section_count, sizeof(compiled_section_t), size) ||
+        !compiled_table_fits(header->hunks, header->hunk_count, sizeof(compiled_hunk_t), size) ||
+        !compiled_table_fits(header->lines, header->line_count, sizeof(compiled_line_t), size) ||
+        header->payload > size || header->payload_size > size - header->payload)
+        return NULL;
+
+    const char* base = (const char*)data;
+    const compiled_section_t* sections = (const compiled_section_t*)(base + header->sections);
+    const compiled_hunk_t* hunks = (const compiled_hunk_t*)(base + header->hunks);
+    const compiled_line_t* lines = (const compiled_line_t*)(base + header->lines);
+    const char* payload = base + header->payload;
+    for (uint32_t i = 0; i < header->section_count; ++i) {
+        const compiled_section_t* section = &sections[i];
+        if (section->first_hunk > header->hunk_count || section->hunk_count > header->hunk_count - section->first_hunk ||
+            !compiled_string_fits(payload, header->payload_size, section->git_old_path) ||
+            !compiled_string_fits(payload, header->payload_size, section->git_new_path) ||
+            !compiled_string_fits(payload, header->payload_size, section->old_file) ||
+            !compiled_string_fits(payload, header->payload_size, section->new_file) ||
+            !compiled_string_fits(payload, header->payload_size, section->old_index) ||
+            !compiled_string_fits(payload, header->payload_size, section->new_index))
+            return NULL;
+    }
+    for (uint32_t i = 0; i < header->hunk_count; ++i) {
+        if (hunks[i].first_line > header->line_count || hunks[i].line_count > header->line_count - hunks[i].first_line)
+            return NULL;
+    }
+    for (uint64_t i = 0; i < header->line_count; ++i) {
+        const compiled_line_t* line = &lines[i];
+        if ((line->kind != ' ' && line->kind != '+' && line->kind != '-') || line->offset > header->payload_size ||
+            line->length > header->payload_size - line->offset)
+            return NULL;
+    }
+    return header;
+}
+
+/* Git section of a compiled section, with the sides swapped for a reversed patch as git_section_line() does */
+static void compiled_git_section(git_section_t* git, const compiled_section_t* section, const char* payload,
+                                 int reverse) {
+    memset(git, 0, sizeof(git_section_t));
+    git->similarity = section->similarity;
+    if (!(section->flags & COMPILED_GIT))
+        return;
+
+    git->active = 1;
+    snprintf(reverse ? git->new_path : git->old_path, MAX_PATH_LEN, "%s", payload + section->git_old_path);
+    snprintf(reverse ? git->old_path : git->new_path, MAX_PATH_LEN, "%s", payload + section->git_new_path);
+    snprintf(reverse ? git->new_index : git->old_index, BLOBHASH_HEX_MAX + 1, "%s", payload + section->old_index);
+    snprintf(reverse ? git->old_index : git->new_index, BLOBHASH_HEX_MAX + 1, "%s", payload + section->new_index);
+    *(reverse ? &git->new_mode : &git->old_mode) = section->old_mode;
+    *(reverse ? &git->old_mode : &git->new_mode) = section->new_mode;
+    git->rename = (section->flags & COMPILED_RENAME) != 0;
+    if (section->flags & COMPILED_COPY)
+        *(reverse ? &git->deleted : &git->copy) = 1;
+    if (section->flags & COMPILED_DELETED)
+        *(reverse ? &git->created : &git->deleted) = 1;
+    if (section->flags & COMPILED_CREATED)
+        *(reverse ? &git->deleted : &git->created) = 1;
+}
+
+/* compiled_hunk_load:
+ *  Fills the hunk from its table entry. The lines keep the hashes they were
+ *  compiled with, unless the options compare lines another way.
+ *
+ * Returns 0 on success, non-0 on allocation failure
+ */
+static int compiled_hunk_load(hunk_t* hunk, const compiled_header_t* header, const compiled_hunk_t* from,
+                              int reverse) {
+    const char* base = (const char*)header;
+    const compiled_line_t* lines = (const compiled_line_t*)(base + header->lines) + from->first_line;
+    const char* payload = base + header->payload;
+
+    hunk->start_old = reverse ? from->start_new : from->start_old;
+    hunk->len_old = reverse ? from->len_new : from->len_old;
+    hunk->start_new = reverse ? from->start_old : from->start_new;
+    hunk->len_new = reverse ? from->len_old : from->len_new;
+    int rehash = hunk->lines.flags != header->line_flags;
+    for (uint32_t i = 0; i < from->line_count; ++i) {
+        const char* text = payload + lines[i].offset;
+        char kind = (char)lines[i].kind;
+        /* reversed: added lines are the ones to delete and vice versa */
+        if (reverse && kind != ' ')
+            kind = kind == '+' ? '-' : '+';
+        uint64_t hash = rehash ? line_hash(text, lines[i].length, hunk->lines.flags) : lines[i].hash;
+        if (hunk_add_hashed_line(hunk, kind, text, lines[i].length, hash) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* Bytes the hunks of the section add to its file, from the line table alone:
+ * those of their added lines, less those of their deleted lines */
+static long compiled_growth(const compiled_header_t* header, const compiled_section_t* section, int reverse) {
+    const char* base = (const char*)header;
+    const compiled_hunk_t* hunks = (const compiled_hunk_t*)(base + header->hunks) + section->first_hunk;
+    const compiled_line_t* lines = (const compiled_line_t*)(base + header->lines);
+    long growth = 0;
+    for (uint32_t n = 0; n < section->hunk_count; ++n) {
+        for (uint32_t i = 0; i < hunks[n].line_count; ++i) {
+            const compiled_line_t* line = &lines[hunks[n].first_line + i];
+            if (line->kind == '+')
+                growth += (long)line->length;
+            else if (line->kind == '-')
+                growth -= (long)line->length;
+        }
+    }
+    return reverse ? -growth : growth;
+}
+
+int apply_compiled_patch(void* self, const void* data, size_t size) {
+    if (self == NULL)   /* Invalid instance pointer */
+        return 1;
+    patch_instance_data_t* instance = (patch_instance_data_t*)self;
+
+    /* shorthand */
+    patch_options_t* options = &instance->options;
+
+    const compiled_header_t* header = compiled_check(data, size);
+    if (header == NULL) {
+        fprintf(stderr, "Not a compiled patch, or a damaged one\n");
+        return 1;
+    }
+    if (options->verbose)
+        printf("Opened compiled patch\n");
+
+    instance->hunks_failed = 0;
+    instance->result_count = 0;
+
+    const char* base = (const char*)data;
+    const compiled_section_t* sections = (const compiled_section_t*)(base + header->sections);
+    const compiled_hunk_t* hunks = (const compiled_hunk_t*)(base + header->hunks);
+    const char* payload = base + header->payload;
+    stream_wrapper_t output_stream = { 0 };
+    stream_wrapper_t input_stream = { 0 };
+    char orig_file[MAX_PATH_LEN] = { 0 };
+    char new_file[MAX_PATH_LEN];
+    int stat = 0;
+
+    for (uint32_t i = 0; stat == 0 && i < header->section_count; ++i) {
+        const compiled_section_t* section = &sections[i];
+        git_section_t git;
+        compiled_git_section(&git, section, payload, options->reverse);
+
+        /* the input of a reversed patch is its new file */
+        snprintf(options->reverse ? new_file : orig_file, MAX_PATH_LEN, "%s", payload + section->old_file);
+        snprintf(options->reverse ? orig_file : new_file, MAX_PATH_LEN, "%s", payload + section->new_file);
+
+        int creating = 0;
+        long growth = compiled_growth(header, section, options->reverse);
+        if ((section->flags & COMPILED_CONTENT) &&
+            open_section(instance, &git, orig_file, new_file, &growth, &creating, &input_stream, &output_stream) != 0)
+            stat = 1;
+
+        for (uint32_t n = 0; stat == 0 && n < section->hunk_count; ++n) {
+            hunk_t* hunk = section_hunk(instance, &git, creating, &input_stream, &output_stream, (int)n + 1);
+            if (hunk == NULL) {
+                stat = 1;
+                break;
+            }
+            hunk->number = (int)n + 1;
+            if (compiled_hunk_load(hunk, header, &hunks[section->first_hunk + n], options->reverse) != 0) {
+                fprintf(stderr, "Out of memory while reading hunk #%d\n", hunk->number);
+                stat = 1;
+            } else {
+                stat = take_hunk(instance, hunk, &git, creating, &input_stream, &output_stream, new_file) != 0;
+            }
+        }
+
+        if (stat == 0 && (input_stream._impl || output_stream._impl)) {
+            if (options->verbose)
+                printf("Finalizing %s\n", new_file);
+            stat = finalize_file(instance, &input_stream, &output_stream, orig_file, new_file) != 0;
+        }
+        if (stat == 0)
+            stat = git_section_finish(instance, &git) != 0;
+    }
+
+    /* a file left open by an error is dropped as parser_abort() drops it, its output does not replace it */
+    if (stat != 0) {
+        cache_end(instance, 0);
+        if (output_stream._impl)
+            patch_discard_user_stream(instance, instance->output_path, &output_stream, instance->output_purpose);
+        if (input_stream._impl)
+            patch_release_user_stream(instance, orig_file, &input_stream, PATCH_STREAM_PURPOSE_INPUT);
+        return 1;
+    }
+    return instance->hunks_failed ? 1 : 0;
+}
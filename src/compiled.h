@@ -0,0 +1,79 @@
+#ifndef COMPILED_H_
+#define COMPILED_H_
+
+#include <stdint.h>
+
+/*
+ * Compiled patch: a unified diff parsed once into tables, to be applied again
+ * and again without reading text (see patch_compile(), apply_compiled_patch()).
+ * The file is the header, then the section, hunk and line tables and the
+ * payload, each at the offset the header names. Every table entry is a fixed
+ * size struct and every offset is aligned to 8 bytes, so a file mapped into
+ * memory is used where it is. Numbers are in the byte order of the machine
+ * that compiled the patch, the magic tells another order from damage.
+ *
+ * The payload holds the text of the hunk lines, without their ' ', '+' or '-',
+ * and the paths, NUL terminated. Sides are as in the patch; reversing is done
+ * when it is applied.
+ */
+
+#define COMPILED_MAGIC   "PATCHBIN"
+#define COMPILED_VERSION 1
+
+/* compiled_section_t.flags */
+#define COMPILED_GIT     0x1    /* a `diff --git` section, its paths have lost the a/ and b/ prefixes */
+#define COMPILED_CONTENT 0x2    /* the section has `---`/`+++` lines */
+#define COMPILED_RENAME  0x4    /* git extended headers, see git_section_line() in gitsection.c */
+#define COMPILED_COPY    0x8
+#define COMPILED_DELETED 0x10
+#define COMPILED_CREATED 0x20
+
+typedef struct compiled_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t line_flags;        /* LINEIDX_* the line hashes are computed with */
+    uint32_t section_count;
+    uint32_t hunk_count;
+    uint64_t line_count;
+    uint64_t sections;          /* offsets of the tables and of the payload from the start of the file */
+    uint64_t hunks;
+    uint64_t lines;
+    uint64_t payload;
+    uint64_t payload_size;
+} compiled_header_t;
+
+/* One file of the patch. Paths are payload offsets, "" if not given. */
+typedef struct compiled_section {
+    uint32_t flags;             /* COMPILED_* */
+    int32_t similarity;         /* `similarity index` in percent, -1 if not given */
+    uint32_t old_mode;          /* git modes, 0 if not given */
+    uint32_t new_mode;
+    uint32_t first_hunk;
+    uint32_t hunk_count;
+    uint64_t git_old_path;      /* from `diff --git` or `rename from`-like lines */
+    uint64_t git_new_path;
+    uint64_t old_file;          /* from the `---` line, DEV_NULL for a created file */
+    uint64_t new_file;          /* from the `+++` line */
+    uint64_t old_index;         /* blob hashes of the `index` line */
+    uint64_t new_index;
+} compiled_section_t;
+
+typedef struct compiled_hunk {
+    int32_t start_old;
+    int32_t len_old;
+    int32_t start_new;
+    int32_t len_new;
+    uint64_t first_line;
+    uint32_t line_count;
+    uint32_t reserved;
+} compiled_hunk_t;
+
+typedef struct compiled_line {
+    uint64_t offset;            /* payload offset of the text */
+    uint64_t hash;              /* line_hash() of the text with the header's line_flags */
+    uint32_t length;            /* EOL included, none after `\ No newline at end of file` */
+    uint8_t kind;               /* ' ', '+' or '-' */
+    uint8_t reserved[3];
+} compiled_line_t;
+
+#endif  /* COMPILED_H_ */
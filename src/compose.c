@@ -0,0 +1,652 @@
+// compose.c - Composing two consecutive patches into one (C99 only)
+// Hunks are merged on the line numbers of the intermediate file, no file is read
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csw.h"
+#include "gitsection.h"
+#include "lineidx.h"
+#include "patch.h"
+
+#define NO_NEWLINE_MARKER "\\ No newline at end of file\n"
+
+/* Body line of a hunk, `text` points into the patch and excludes the prefix */
+typedef struct compose_line {
+    char kind;          /* ' ', '-' or '+' */
+    const char* text;
+    size_t length;      /* EOL included */
+    int no_newline;     /* last line of the file, without the final newline */
+} compose_line_t;
+
+/* Line ranges are kept as first line + count, the first line of an empty
+ * range being the one it comes before, unlike the "@@" header */
+typedef struct compose_hunk {
+    long old_lo, old_len;
+    long new_lo, new_len;
+    compose_line_t* lines;
+    size_t count;
+} compose_hunk_t;
+
+typedef struct compose_file {
+    int headers;            /* the file has "--- "/"+++ " headers, a git section may have none */
+    size_t old_header;      /* line of the "--- " header in the patch */
+    size_t new_header;      /* line of the "+++ " header */
+    char old_path[PATCH_MAX_PATH];  /* without the a/ b/ prefixes of a git section */
+    char new_path[PATCH_MAX_PATH];
+    int git;                /* a `diff --git` section */
+    size_t git_line;        /* line of its `diff --git` header */
+    size_t ext_lo, ext_hi;  /* its extended header lines */
+    git_section_t section;  /* ... as the patcher reads them */
+    compose_hunk_t* hunks;
+    size_t count;
+    size_t capacity;
+    int used;               /* matched with a file of the other patch */
+} compose_file_t;
+
+typedef struct compose_patch {
+    lineidx_t lines;
+    compose_file_t* files;
+    size_t count;
+    size_t capacity;
+} compose_patch_t;
+
+/* Output lines of one composed hunk */
+typedef struct compose_out {
+    compose_line_t* lines;
+    size_t count;
+    size_t capacity;
+} compose_out_t;
+
+/* private */
+static void compose_patch_free(compose_patch_t* patch) {
+    for (size_t f = 0; f < patch->count; ++f) {
+        for (size_t h = 0; h < patch->files[f].count; ++h)
+            free(patch->files[f].hunks[h].lines);
+        free(patch->files[f].hunks);
+    }
+    free(patch->files);
+    lineidx_free(&patch->lines);
+}
+
+/* Copies line n of the patch to a NUL terminated buffer of PATCH_MAX_LINE bytes */
+static const char* patch_line(const compose_patch_t* patch, size_t n, char* buf) {
+    size_t length = patch->lines.lines[n].length;
+    memcpy(buf, lineidx_text(&patch->lines, n), length);
+    buf[length] = '\0';
+    return buf;
+}
+
+/* private */
+static int read_patch(const char* path, compose_patch_t* patch) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return 1;
+    }
+
+    dynmem_t text;
+    make_dynmem(&text, 0, 0);
+    char chunk[65536];
+    size_t n;
+    int stat = 0;
+    while (stat == 0 && (n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        stat = dynmem_write(&text, chunk, 1, n) < 0;
+    fclose(fp);
+
+    if (stat == 0 && lineidx_append_text(&patch->lines, text.buf, text.writepos, PATCH_MAX_LINE) != 0)
+        stat = 1;
+    dynmem_free(&text);
+    if (stat != 0)
+        fprintf(stderr, "Cannot read %s\n", path);
+    return stat;
+}
+
+/* private */
+static compose_file_t* add_file(compose_patch_t* patch) {
+    if (patch->count == patch->capacity) {
+        size_t new_capacity = patch->capacity ? patch->capacity * 2 : 16;
+        compose_file_t* new_files = realloc(patch->files, new_capacity * sizeof(compose_file_t));
+        if (new_files == NULL)
+            return NULL;
+        patch->files = new_files;
+        patch->capacity = new_capacity;
+    }
+    compose_file_t* file = &patch->files[patch->count++];
+    memset(file, 0, sizeof(compose_file_t));
+    return file;
+}
+
+/* private */
+static compose_hunk_t* add_hunk(compose_file_t* file) {
+    if (file->count == file->capacity) {
+        size_t new_capacity = file->capacity ? file->capacity * 2 : 16;
+        compose_hunk_t* new_hunks = realloc(file->hunks, new_capacity * sizeof(compose_hunk_t));
+        if (new_hunks == NULL)
+            return NULL;
+        file->hunks = new_hunks;
+        file->capacity = new_capacity;
+    }
+    compose_hunk_t* hunk = &file->hunks[file->count++];
+    memset(hunk, 0, sizeof(compose_hunk_t));
+    return hunk;
+}
+
+/* private */
+static int out_push(compose_out_t* out, char kind, const compose_line_t* from) {
+    if (out->count == out->capacity) {
+        size_t new_capacity = out->capacity ? out->capacity * 2 : 64;
+        compose_line_t* new_lines = realloc(out->lines, new_capacity * sizeof(compose_line_t));
+        if (new_lines == NULL)
+            return 1;
+        out->lines = new_lines;
+        out->capacity = new_capacity;
+    }
+    compose_line_t* line = &out->lines[out->count++];
+    *line = *from;
+    line->kind = kind;
+    return 0;
+}
+
+/* Paths of a git section that has no "--- "/"+++ " headers, from its extended headers */
+static void git_file_paths(compose_file_t* file) {
+    snprintf(file->old_path, PATCH_MAX_PATH, "%s", file->section.created ? DEV_NULL : file->section.old_path);
+    snprintf(file->new_path, PATCH_MAX_PATH, "%s", file->section.deleted ? DEV_NULL : file->section.new_path);
+}
+
+/* parse_patch:
+ *  Splits the patch into files and hunks. Lines outside of hunks other than
+ *  the file headers and the headers of git sections are dropped, the
+ *  "\ No newline" marker is folded into the line it follows. The paths of a
+ *  git section are read as the patcher reads them, without their a/ and b/
+ *  prefixes, so files of git and plain patches match.
+ */
+static int parse_patch(const char* path, compose_patch_t* patch) {
+    char buf[PATCH_MAX_LINE + 1];
+    compose_file_t* file = NULL;
+
+    for (size_t n = 0; n < patch->lines.count; ++n) {
+        const char* line = patch_line(patch, n, buf);
+        /* the headers of a git section are read without their EOL */
+        char header[PATCH_MAX_LINE + 1];
+        snprintf(header, sizeof(header), "%s", line);
+        header[strcspn(header, "\r\n")] = '\0';
+        int git_headers = file != NULL && file->git && !file->headers;
+
+        if (strncmp(line, "diff --git ", 11) == 0) {
+            file = add_file(patch);
+            if (file == NULL)
+                return 1;
+            file->git = 1;
+            file->git_line = n;
+            file->ext_lo = file->ext_hi = n + 1;
+            git_section_begin(&file->section, header, 0);
+            git_file_paths(file);
+        } else if (git_headers && file->ext_hi == n && git_section_line(&file->section, header, 0)) {
+            file->ext_hi = n + 1;
+            git_file_paths(file);
+        } else if (git_headers && strcmp(header, "GIT binary patch") == 0) {
+            fprintf(stderr, "%s: binary patches cannot be composed: %s\n", path, file->new_path);
+            return 1;
+        } else if (strncmp(line, "--- ", 4) == 0) {
+            /* the content of a git section, or the next file */
+            if (!git_headers) {
+                file = add_file(patch);
+                if (file == NULL)
+                    return 1;
+            }
+            file->headers = 1;
+            file->old_header = file->new_header = n;
+            patch_header_path(line, file->old_path, sizeof(file->old_path));
+            if (file->git)
+                git_strip_prefix(file->old_path);
+        } else if (strncmp(line, "+++ ", 4) == 0 && file != NULL) {
+            file->new_header = n;
+            patch_header_path(line, file->new_path, sizeof(file->new_path));
+            if (file->git)
+                git_strip_prefix(file->new_path);
+        } else if (strncmp(line, "@@ ", 3) == 0) {
+            int start_old = 0, len_old = 0, start_new = 0, len_new = 0;
+            if (file == NULL ||
+                patch_hunk_header(line, &start_old, &len_old, &start_new, &len_new) != 0) {
+                fprintf(stderr, "%s: malformed hunk header: %s", path, line);
+                return 1;
+            }
+
+            compose_hunk_t* hunk = add_hunk(file);
+            if (hunk == NULL)
+                return 1;
+            hunk->old_lo = len_old ? start_old : start_old + 1;
+            hunk->old_len = len_old;
+            hunk->new_lo = len_new ? start_new : start_new + 1;
+            hunk->new_len = len_new;
+            hunk->lines = malloc(((size_t)len_old + (size_t)len_new + 1) * sizeof(compose_line_t));
+            if (hunk->lines == NULL)
+                return 1;
+
+            int old_left = len_old, new_left = len_new;
+            while (n + 1 < patch->lines.count) {
+                const char* body = lineidx_text(&patch->lines, n + 1);
+                size_t length = patch->lines.lines[n + 1].length;
+                if (body[0] == '\\') {
+                    /* the line before has no newline */
+                    if (hunk->count > 0) {
+                        compose_line_t* last = &hunk->lines[hunk->count - 1];
+                        if (last->length > 0 && last->text[last->length - 1] == '\n')
+                            --last->length;
+                        last->no_newline = 1;
+                    }
+                    ++n;
+                    continue;
+                }
+                if ((old_left == 0 && new_left == 0) || (body[0] != ' ' && body[0] != '-' && body[0] != '+'))
+                    break;
+                if ((body[0] != '+' && old_left == 0) || (body[0] != '-' && new_left == 0)) {
+                    fprintf(stderr, "%s: hunk body does not match its header: %s", path, line);
+                    return 1;
+                }
+                compose_line_t* hline = &hunk->lines[hunk->count++];
+                hline->kind = body[0];
+                hline->text = body + 1;
+                hline->length = length - 1;
+                hline->no_newline = 0;
+                old_left -= body[0] != '+';
+                new_left -= body[0] != '-';
+                ++n;
+            }
+            if (old_left > 0 || new_left > 0) {
+                fprintf(stderr, "%s: hunk is cut short: %s", path, line);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* private */
+static int write_text(stream_wrapper_t* out, const char* text, size_t length) {
+    if (length == 0)
+        return 0;
+    return out->write(out, (char*)text, 1, length) != (long)length;
+}
+
+/* private */
+static int write_hunk(stream_wrapper_t* out, long old_lo, long old_len, long new_lo, long new_len,
+                      const compose_line_t* lines, size_t count) {
+    char header[128];
+    int length = snprintf(header, sizeof(header), "@@ -%ld,%ld +%ld,%ld @@\n", old_len ? old_lo : old_lo - 1,
+                          old_len, new_len ? new_lo : new_lo - 1, new_len);
+    int stat = write_text(out, header, (size_t)length);
+    for (size_t i = 0; stat == 0 && i < count; ++i) {
+        const compose_line_t* line = &lines[i];
+        stat = write_text(out, &line->kind, 1) || write_text(out, line->text, line->length);
+        if (stat == 0 && line->no_newline)
+            stat = write_text(out, "\n" NO_NEWLINE_MARKER, strlen("\n" NO_NEWLINE_MARKER));
+    }
+    return stat;
+}
+
+/* private */
+static int write_header(stream_wrapper_t* out, const compose_patch_t* patch, size_t n) {
+    return write_text(out, lineidx_text(&patch->lines, n), patch->lines.lines[n].length);
+}
+
+/* Writes a path of a composed git section with its prefix, quoted if the
+ * patcher would not read it whole otherwise; /dev/null has no prefix */
+static int write_path(stream_wrapper_t* out, const char* prefix, const char* path) {
+    if (strcmp(path, DEV_NULL) == 0)
+        return write_text(out, path, strlen(path));
+    if (strpbrk(path, " \t\"\\") == NULL)
+        return write_text(out, prefix, strlen(prefix)) || write_text(out, path, strlen(path));
+
+    int stat = write_text(out, "\"", 1) || write_text(out, prefix, strlen(prefix));
+    for (const char* p = path; stat == 0 && *p; ++p) {
+        if (*p == '"' || *p == '\\')
+            stat = write_text(out, "\\", 1);
+        if (stat == 0)
+            stat = write_text(out, p, 1);
+    }
+    return stat || write_text(out, "\"", 1);
+}
+
+/* Side of the file an extended header line describes: 0 the old one, 1 the
+ * new one, 2 both (`index`), -1 neither the composed file can keep */
+static int extended_side(const char* line) {
+    static const char* const old_side[] = { "old mode ", "new file mode ", "rename from ", "copy from " };
+    static const char* const new_side[] = { "new mode ", "deleted file mode ", "rename to ", "copy to " };
+    for (size_t k = 0; k < sizeof(old_side) / sizeof(*old_side); ++k) {
+        if (strncmp(line, old_side[k], strlen(old_side[k])) == 0)
+            return 0;
+        if (strncmp(line, new_side[k], strlen(new_side[k])) == 0)
+            return 1;
+    }
+    return strncmp(line, "index ", 6) == 0 ? 2 : -1;
+}
+
+/* Non-0 if the git section has an extended header line of the same kind as `line` */
+static int has_extended(const compose_patch_t* patch, const compose_file_t* file, const char* line) {
+    size_t length = strcspn(line, " ");
+    length += strcspn(line + length + 1, " ") + 1;  /* the kinds are told apart by their first two words */
+    for (size_t n = file->git ? file->ext_lo : 0; n < (file->git ? file->ext_hi : 0); ++n) {
+        if (strncmp(lineidx_text(&patch->lines, n), line, length) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* Writes the extended header lines of the composed section the patch gives for the side it is on */
+static int write_extended(stream_wrapper_t* out, const compose_patch_t* patch, const compose_file_t* file,
+                          const compose_patch_t* other_patch, const compose_file_t* other, int side) {
+    char buf[PATCH_MAX_LINE + 1];
+    int stat = 0;
+    for (size_t n = file->git ? file->ext_lo : 0; stat == 0 && n < (file->git ? file->ext_hi : 0); ++n) {
+        const char* line = patch_line(patch, n, buf);
+        int line_side = extended_side(line);
+        /* the other patch may give a side of the file that this one leaves as it is */
+        if (line_side == side || (line_side == 1 - side && !has_extended(other_patch, other, line)))
+            stat = write_header(out, patch, n);
+    }
+    return stat;
+}
+
+/* write_git_header:
+ *  Writes the `diff --git` header of a file the two patches change, either of
+ *  them a git section: the old side as the first patch gives it, the new side
+ *  as the second one does. Each extended header line comes from the patch
+ *  whose side it is about, or from the other one if that one has no line of
+ *  its kind; the `index` line takes the old blob of the first patch and the
+ *  new one of the second, the similarity is not known and is left out.
+ */
+static int write_git_header(stream_wrapper_t* out, const compose_patch_t* pa, const compose_file_t* fa,
+                            const compose_patch_t* pb, const compose_file_t* fb) {
+    const char* old_path = fa->git ? fa->section.old_path
+                                   : strcmp(fa->old_path, DEV_NULL) != 0 ? fa->old_path : fa->new_path;
+    const char* new_path = fb->git ? fb->section.new_path
+                                   : strcmp(fb->new_path, DEV_NULL) != 0 ? fb->new_path : fb->old_path;
+    int stat = write_text(out, "diff --git ", 11) || write_path(out, "a/", old_path) || write_text(out, " ", 1) ||
+               write_path(out, "b/", new_path) || write_text(out, "\n", 1) ||
+               write_extended(out, pa, fa, pb, fb, 0) || write_extended(out, pb, fb, pa, fa, 1);
+    if (stat == 0 && fa->section.old_index[0] && fb->section.new_index[0]) {
+        char index[2 * BLOBHASH_HEX_MAX + 16];
+        int length = snprintf(index, sizeof(index), "index %s..%s\n", fa->section.old_index, fb->section.new_index);
+        stat = write_text(out, index, (size_t)length);
+    }
+    return stat;
+}
+
+/* Writes the "--- "/"+++ " headers of a file the two patches change */
+static int write_file_headers(stream_wrapper_t* out, const compose_patch_t* pa, const compose_file_t* fa,
+                              const compose_patch_t* pb, const compose_file_t* fb) {
+    if (!fa->git && !fb->git)
+        return write_header(out, pa, fa->old_header) || write_header(out, pb, fb->new_header);
+    /* in a git section the paths are read with their prefixes, a path of a plain patch has none */
+    return write_text(out, "--- ", 4) || write_path(out, "a/", fa->old_path) || write_text(out, "\n", 1) ||
+           write_text(out, "+++ ", 4) || write_path(out, "b/", fb->new_path) || write_text(out, "\n", 1);
+}
+
+/* Writes a file of one patch as it is */
+static int write_file(stream_wrapper_t* out, const compose_patch_t* patch, const compose_file_t* file) {
+    int stat = 0;
+    for (size_t n = file->git ? file->git_line : 0; stat == 0 && n < (file->git ? file->ext_hi : 0); ++n)
+        stat = write_header(out, patch, n);
+    if (stat == 0 && file->headers)
+        stat = write_header(out, patch, file->old_header) || write_header(out, patch, file->new_header);
+    for (size_t h = 0; stat == 0 && h < file->count; ++h) {
+        const compose_hunk_t* hunk = &file->hunks[h];
+        stat = write_hunk(out, hunk->old_lo, hunk->old_len, hunk->new_lo, hunk->new_len, hunk->lines, hunk->count);
+    }
+    return stat;
+}
+
+/* Walks the hunks of one side in order of their lines of the intermediate file */
+typedef struct hunk_cursor {
+    const compose_hunk_t* hunks;
+    size_t end;         /* one past the last hunk of the cluster */
+    size_t hunk;
+    size_t line;
+    long pos;           /* intermediate line the next hunk line is at */
+    char skip;          /* kind the intermediate file does not have: '-' for the first patch, '+' for the second */
+} hunk_cursor_t;
+
+/* private */
+static const compose_line_t* cursor_peek(hunk_cursor_t* c) {
+    while (c->hunk < c->end && c->line == c->hunks[c->hunk].count) {
+        if (++c->hunk < c->end) {
+            c->line = 0;
+            c->pos = c->skip == '-' ? c->hunks[c->hunk].new_lo : c->hunks[c->hunk].old_lo;
+        }
+    }
+    return c->hunk < c->end ? &c->hunks[c->hunk].lines[c->line] : NULL;
+}
+
+/* Takes the next line of the cursor if it lies in gap `pos`, i.e. just before intermediate line `pos` */
+static const compose_line_t* cursor_gap_line(hunk_cursor_t* c, long pos) {
+    const compose_line_t* line = cursor_peek(c);
+    if (line == NULL || c->pos != pos || line->kind != c->skip)
+        return NULL;
+    ++c->line;
+    return line;
+}
+
+/* Takes the next line of the cursor if it is intermediate line `pos` */
+static const compose_line_t* cursor_line(hunk_cursor_t* c, long pos) {
+    const compose_line_t* line = cursor_peek(c);
+    if (line == NULL || c->pos != pos || line->kind == c->skip)
+        return NULL;
+    ++c->line;
+    ++c->pos;
+    return line;
+}
+
+/* compose_cluster:
+ *  Merges first-patch hunks [a0, a1) and second-patch hunks [b0, b1) that
+ *  together cover intermediate lines [lo, hi) with no gap. Every intermediate
+ *  line becomes a context line, or a line added or removed by one of the
+ *  patches; a line the first patch adds and the second removes drops out.
+ */
+static int compose_cluster(const compose_file_t* fa, size_t a0, size_t a1, const compose_file_t* fb, size_t b0,
+                           size_t b1, long lo, long hi, compose_out_t* out) {
+    hunk_cursor_t ca = { fa->hunks, a1, a0, 0, a0 < a1 ? fa->hunks[a0].new_lo : 0, '-' };
+    hunk_cursor_t cb = { fb->hunks, b1, b0, 0, b0 < b1 ? fb->hunks[b0].old_lo : 0, '+' };
+    const compose_line_t* line;
+
+    out->count = 0;
+    for (long pos = lo; pos <= hi; ++pos) {
+        while ((line = cursor_gap_line(&ca, pos)) != NULL) {
+            if (out_push(out, '-', line) != 0)
+                return -1;
+        }
+        while ((line = cursor_gap_line(&cb, pos)) != NULL) {
+            if (out_push(out, '+', line) != 0)
+                return -1;
+        }
+        if (pos == hi)
+            break;
+
+        const compose_line_t* la = cursor_line(&ca, pos);
+        const compose_line_t* lb = cursor_line(&cb, pos);
+        if (la == NULL && lb == NULL)
+            return 1;
+        if (la != NULL && lb != NULL &&
+            !line_equal(la->text, la->length, line_hash(la->text, la->length, 0), lb->text, lb->length,
+                        line_hash(lb->text, lb->length, 0), 0))
+            return 1;
+
+        const compose_line_t* text = la != NULL ? la : lb;
+        int added = la != NULL && la->kind == '+';
+        int removed = lb != NULL && lb->kind == '-';
+        if (added && removed)
+            continue;
+        char kind = added ? '+' : removed ? '-' : ' ';
+        if (out_push(out, kind, text) != 0)
+            return -1;
+    }
+
+    /* every hunk line must have been taken */
+    if (cursor_peek(&ca) != NULL || cursor_peek(&cb) != NULL)
+        return 1;
+    return 0;
+}
+
+/* Context lines around the changes of a hunk */
+static void hunk_context(const compose_hunk_t* hunk, size_t* lead, size_t* trail) {
+    *lead = *trail = 0;
+    while (*lead < hunk->count && hunk->lines[*lead].kind == ' ')
+        ++*lead;
+    while (*trail < hunk->count - *lead && hunk->lines[hunk->count - 1 - *trail].kind == ' ')
+        ++*trail;
+}
+
+/* Non-0 if a hunk of the cluster ends at intermediate line `hi` with less
+ * context after its changes than before them, i.e. at the end of the file */
+static int cut_at_end(const compose_file_t* fa, size_t a0, size_t a1, const compose_file_t* fb, size_t b0, size_t b1,
+                      long hi) {
+    size_t lead, trail;
+    for (size_t k = a0; k < a1; ++k) {
+        hunk_context(&fa->hunks[k], &lead, &trail);
+        if (fa->hunks[k].new_lo + fa->hunks[k].new_len == hi && trail < lead)
+            return 1;
+    }
+    for (size_t k = b0; k < b1; ++k) {
+        hunk_context(&fb->hunks[k], &lead, &trail);
+        if (fb->hunks[k].old_lo + fb->hunks[k].old_len == hi && trail < lead)
+            return 1;
+    }
+    return 0;
+}
+
+/* compose_file:
+ *  Groups the hunks of both patches that touch or overlap on the intermediate
+ *  file into clusters and writes one hunk per cluster. Old line numbers of a
+ *  cluster are its intermediate lines less the lines the first patch added
+ *  before it, new ones the old ones plus the lines all earlier clusters added.
+ */
+static int compose_file(stream_wrapper_t* out, const compose_patch_t* pa, const compose_file_t* fa,
+                        const compose_patch_t* pb, const compose_file_t* fb) {
+    compose_out_t lines = { 0 };
+    long delta_a = 0;   /* lines added by the first patch before the cluster */
+    long delta = 0;     /* lines added by the composed hunks so far */
+    size_t i = 0, j = 0;
+    int written = 0;    /* file headers written */
+    int stat = 0;
+
+    /* the file operations of a git section are kept even if its changes cancel out */
+    if ((fa->git || fb->git) && write_git_header(out, pa, fa, pb, fb) != 0)
+        stat = -1;
+
+    while (stat == 0 && (i < fa->count || j < fb->count)) {
+        size_t a0 = i, b0 = j;
+        long lo, hi;
+        if (j == fb->count || (i < fa->count && fa->hunks[i].new_lo <= fb->hunks[j].old_lo)) {
+            lo = fa->hunks[i].new_lo;
+            hi = lo + fa->hunks[i++].new_len;
+        } else {
+            lo = fb->hunks[j].old_lo;
+            hi = lo + fb->hunks[j++].old_len;
+        }
+        for (;;) {
+            if (i < fa->count && fa->hunks[i].new_lo <= hi) {
+                long end = fa->hunks[i].new_lo + fa->hunks[i].new_len;
+                hi = end > hi ? end : hi;
+                ++i;
+            } else if (j < fb->count && fb->hunks[j].old_lo <= hi) {
+                long end = fb->hunks[j].old_lo + fb->hunks[j].old_len;
+                hi = end > hi ? end : hi;
+                ++j;
+            } else {
+                break;
+            }
+        }
+
+        stat = compose_cluster(fa, a0, i, fb, b0, j, lo, hi, &lines);
+        if (stat > 0) {
+            fprintf(stderr, "%s: the second patch does not apply on top of the first near line %ld\n", fb->old_path,
+                    lo);
+            break;
+        }
+
+        /* patch reads uneven context as a hunk at the start or end of the
+         * file, merged hunks keep it even unless an input hunk was cut so */
+        size_t first = 0, count = lines.count;
+        size_t lead = 0, trail = 0;
+        while (lead < count && lines.lines[lead].kind == ' ')
+            ++lead;
+        while (trail < count - lead && lines.lines[count - 1 - trail].kind == ' ')
+            ++trail;
+        long old_lo = lo - delta_a;
+        if (lead < count) {
+            if (lead > trail && !cut_at_end(fa, a0, i, fb, b0, j, hi))
+                first = lead - trail;
+            else if (trail > lead && old_lo > 1)
+                count -= trail - lead;
+        }
+
+        long old_len = 0, new_len = 0;
+        for (size_t k = first; k < count; ++k) {
+            old_len += lines.lines[k].kind != '+';
+            new_len += lines.lines[k].kind != '-';
+        }
+        old_lo += (long)first;
+        if (lead < lines.count) {
+            /* a file whose changes cancel out is left out */
+            if (!written && write_file_headers(out, pa, fa, pb, fb))
+                stat = -1;
+            written = 1;
+            if (stat == 0 && write_hunk(out, old_lo, old_len, old_lo + delta, new_len, lines.lines + first,
+                                        count - first))
+                stat = -1;
+        }
+        delta += new_len - old_len;
+        for (size_t k = a0; k < i; ++k)
+            delta_a += fa->hunks[k].new_len - fa->hunks[k].old_len;
+    }
+
+    free(lines.lines);
+    return stat;
+}
+
+/*
+ *  PUBLIC API
+ */
+
+int patch_compose(const char* first_path, const char* second_path, stream_wrapper_t* out) {
+    if (first_path == NULL || second_path == NULL || out == NULL)
+        return -1;
+
+    compose_patch_t pa = { 0 }, pb = { 0 };
+    make_lineidx(&pa.lines);
+    make_lineidx(&pb.lines);
+
+    int stat = read_patch(first_path, &pa) || read_patch(second_path, &pb) || parse_patch(first_path, &pa) ||
+               parse_patch(second_path, &pb) ? -1 : 0;
+
+    /* files of the first patch in order, composed with the second patch's change of the same file;
+     * a deleted file is not the one a created file of the same side is */
+    for (size_t f = 0; stat == 0 && f < pa.count; ++f) {
+        compose_file_t* fa = &pa.files[f];
+        const char* path = fa->new_path[0] ? fa->new_path : fa->old_path;
+        compose_file_t* fb = NULL;
+        for (size_t g = 0; g < pb.count && fb == NULL && strcmp(path, DEV_NULL) != 0; ++g) {
+            if (!pb.files[g].used && strcmp(pb.files[g].old_path[0] ? pb.files[g].old_path : pb.files[g].new_path,
+                                            path) == 0)
+                fb = &pb.files[g];
+        }
+        if (fb == NULL) {
+            stat = write_file(out, &pa, fa) ? -1 : 0;
+        } else {
+            fb->used = 1;
+            stat = compose_file(out, &pa, fa, &pb, fb);
+        }
+    }
+
+    /* files only the second patch changes */
+    for (size_t g = 0; stat == 0 && g < pb.count; ++g) {
+        if (!pb.files[g].used)
+            stat = write_file(out, &pb, &pb.files[g]) ? -1 : 0;
+    }
+
+    compose_patch_free(&pa);
+    compose_patch_free(&pb);
+    return stat;
+}
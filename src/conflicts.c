@@ -0,0 +1,284 @@
+// conflicts.c - Finding patches that touch the same lines (C99 only)
+// Only the patch headers are read, the patched files are never opened
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csw.h"
+#include "patch.h"
+
+#define CONFLICT_BUCKETS 1024   /* power of two */
+
+/* Old side of a hunk on a doubled line axis: line L is 2L, the gap after it
+ * 2L + 1, so a hunk that only adds lines is a point in the gap it adds to.
+ * Closed ranges overlap when neither ends before the other starts. */
+typedef struct line_range {
+    long lo;
+    long hi;
+    size_t patch;
+} line_range_t;
+
+typedef struct file_ranges {
+    char path[PATCH_MAX_PATH];
+    size_t id;
+    line_range_t* ranges;
+    size_t count;
+    size_t capacity;
+    struct file_ranges* next;
+} file_ranges_t;
+
+/* Overlapping pair of patches on a file; first < second */
+typedef struct range_pair {
+    size_t first;
+    size_t second;
+    size_t file;
+} range_pair_t;
+
+typedef struct conflict_scan {
+    file_ranges_t* buckets[CONFLICT_BUCKETS];
+    file_ranges_t** files;      /* by id */
+    size_t file_count;
+    size_t file_capacity;
+    size_t patch;               /* patch being scanned */
+    range_pair_t* pairs;
+    size_t pair_count;
+    size_t pair_capacity;
+} conflict_scan_t;
+
+/* private */
+static size_t path_hash(const char* path) {
+    size_t h = 2166136261u;
+    for (; *path; ++path)
+        h = (h ^ (unsigned char)*path) * 16777619u;
+    return h;
+}
+
+/* private */
+static file_ranges_t* scan_file(conflict_scan_t* scan, const char* path) {
+    size_t b = path_hash(path) & (CONFLICT_BUCKETS - 1);
+    for (file_ranges_t* file = scan->buckets[b]; file != NULL; file = file->next) {
+        if (strcmp(file->path, path) == 0)
+            return file;
+    }
+
+    if (scan->file_count == scan->file_capacity) {
+        size_t new_capacity = scan->file_capacity ? scan->file_capacity * 2 : 64;
+        file_ranges_t** new_files = realloc(scan->files, new_capacity * sizeof(file_ranges_t*));
+        if (new_files == NULL)
+            return NULL;
+        scan->files = new_files;
+        scan->file_capacity = new_capacity;
+    }
+
+    file_ranges_t* file = calloc(1, sizeof(file_ranges_t));
+    if (file == NULL)
+        return NULL;
+    snprintf(file->path, sizeof(file->path), "%s", path);
+    file->id = scan->file_count;
+    file->next = scan->buckets[b];
+    scan->buckets[b] = file;
+    scan->files[scan->file_count++] = file;
+    return file;
+}
+
+/* collect_range:
+ *  patch_range_cbk_t adding the old range of a hunk to its file; the new
+ *  range is not needed, every patch is made against the same old files
+ */
+static int collect_range(const char* path, int start_old, int len_old, int start_new, int len_new, void* userdata) {
+    (void)start_new;
+    (void)len_new;
+    conflict_scan_t* scan = (conflict_scan_t*)userdata;
+    file_ranges_t* file = scan_file(scan, path);
+    if (file == NULL)
+        return 1;
+
+    if (file->count == file->capacity) {
+        size_t new_capacity = file->capacity ? file->capacity * 2 : 16;
+        line_range_t* new_ranges = realloc(file->ranges, new_capacity * sizeof(line_range_t));
+        if (new_ranges == NULL)
+            return 1;
+        file->ranges = new_ranges;
+        file->capacity = new_capacity;
+    }
+
+    line_range_t* range = &file->ranges[file->count++];
+    if (len_old > 0) {
+        range->lo = 2L * start_old;
+        range->hi = 2L * (start_old + len_old - 1);
+    } else {
+        range->lo = range->hi = 2L * start_old + 1;
+    }
+    range->patch = scan->patch;
+    return 0;
+}
+
+/* private */
+static int add_pair(conflict_scan_t* scan, size_t a, size_t b, size_t file) {
+    if (scan->pair_count == scan->pair_capacity) {
+        size_t new_capacity = scan->pair_capacity ? scan->pair_capacity * 2 : 64;
+        range_pair_t* new_pairs = realloc(scan->pairs, new_capacity * sizeof(range_pair_t));
+        if (new_pairs == NULL)
+            return 1;
+        scan->pairs = new_pairs;
+        scan->pair_capacity = new_capacity;
+    }
+    range_pair_t* pair = &scan->pairs[scan->pair_count++];
+    pair->first = a < b ? a : b;
+    pair->second = a < b ? b : a;
+    pair->file = file;
+    return 0;
+}
+
+/* private */
+static int compare_ranges(const void* a, const void* b) {
+    const line_range_t* x = (const line_range_t*)a;
+    const line_range_t* y = (const line_range_t*)b;
+    if (x->lo != y->lo)
+        return x->lo < y->lo ? -1 : 1;
+    return x->hi < y->hi ? -1 : x->hi > y->hi;
+}
+
+/* private */
+static int compare_pairs(const void* a, const void* b) {
+    const range_pair_t* x = (const range_pair_t*)a;
+    const range_pair_t* y = (const range_pair_t*)b;
+    if (x->file != y->file)
+        return x->file < y->file ? -1 : 1;
+    if (x->first != y->first)
+        return x->first < y->first ? -1 : 1;
+    return x->second < y->second ? -1 : x->second > y->second;
+}
+
+/* sweep_file:
+ *  Pairs every range of the file with the earlier ranges still open at its
+ *  start. Ranges are taken by start; the open ones sit in a min-heap by end,
+ *  so the ones that closed are dropped from the top and all the rest overlap.
+ *  O(n log n + k) for n ranges and k overlaps.
+ */
+static int sweep_file(conflict_scan_t* scan, file_ranges_t* file) {
+    qsort(file->ranges, file->count, sizeof(line_range_t), &compare_ranges);
+
+    line_range_t* heap = malloc((file->count ? file->count : 1) * sizeof(line_range_t));
+    if (heap == NULL)
+        return 1;
+    size_t open = 0;
+
+    for (size_t i = 0; i < file->count; ++i) {
+        const line_range_t* range = &file->ranges[i];
+
+        /* drop the ranges that end before this one starts */
+        while (open > 0 && heap[0].hi < range->lo) {
+            heap[0] = heap[--open];
+            for (size_t n = 0;;) {
+                size_t least = n, l = 2 * n + 1, r = 2 * n + 2;
+                if (l < open && heap[l].hi < heap[least].hi)
+                    least = l;
+                if (r < open && heap[r].hi < heap[least].hi)
+                    least = r;
+                if (least == n)
+                    break;
+                line_range_t tmp = heap[n];
+                heap[n] = heap[least];
+                heap[least] = tmp;
+                n = least;
+            }
+        }
+
+        for (size_t n = 0; n < open; ++n) {
+            if (heap[n].patch != range->patch && add_pair(scan, heap[n].patch, range->patch, file->id) != 0) {
+                free(heap);
+                return 1;
+            }
+        }
+
+        /* push */
+        size_t n = open++;
+        heap[n] = *range;
+        while (n > 0 && heap[(n - 1) / 2].hi > heap[n].hi) {
+            line_range_t tmp = heap[n];
+            heap[n] = heap[(n - 1) / 2];
+            heap[(n - 1) / 2] = tmp;
+            n = (n - 1) / 2;
+        }
+    }
+
+    free(heap);
+    return 0;
+}
+
+/* private */
+static void conflict_scan_free(conflict_scan_t* scan) {
+    for (size_t i = 0; i < scan->file_count; ++i) {
+        free(scan->files[i]->ranges);
+        free(scan->files[i]);
+    }
+    free(scan->files);
+    free(scan->pairs);
+}
+
+int patch_find_conflicts(const char* const* patch_paths, size_t count, unsigned int opts,
+                         patch_conflict_t** conflicts, size_t* conflict_count) {
+    if ((patch_paths == NULL && count > 0) || conflicts == NULL || conflict_count == NULL)
+        return -1;
+    *conflicts = NULL;
+    *conflict_count = 0;
+
+    void* patcher = patch_init();
+    if (patcher == NULL)
+        return -1;
+    patch_set_options(patcher, opts);
+
+    conflict_scan_t* scan = calloc(1, sizeof(conflict_scan_t));
+    int stat = scan == NULL ? -1 : 0;
+
+    /* old ranges of every hunk, grouped by file */
+    for (size_t i = 0; i < count && stat == 0; ++i) {
+        FILE* fp = fopen(patch_paths[i], "rb");
+        if (!fp) {
+            fprintf(stderr, "Cannot open %s\n", patch_paths[i]);
+            stat = -1;
+            break;
+        }
+        stream_wrapper_t sw = { 0 };
+        make_fdsw(&sw, fp);
+        scan->patch = i;
+        if (patch_scan_hunks(patcher, &sw, &collect_range, scan) != 0)    /* closes the stream */
+            stat = -1;
+    }
+    patch_destroy(patcher);
+
+    for (size_t f = 0; stat == 0 && f < scan->file_count; ++f) {
+        if (sweep_file(scan, scan->files[f]) != 0)
+            stat = -1;
+    }
+
+    /* a pair overlapping in several hunks of a file is reported once */
+    if (stat == 0 && scan->pair_count > 0) {
+        qsort(scan->pairs, scan->pair_count, sizeof(range_pair_t), &compare_pairs);
+        *conflicts = malloc(scan->pair_count * sizeof(patch_conflict_t));
+        if (*conflicts == NULL)
+            stat = -1;
+        for (size_t i = 0; stat == 0 && i < scan->pair_count; ++i) {
+            const range_pair_t* pair = &scan->pairs[i];
+            if (i > 0 && compare_pairs(pair, pair - 1) == 0)
+                continue;
+            patch_conflict_t* conflict = &(*conflicts)[(*conflict_count)++];
+            conflict->first = pair->first;
+            conflict->second = pair->second;
+            strcpy(conflict->path, scan->files[pair->file]->path);
+        }
+    }
+
+    if (scan != NULL) {
+        conflict_scan_free(scan);
+        free(scan);
+    }
+    if (stat != 0) {
+        free(*conflicts);
+        *conflicts = NULL;
+        *conflict_count = 0;
+    }
+    return stat;
+}
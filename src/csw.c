@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h> /* for memcpy */
 
 #include "csw.h"
 
@@ -20,6 +21,7 @@ long make_fdsw(void* self, FILE* fp) {
     sw->seekg = &fdsw_seekg;
     sw->seekp = &fdsw_seekp;
     sw->close = &fdsw_close;
+    sw->pushed_back = 0;
 
     return 0;
 }
@@ -36,7 +38,9 @@ long fdsw_read(void* self, char* data, size_t element_size, size_t count) {
     if (fp == NULL)
         return -1;
 
-    return fread(data, element_size, count, fp);
+    size_t got = fread(data, element_size, count, fp);
+    sw->read_pos += (long)(got * element_size);
+    return (long)got;
 }
 
 long fdsw_write(void* self, const char* data, size_t element_size, size_t count) {
@@ -51,7 +55,9 @@ long fdsw_write(void* self, const char* data, size_t element_size, size_t count)
     if (fp == NULL)
         return -1;
 
-    return fwrite(data, element_size, count, fp);
+    size_t written = fwrite(data, element_size, count, fp);
+    sw->write_pos += (long)(written * element_size);
+    return (long)written;
 }
 
 long fdsw_seekg(void* self, size_t pos, int whence) {
@@ -62,7 +68,7 @@ long fdsw_seekg(void* self, size_t pos, int whence) {
     if (fp == NULL)
         return -1;
 
-    long new_pos = sw->read_pos;
+    long new_pos = sw->read_pos - sw->pushed_back;
     switch (whence) {
     case SEEK_SET:
         new_pos = (long)pos;
@@ -78,9 +84,10 @@ long fdsw_seekg(void* self, size_t pos, int whence) {
     default:
         return -1;
     }
-    if (new_pos < 0)
+    if (new_pos < 0 || fseek(fp, new_pos, SEEK_SET) != 0)
         return -1;
     sw->read_pos = new_pos;
+    sw->pushed_back = 0;
     return 0;
 }
 
@@ -108,7 +115,7 @@ long fdsw_seekp(void* self, size_t pos, int whence) {
     default:
         return -1;
     }
-    if (new_pos < 0)
+    if (new_pos < 0 || fseek(fp, new_pos, SEEK_SET) != 0)
         return -1;
     sw->write_pos = new_pos;
     return 0;
@@ -118,7 +125,7 @@ long fdsw_tellg(void* self) {
     if (self == NULL)
         return -1;
     stream_wrapper_t* sw = (stream_wrapper_t*)self;
-    return sw->read_pos;
+    return sw->read_pos - sw->pushed_back;
 }
 
 long fdsw_tellp(void* self) {
@@ -138,10 +145,8 @@ long fdsw_close(void* self) {
         return -1;
 
     int status = fclose(fp);
-    if (status == 0) {
-        /* 0 means success */
-        fp = NULL;
-    }
+    /* the FILE is gone even if fclose reported an error, never close it twice */
+    sw->_impl = NULL;
 
     return status;
 }
@@ -164,6 +169,7 @@ long make_memsw(void* self, dynmem_t* dm) {
     sw->seekg = &memsw_seekg;
     sw->seekp = &memsw_seekp;
     sw->close = &memsw_close;
+    sw->pushed_back = 0;
 
     return 0;
 }
@@ -227,8 +233,11 @@ long memsw_seekg(void* self, size_t pos, int whence) {
     if (dm == NULL) /* Invalid dynmem pointer */
         return -1;
 
-    long offset = (long)pos;
-    return dynmem_seekg(dm, offset, whence);
+    long offset = (long)pos - (whence == SEEK_CUR ? sw->pushed_back : 0);
+    if (dynmem_seekg(dm, offset, whence) != 0)
+        return -1;
+    sw->pushed_back = 0;
+    return 0;
 }
 
 long memsw_tellp(void* self) {
@@ -266,3 +275,166 @@ long memsw_close(void* self) {
 
     return dynmem_free(dm);
 }
+
+long make_nullsw(void* self) {
+    stream_wrapper_t* sw = (stream_wrapper_t*)self;
+    if (sw->_impl != NULL) /* stream descriptor already opened and used */
+        return -1;
+
+    /* nothing to point to, but _impl tells an open stream from a closed one */
+    sw->_impl = sw;
+    sw->read_pos = 0;
+    sw->write_pos = 0;
+    sw->pushed_back = 0;
+
+    sw->read = &nullsw_read;
+    sw->write = &nullsw_write;
+    sw->tellg = &nullsw_tell;
+    sw->tellp = &nullsw_tell;
+    sw->seekg = &nullsw_seek;
+    sw->seekp = &nullsw_seek;
+    sw->close = &nullsw_close;
+
+    return 0;
+}
+
+long nullsw_read(void* self, char* data, size_t element_size, size_t count) {
+    (void)data;
+    (void)element_size;
+    (void)count;
+    if (self == NULL)
+        return -1;
+    return 0;   /* always at EOF */
+}
+
+long nullsw_write(void* self, const char* data, size_t element_size, size_t count) {
+    if (self == NULL)
+        return -1;
+
+    if (data == NULL || element_size == 0 || count == 0)
+        return -1;
+
+    /* discard the data, only count it */
+    stream_wrapper_t* sw = (stream_wrapper_t*)self;
+    sw->write_pos += (long)(element_size * count);
+    return (long)count;
+}
+
+long nullsw_seek(void* self, size_t pos, int whence) {
+    (void)self;
+    (void)pos;
+    (void)whence;
+    return -1;  /* nothing to seek in */
+}
+
+long nullsw_tell(void* self) {
+    if (self == NULL)
+        return -1;
+    stream_wrapper_t* sw = (stream_wrapper_t*)self;
+    return sw->write_pos;
+}
+
+long nullsw_close(void* self) {
+    if (self == NULL)
+        return -1;
+
+    stream_wrapper_t* sw = (stream_wrapper_t*)self;
+    sw->_impl = NULL;
+    sw->_view = NULL;
+    return 0;
+}
+
+long make_viewsw(void* self, const dynmem_t* dm) {
+    if (dm == NULL) /* Invalid dynmem_t* */
+        return -1;
+
+    stream_wrapper_t* sw = (stream_wrapper_t*)self;
+    if (sw->_impl != NULL) /* stream descriptor already opened and used */
+        return -1;
+
+    /* the dynmem is shared by other readers: its own read position is left alone;
+     * it is kept apart from _impl, which only tells an open stream from a closed one */
+    sw->_impl = sw;
+    sw->_view = dm;
+    sw->read_pos = 0;
+    sw->write_pos = 0;
+    sw->pushed_back = 0;
+
+    sw->read = &viewsw_read;
+    sw->write = &viewsw_write;
+    sw->tellg = &viewsw_tellg;
+    sw->tellp = &viewsw_tellg;
+    sw->seekg = &viewsw_seekg;
+    sw->seekp = &nullsw_seek;
+    sw->close = &nullsw_close;
+
+    return 0;
+}
+
+long viewsw_read(void* self, char* data, size_t element_size, size_t count) {
+    if (self == NULL) /* Invalid self pointer */
+        return -1;
+
+    stream_wrapper_t* sw = (stream_wrapper_t*)self;
+    const dynmem_t* dm = (const dynmem_t*)sw->_view;
+    if (dm == NULL) /* Invalid dynmem pointer */
+        return -1;
+
+    if (data == NULL) /* Invalid data pointer to read to */
+        return -1;
+
+    if (element_size == 0 || count == 0) /* Nothing to read */
+        return 0;
+
+    size_t left = dm->writepos - (size_t)sw->read_pos;
+    if (count > left / element_size)
+        count = left / element_size;
+    memcpy(data, dm->buf + sw->read_pos, count * element_size);
+    sw->read_pos += (long)(count * element_size);
+    return (long)count;
+}
+
+long viewsw_write(void* self, const char* data, size_t element_size, size_t count) {
+    (void)self;
+    (void)data;
+    (void)element_size;
+    (void)count;
+    return -1;  /* read only */
+}
+
+long viewsw_seekg(void* self, size_t pos, int whence) {
+    if (self == NULL)
+        return -1;
+
+    stream_wrapper_t* sw = (stream_wrapper_t*)self;
+    const dynmem_t* dm = (const dynmem_t*)sw->_view;
+    if (dm == NULL) /* Invalid dynmem pointer */
+        return -1;
+
+    long new_pos = sw->read_pos - sw->pushed_back;
+    switch (whence) {
+    case SEEK_SET:
+        new_pos = (long)pos;
+        break;
+    case SEEK_CUR:
+        new_pos += (long)pos;
+        break;
+    case SEEK_END:
+        new_pos = (long)dm->writepos + (long)pos;
+        break;
+    default:
+        return -1;
+    }
+    if (new_pos < 0 || (size_t)new_pos > dm->writepos)
+        return -1;
+    sw->read_pos = new_pos;
+    sw->pushed_back = 0;
+    return 0;
+}
+
+long viewsw_tellg(void* self) {
+    if (self == NULL)
+        return -1;
+    stream_wrapper_t* sw = (stream_wrapper_t*)self;
+    return sw->read_pos - sw->pushed_back;
+}
@@ -15,6 +15,14 @@ typedef struct stream_wrapper_ {
 
     long read_pos;
     long write_pos;
+
+    /* the byte sw_fgets() read past a lone '\r', kept for its next call instead
+     * of seeking back; tellg and seekg take it as not read yet */
+    int pushed_back;
+    char pushback;
+
+    /* read-only storage of a view stream, see make_viewsw() */
+    const void* _view;
 } stream_wrapper_t;
 
 long make_fdsw(void* sw, FILE* fp);
@@ -35,4 +43,19 @@ long memsw_tellg(void* self);
 long memsw_tellp(void* self);
 long memsw_close(void* self);
 
+/* Sink that discards everything written to it and counts the bytes in write_pos */
+long make_nullsw(void* sw);
+long nullsw_read(void* self, char* data, size_t element_size, size_t count);
+long nullsw_write(void* self, const char* data, size_t element_size, size_t count);
+long nullsw_seek(void* self, size_t pos, int whence);
+long nullsw_tell(void* self);
+long nullsw_close(void* self);
+
+/* Read-only stream over a dynmem other readers may share, the dynmem is neither changed nor freed */
+long make_viewsw(void* sw, const dynmem_t* dm);
+long viewsw_read(void* self, char* data, size_t element_size, size_t count);
+long viewsw_write(void* self, const char* data, size_t element_size, size_t count);
+long viewsw_seekg(void* self, size_t pos, int whence);
+long viewsw_tellg(void* self);
+
 #endif  /* CSW_H_ */
@@ -108,6 +108,14 @@ long dynmem_resize(dynmem_t* dm, size_t new_size) {
     return 0;
 };
 
+long dynmem_reserve(dynmem_t* dm, size_t size) {
+    if (dm == NULL) /* Invalid self pointer */
+        return -1;
+    if (size <= dm->size) /* Room enough already */
+        return 0;
+    return dynmem_resize(dm, size);
+}
+
 long dynmem_write(dynmem_t* dm, const char* data, size_t element_size, size_t count) {
     if (dm == NULL) /* Invalid self pointer */
         return -1;
@@ -32,6 +32,13 @@ long make_dynmem_as_copy(dynmem_t* dm, const char* data, size_t element_size, si
 long dynmem_free(dynmem_t* dm);
 
 long dynmem_resize(dynmem_t* dm, size_t new_size);
+
+/*
+ * Makes room for `size` bytes in all, so writes up to there allocate nothing; content and
+ * positions are kept. dynmem_write() grows to the exact end of each write, a stream of small
+ * writes of known total size reserves it first.
+ */
+long dynmem_reserve(dynmem_t* dm, size_t size);
 long dynmem_write(dynmem_t* dm, const char* data, size_t element_size, size_t count);
 long dynmem_read(dynmem_t* dm, char* data, size_t element_size, size_t count);
 long dynmem_seekp(dynmem_t* dm, long offset, int origin);
@@ -0,0 +1,342 @@
+// editscript.c - Edit scripts: a patch resolved to byte spans against its files, and replayed (C99 only)
+// Replaying reads each input once, in chunks, and places no hunk
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "editscript.h"
+#include "instance.h"
+#include "parser.h"
+
+/* Records a span of the output, merged into the span before if it goes on where that one ends */
+void script_span(script_builder_t* script, uint32_t kind, uint64_t offset, uint64_t length) {
+    if (script->span_count > script->file.first_span) {
+        edit_span_t* last = (edit_span_t*)script->spans.buf + (script->span_count - 1);
+        if (last->kind == kind && last->offset + last->length == offset) {
+            last->length += length;
+            return;
+        }
+    }
+    edit_span_t span = { 0 };
+    span.kind = kind;
+    span.offset = offset;
+    span.length = length;
+    table_put(&script->spans, &span, sizeof(span), &script->failed);
+    ++script->span_count;
+}
+
+/* Records bytes that are not copied from the input */
+static void script_insert(script_builder_t* script, const char* data, size_t length) {
+    if (length > 0)
+        script_span(script, EDIT_INSERT, table_put(&script->payload, data, length, &script->failed), length);
+}
+
+/* Records a line written from the patch, or converted to another EOL, as output_write() writes it */
+void script_line(script_builder_t* script, const char* data, size_t length, const char* eol) {
+    size_t old = eol != NULL ? line_eol_length(data, length) : 0;
+    script_insert(script, data, length - old);
+    if (old > 0)
+        script_insert(script, eol, strlen(eol));
+}
+
+/* script_input:
+ *  Names the input just acquired by its size and blob hash, for the output
+ *  acquired next; the stream is read whole and left at its start.
+ *
+ * Returns 0 on success, non-0 if the stream cannot be read
+ */
+int script_input(script_builder_t* script, const char* path, stream_wrapper_t* sw) {
+    if (stream_blob_hash(sw, script->in_hash, &script->in_size) != 0) {
+        fprintf(stderr, "Cannot read %s to resolve it\n", path);
+        return 1;
+    }
+    snprintf(script->in_path, MAX_PATH_LEN, "%s", path);
+    return 0;
+}
+
+/* Starts the file of an output, which is a null stream: its bytes are recorded as spans */
+int script_file_begin(patch_instance_data_t* instance, const char* path, stream_wrapper_t* sw) {
+    script_builder_t* script = instance->script;
+    /* an output dropped after a failed hunk was never ended, its spans go */
+    script->span_count = script->file.first_span;
+    script->spans.writepos = (size_t)script->span_count * sizeof(edit_span_t);
+
+    memset(&script->file, 0, sizeof(edit_file_t));
+    script->file.in_path = table_put(&script->payload, script->in_path, strlen(script->in_path) + 1, &script->failed);
+    script->file.out_path = table_put(&script->payload, path, strlen(path) + 1, &script->failed);
+    if (script->in_path[0] != '\0') {
+        memcpy(script->file.in_hash, script->in_hash, RESULT_CACHE_HASH);
+        script->file.in_size = (uint64_t)script->in_size;
+    }
+    script->file.first_span = script->span_count;
+    script->in_path[0] = '\0';
+    return make_nullsw(sw) == 0 ? 0 : 1;
+}
+
+/* script_file_end:
+ *  Adds the file of the output to the file table. Every input byte must have
+ *  been seen, spans are offsets into the file as it is.
+ *
+ * Returns 0 on success, non-0 if the input cannot be resolved
+ */
+int script_file_end(patch_instance_data_t* instance, stream_wrapper_t* sw) {
+    script_builder_t* script = instance->script;
+    sw->close(sw);
+    if (script->file.in_hash[0] != '\0' && (uint64_t)instance->input.in_bytes != script->file.in_size) {
+        fprintf(stderr, "%s: lines with NUL bytes cannot be resolved to an edit script\n",
+                script->payload.buf + script->file.in_path);
+        return 1;
+    }
+
+    script->file.span_count = script->span_count - script->file.first_span;
+    const edit_span_t* spans = (const edit_span_t*)script->spans.buf + script->file.first_span;
+    for (uint64_t i = 0; i < script->file.span_count; ++i)
+        script->file.out_size += spans[i].length;
+    table_put(&script->files, &script->file, sizeof(edit_file_t), &script->failed);
+    ++script->file_count;
+    script->file.first_span = script->span_count;
+    return 0;
+}
+
+/* Writes the header, the tables and the payload, one after another */
+static int script_write(script_builder_t* script, stream_wrapper_t* out) {
+    edit_script_header_t header = { 0 };
+    memcpy(header.magic, EDIT_SCRIPT_MAGIC, sizeof(header.magic));
+    header.version = EDIT_SCRIPT_VERSION;
+    header.file_count = script->file_count;
+    header.span_count = script->span_count;
+    /* the entries are whole multiples of 8 bytes, so every table stays aligned */
+    header.files = sizeof(header);
+    header.spans = header.files + script->files.writepos;
+    header.payload = header.spans + script->spans.writepos;
+    header.payload_size = script->payload.writepos;
+
+    int stat = write_span(out, (const char*)&header, sizeof(header));
+    stat |= write_span(out, script->files.buf, script->files.writepos);
+    stat |= write_span(out, script->spans.buf, script->spans.writepos);
+    stat |= write_span(out, script->payload.buf, script->payload.writepos);
+    if (stat != 0)
+        fprintf(stderr, "Write error while writing the edit script\n");
+    return stat;
+}
+
+int patch_resolve(void* self, stream_wrapper_t* sw, stream_wrapper_t* out) {
+    if (self == NULL || out == NULL)   /* Invalid instance pointer */
+        return 1;
+    patch_instance_data_t* instance = (patch_instance_data_t*)self;
+
+    script_builder_t script = { 0 };
+    make_dynmem(&script.files, 0, 0);
+    make_dynmem(&script.spans, 0, 0);
+    make_dynmem(&script.payload, 0, 0);
+
+    /* the outputs are recorded, not written, and only to write them could they be written in place */
+    int dry_run = instance->options.dry_run;
+    instance->options.dry_run = 0;
+    instance->script = &script;
+    int stat = apply_patch(self, sw);
+    instance->script = NULL;
+    instance->input.script = NULL;
+    instance->options.dry_run = dry_run;
+
+    if (stat == 0 && script.failed) {
+        fprintf(stderr, "Out of memory while resolving the patch\n");
+        stat = 1;
+    }
+    if (stat == 0)
+        stat = script_write(&script, out);
+    dynmem_free(&script.files);
+    dynmem_free(&script.spans);
+    dynmem_free(&script.payload);
+    return stat;
+}
+
+/* script_check:
+ *  Checks the header and every file and span against the size, as
+ *  compiled_check() does; copies must also go forward through the input and
+ *  add up, with the inserts, to the output size.
+ *
+ * Returns 0 and the header on success, non-0 if the data is not an edit script or is damaged
+ */
+static int script_check(const void* data, size_t size, const edit_script_header_t** header_out) {
+    const edit_script_header_t* header = (const edit_script_header_t*)data;
+    if (data == NULL || ((uintptr_t)data % 8) != 0 || size < sizeof(edit_script_header_t) ||
+        memcmp(header->magic, EDIT_SCRIPT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != EDIT_SCRIPT_VERSION)
+        return 1;
+    if (!compiled_table_fits(header->files, header->file_count, sizeof(edit_file_t), size) ||
+        !compiled_table_fits(header->spans, header->span_count, sizeof(edit_span_t), size) ||
+        header->payload > size || header->payload_size > size - header->payload)
+        return 1;
+
+    const char* base = (const char*)data;
+    const edit_file_t* files = (const edit_file_t*)(base + header->files);
+    const edit_span_t* spans = (const edit_span_t*)(base + header->spans);
+    const char* payload = base + header->payload;
+    for (uint32_t i = 0; i < header->file_count; ++i) {
+        const edit_file_t* file = &files[i];
+        if (file->first_span > header->span_count || file->span_count > header->span_count - file->first_span ||
+            !compiled_string_fits(payload, header->payload_size, file->in_path) ||
+            !compiled_string_fits(payload, header->payload_size, file->out_path) ||
+            memchr(file->in_hash, '\0', sizeof(file->in_hash)) == NULL)
+            return 1;
+
+        /* copies go forward through the input, so it is read once, front to back */
+        uint64_t in_pos = 0, out_size = 0;
+        for (uint64_t n = file->first_span; n < file->first_span + file->span_count; ++n) {
+            const edit_span_t* span = &spans[n];
+            uint64_t limit = span->kind == EDIT_COPY ? file->in_size : header->payload_size;
+            if ((span->kind != EDIT_COPY && span->kind != EDIT_INSERT) || span->offset > limit ||
+                span->length > limit - span->offset || (span->kind == EDIT_COPY && span->offset < in_pos))
+                return 1;
+            if (span->kind == EDIT_COPY)
+                in_pos = span->offset + span->length;
+            out_size += span->length;
+        }
+        if (out_size != file->out_size)
+            return 1;
+    }
+    *header_out = header;
+    return 0;
+}
+
+/* script_replay:
+ *  Writes the output of one file: the input is read front to back in chunks,
+ *  all of it hashed, copied spans passed on as they go by and payload bytes
+ *  written between them.
+ *
+ * Returns 0 on success, 1 if the input is not the one the script names, -1 on a read or write error
+ */
+static int script_replay(const edit_script_header_t* header, const edit_file_t* file, stream_wrapper_t* in_stream,
+                         stream_wrapper_t* out_stream) {
+    const char* base = (const char*)header;
+    const edit_span_t* spans = (const edit_span_t*)(base + header->spans) + file->first_span;
+    const char* payload = base + header->payload;
+
+    blobhash_t hash = { 0 };
+    if (in_stream->_impl) {
+        long size;
+        if (in_stream->seekg(in_stream, 0, SEEK_END) != 0 || (size = in_stream->tellg(in_stream)) < 0 ||
+            in_stream->seekg(in_stream, 0, SEEK_SET) != 0)
+            return -1;
+        if ((uint64_t)size != file->in_size)
+            return 1;
+        blobhash_init(&hash, file->in_hash);
+        blobhash_begin(&hash, (size_t)size);
+    }
+
+    char buf[EDIT_SCRIPT_BUFFER];
+    uint64_t buf_pos = 0;   /* input offset of buf[0] */
+    size_t buf_len = 0;
+    for (uint64_t n = 0; n < file->span_count; ++n) {
+        const edit_span_t* span = &spans[n];
+        if (span->kind == EDIT_INSERT) {
+            if (write_span(out_stream, payload + span->offset, (size_t)span->length) != 0)
+                return -1;
+            continue;
+        }
+        uint64_t offset = span->offset, left = span->length;
+        while (left > 0) {
+            if (offset >= buf_pos + buf_len) {
+                buf_pos += buf_len;
+                long got = in_stream->read(in_stream, buf, 1, sizeof(buf));
+                if (got <= 0)
+                    return -1;
+                buf_len = (size_t)got;
+                blobhash_update(&hash, buf, buf_len);
+                continue;   /* deleted bytes are skipped a chunk at a time */
+            }
+            size_t at = (size_t)(offset - buf_pos);
+            size_t length = buf_len - at < left ? buf_len - at : (size_t)left;
+            if (write_span(out_stream, buf + at, length) != 0)
+                return -1;
+            offset += length;
+            left -= length;
+        }
+    }
+
+    /* the rest of the input is hashed too, it is deleted or the script does not fit it */
+    if (in_stream->_impl) {
+        long got;
+        while ((got = in_stream->read(in_stream, buf, 1, sizeof(buf))) > 0)
+            blobhash_update(&hash, buf, (size_t)got);
+        if (got < 0)
+            return -1;
+        return blobhash_end(&hash) == 0 ? 0 : 1;
+    }
+    return 0;
+}
+
+int apply_edit_script(void* self, const void* data, size_t size) {
+    if (self == NULL)   /* Invalid instance pointer */
+        return 1;
+    patch_instance_data_t* instance = (patch_instance_data_t*)self;
+
+    /* shorthand */
+    patch_options_t* options = &instance->options;
+
+    const edit_script_header_t* header = NULL;
+    if (script_check(data, size, &header) != 0) {
+        fprintf(stderr, "Not an edit script, or a damaged one\n");
+        return 1;
+    }
+    if (options->verbose)
+        printf("Opened edit script\n");
+
+    instance->hunks_failed = 0;
+    instance->result_count = 0;
+
+    const char* base = (const char*)data;
+    const edit_file_t* files = (const edit_file_t*)(base + header->files);
+    const char* payload = base + header->payload;
+    for (uint32_t i = 0; i < header->file_count; ++i) {
+        const edit_file_t* file = &files[i];
+        char in_path[MAX_PATH_LEN];
+        char out_path[MAX_PATH_LEN];
+        snprintf(in_path, MAX_PATH_LEN, "%s", payload + file->in_path);
+        snprintf(out_path, MAX_PATH_LEN, "%s", payload + file->out_path);
+
+        stream_wrapper_t in_stream = { 0 };
+        stream_wrapper_t out_stream = { 0 };
+        if (in_path[0] != '\0' &&
+            patch_acquire_user_stream(instance, in_path, &in_stream, PATCH_STREAM_PURPOSE_INPUT, NULL, -1) != 0) {
+            fprintf(stderr, "Cannot open input file: %s\n", in_path);
+            return 1;
+        }
+        int stat = options->dry_run ? make_nullsw(&out_stream)
+                                    : patch_acquire_user_stream(instance, out_path, &out_stream,
+                                                                PATCH_STREAM_PURPOSE_OUTPUT, NULL,
+                                                                (long)file->out_size);
+        if (stat != 0) {
+            fprintf(stderr, "Cannot open output file: %s\n", out_path);
+            if (in_stream._impl)
+                patch_release_user_stream(instance, in_path, &in_stream, PATCH_STREAM_PURPOSE_INPUT);
+            return 1;
+        }
+
+        if (options->verbose)
+            printf("Replaying %llu spans to %s\n", (unsigned long long)file->span_count, out_path);
+        stat = script_replay(header, file, &in_stream, &out_stream);
+        if (stat > 0) {
+            fprintf(stderr, "%s is not the input the edit script was resolved against, %s is left as it is\n",
+                    in_path, out_path);
+            ++instance->hunks_failed;
+        } else if (stat < 0) {
+            perror("Read or write error while replaying the edit script");
+        }
+        if (in_stream._impl)
+            patch_release_user_stream(instance, in_path, &in_stream, PATCH_STREAM_PURPOSE_INPUT);
+        /* a dropped output is discarded, so it does not replace the file; a dry run has no user stream */
+        if (stat != 0)
+            patch_discard_user_stream(instance, out_path, &out_stream, PATCH_STREAM_PURPOSE_OUTPUT);
+        else if (options->dry_run)
+            out_stream.close(&out_stream);
+        else if (patch_release_user_stream(instance, out_path, &out_stream, PATCH_STREAM_PURPOSE_OUTPUT) != 0)
+            stat = -1;
+        if (stat < 0)
+            return 1;
+    }
+
+    return instance->hunks_failed ? 1 : 0;
+}
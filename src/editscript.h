@@ -0,0 +1,57 @@
+#ifndef EDITSCRIPT_H_
+#define EDITSCRIPT_H_
+
+#include <stdint.h>
+
+#include "resultcache.h"
+
+/*
+ * Edit script: a patch resolved against the very files it was placed on (see
+ * patch_resolve(), apply_edit_script()). Each file is a list of byte spans, in
+ * output order: copy [offset, offset + length) of the input, or insert bytes
+ * of the payload. The input is named by its size and git blob SHA-1, and the
+ * size of the output is known ahead. Replaying reads no lines and places no
+ * hunk; an input that is not the one named is not patched.
+ *
+ * The file is laid out as a compiled patch is (see compiled.h): the header,
+ * then the file and span tables and the payload at the offsets it names,
+ * every table aligned to 8 bytes, in the byte order of the machine that wrote it.
+ */
+
+#define EDIT_SCRIPT_MAGIC   "PATCHEDS"
+#define EDIT_SCRIPT_VERSION 1
+#define EDIT_SCRIPT_BUFFER  65536   /* chunk the input is read by when replayed */
+
+/* edit_span_t.kind */
+#define EDIT_COPY   1   /* bytes of the input */
+#define EDIT_INSERT 2   /* bytes of the payload */
+
+typedef struct edit_script_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t file_count;
+    uint64_t span_count;
+    uint64_t files;             /* offsets of the tables and of the payload from the start of the file */
+    uint64_t spans;
+    uint64_t payload;
+    uint64_t payload_size;
+} edit_script_header_t;
+
+typedef struct edit_file {
+    uint64_t in_path;           /* payload offsets of NUL terminated paths, "" for a file created from nothing */
+    uint64_t out_path;
+    char in_hash[RESULT_CACHE_HASH + 7];    /* git blob SHA-1 hex of the input, NUL padded */
+    uint64_t in_size;
+    uint64_t out_size;          /* sum of the span lengths */
+    uint64_t first_span;
+    uint64_t span_count;
+} edit_file_t;
+
+typedef struct edit_span {
+    uint32_t kind;              /* EDIT_COPY or EDIT_INSERT */
+    uint32_t reserved;
+    uint64_t offset;            /* input offset to copy from, payload offset to insert from */
+    uint64_t length;
+} edit_span_t;
+
+#endif  /* EDITSCRIPT_H_ */
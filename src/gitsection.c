@@ -0,0 +1,347 @@
+// gitsection.c - `diff --git` sections: extended headers, created and deleted files, GIT binary patches (C99 only)
+// The file operations a section asks for are sent as events once its content is written
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gitsection.h"
+
+void git_strip_prefix(char* path) {
+    if (strcmp(path, DEV_NULL) == 0)
+        return;
+    char* slash = strchr(path, '/');
+    if (slash != NULL)
+        memmove(path, slash + 1, strlen(slash + 1) + 1);
+}
+
+/* Path of a `rename from`-like line: quoted as in the headers, or the rest of the line as it is */
+static void git_header_path(const char* p, char* path) {
+    if (*p == '"')
+        parse_header_filename(p, path, MAX_PATH_LEN);
+    else
+        snprintf(path, MAX_PATH_LEN, "%s", p);
+}
+
+void git_section_begin(git_section_t* git, const char* line, int reverse) {
+    memset(git, 0, sizeof(git_section_t));
+    git->active = 1;
+    git->similarity = -1;
+    char* old_path = reverse ? git->new_path : git->old_path;
+    char* new_path = reverse ? git->old_path : git->new_path;
+    const char* p = parse_header_filename(line + 11, old_path, MAX_PATH_LEN);
+    parse_header_filename(p, new_path, MAX_PATH_LEN);
+    git_strip_prefix(old_path);
+    git_strip_prefix(new_path);
+}
+
+int git_section_line(git_section_t* git, const char* line, int reverse) {
+    char* old_path = reverse ? git->new_path : git->old_path;
+    char* new_path = reverse ? git->old_path : git->new_path;
+    unsigned int* old_mode = reverse ? &git->new_mode : &git->old_mode;
+    unsigned int* new_mode = reverse ? &git->old_mode : &git->new_mode;
+    char* old_index = reverse ? git->new_index : git->old_index;
+    char* new_index = reverse ? git->old_index : git->new_index;
+
+    if (strncmp(line, "index ", 6) == 0) {
+        /* `index <old>..<new>`, the mode of an unchanged mode may follow */
+        const char* dots = strstr(line + 6, "..");
+        if (dots == NULL)
+            return 0;
+        snprintf(old_index, BLOBHASH_HEX_MAX + 1, "%.*s", (int)(dots - (line + 6)), line + 6);
+        snprintf(new_index, BLOBHASH_HEX_MAX + 1, "%.*s", (int)strcspn(dots + 2, " "), dots + 2);
+    } else if (strncmp(line, "old mode ", 9) == 0) {
+        *old_mode = (unsigned int)strtoul(line + 9, NULL, 8);
+    } else if (strncmp(line, "new mode ", 9) == 0) {
+        *new_mode = (unsigned int)strtoul(line + 9, NULL, 8);
+    } else if (strncmp(line, "deleted file mode ", 18) == 0) {
+        *(reverse ? &git->created : &git->deleted) = 1;
+        *old_mode = (unsigned int)strtoul(line + 18, NULL, 8);
+    } else if (strncmp(line, "new file mode ", 14) == 0) {
+        *(reverse ? &git->deleted : &git->created) = 1;
+        *new_mode = (unsigned int)strtoul(line + 14, NULL, 8);
+    } else if (strncmp(line, "similarity index ", 17) == 0) {
+        git->similarity = atoi(line + 17);
+    } else if (strncmp(line, "rename from ", 12) == 0) {
+        git->rename = 1;
+        git_header_path(line + 12, old_path);
+    } else if (strncmp(line, "rename to ", 10) == 0) {
+        git->rename = 1;
+        git_header_path(line + 10, new_path);
+    } else if (strncmp(line, "copy from ", 10) == 0) {
+        *(reverse ? &git->deleted : &git->copy) = 1;
+        git_header_path(line + 10, old_path);
+    } else if (strncmp(line, "copy to ", 8) == 0) {
+        *(reverse ? &git->deleted : &git->copy) = 1;
+        git_header_path(line + 8, new_path);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/* Sends a PATCH_EVT_FILE_* event, reports a failure */
+static int git_file_event(patch_instance_data_t* instance, unsigned int type, char* path, char* new_path,
+                          unsigned int mode) {
+    if (instance->script != NULL) {
+        fprintf(stderr, "%s: renames, deletions and mode changes cannot be resolved to an edit script\n", path);
+        return 1;
+    }
+
+    patch_evt_t event = { 0 };
+    event.type = type;
+    event.data.file_event.path = path;
+    event.data.file_event.new_path = new_path;
+    event.data.file_event.mode = mode;
+
+    if (instance->options.verbose) {
+        if (type == PATCH_EVT_FILE_RENAME)
+            printf("Renaming %s to %s\n", path, new_path);
+        else if (type == PATCH_EVT_FILE_DELETE)
+            printf("Deleting %s\n", path);
+        else
+            printf("Setting mode of %s to %o\n", path, mode);
+    }
+    if (patch_call_user_cbk(instance, &event) == 0)
+        return 0;
+
+    if (type == PATCH_EVT_FILE_RENAME)
+        fprintf(stderr, "Cannot rename %s to %s\n", path, new_path);
+    else if (type == PATCH_EVT_FILE_DELETE)
+        fprintf(stderr, "Cannot delete %s\n", path);
+    else
+        fprintf(stderr, "Cannot set the mode of %s\n", path);
+    return 1;
+}
+
+int create_hunk(patch_instance_data_t* instance, hunk_t* hunk, stream_wrapper_t* out_stream, char* path) {
+    patch_input_t* input = &instance->input;
+    hunk->line = hunk_patch_line(hunk);
+    hunk->head = hunk->tail = 0;
+
+    if (hunk->proc_old > 0 || out_stream->_impl) {
+        fprintf(stderr, "Hunk #%d FAILED at %d, %s is created from nothing.\n", hunk->number, hunk->line, path);
+        hunk->status = PATCH_HUNK_FAILED;
+        report_hunk(instance, path, hunk);
+        return instance->options.dry_run ? 0 : 1;
+    }
+
+    long size = 0;
+    for (size_t i = 0; i < hunk->lines.count; ++i)
+        size += (long)eol_converted_length(lineidx_text(&hunk->lines, i), hunk->lines.lines[i].length, input->eol);
+    int stat = instance->options.dry_run ? make_nullsw(out_stream)
+                                         : patch_acquire_user_stream(instance, path, out_stream,
+                                                                     PATCH_STREAM_PURPOSE_OUTPUT, NULL, size);
+    if (stat != 0) {
+        fprintf(stderr, "Cannot create file: %s\n", path);
+        return 1;
+    }
+
+    blobhash_begin(&input->out_hash, (size_t)size);
+    for (size_t i = 0; i < hunk->lines.count; ++i) {
+        if (output_insert(input, out_stream, lineidx_text(&hunk->lines, i), hunk->lines.lines[i].length) != 0) {
+            fprintf(stderr, "Write error while applying hunk");
+            return 1;
+        }
+    }
+    hunk->status = PATCH_HUNK_APPLIED;
+    report_hunk(instance, path, hunk);
+    return 0;
+}
+
+/* verify_deleted:
+ *  Compares the file with the pre-image of the hunk, none if `hunk` is NULL,
+ *  reading it line by line; nothing is buffered.
+ *
+ * Returns 0 if the file is that image, non-0 if it differs or cannot be read
+ */
+static int verify_deleted(patch_instance_data_t* instance, const hunk_t* hunk, char* path) {
+    stream_wrapper_t in_stream = { 0 };
+    if (patch_acquire_user_stream(instance, path, &in_stream, PATCH_STREAM_PURPOSE_INPUT, NULL, -1) != 0)
+        return -1;
+
+    unsigned int flags = instance->input.buffer.flags;
+    size_t count = hunk != NULL ? hunk->lines.count : 0;
+    size_t i = 0;
+    int stat = 0;
+    char line[MAX_LINE];
+    while (stat == 0 && sw_fgets(&in_stream, line, MAX_LINE)) {
+        while (i < count && !hunk_in_image(hunk, i, HUNK_PRE_IMAGE))
+            ++i;
+        size_t length = strlen(line);
+        if (i == count || !line_equal(line, length, line_hash(line, length, flags), lineidx_text(&hunk->lines, i),
+                                      hunk->lines.lines[i].length, hunk->lines.lines[i].hash, flags))
+            stat = 1;
+        ++i;
+    }
+    while (i < count && !hunk_in_image(hunk, i, HUNK_PRE_IMAGE))
+        ++i;
+    patch_release_user_stream(instance, path, &in_stream, PATCH_STREAM_PURPOSE_INPUT);
+    return stat != 0 || i < count;
+}
+
+int delete_hunk(patch_instance_data_t* instance, hunk_t* hunk, git_section_t* git) {
+    hunk->line = hunk_patch_line(hunk);
+    hunk->head = hunk->tail = 0;
+    hunk->status = PATCH_HUNK_APPLIED;
+    if (instance->options.verify_delete) {
+        /* the file is compared whole, with the first hunk */
+        if (git->verified || verify_deleted(instance, hunk, git->old_path) != 0)
+            hunk->status = PATCH_HUNK_FAILED;
+        git->verified = 1;
+    }
+    report_hunk(instance, git->old_path, hunk);
+    if (hunk->status != PATCH_HUNK_FAILED)
+        return 0;
+    fprintf(stderr, "Hunk #%d FAILED at %d, %s is not what is deleted and is kept.\n", hunk->number, hunk->line,
+            git->old_path);
+    return instance->options.dry_run ? 0 : 1;
+}
+
+int binary_end(patch_instance_data_t* instance, git_section_t* git, stream_wrapper_t* in_stream,
+               stream_wrapper_t* out_stream) {
+    int verifying = git->deleted;
+    char* path = verifying ? git->old_path : git->new_path;
+    int stat = binpatch_end(&instance->binary);
+    git->binary_hunk = 0;
+
+    if (in_stream->_impl) {
+        patch_release_user_stream(instance, git->old_path, in_stream, PATCH_STREAM_PURPOSE_INPUT);
+        memset(in_stream, 0, sizeof(stream_wrapper_t));
+    }
+    if (out_stream->_impl) {
+        if (stat == 0 && !instance->options.dry_run)
+            stat = patch_release_user_stream(instance, path, out_stream, PATCH_STREAM_PURPOSE_OUTPUT);
+        else
+            patch_discard_user_stream(instance, path, out_stream, PATCH_STREAM_PURPOSE_OUTPUT);
+        memset(out_stream, 0, sizeof(stream_wrapper_t));
+    }
+
+    hunk_t* hunk = &instance->hunk;
+    hunk_reset(hunk);
+    hunk->number = git->binary_hunks;
+    hunk->line = hunk_patch_line(hunk);
+    hunk->head = hunk->tail = 0;
+    hunk->status = stat == 0 ? PATCH_HUNK_APPLIED : PATCH_HUNK_FAILED;
+    if (verifying)
+        git->verified = 1;
+    report_hunk(instance, path, hunk);
+    if (stat == 0)
+        return 0;
+
+    const char* error = instance->binary.error != NULL ? instance->binary.error : "cannot write the output";
+    if (verifying)
+        fprintf(stderr, "Hunk #%d FAILED, %s is not what is deleted and is kept: %s\n", hunk->number, path, error);
+    else
+        fprintf(stderr, "Hunk #%d FAILED, binary patch of %s: %s\n", hunk->number, path, error);
+    return instance->options.dry_run ? 0 : 1;
+}
+
+int binary_line(patch_instance_data_t* instance, git_section_t* git, const char* line,
+                stream_wrapper_t* in_stream, stream_wrapper_t* out_stream) {
+    patch_options_t* options = &instance->options;
+
+    if (instance->script != NULL) {
+        fprintf(stderr, "%s: binary patches cannot be resolved to an edit script\n", git->new_path);
+        return 1;
+    }
+    if (git->binary_hunk == 1 && line[0] == '\0')
+        return binary_end(instance, git, in_stream, out_stream);
+    if (git->binary_hunk != 0) {
+        if (line[0] == '\0')
+            git->binary_hunk = 0;
+        else if (git->binary_hunk == 1)
+            binpatch_line(&instance->binary, line);   /* an error is reported at the end of the hunk */
+        return 0;
+    }
+
+    int kind;
+    size_t size;
+    if (binpatch_header(line, &kind, &size) != 0)
+        return 0;   /* the empty line after the last hunk, or something else to skip */
+    ++git->binary_hunks;
+    git->binary_hunk = 2;
+
+    int applied = git->binary_hunks == (options->reverse ? 2 : 1);
+    if (git->deleted ? applied || !options->verify_delete : !applied)
+        return 0;
+
+    int stat;
+    if (git->deleted) {
+        /* the old content is compared as it is decoded, a delta of it has nothing to be compared with */
+        stat = patch_acquire_user_stream(instance, git->old_path, in_stream, PATCH_STREAM_PURPOSE_INPUT, NULL, -1);
+        if (stat != 0 || kind != BINPATCH_LITERAL) {
+            fprintf(stderr, "Cannot verify %s against its binary patch\n", git->old_path);
+            return stat == 0 ? binary_end(instance, git, in_stream, out_stream) : 1;
+        }
+        stat = binpatch_begin(&instance->binary, kind, size, NULL, NULL, in_stream, NULL);
+    } else {
+        if (kind == BINPATCH_DELTA &&
+            patch_acquire_user_stream(instance, git->old_path, in_stream, PATCH_STREAM_PURPOSE_INPUT, NULL, -1) != 0) {
+            fprintf(stderr, "Cannot open source file: %s\n", git->old_path);
+            return 1;
+        }
+        if (options->dry_run)
+            stat = make_nullsw(out_stream);
+        else
+            stat = patch_acquire_user_stream(instance, git->new_path, out_stream, PATCH_STREAM_PURPOSE_OUTPUT, NULL,
+                                             kind == BINPATCH_LITERAL ? (long)size : -1);
+        if (stat != 0) {
+            fprintf(stderr, "Cannot create resulted patched file: %s\n", git->new_path);
+            return 1;
+        }
+        /* the base of a delta is read out of order, only the result can be hashed */
+        blobhash_t* hash = &instance->input.out_hash;
+        if (!options->verify_index || blobhash_init(hash, git->new_index) != 0)
+            hash = NULL;
+        stat = binpatch_begin(&instance->binary, kind, size, in_stream->_impl ? in_stream : NULL, out_stream, NULL,
+                              hash);
+    }
+    if (stat != 0 && instance->binary.error == NULL) {
+        fprintf(stderr, "Out of memory while reading binary patch of %s\n", git->new_path);
+        return 1;
+    }
+    git->binary_hunk = 1;   /* a failure to begin is reported at the end of the hunk */
+    return 0;
+}
+
+int git_section_finish(patch_instance_data_t* instance, git_section_t* git) {
+    if (!git->active)
+        return 0;
+    git->active = 0;
+    if (instance->options.dry_run)
+        return 0;
+
+    if (git->deleted && instance->options.verify_delete && !git->verified &&
+        verify_deleted(instance, NULL, git->old_path) != 0) {
+        fprintf(stderr, "%s is not empty and is kept.\n", git->old_path);
+        return 1;
+    }
+    if (git->deleted)
+        return git_file_event(instance, PATCH_EVT_FILE_DELETE, git->old_path, NULL, 0);
+
+    int stat = 0;
+    if (git->rename && (!git->content || git->inplace)) {
+        stat = git_file_event(instance, PATCH_EVT_FILE_RENAME, git->old_path, git->new_path, 0);
+    } else if (git->rename) {
+        stat = git_file_event(instance, PATCH_EVT_FILE_DELETE, git->old_path, NULL, 0);
+    } else if (git->copy && !git->content) {
+        stream_wrapper_t input_stream = { 0 };
+        stream_wrapper_t output_stream = { 0 };
+        stat = begin_file(instance, git->old_path, git->new_path, 0, &input_stream);
+        if (stat == 0)
+            stat = finalize_file(instance, &input_stream, &output_stream, git->old_path, git->new_path);
+    } else if (git->created && !git->content) {
+        stream_wrapper_t output_stream = { 0 };
+        stat = patch_acquire_user_stream(instance, git->new_path, &output_stream, PATCH_STREAM_PURPOSE_OUTPUT, NULL, 0);
+        if (stat == 0)
+            stat = patch_release_user_stream(instance, git->new_path, &output_stream, PATCH_STREAM_PURPOSE_OUTPUT);
+        if (stat != 0)
+            fprintf(stderr, "Cannot create file: %s\n", git->new_path);
+    }
+
+    /* permission bits of regular files only, a symlink or a submodule has none to set */
+    if (stat == 0 && git->new_mode != 0 && git->new_mode != git->old_mode && (git->new_mode & 0170000) == 0100000)
+        stat = git_file_event(instance, PATCH_EVT_FILE_MODE, git->new_path, NULL, git->new_mode & 0777);
+    return stat;
+}
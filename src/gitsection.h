@@ -0,0 +1,102 @@
+#ifndef GITSECTION_H_
+#define GITSECTION_H_
+
+#include "instance.h"
+
+/* Extended header of a `diff --git` section, with the sides the patch is applied in (swapped by -R) */
+struct git_section {
+    int active;                     /* inside a `diff --git` section */
+    char old_path[MAX_PATH_LEN];    /* from the `diff --git` line, `rename from` or `copy from` */
+    char new_path[MAX_PATH_LEN];
+    int rename;
+    int copy;
+    int deleted;                    /* `deleted file mode`: the old path is removed */
+    int created;                    /* `new file mode` */
+    unsigned int old_mode;          /* git mode, e.g. 0100644; 0 if not given */
+    unsigned int new_mode;
+    int similarity;                 /* `similarity index` in percent, -1 if not given */
+    char old_index[BLOBHASH_HEX_MAX + 1];   /* blob hashes of the `index` line, empty if not given */
+    char new_index[BLOBHASH_HEX_MAX + 1];
+    int content;                    /* the section has `---`/`+++` lines, the content went through the streams */
+    int inplace;                    /* ... written into the old path */
+    int verified;                   /* the deleted file was compared with its hunk, see delete_hunk() */
+    int binary;                     /* the content is a `GIT binary patch`, see binary_line() */
+    int binary_hunks;               /* its hunks so far */
+    int binary_hunk;                /* inside a binary hunk: 1 decoded, 2 read past; 0 between hunks */
+};
+
+/*
+ * Drops the a/ or b/ prefix (the first path component) of a path in a
+ * `diff --git` section; /dev/null is kept as it is.
+ */
+void git_strip_prefix(char* path);
+
+/*
+ * Starts a section at its `diff --git a/old b/new` line.
+ */
+void git_section_begin(git_section_t* git, const char* line, int reverse);
+
+/*
+ * Takes an extended header line of the section. Reversed, the sides swap: a
+ * new file is deleted, and a copy is undone by deleting it.
+ *
+ * returns non-0 if the line was an extended header line
+ */
+int git_section_line(git_section_t* git, const char* line, int reverse);
+
+/*
+ * Writes the hunk of a file created from /dev/null. Its added lines are the
+ * whole file: the output is acquired with their size and they are written as
+ * they come, there is no input to read. Any other hunk, or a second one, does
+ * not fit an empty file and fails.
+ *
+ * returns 0 on success (a failed hunk in a dry run), non-0 on error (reported)
+ */
+int create_hunk(patch_instance_data_t* instance, hunk_t* hunk, stream_wrapper_t* out_stream, char* path);
+
+/*
+ * Takes the hunk of a file the section deletes. The file is removed unread
+ * once the section ends; with --verify-delete it is compared with the hunk
+ * first, and a file that differs fails the hunk and is kept.
+ *
+ * returns 0 on success (a failed hunk in a dry run), non-0 on a failed hunk (reported)
+ */
+int delete_hunk(patch_instance_data_t* instance, hunk_t* hunk, git_section_t* git);
+
+/*
+ * Ends the binary hunk being decoded at its empty line: the result is
+ * complete only now, so only now is the output released to replace the file.
+ * A hunk that fails drops its output, or keeps the file it was verifying.
+ *
+ * returns 0 on success (a failed hunk in a dry run), non-0 on a failed hunk (reported)
+ */
+int binary_end(patch_instance_data_t* instance, git_section_t* git, stream_wrapper_t* in_stream,
+               stream_wrapper_t* out_stream);
+
+/*
+ * Takes a line of the `GIT binary patch` of the section. It has two hunks,
+ * each a `literal` or `delta` header, base85 lines and an empty line: the
+ * first makes the new file of the old one, the second the old file of the
+ * new one. Only the hunk of the direction the patch is applied in is
+ * decoded; a delta copies from the old file, which is never written in
+ * place. A deleted file is verified, if asked to, against the other hunk,
+ * which holds the deleted content.
+ *
+ * returns 0 on success (a failed hunk in a dry run), non-0 on error (reported)
+ */
+int binary_line(patch_instance_data_t* instance, git_section_t* git, const char* line,
+                stream_wrapper_t* in_stream, stream_wrapper_t* out_stream);
+
+/*
+ * Does the file operations of a finished section, after its content, if it
+ * has any, is written. A rename whose content is unchanged, or was written
+ * in place, is a single rename; written elsewhere, the content is at the new
+ * path already and the old file is deleted. A copy without content is copied
+ * through the streams, a new file without content is created empty. A
+ * deleted file without a hunk is verified to be empty, if asked to.
+ *
+ * returns 0 on success, non-0 on error (reported)
+ */
+int git_section_finish(patch_instance_data_t* instance, git_section_t* git);
+
+#endif  /* GITSECTION_H_ */
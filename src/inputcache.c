@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inputcache.h"
+
+#define INPUT_CACHE_BUCKETS 1024   /* power of two */
+
+/* private */
+static size_t path_hash(const char* path) {
+    size_t h = 2166136261u;
+    for (; *path; ++path)
+        h = (h ^ (unsigned char)*path) * 16777619u;
+    return h;
+}
+
+/* input_cache_load:
+ *  Reads the whole file into the entry and indexes its lines.
+ *
+ * Returns 0 on success, non-0 on error
+ */
+static int input_cache_load(input_cache_t* cache, input_cache_entry_t* entry) {
+    FILE* fp = fopen(entry->path, "rb");
+    if (!fp)
+        return 1;
+
+    long size = -1;
+    if (fseek(fp, 0, SEEK_END) == 0)
+        size = ftell(fp);
+    if (size < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+        fclose(fp);
+        return 1;
+    }
+
+    char* data = malloc(size ? (size_t)size : 1);
+    if (data == NULL || fread(data, 1, (size_t)size, fp) != (size_t)size) {
+        free(data);
+        fclose(fp);
+        return 1;
+    }
+    fclose(fp);
+
+    /* the index keeps its own copy of the bytes, sized to fit at once */
+    entry->lines.flags = cache->flags;
+    int stat = (size > 0 && dynmem_resize(&entry->lines.mem, (size_t)size) != 0) ||
+               lineidx_append_text(&entry->lines, data, (size_t)size, cache->max_line) != 0 ||
+               lineidx_build_hash(&entry->lines) != 0;
+    free(data);
+    return stat;
+}
+
+/*
+ *  PUBLIC API
+ */
+
+input_cache_t* make_input_cache(unsigned int flags, size_t max_line) {
+    input_cache_t* cache = calloc(1, sizeof(input_cache_t));
+    if (cache == NULL)
+        return NULL;
+
+    cache->buckets = calloc(INPUT_CACHE_BUCKETS, sizeof(input_cache_entry_t*));
+    if (cache->buckets == NULL) {
+        free(cache);
+        return NULL;
+    }
+    cache->bucket_mask = INPUT_CACHE_BUCKETS - 1;
+    InitializeSRWLock(&cache->lock);
+    cache->flags = flags;
+    cache->max_line = max_line;
+    cache->refs = 1;
+    return cache;
+}
+
+input_cache_t* input_cache_ref(input_cache_t* cache) {
+    if (cache != NULL)
+        InterlockedIncrement(&cache->refs);
+    return cache;
+}
+
+void input_cache_unref(input_cache_t* cache) {
+    if (cache == NULL || InterlockedDecrement(&cache->refs) != 0)
+        return;
+
+    for (size_t b = 0; b <= cache->bucket_mask; ++b) {
+        input_cache_entry_t* entry = cache->buckets[b];
+        while (entry != NULL) {
+            input_cache_entry_t* next = entry->next;
+            lineidx_free(&entry->lines);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(cache->buckets);
+    free(cache);
+}
+
+const input_cache_entry_t* input_cache_get(input_cache_t* cache, const char* path) {
+    if (cache == NULL || path == NULL || strlen(path) >= INPUT_CACHE_MAX_PATH)
+        return NULL;
+
+    /* find or add the entry */
+    size_t b = path_hash(path) & cache->bucket_mask;
+    AcquireSRWLockExclusive(&cache->lock);
+    input_cache_entry_t* entry = cache->buckets[b];
+    while (entry != NULL && strcmp(entry->path, path) != 0)
+        entry = entry->next;
+    if (entry == NULL) {
+        entry = calloc(1, sizeof(input_cache_entry_t));
+        if (entry != NULL) {
+            strcpy(entry->path, path);
+            make_lineidx(&entry->lines);
+            InitializeSRWLock(&entry->load_lock);
+            entry->next = cache->buckets[b];
+            cache->buckets[b] = entry;
+        }
+    }
+    ReleaseSRWLockExclusive(&cache->lock);
+    if (entry == NULL)  /* failed to allocate */
+        return NULL;
+
+    /* load it once, the others wait on the entry lock only */
+    AcquireSRWLockExclusive(&entry->load_lock);
+    if (entry->state == 0)
+        entry->state = input_cache_load(cache, entry) == 0 ? 1 : -1;
+    int state = entry->state;
+    ReleaseSRWLockExclusive(&entry->load_lock);
+
+    return state > 0 ? entry : NULL;
+}
@@ -0,0 +1,61 @@
+#ifndef INPUTCACHE_H_
+#define INPUTCACHE_H_
+
+#include <windows.h>
+
+#include "lineidx.h"
+
+#define INPUT_CACHE_MAX_PATH 260
+
+/*
+ * One cached input file. It is loaded once, on the first request, and never
+ * changes after that, so any number of threads may read it without locking.
+ */
+typedef struct input_cache_entry {
+    char path[INPUT_CACHE_MAX_PATH];
+    lineidx_t lines;    /* the whole file, chained by hash; lines.mem holds the file bytes */
+    int state;          /* 0 not loaded yet, 1 loaded, -1 cannot be read */
+    SRWLOCK load_lock;  /* held while the file is being loaded */
+    struct input_cache_entry* next;
+} input_cache_entry_t;
+
+/*
+ * Shared read-only cache of input files, with the line indexes the patcher
+ * needs to place hunks. The cache is reference counted, the last
+ * input_cache_unref() frees it together with all its entries.
+ */
+typedef struct input_cache {
+    input_cache_entry_t** buckets;  /* entries chained by path hash */
+    size_t bucket_mask;
+    SRWLOCK lock;           /* guards the buckets */
+    unsigned int flags;     /* LINEIDX_* flags the lines are hashed with */
+    size_t max_line;        /* longest line the patcher reads, longer lines are split */
+    volatile LONG refs;
+} input_cache_t;
+
+/*
+ * Makes an empty cache holding one reference.
+ *
+ * returns pointer to the cache, NULL on allocation failure
+ */
+input_cache_t* make_input_cache(unsigned int flags, size_t max_line);
+
+/*
+ * Takes one more reference to the cache.
+ */
+input_cache_t* input_cache_ref(input_cache_t* cache);
+
+/*
+ * Drops a reference, the last one frees the cache.
+ */
+void input_cache_unref(input_cache_t* cache);
+
+/*
+ * Returns the entry of the file, loading and indexing it on the first request.
+ * Concurrent requests of the same file wait for a single load.
+ *
+ * returns the entry (valid as long as the cache), NULL if the file cannot be read
+ */
+const input_cache_entry_t* input_cache_get(input_cache_t* cache, const char* path);
+
+#endif  /* INPUTCACHE_H_ */
@@ -0,0 +1,188 @@
+#ifndef INSTANCE_H_
+#define INSTANCE_H_
+
+#include <stdio.h>
+
+#include "binpatch.h"
+#include "blobhash.h"
+#include "csw.h"
+#include "editscript.h"
+#include "lineidx.h"
+#include "patch.h"
+#include "resultcache.h"
+
+/*
+ * State of a patcher instance, shared by the units the patcher is made of:
+ * parser.c reads the patch, patch.c places and writes the hunks, gitsection.c
+ * does what the git sections ask for besides, compiled.c compiles patches
+ * and applies them compiled, and editscript.c resolves them to edit scripts
+ * and replays those.
+ */
+
+#define MAX_LINE PATCH_MAX_LINE
+#define MAX_PATH_LEN 260
+#define DEV_NULL "/dev/null"    /* the missing side of a created or deleted file */
+
+typedef struct patch_options {
+    unsigned int inplace : 1;
+    unsigned int apply_dates : 1;
+    unsigned int verbose : 1;
+    unsigned int ignore_whitespace : 1;
+    unsigned int ignore_eol : 1;
+    unsigned int reverse : 1;
+    unsigned int dry_run : 1;
+    unsigned int unordered : 1;
+    unsigned int eol_preserve : 1;
+    unsigned int eol_lf : 1;
+    unsigned int eol_crlf : 1;
+    unsigned int verify_delete : 1;
+    unsigned int verify_index : 1;
+    unsigned int stream : 1;
+} patch_options_t;
+
+/* One hunk of a unified diff, collected from the patch before it is applied */
+typedef struct hunk {
+    int number;         /* 1-based number of the hunk within its file */
+    int start_old;
+    int len_old;
+    int start_new;
+    int len_new;
+    int proc_old;       /* how many old (input) lines collected */
+    int proc_new;       /* how many new (output) lines collected */
+    lineidx_t lines;    /* hunk lines without the leading ' ', '+' or '-' */
+    char* kinds;        /* leading char of every line in `lines` */
+    size_t kinds_capacity;
+
+    unsigned int status;    /* PATCH_HUNK_* once placed */
+    int line;           /* input line of the first old line, the line it was expected at if it failed */
+    int head, tail;     /* outer context lines dropped by fuzz */
+} hunk_t;
+
+/* Edit script being resolved, see patch_resolve(). The output streams are
+ * null streams, what would be written to them is recorded as spans. */
+typedef struct script_builder {
+    dynmem_t files;
+    dynmem_t spans;
+    dynmem_t payload;
+    uint32_t file_count;
+    uint64_t span_count;
+    int failed;             /* out of memory, the tables are incomplete */
+    edit_file_t file;       /* file whose output is open */
+    char in_hash[RESULT_CACHE_HASH];    /* input acquired for the next output, in_path "" if none */
+    char in_path[MAX_PATH_LEN];
+    long in_size;
+} script_builder_t;
+
+/* Input of the file being patched. Lines are streamed from the input stream
+ * and only those a hunk may be placed on are buffered, unless the user
+ * provides a ready index of the whole input along with the stream. */
+typedef struct patch_input {
+    lineidx_t buffer;   /* input lines read from the stream */
+    const lineidx_t* lines; /* `buffer` or the user's index, lines[0] is input line `base_line` */
+    int shared;         /* `lines` is the user's index, the stream is not read */
+    int base_line;
+    int cur_line;       /* next input line to write out (1-based) */
+    int offset;         /* offset the last hunk was applied at, expected for the next one */
+    int indexed;        /* whole remainder of the input is buffered and chained by hash */
+    int hunks;          /* hunks placed on this input so far */
+    int already_applied;    /* how many of them were found already applied */
+    int inplace;        /* the output is written into the input file, see output_copy() */
+    long in_bytes;      /* input bytes in front of cur_line */
+    long out_bytes;     /* output bytes written or kept so far */
+    const char* eol;    /* "\n" or "\r\n" added lines are written with, NULL: as they come */
+    int convert;        /* copied lines get `eol` too, see output_copy() */
+    int detect_eol;     /* `eol` is taken from the first input line that has one */
+    long in_size;       /* size of the input, known only if it is hashed or the output size is told */
+    int collect;        /* the hunks wait for the end of the file, see index_begin() */
+    int out_pending;    /* the output is acquired once the hunks are collected, see output_open() */
+    int replay;         /* the hunks were placed by inplace_check() already, they are not reported again */
+    char out_path[MAX_PATH_LEN];
+    blobhash_t in_hash; /* blob hash of the input as it is read, kinds 0 if not verified */
+    blobhash_t out_hash;    /* ... of the output as it is written */
+    int cache;          /* the output is looked up in the result cache, see cache_lookup() */
+    FILE* cache_fp;     /* new cache entry the output is written to as well, NULL if none */
+    int cache_failed;   /* ... and it could not take all of it */
+    char cache_path[RESULT_CACHE_MAX_PATH];  /* where the entry goes once complete */
+    char cache_temp[RESULT_CACHE_MAX_PATH];  /* ... and where it is written until then */
+    script_builder_t* script;   /* edit script the output is recorded to, NULL if none */
+} patch_input_t;
+
+typedef struct patch_parser patch_parser_t;     /* see parser.h */
+typedef struct git_section git_section_t;       /* see gitsection.h */
+
+typedef struct patch_instance_data {
+    patch_options_t options;
+    patch_event_cbk_t* path_cbk;
+    void* path_cbk_userdata;
+    unsigned int fuzz;  /* how many outer context lines a hunk may lose */
+    hunk_t hunk;        /* hunk being collected, reused between hunks */
+    hunk_t* pending;    /* hunks of the current file, collected to be applied in line order */
+    size_t pending_count;
+    size_t pending_capacity;
+    patch_input_t input;
+    binpatch_t binary;  /* decoder of the GIT binary patch hunk being read */
+    char* cache_dir;    /* directory of the result cache, NULL if none */
+    script_builder_t* script;   /* edit script being resolved, NULL when patching */
+    int hunks_failed;   /* failed hunks in the current apply_patch() call */
+    patch_parser_t* parser;     /* patch being fed, NULL if none, see patch_feed() */
+    char output_path[MAX_PATH_LEN];     /* path and purpose the last output was acquired with, */
+    unsigned int output_purpose;        /* to discard it if the patch ends on an error */
+
+    patch_hunk_result_t* results;   /* every hunk of the current apply_patch() call */
+    size_t result_count;
+    size_t result_capacity;
+} patch_instance_data_t;
+
+/* images of a hunk, see hunk_in_image() */
+#define HUNK_PRE_IMAGE  0
+#define HUNK_POST_IMAGE 1
+
+/* patch.c, for the other units of the patcher */
+int patch_call_user_cbk(patch_instance_data_t* instance, patch_evt_t* evt);
+int patch_acquire_user_stream(patch_instance_data_t* instance, char* path, stream_wrapper_t* sw_ptr, unsigned int purpose,
+                              const lineidx_t** index, long size);
+int patch_release_user_stream(patch_instance_data_t* instance, char* path, stream_wrapper_t* sw_ptr, unsigned int purpose);
+int patch_discard_user_stream(patch_instance_data_t* instance, char* path, stream_wrapper_t* sw_ptr,
+                              unsigned int purpose);
+char* sw_fgets(stream_wrapper_t* sw, char* line, int maxlen);
+int write_span(stream_wrapper_t* out_stream, const char* data, size_t length);
+uint64_t table_put(dynmem_t* table, const void* data, size_t length, int* failed);
+void trim_newline(char* line);
+const char* parse_header_filename(const char* p, char* out_fname, size_t out_len);
+int header_is_epoch(const char* p);
+size_t line_eol_length(const char* line, size_t length);
+size_t eol_converted_length(const char* line, size_t length, const char* eol);
+int stream_blob_hash(stream_wrapper_t* sw, char* hex, long* size_out);
+int output_insert(patch_input_t* input, stream_wrapper_t* out_stream, const char* data, size_t length);
+void hunk_reset(hunk_t* hunk);
+void hunk_free(hunk_t* hunk);
+int hunk_add_line(hunk_t* hunk, const char* line);
+int hunk_add_hashed_line(hunk_t* hunk, char kind, const char* text, size_t length, uint64_t hash);
+void hunk_no_newline(hunk_t* hunk);
+int hunk_in_image(const hunk_t* hunk, size_t i, int image);
+int hunk_patch_line(const hunk_t* hunk);
+void report_hunk(patch_instance_data_t* instance, char* path, const hunk_t* hunk);
+int begin_file(patch_instance_data_t* instance, char* orig_file, char* new_file, int allow_inplace,
+               stream_wrapper_t* input_stream);
+int finalize_file(patch_instance_data_t* instance, stream_wrapper_t* in_stream, stream_wrapper_t* out_stream,
+                  char* in_path, char* out_path);
+void cache_end(patch_instance_data_t* instance, int keep);
+int open_section(patch_instance_data_t* instance, git_section_t* git, char* orig_file, char* new_file,
+                 const long* growth, int* creating, stream_wrapper_t* in_stream, stream_wrapper_t* out_stream);
+hunk_t* section_hunk(patch_instance_data_t* instance, const git_section_t* git, int creating,
+                     const stream_wrapper_t* in_stream, const stream_wrapper_t* out_stream, int number);
+int take_hunk(patch_instance_data_t* instance, hunk_t* hunk, git_section_t* git, int creating,
+              stream_wrapper_t* in_stream, stream_wrapper_t* out_stream, char* path);
+
+/* compiled.c, for the edit scripts laid out as compiled patches are */
+int compiled_table_fits(uint64_t offset, uint64_t count, size_t entry, size_t size);
+int compiled_string_fits(const char* payload, uint64_t payload_size, uint64_t offset);
+
+/* editscript.c, for the output code of patch.c */
+void script_span(script_builder_t* script, uint32_t kind, uint64_t offset, uint64_t length);
+void script_line(script_builder_t* script, const char* data, size_t length, const char* eol);
+int script_input(script_builder_t* script, const char* path, stream_wrapper_t* sw);
+int script_file_begin(patch_instance_data_t* instance, const char* path, stream_wrapper_t* sw);
+int script_file_end(patch_instance_data_t* instance, stream_wrapper_t* sw);
+
+#endif  /* INSTANCE_H_ */
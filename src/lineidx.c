@@ -0,0 +1,323 @@
+#include <stdlib.h> /* for realloc() */
+#include <string.h> /* for memcpy, memcmp */
+
+#include "lineidx.h"
+
+#define LINEIDX_MIN_LINES 64
+#define LINEIDX_MIN_BYTES 4096
+
+#define HASH_SEED  0xcbf29ce484222325ULL
+#define HASH_MULT  0x9e3779b97f4a7c15ULL
+#define BYTES_ONES 0x0101010101010101ULL
+#define BYTES_HIGH 0x8080808080808080ULL
+
+/* Strip the EOL that terminates the line, it is not a part of the content */
+static size_t line_content_length(const char* line, size_t length, unsigned int flags) {
+    if (length > 0 && line[length - 1] == '\n')
+        --length;
+    if ((flags & LINEIDX_IGNORE_EOL) && length > 0 && line[length - 1] == '\r')
+        --length;
+    return length;
+}
+
+/* Blanks folded by LINEIDX_IGNORE_WHITESPACE */
+static int is_blank(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/* Non-0 if any byte of the word is below 0x21, i.e. the word may hold a blank */
+static uint64_t word_has_low_byte(uint64_t w) {
+    return (w - BYTES_ONES * 0x21) & ~w & BYTES_HIGH;
+}
+
+/* Loads 8 bytes, first byte lowest, whatever the byte order of the machine */
+static uint64_t load_word(const char* p) {
+    const unsigned char* u = (const unsigned char*)p;
+    return (uint64_t)u[0] | (uint64_t)u[1] << 8 | (uint64_t)u[2] << 16 | (uint64_t)u[3] << 24 |
+           (uint64_t)u[4] << 32 | (uint64_t)u[5] << 40 | (uint64_t)u[6] << 48 | (uint64_t)u[7] << 56;
+}
+
+static uint64_t hash_mix(uint64_t h, uint64_t w) {
+    h = (h ^ w) * HASH_MULT;
+    return h ^ (h >> 32);
+}
+
+/*
+ * Hash of the line with blank runs folded. The folded bytes are gathered into
+ * 8-byte words and mixed a word at a time. Words that hold no byte below 0x21
+ * have nothing to fold and go to the hash whole, shifted into the pending bytes.
+ */
+static uint64_t line_hash_folded(const char* line, size_t length) {
+    uint64_t h = HASH_SEED;
+    uint64_t pending = 0;       /* folded bytes not mixed in yet, first byte lowest */
+    unsigned int fill = 0;      /* number of pending bytes */
+    uint64_t total = 0;         /* folded length */
+    int blank = 0;              /* blank run seen, folded into ' ' once followed by content */
+
+#define FOLD_PUT(byte)                                   \
+    do {                                                 \
+        pending |= (uint64_t)(byte) << (8 * fill);       \
+        ++total;                                         \
+        if (++fill == 8) {                               \
+            h = hash_mix(h, pending);                    \
+            pending = 0;                                 \
+            fill = 0;                                    \
+        }                                                \
+    } while (0)
+
+    size_t i = 0;
+    while (i < length) {
+        if (!blank && i + 8 <= length) {
+            uint64_t w = load_word(line + i);
+            if (!word_has_low_byte(w)) {
+                if (fill == 0) {
+                    h = hash_mix(h, w);
+                } else {
+                    h = hash_mix(h, pending | (w << (8 * fill)));
+                    pending = w >> (64 - 8 * fill);
+                }
+                total += 8;
+                i += 8;
+                continue;
+            }
+        }
+
+        unsigned char c = (unsigned char)line[i++];
+        if (is_blank(c)) {
+            blank = 1;
+            continue;
+        }
+        if (blank) {
+            FOLD_PUT(' ');
+            blank = 0;
+        }
+        FOLD_PUT(c);
+    }
+#undef FOLD_PUT
+
+    if (fill > 0)
+        h = hash_mix(h, pending);
+    h = hash_mix(h, total);
+    h ^= h >> 29;
+    return h;
+}
+
+/* Compares two lines with blank runs folded, see line_hash_folded() */
+static int line_equal_folded(const char* a, size_t alen, const char* b, size_t blen) {
+    size_t i = 0, j = 0;
+    for (;;) {
+        int a_blank = i < alen && is_blank((unsigned char)a[i]);
+        int b_blank = j < blen && is_blank((unsigned char)b[j]);
+        if (a_blank || b_blank) {
+            while (i < alen && is_blank((unsigned char)a[i]))
+                ++i;
+            while (j < blen && is_blank((unsigned char)b[j]))
+                ++j;
+            if (i == alen || j == blen)
+                return i == alen && j == blen;  /* trailing blanks do not count */
+            if (!a_blank || !b_blank)
+                return 0;
+            continue;
+        }
+        if (i == alen || j == blen)
+            return i == alen && j == blen;
+        if (a[i++] != b[j++])
+            return 0;
+    }
+}
+
+/*
+ *  PUBLIC API
+ */
+
+long make_lineidx(lineidx_t* idx) {
+    if (idx == NULL)
+        return -1;
+
+    memset(idx, 0, sizeof(lineidx_t));
+    return make_dynmem(&idx->mem, 0, 0);
+}
+
+long lineidx_free(lineidx_t* idx) {
+    if (idx == NULL)
+        return -1;
+
+    dynmem_free(&idx->mem);
+    free(idx->lines);
+    free(idx->buckets);
+    free(idx->chain);
+    free(idx->bucket_sizes);
+    memset(idx, 0, sizeof(lineidx_t));
+    return 0;
+}
+
+long lineidx_clear(lineidx_t* idx) {
+    if (idx == NULL)
+        return -1;
+
+    idx->mem.readpos = 0;
+    idx->mem.writepos = 0;
+    idx->count = 0;
+    idx->bucket_mask = 0;
+    return 0;
+}
+
+long lineidx_append(lineidx_t* idx, const char* line, size_t length) {
+    if (idx == NULL || line == NULL)
+        return -1;
+    return lineidx_append_hashed(idx, line, length, line_hash(line, length, idx->flags));
+}
+
+long lineidx_append_hashed(lineidx_t* idx, const char* line, size_t length, uint64_t hash) {
+    if (idx == NULL || line == NULL)
+        return -1;
+
+    /* Grow geometrically, dynmem_write itself only grows to the exact size */
+    if (idx->mem.writepos + length > idx->mem.size) {
+        size_t new_size = idx->mem.size ? idx->mem.size * 2 : LINEIDX_MIN_BYTES;
+        while (new_size < idx->mem.writepos + length)
+            new_size *= 2;
+        if (dynmem_resize(&idx->mem, new_size) != 0)
+            return -1;
+    }
+
+    if (idx->count == idx->capacity) {
+        size_t new_capacity = idx->capacity ? idx->capacity * 2 : LINEIDX_MIN_LINES;
+        line_ref_t* new_lines = realloc(idx->lines, new_capacity * sizeof(line_ref_t));
+        if (new_lines == NULL) /* failed to allocate */
+            return -1;
+        idx->lines = new_lines;
+        idx->capacity = new_capacity;
+    }
+
+    line_ref_t* ref = &idx->lines[idx->count];
+    ref->offset = idx->mem.writepos;
+    ref->length = length;
+    ref->hash = hash;
+
+    if (length > 0 && dynmem_write(&idx->mem, line, 1, length) < 0)
+        return -1;
+
+    ++idx->count;
+    return 0;
+}
+
+long lineidx_append_text(lineidx_t* idx, const char* text, size_t length, size_t max_line) {
+    if (idx == NULL || (text == NULL && length > 0) || max_line < 2)
+        return -1;
+
+    size_t pos = 0;
+    while (pos < length) {
+        size_t limit = length - pos < max_line - 1 ? length - pos : max_line - 1;
+        size_t end = 0;
+        while (end < limit && text[pos + end] != '\n' && text[pos + end] != '\r')
+            ++end;
+        if (end < limit) {
+            /* take the EOL: "\n", "\r\n" or a lone "\r" */
+            if (text[pos + end++] == '\r' && end < limit && text[pos + end] == '\n')
+                ++end;
+        }
+        if (lineidx_append(idx, text + pos, end) != 0)
+            return -1;
+        pos += end;
+    }
+    return 0;
+}
+
+const char* lineidx_text(const lineidx_t* idx, size_t n) {
+    if (idx == NULL || n >= idx->count)
+        return NULL;
+    return idx->mem.buf + idx->lines[n].offset;
+}
+
+long lineidx_build_hash(lineidx_t* idx) {
+    if (idx == NULL)
+        return -1;
+
+    /* Power of two bucket count, about two buckets per line */
+    size_t bucket_count = 16;
+    while (bucket_count < idx->count * 2)
+        bucket_count *= 2;
+
+    size_t* buckets = realloc(idx->buckets, bucket_count * sizeof(size_t));
+    if (buckets == NULL)
+        return -1;
+    idx->buckets = buckets;
+
+    size_t* sizes = realloc(idx->bucket_sizes, bucket_count * sizeof(size_t));
+    if (sizes == NULL)
+        return -1;
+    idx->bucket_sizes = sizes;
+
+    size_t* chain = realloc(idx->chain, (idx->count ? idx->count : 1) * sizeof(size_t));
+    if (chain == NULL)
+        return -1;
+    idx->chain = chain;
+
+    for (size_t b = 0; b < bucket_count; ++b) {
+        buckets[b] = LINEIDX_NONE;
+        sizes[b] = 0;
+    }
+
+    /* Insert from the last line, so every chain lists its lines in ascending order */
+    size_t mask = bucket_count - 1;
+    for (size_t n = idx->count; n-- > 0;) {
+        size_t b = (size_t)idx->lines[n].hash & mask;
+        chain[n] = buckets[b];
+        buckets[b] = n;
+        ++sizes[b];
+    }
+
+    idx->bucket_mask = mask;
+    return 0;
+}
+
+size_t lineidx_first(const lineidx_t* idx, uint64_t hash) {
+    if (idx == NULL || idx->bucket_mask == 0)
+        return LINEIDX_NONE;
+    return idx->buckets[(size_t)hash & idx->bucket_mask];
+}
+
+size_t lineidx_next(const lineidx_t* idx, size_t n) {
+    if (idx == NULL || idx->bucket_mask == 0 || n >= idx->count)
+        return LINEIDX_NONE;
+    return idx->chain[n];
+}
+
+size_t lineidx_chain_length(const lineidx_t* idx, uint64_t hash) {
+    if (idx == NULL || idx->bucket_mask == 0)
+        return 0;
+    return idx->bucket_sizes[(size_t)hash & idx->bucket_mask];
+}
+
+uint64_t line_hash(const char* line, size_t length, unsigned int flags) {
+    length = line_content_length(line, length, flags);
+    if (flags & LINEIDX_IGNORE_WHITESPACE)
+        return line_hash_folded(line, length);
+
+    /* Word-at-a-time multiplicative hash; 8 bytes per step keeps it memory bound */
+    uint64_t h = HASH_SEED ^ (uint64_t)length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t w;
+        memcpy(&w, line + i, sizeof(w));
+        h = hash_mix(h, w);
+    }
+    for (; i < length; ++i) {
+        h = (h ^ (unsigned char)line[i]) * 0x100000001b3ULL;
+    }
+    h ^= h >> 29;
+    return h;
+}
+
+int line_equal(const char* a, size_t alen, uint64_t ahash, const char* b, size_t blen, uint64_t bhash,
+               unsigned int flags) {
+    if (ahash != bhash)
+        return 0;
+
+    alen = line_content_length(a, alen, flags);
+    blen = line_content_length(b, blen, flags);
+    if (flags & LINEIDX_IGNORE_WHITESPACE)
+        return line_equal_folded(a, alen, b, blen);
+    return alen == blen && memcmp(a, b, alen) == 0;
+}
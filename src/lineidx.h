@@ -0,0 +1,135 @@
+#ifndef LINEIDX_H_
+#define LINEIDX_H_
+
+#include <stdint.h>
+
+#include "dynmem.h"
+
+typedef struct line_ref_ {
+    size_t offset;  /* byte offset of the line in the index buffer */
+    size_t length;  /* line length in bytes, EOL included */
+    uint64_t hash;  /* line_hash() of the line */
+} line_ref_t;
+
+#define LINEIDX_NONE ((size_t)-1)
+
+/* Matching flags, see line_hash() */
+#define LINEIDX_IGNORE_EOL        0x1
+#define LINEIDX_IGNORE_WHITESPACE 0x2
+
+/*
+ * Sequence of text lines stored back to back in one buffer.
+ * Every line carries its hash, so two lines are compared with a single
+ * integer compare in the common (mismatching) case.
+ *
+ * lineidx_build_hash() additionally chains the lines by hash, so all lines
+ * with a given content are found without scanning the whole sequence.
+ */
+typedef struct lineidx_ {
+    dynmem_t mem;
+    line_ref_t* lines;
+    size_t count;
+    size_t capacity;
+
+    size_t* buckets;        /* first line of every hash bucket, LINEIDX_NONE if empty */
+    size_t* chain;          /* next line in the same bucket, in ascending order */
+    size_t* bucket_sizes;   /* number of lines in every bucket */
+    size_t bucket_mask;     /* bucket count - 1, 0 when the hash chains are not built */
+
+    unsigned int flags;     /* LINEIDX_IGNORE_* the lines are hashed with, kept by lineidx_clear() */
+} lineidx_t;
+
+/*
+ * Makes an empty line index. Memory is allocated on first append.
+ */
+long make_lineidx(lineidx_t* idx);
+
+/*
+ * Deallocates the memory, the index becomes empty.
+ */
+long lineidx_free(lineidx_t* idx);
+
+/*
+ * Drops all lines but keeps the allocated memory for reuse.
+ */
+long lineidx_clear(lineidx_t* idx);
+
+/*
+ * Appends a copy of the line (EOL included) and computes its hash with the
+ * flags of the index. The copy keeps the original bytes, the flags only affect
+ * the hash and comparison.
+ *
+ * returns 0 on success, non-0 on error
+ */
+long lineidx_append(lineidx_t* idx, const char* line, size_t length);
+
+/*
+ * Appends a copy of the line with its hash computed ahead, line_hash() of the
+ * line with the flags of the index.
+ *
+ * returns 0 on success, non-0 on error
+ */
+long lineidx_append_hashed(lineidx_t* idx, const char* line, size_t length, uint64_t hash);
+
+/*
+ * Splits the text into lines and appends them. Lines end after "\n", "\r\n"
+ * or a lone "\r"; longer lines are cut every `max_line - 1` bytes. This is how
+ * the patcher reads its input line by line, so the line numbers agree.
+ *
+ * returns 0 on success, non-0 on error
+ */
+long lineidx_append_text(lineidx_t* idx, const char* text, size_t length, size_t max_line);
+
+/*
+ * Returns pointer to the text of the n-th line (0-based), not NUL terminated.
+ */
+const char* lineidx_text(const lineidx_t* idx, size_t n);
+
+/*
+ * Chains all lines currently in the index by their hash. Lines appended later
+ * are not chained until the next call.
+ *
+ * returns 0 on success, non-0 on error
+ */
+long lineidx_build_hash(lineidx_t* idx);
+
+/*
+ * Walks the lines that may have the given hash, in ascending order:
+ *
+ *  for (size_t n = lineidx_first(idx, h); n != LINEIDX_NONE; n = lineidx_next(idx, n))
+ *      if (idx->lines[n].hash == h) ...
+ *
+ * Lines of other hashes sharing the bucket are walked too.
+ */
+size_t lineidx_first(const lineidx_t* idx, uint64_t hash);
+size_t lineidx_next(const lineidx_t* idx, size_t n);
+
+/*
+ * Returns the length of the chain lineidx_first() starts for the hash,
+ * cheap way to tell rare lines from common ones.
+ */
+size_t lineidx_chain_length(const lineidx_t* idx, uint64_t hash);
+
+/*
+ * Hash of the line content. The trailing '\n' does not take part, so the last
+ * line of a file that lacks the final newline hashes the same as its patch line.
+ *
+ * flags:
+ *  LINEIDX_IGNORE_EOL - a '\r' in front of the '\n' does not take part either
+ *  LINEIDX_IGNORE_WHITESPACE - every run of blanks (space, tab, '\r', '\v', '\f')
+ *      counts as a single space, trailing blanks do not count at all
+ *
+ * The line is normalized on the fly, no normalized copy is made.
+ */
+uint64_t line_hash(const char* line, size_t length, unsigned int flags);
+
+/*
+ * Compares two lines by content (see line_hash() on what is content).
+ * Both hashes must have been computed with the same flags.
+ *
+ * returns non-0 if the lines are equal
+ */
+int line_equal(const char* a, size_t alen, uint64_t ahash, const char* b, size_t blen, uint64_t bhash,
+               unsigned int flags);
+
+#endif  /* LINEIDX_H_ */
@@ -1,31 +1,556 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "compiled.h"
+#include "editscript.h"
 #include "patch.h"
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define dup _dup
+#define dup2 _dup2
+#define fdopen _fdopen
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+
+/* Reads the non-negative number of option argv[*i] ("--opt N" or "--opt=N")
+ *
+ * returns 0 on success, non-0 on a missing or invalid number
+ */
+static int parse_count(int argc, char** argv, int* i, size_t name_len, unsigned int* out) {
+    const char* value = argv[*i][name_len] == '=' ? argv[*i] + name_len + 1 : (*i + 1 < argc ? argv[++*i] : NULL);
+    char* end = NULL;
+    long n = value ? strtol(value, &end, 10) : -1;
+    if (!value || end == value || *end != '\0' || n < 0) {
+        fprintf(stderr, "%.*s expects a non-negative number\n", (int)name_len, argv[*i]);
+        return 1;
+    }
+    *out = (unsigned int)n;
+    return 0;
+}
+
+/* Reads the EOL policy of option argv[*i] ("--eol P" or "--eol=P") into the options
+ *
+ * returns 0 on success, non-0 on a missing or unknown policy
+ */
+static int parse_eol(int argc, char** argv, int* i, unsigned int* options) {
+    const char* value = argv[*i][5] == '=' ? argv[*i] + 6 : (*i + 1 < argc ? argv[++*i] : NULL);
+    unsigned int policy = 0;
+    if (value && strcmp(value, "preserve") == 0)
+        policy = PATCH_OPTION_EOL_PRESERVE;
+    else if (value && strcmp(value, "lf") == 0)
+        policy = PATCH_OPTION_EOL_LF;
+    else if (value && strcmp(value, "crlf") == 0)
+        policy = PATCH_OPTION_EOL_CRLF;
+    if (policy == 0) {
+        fprintf(stderr, "--eol expects preserve, lf or crlf\n");
+        return 1;
+    }
+    *options = (*options & ~(PATCH_OPTION_EOL_PRESERVE | PATCH_OPTION_EOL_LF | PATCH_OPTION_EOL_CRLF)) | policy;
+    return 0;
+}
+
+/* Checks several patches at once, prints one line per patch:
+ * patch, status, hunks that apply, hunks applied already, hunks that fail */
+static int check_many(const char** patchfiles, size_t count, unsigned int options, unsigned int fuzz,
+                      unsigned int jobs) {
+    patch_check_result_t* results = calloc(count, sizeof(patch_check_result_t));
+    if (results == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    int stat = patch_check_many(patchfiles, count, options, fuzz, jobs, results);
+    for (size_t i = 0; i < count && stat >= 0; ++i) {
+        const patch_check_result_t* r = &results[i];
+        const char* status = r->status == PATCH_CHECK_OK ? "ok" : r->status == PATCH_CHECK_FAILED ? "FAILED" : "error";
+        printf("%s\t%s\t%zu\t%zu\t%zu\n", patchfiles[i], status, r->hunks_ok, r->hunks_applied, r->hunks_failed);
+    }
+
+    free(results);
+    return stat == 0 ? 0 : 1;
+}
+
+/* Prints the pairs of patches that change the same lines: first patch, second patch, file */
+static int find_conflicts(const char** patchfiles, size_t count, unsigned int options) {
+    patch_conflict_t* conflicts = NULL;
+    size_t conflict_count = 0;
+    if (patch_find_conflicts(patchfiles, count, options, &conflicts, &conflict_count) != 0)
+        return 1;
+
+    for (size_t i = 0; i < conflict_count; ++i) {
+        const patch_conflict_t* c = &conflicts[i];
+        printf("%s\t%s\t%s\n", patchfiles[c->first], patchfiles[c->second], c->path);
+    }
+
+    free(conflicts);
+    return conflict_count > 0 ? 1 : 0;
+}
+
+/* Writes the composition of two patches to stdout */
+static int compose(const char** patchfiles, size_t count) {
+    if (count != 2) {
+        fprintf(stderr, "--compose takes exactly two patch files\n");
+        return 1;
+    }
+
+    stream_wrapper_t out_sw = {0};
+    make_fdsw(&out_sw, stdout);
+    int stat = patch_compose(patchfiles[0], patchfiles[1], &out_sw);
+    fflush(stdout);
+    return stat == 0 ? 0 : 1;
+}
+
+/* Compiles the patch file into `out_path`, see patch_compile() */
+static int compile(const char* patchfile, const char* out_path, unsigned int options) {
+    FILE* fp = fopen(patchfile, "rb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open %s\n", patchfile);
+        return 1;
+    }
+    FILE* out = fopen(out_path, "wb");
+    if (!out) {
+        fprintf(stderr, "Cannot create %s\n", out_path);
+        fclose(fp);
+        return 1;
+    }
+
+    stream_wrapper_t file_sw = {0};
+    stream_wrapper_t out_sw = {0};
+    make_fdsw(&file_sw, fp);
+    make_fdsw(&out_sw, out);
+    int stat = patch_compile(&file_sw, options, &out_sw);
+    if (out_sw.close(&out_sw) != 0 && stat == 0) {
+        fprintf(stderr, "Write error while writing %s\n", out_path);
+        stat = 1;
+    }
+    if (stat != 0)
+        remove(out_path);   /* not a compiled patch anything could apply */
+    return stat;
+}
+
+/* Resolves the patch file into an edit script at `out_path`, see patch_resolve() */
+static int resolve(void* patcher, stream_wrapper_t* file_sw, const char* out_path) {
+    FILE* out = fopen(out_path, "wb");
+    if (!out) {
+        fprintf(stderr, "Cannot create %s\n", out_path);
+        file_sw->close(file_sw);
+        return 1;
+    }
+
+    stream_wrapper_t out_sw = {0};
+    make_fdsw(&out_sw, out);
+    int stat = patch_resolve(patcher, file_sw, &out_sw);
+    if (out_sw.close(&out_sw) != 0 && stat == 0) {
+        fprintf(stderr, "Write error while writing %s\n", out_path);
+        stat = 1;
+    }
+    if (stat != 0)
+        remove(out_path);   /* not an edit script anything could replay */
+    return stat;
+}
+
+/* The one input and the one output of the filter mode (--stdout) */
+typedef struct filter {
+    FILE* input;        /* the file to patch, NULL to open the path the patch names */
+    FILE* output;       /* stdout, taken over from the messages */
+    int outputs;        /* outputs acquired so far */
+} filter_t;
+
+/* filter_evt_cbk:
+ *  The input is the file given, or the path the patch names if none is; the
+ *  output is stdout. A patch of more than one file, or one that renames or
+ *  deletes a file, is refused. Each stream closes its FILE when released.
+ */
+static int filter_evt_cbk(patch_evt_t* evt) {
+    if (evt == NULL || evt->userdata == NULL)   /* Invalid evt or userdata */
+        return -1;
+    filter_t* filter = (filter_t*)evt->userdata;
+
+    switch (evt->type) {
+    case PATCH_EVT_HUNK_RESULT:
+        return default_patch_evt_cbk(evt);
+    case PATCH_EVT_FILE_MODE:
+        return 0;   /* a stream has no permission bits */
+    case PATCH_EVT_FILE_RENAME:
+    case PATCH_EVT_FILE_DELETE:
+        fprintf(stderr, "--stdout cannot rename or delete %s\n", evt->data.file_event.path);
+        return -1;
+    case PATCH_EVT_STREAM_ACQUIRE: {
+        stream_wrapper_t* sw = evt->data.stream_event.stream;
+        FILE* fp;
+        if (evt->data.stream_event.purpose == PATCH_STREAM_PURPOSE_INPUT) {
+            fp = filter->input != NULL ? filter->input : fopen(evt->data.stream_event.path, "rb");
+            filter->input = NULL;
+        } else if (filter->outputs++ == 0) {
+            fp = filter->output;
+            filter->output = NULL;
+        } else {
+            fprintf(stderr, "--stdout takes a patch of one file, %s is another\n", evt->data.stream_event.path);
+            return -1;
+        }
+        return make_fdsw(sw, fp);
+    }
+    case PATCH_EVT_STREAM_RELEASE:
+        return evt->data.stream_event.stream->close(evt->data.stream_event.stream) == 0 ? 0 : -1;
+    }
+    return -1;  /* Unknown event */
+}
+
+/* Takes stdout over for the patched file: the messages printed to stdout go to stderr from now on, so
+ * they do not mix into it
+ *
+ * returns the stream the patched file is written to, NULL on error
+ */
+static FILE* take_stdout(void) {
+    fflush(stdout);
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    int fd = dup(fileno(stdout));
+    FILE* out = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (out == NULL || dup2(fileno(stderr), fileno(stdout)) < 0) {
+        if (out != NULL)
+            fclose(out);
+        return NULL;
+    }
+    return out;
+}
+
+/* Applies a patch of one file as a filter, see PATCH_OPTION_STREAM: the patch is read from `patchfile`, or
+ * stdin if it is "-"; the file to patch from fd `input_fd` if not -1, else from `input_path`, else from stdin
+ * unless the patch comes from there, else from the path the patch names. The patched file goes to stdout. */
+static int filter(const char* patchfile, const char* input_path, int input_fd, unsigned int options,
+                  unsigned int fuzz) {
+    int patch_stdin = strcmp(patchfile, "-") == 0;
+    int input_stdin = input_fd < 0 && (input_path != NULL ? strcmp(input_path, "-") == 0 : !patch_stdin);
+    if (patch_stdin && input_stdin) {
+        fprintf(stderr, "--stdout cannot read both the patch and the file to patch from stdin\n");
+        return 1;
+    }
+
+    filter_t filter = { 0 };
+    if (input_fd >= 0)
+        filter.input = fdopen(input_fd, "rb");
+    else if (input_stdin)
+        filter.input = stdin;
+    else if (input_path != NULL)
+        filter.input = fopen(input_path, "rb");
+    if ((input_fd >= 0 || input_path != NULL || input_stdin) && filter.input == NULL) {
+        fprintf(stderr, "Cannot open %s\n", input_fd >= 0 ? "the input fd" : input_path ? input_path : "stdin");
+        return 1;
+    }
+    FILE* fp = patch_stdin ? stdin : fopen(patchfile, "rb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open %s\n", patchfile);
+        if (filter.input != NULL)
+            fclose(filter.input);
+        return 1;
+    }
+    filter.output = take_stdout();
+
+    void* patcher = filter.output != NULL ? patch_init() : NULL;
+    if (patcher == NULL) {
+        fprintf(stderr, "Cannot take stdout over for the patched file\n");
+        fclose(fp);
+        if (filter.input != NULL)
+            fclose(filter.input);
+        if (filter.output != NULL)
+            fclose(filter.output);
+        return 1;
+    }
+    patch_set_options(patcher, options | PATCH_OPTION_STREAM);
+    patch_set_fuzz(patcher, fuzz);
+    patch_set_path_cbk(patcher, &filter_evt_cbk, &filter);
+
+    stream_wrapper_t file_sw = {0};
+    make_fdsw(&file_sw, fp);
+    int stat = apply_patch(patcher, &file_sw);
+    patch_destroy(patcher);
+
+    /* streams the patch did not ask for */
+    if (filter.input != NULL)
+        fclose(filter.input);
+    if (filter.output != NULL)
+        fclose(filter.output);
+    return stat;
+}
+
+/* The patch file, with the bytes read_compiled() read to tell its format put
+ * back in front: a diff is read from its first byte, and the file, which may
+ * be a pipe, is never seeked */
+typedef struct patch_file {
+    FILE* fp;
+    char head[sizeof(COMPILED_MAGIC) - 1];
+    size_t head_length;
+    size_t head_read;   /* ... of them read again so far */
+} patch_file_t;
+
+static long patch_file_read(void* self, char* data, size_t element_size, size_t count) {
+    stream_wrapper_t* sw = (stream_wrapper_t*)self;
+    patch_file_t* file = (patch_file_t*)sw->_impl;
+    if (file == NULL || element_size != 1)
+        return -1;
+
+    size_t got = 0;
+    while (got < count && file->head_read < file->head_length)
+        data[got++] = file->head[file->head_read++];
+    got += fread(data + got, 1, count - got, file->fp);
+    if (got < count && ferror(file->fp))
+        return -1;
+    sw->read_pos += (long)got;
+    return (long)got;
+}
+
+static long patch_file_write(void* self, char* data, size_t element_size, size_t count) {
+    (void)self;
+    (void)data;
+    (void)element_size;
+    (void)count;
+    return -1;  /* read only */
+}
+
+static long patch_file_seek(void* self, size_t pos, int whence) {
+    (void)self;
+    (void)pos;
+    (void)whence;
+    return -1;  /* read once, front to back */
+}
+
+static long patch_file_tell(void* self) {
+    return ((stream_wrapper_t*)self)->read_pos;
+}
+
+static long patch_file_close(void* self) {
+    stream_wrapper_t* sw = (stream_wrapper_t*)self;
+    patch_file_t* file = (patch_file_t*)sw->_impl;
+    if (file == NULL)
+        return -1;
+    sw->_impl = NULL;
+    return fclose(file->fp) == 0 ? 0 : -1;
+}
+
+static void make_patch_file_sw(stream_wrapper_t* sw, patch_file_t* file) {
+    sw->_impl = file;
+    sw->read = &patch_file_read;
+    sw->write = &patch_file_write;
+    sw->seekg = &patch_file_seek;
+    sw->seekp = &patch_file_seek;
+    sw->tellg = &patch_file_tell;
+    sw->tellp = &patch_file_tell;
+    sw->close = &patch_file_close;
+}
+
+/* Reads the whole patch file into `*data` if it is a compiled one or an edit
+ * script (`*script` is set then); `*data` is NULL if it is a diff, whose first
+ * bytes are kept in `file` to be read again
+ *
+ * returns 0 on success, non-0 on error (reported)
+ */
+static int read_compiled(patch_file_t* file, char** data, size_t* size, int* script) {
+    *data = NULL;
+    file->head_length = fread(file->head, 1, sizeof(file->head), file->fp);
+    int got = file->head_length == sizeof(file->head);
+    *script = got && memcmp(file->head, EDIT_SCRIPT_MAGIC, sizeof(file->head)) == 0;
+    if (!*script && !(got && memcmp(file->head, COMPILED_MAGIC, sizeof(file->head)) == 0))
+        return 0;
+
+    /* malloc() aligns it as apply_compiled_patch() needs; the size is not asked for, the file may be a pipe */
+    size_t capacity = 64 * 1024;
+    size_t length = sizeof(file->head);
+    char* buf = malloc(capacity);
+    if (buf != NULL)
+        memcpy(buf, file->head, length);
+    while (buf != NULL) {
+        length += fread(buf + length, 1, capacity - length, file->fp);
+        if (length < capacity || ferror(file->fp))
+            break;
+        char* grown = realloc(buf, capacity * 2);
+        if (grown == NULL)
+            free(buf);
+        buf = grown;
+        capacity *= 2;
+    }
+    if (buf == NULL || ferror(file->fp)) {
+        fprintf(stderr, buf == NULL ? "Out of memory while reading the patch\n" : "Cannot read the patch\n");
+        free(buf);
+        return 1;
+    }
+    *data = buf;
+    *size = length;
+    return 0;
+}
+
 int main(int argc, char** argv) {
     /* Simple argument parser (no fancy lib). */
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s [--verbose] <patchfile>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--verbose] [--force-inplace] [-R] [--dry-run] [--unordered] [--conflicts] [--series] [--compose] [--fuzz N] [--jobs N] [--ignore-whitespace] [--ignore-eol] [--eol preserve|lf|crlf] [--verify-delete] [--verify-index] [--cache DIR] [--compile OUT] [--resolve OUT] [--stdout [--input FILE|-] [--input-fd N]] <patchfile>...\n", argv[0]);
         return 1;
     }
 
     unsigned int options = 0;
-    const char* patchfile = NULL;
+    unsigned int fuzz = 0;
+    unsigned int jobs = 0;
+    const char* cache_dir = NULL;
+    const char* compile_path = NULL;
+    const char* resolve_path = NULL;
+    const char* input_path = NULL;
+    int input_fd = -1;
+    int to_stdout = 0;
+    int conflicts = 0;
+    int series = 0;
+    int composing = 0;
+    const char** patchfiles = calloc((size_t)argc, sizeof(char*));
+    size_t patch_count = 0;
+    if (patchfiles == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "--verbose") == 0)
             options |= PATCH_OPTION_VERBOSE;
-        else if (*argv[i] == '-') {
+        else if (strcmp(argv[i], "--force-inplace") == 0)
+            options |= PATCH_OPTION_INPLACE;
+        else if (strcmp(argv[i], "--dry-run") == 0 || strcmp(argv[i], "--check") == 0)
+            options |= PATCH_OPTION_DRY_RUN;
+        else if (strcmp(argv[i], "--unordered") == 0)
+            options |= PATCH_OPTION_UNORDERED;
+        else if (strcmp(argv[i], "--verify-delete") == 0)
+            options |= PATCH_OPTION_VERIFY_DELETE;
+        else if (strcmp(argv[i], "--verify-index") == 0)
+            options |= PATCH_OPTION_VERIFY_INDEX;
+        else if (strcmp(argv[i], "--conflicts") == 0)
+            conflicts = 1;
+        else if (strcmp(argv[i], "--series") == 0)
+            series = 1;
+        else if (strcmp(argv[i], "--compose") == 0)
+            composing = 1;
+        else if (strcmp(argv[i], "--stdout") == 0)
+            to_stdout = 1;
+        else if (strcmp(argv[i], "-R") == 0 || strcmp(argv[i], "--reverse") == 0)
+            options |= PATCH_OPTION_REVERSE;
+        else if (strcmp(argv[i], "--ignore-whitespace") == 0)
+            options |= PATCH_OPTION_IGNORE_WHITESPACE;
+        else if (strcmp(argv[i], "--ignore-eol") == 0)
+            options |= PATCH_OPTION_IGNORE_EOL;
+        else if (strcmp(argv[i], "--eol") == 0 || strncmp(argv[i], "--eol=", 6) == 0) {
+            if (parse_eol(argc, argv, &i, &options) != 0)
+                return 1;
+        }
+        else if (strcmp(argv[i], "--fuzz") == 0 || strncmp(argv[i], "--fuzz=", 7) == 0) {
+            if (parse_count(argc, argv, &i, 6, &fuzz) != 0)
+                return 1;
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 || strncmp(argv[i], "--jobs=", 7) == 0) {
+            if (parse_count(argc, argv, &i, 6, &jobs) != 0)
+                return 1;
+        }
+        else if (strcmp(argv[i], "--cache") == 0 || strncmp(argv[i], "--cache=", 8) == 0) {
+            cache_dir = argv[i][7] == '=' ? argv[i] + 8 : (i + 1 < argc ? argv[++i] : NULL);
+            if (cache_dir == NULL || *cache_dir == '\0') {
+                fprintf(stderr, "--cache expects a directory\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--compile") == 0 || strncmp(argv[i], "--compile=", 10) == 0) {
+            compile_path = argv[i][9] == '=' ? argv[i] + 10 : (i + 1 < argc ? argv[++i] : NULL);
+            if (compile_path == NULL || *compile_path == '\0') {
+                fprintf(stderr, "--compile expects an output file\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--resolve") == 0 || strncmp(argv[i], "--resolve=", 10) == 0) {
+            resolve_path = argv[i][9] == '=' ? argv[i] + 10 : (i + 1 < argc ? argv[++i] : NULL);
+            if (resolve_path == NULL || *resolve_path == '\0') {
+                fprintf(stderr, "--resolve expects an output file\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--input") == 0 || strncmp(argv[i], "--input=", 8) == 0) {
+            input_path = argv[i][7] == '=' ? argv[i] + 8 : (i + 1 < argc ? argv[++i] : NULL);
+            if (input_path == NULL || *input_path == '\0') {
+                fprintf(stderr, "--input expects a file, or - for stdin\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--input-fd") == 0 || strncmp(argv[i], "--input-fd=", 11) == 0) {
+            unsigned int fd;
+            if (parse_count(argc, argv, &i, 10, &fd) != 0)
+                return 1;
+            input_fd = (int)fd;
+        }
+        else if (*argv[i] == '-' && argv[i][1] != '\0') {
             fprintf(stderr, "Unknown option: %s\n", argv[i]);
             return 1;
         } else {
-            patchfile = argv[i];
+            patchfiles[patch_count++] = argv[i];
         }
     }
-    if (!patchfile) {
+    if (to_stdout) {
+        /* a filter in a pipeline: one patch and one file in, the patched file out, nothing seeked */
+        int stat = 1;
+        if (patch_count > 1 || conflicts || series || composing || compile_path || resolve_path || cache_dir ||
+            (options & (PATCH_OPTION_INPLACE | PATCH_OPTION_DRY_RUN | PATCH_OPTION_UNORDERED |
+                        PATCH_OPTION_VERIFY_INDEX)))
+            fprintf(stderr, "--stdout streams one patch over one file, it takes no option that seeks or "
+                            "writes files\n");
+        else
+            stat = filter(patch_count > 0 ? patchfiles[0] : "-", input_path, input_fd, options, fuzz);
+        free(patchfiles);
+        return stat;
+    }
+    if (input_path != NULL || input_fd >= 0) {
+        fprintf(stderr, "--input and --input-fd go with --stdout\n");
+        return 1;
+    }
+    if (patch_count == 0) {
         fprintf(stderr, "Patch file not specified\n");
         return 1;
     }
+    if (conflicts) {
+        int stat = find_conflicts(patchfiles, patch_count, options);
+        free(patchfiles);
+        return stat;
+    }
+    if (composing) {
+        /* the first patch followed by the second, as one patch */
+        int stat = compose(patchfiles, patch_count);
+        free(patchfiles);
+        return stat;
+    }
+    if (compile_path) {
+        /* compiled once, to be applied again and again */
+        if (patch_count != 1) {
+            fprintf(stderr, "--compile takes exactly one patch file\n");
+            return 1;
+        }
+        int stat = compile(patchfiles[0], compile_path, options);
+        free(patchfiles);
+        return stat;
+    }
+    if (series) {
+        /* in order, every file read and written once */
+        int stat = patch_apply_series(patchfiles, patch_count, options, fuzz);
+        free(patchfiles);
+        return stat;
+    }
+    if (patch_count > 1) {
+        /* several patches are only checked, against the same tree */
+        if (!(options & PATCH_OPTION_DRY_RUN)) {
+            fprintf(stderr, "Several patch files can only be checked or applied as a series, use --check or --series\n");
+            return 1;
+        }
+        int stat = check_many(patchfiles, patch_count, options, fuzz, jobs);
+        free(patchfiles);
+        return stat;
+    }
+    const char* patchfile = patchfiles[0];
+    free(patchfiles);
 
     FILE* fp = fopen(patchfile, "rb");
     if (!fp) {
@@ -33,8 +558,17 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    patch_file_t file = {0};
+    file.fp = fp;
+    size_t compiled_size = 0;
+    int script = 0;
+    char* compiled = NULL;
+    if (read_compiled(&file, &compiled, &compiled_size, &script) != 0) {
+        fclose(fp);
+        return 1;
+    }
     stream_wrapper_t file_sw = {0};
-    make_fdsw(&file_sw, fp);
+    make_patch_file_sw(&file_sw, &file);
 
     void* patcher = patch_init();
     if (patcher == NULL) {
@@ -43,7 +577,39 @@ int main(int argc, char** argv) {
     }
 
     patch_set_options(patcher, options);
-    int stat = apply_patch(patcher, &file_sw);
+    patch_set_fuzz(patcher, fuzz);
+    if (cache_dir != NULL)
+        patch_set_cache_dir(patcher, cache_dir);
+    int stat;
+    if (resolve_path != NULL && compiled != NULL) {
+        fprintf(stderr, "--resolve takes a diff, not a compiled patch\n");
+        file_sw.close(&file_sw);
+        free(compiled);
+        stat = 1;
+    } else if (resolve_path != NULL) {
+        /* resolved once against these very files, to be replayed on copies of them */
+        stat = resolve(patcher, &file_sw, resolve_path);
+    } else if (compiled != NULL) {
+        file_sw.close(&file_sw);
+        stat = script ? apply_edit_script(patcher, compiled, compiled_size)
+                      : apply_compiled_patch(patcher, compiled, compiled_size);
+        free(compiled);
+    } else {
+        stat = apply_patch(patcher, &file_sw);
+    }
+
+    if (options & PATCH_OPTION_DRY_RUN) {
+        /* one line per hunk: path, hunk number, status, line, offset, fuzz */
+        const patch_hunk_result_t* results = NULL;
+        size_t count = patch_get_results(patcher, &results);
+        for (size_t i = 0; i < count; ++i) {
+            const patch_hunk_result_t* r = &results[i];
+            const char* status = r->status == PATCH_HUNK_APPLIED ? "ok"
+                               : r->status == PATCH_HUNK_ALREADY_APPLIED ? "applied" : "FAILED";
+            printf("%s\t%d\t%s\t%d\t%d\t%d\n", r->path, r->number, status, r->line, r->offset, r->fuzz);
+        }
+    }
+
     patch_destroy(patcher);
 
     return stat;
@@ -0,0 +1,345 @@
+// parser.c - Reading a patch line by line, from a stream or from pieces pushed with patch_feed() (C99 only)
+// A hunk is taken as soon as the line after it shows it is complete
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+
+/* Starts reading a patch */
+static void parser_begin(patch_instance_data_t* instance, patch_parser_t* parser) {
+    if (instance->options.verbose)
+        printf("Opened patch\n");
+
+    instance->hunks_failed = 0;
+    instance->result_count = 0;
+
+    memset(parser, 0, sizeof(patch_parser_t));
+    parser->hunk = &instance->hunk;
+}
+
+/* parser_hunk_line:
+ *  Collects a line of the hunk being read. Strictly tracks the numbers of old
+ *  and new lines the @@ header gives (len_old, len_new); the hunk is applied
+ *  only after it is complete, so the input lines can be verified before
+ *  anything is written.
+ *
+ * Returns 1 if the line is not a hunk line (the hunk ended short, the line
+ * is the next header), 0 if taken, -1 on error
+ */
+static int parser_hunk_line(patch_instance_data_t* instance, patch_parser_t* parser, char* line) {
+    hunk_t* hunk = parser->hunk;
+
+    /* "\ No newline at end of file" of a line before the last one */
+    if (line[0] == '\\') {
+        hunk_no_newline(hunk);
+        return 0;
+    }
+    if (line[0] != ' ' && line[0] != '+' && line[0] != '-')
+        return 1;
+
+    /* reversed: added lines are the ones to delete and vice versa */
+    if (instance->options.reverse && line[0] != ' ')
+        line[0] = line[0] == '+' ? '-' : '+';
+
+    if (hunk_add_line(hunk, line) != 0) {
+        fprintf(stderr, "Out of memory while reading hunk #%d\n", hunk->number);
+        return -1;
+    }
+    if (hunk->proc_old >= hunk->len_old && hunk->proc_new >= hunk->len_new)
+        parser->state = PARSER_MARKER;
+    return 0;
+}
+
+/* parser_line:
+ *  Reads the next line of the patch: a header, or a line of the hunk being
+ *  collected. A hunk is taken once the line after it shows it is complete.
+ *
+ * Returns 0 on success, non-0 on error (the patch cannot go on)
+ */
+static int parser_line(patch_instance_data_t* instance, patch_parser_t* parser, char* line) {
+    patch_options_t* options = &instance->options;
+    git_section_t* git = &parser->git;
+    char* orig_file = parser->orig_file;
+    char* new_file = parser->new_file;
+
+    if (parser->state == PARSER_HUNK) {
+        int stat = parser_hunk_line(instance, parser, line);
+        if (stat <= 0)
+            return stat != 0;
+    } else if (parser->state == PARSER_MARKER && line[0] == '\\') {
+        /* the marker of the last line comes after the hunk */
+        hunk_no_newline(parser->hunk);
+        parser->state = PARSER_HEADERS;
+        return take_hunk(instance, parser->hunk, git, parser->creating, &parser->input_stream,
+                         &parser->output_stream, new_file) != 0;
+    }
+    if (parser->state != PARSER_HEADERS) {
+        parser->state = PARSER_HEADERS;
+        if (take_hunk(instance, parser->hunk, git, parser->creating, &parser->input_stream, &parser->output_stream,
+                      new_file) != 0)
+            return 1;
+    }
+
+    /* Note: lines read from patch may contain CRLF; trim_newline when parsing filenames later */
+    /* Trim newline for header parsing convenience */
+    char line_copy[MAX_LINE];
+    strncpy(line_copy, line, MAX_LINE);
+    trim_newline(line_copy);
+
+    if (strncmp(line_copy, "diff --git ", 11) == 0) {
+        /* the previous section ends: its content first, then its file operations */
+        if (git->binary_hunk == 1 && binary_end(instance, git, &parser->input_stream, &parser->output_stream) != 0)
+            return 1;
+        if (parser->input_stream._impl || parser->output_stream._impl) {
+            if (options->verbose)
+                printf("Finalizing the previous file: %s\n", new_file);
+            if (finalize_file(instance, &parser->input_stream, &parser->output_stream, orig_file, new_file) != 0)
+                return 1;
+            *orig_file = *new_file = '\0';
+        }
+        if (git_section_finish(instance, git) != 0)
+            return 1;
+        git_section_begin(git, line_copy, options->reverse);
+        parser->creating = 0;
+    } else if (git->active && !git->content && git_section_line(git, line_copy, options->reverse)) {
+        /* extended header line, done at the end of the section */
+    } else if (git->active && !git->content && strcmp(line_copy, "GIT binary patch") == 0) {
+        git->binary = 1;
+        git->content = 1;
+    } else if (git->binary) {
+        if (binary_line(instance, git, line_copy, &parser->input_stream, &parser->output_stream) != 0)
+            return 1;
+    } else if (strncmp(line_copy, "Binary files ", 13) == 0) {
+        /* `git diff` without --binary, or plain diff: there is nothing to apply, nor a file operation to do */
+        fprintf(stderr, "%s, the patch has no data to apply (make it with git diff --binary)\n", line_copy);
+        ++instance->hunks_failed;
+        git->active = 0;
+    } else if (strncmp(line_copy, "--- ", 4) == 0) {
+        /* When starting a new diff, if we have currently open input/output finalize it first. */
+        if (parser->input_stream._impl || parser->output_stream._impl) {
+            if (options->verbose)
+                printf("Finalizing the previous file: %s\n", new_file);
+            if (finalize_file(instance, &parser->input_stream, &parser->output_stream, orig_file, new_file) != 0)
+                return 1;
+            /* reset filenames/timestamp */
+            *orig_file = *new_file = '\0';
+        }
+        /* a plain diff after the content of a git section */
+        if (git->content && git_section_finish(instance, git) != 0)
+            return 1;
+        parser->creating = 0;
+        /* parse original filename (token after '--- '), the result of a reversed patch */
+        char* path = options->reverse ? new_file : orig_file;
+        const char* after = parse_header_filename(line_copy + 4, path, MAX_PATH_LEN);
+        if (git->active)
+            git_strip_prefix(path);
+        else if (header_is_epoch(after))
+            strcpy(path, DEV_NULL);
+        if (options->verbose)
+            printf("Found %s: '%s'\n", options->reverse ? "new" : "orig", path);
+    } else if (strncmp(line_copy, "+++ ", 4) == 0) {
+        /* parse new filename, the input of a reversed patch */
+        char* path = options->reverse ? orig_file : new_file;
+        const char* after = parse_header_filename(line_copy + 4, path, MAX_PATH_LEN);
+        if (git->active)
+            git_strip_prefix(path);
+        else if (header_is_epoch(after))
+            strcpy(path, DEV_NULL);
+        if (options->verbose)
+            printf("Found %s: '%s'\n", options->reverse ? "orig" : "new", path);
+        /* the rest of the line may be a timestamp. */
+
+        /* At this point we have both orig_file and new_file (or at least new_file). Open input and output */
+        parser->hunk_no = 0;
+        if (open_section(instance, git, orig_file, new_file, NULL, &parser->creating, &parser->input_stream,
+                         &parser->output_stream) != 0)
+            return 1;
+    } else if (strncmp(line, "@@ ", 3) == 0) {
+        /* hunk header line */
+        int start_old = 0, len_old = 0, start_new = 0, len_new = 0;
+        if (patch_hunk_header(line, &start_old, &len_old, &start_new, &len_new) != 0) {
+            fprintf(stderr, "Malformed hunk header: %s\n", line);
+            return 1;
+        }
+        if (options->reverse) {
+            int start = start_old, len = len_old;
+            start_old = start_new;
+            len_old = len_new;
+            start_new = start;
+            len_new = len;
+        }
+
+        hunk_t* hunk = section_hunk(instance, git, parser->creating, &parser->input_stream, &parser->output_stream,
+                                    ++parser->hunk_no);
+        if (hunk == NULL)
+            return 1;
+        hunk->number = parser->hunk_no;
+        hunk->start_old = start_old;
+        hunk->len_old = len_old;
+        hunk->start_new = start_new;
+        hunk->len_new = len_new;
+
+        /* its lines come next; a line that does not start with ' ', '+' or '-' ends it short */
+        parser->hunk = hunk;
+        parser->state = len_old > 0 || len_new > 0 ? PARSER_HUNK : PARSER_MARKER;
+    }
+    /* other lines in patch are ignored (e.g., index lines, timestamps) */
+    return 0;
+}
+
+/* parser_end:
+ *  Ends the patch: takes the hunk it ends with, finalizes the file still
+ *  open and does the file operations of the last section.
+ *
+ * Returns 0 on success, non-0 on error
+ */
+static int parser_end(patch_instance_data_t* instance, patch_parser_t* parser) {
+    git_section_t* git = &parser->git;
+    if (parser->state == PARSER_HUNK) {
+        fprintf(stderr, "Unexpected EOF inside hunk header at file '%s'.\n", parser->new_file);
+        return 1;
+    }
+    if (parser->state == PARSER_MARKER && take_hunk(instance, parser->hunk, git, parser->creating,
+                                                    &parser->input_stream, &parser->output_stream,
+                                                    parser->new_file) != 0)
+        return 1;
+    parser->state = PARSER_HEADERS;
+
+    /* finalize any remaining open file */
+    if (git->binary_hunk == 1 && binary_end(instance, git, &parser->input_stream, &parser->output_stream) != 0)
+        return 1;
+    if (parser->input_stream._impl || parser->output_stream._impl) {
+        if (instance->options.verbose)
+            printf("Finalizing last file: %s\n", parser->new_file);
+        if (finalize_file(instance, &parser->input_stream, &parser->output_stream, parser->orig_file,
+                          parser->new_file) != 0)
+            return 1;
+    }
+    return git_section_finish(instance, git) != 0;
+}
+
+void parser_abort(patch_instance_data_t* instance, patch_parser_t* parser) {
+    cache_end(instance, 0);
+    if (parser->output_stream._impl) {
+        patch_discard_user_stream(instance, instance->output_path, &parser->output_stream, instance->output_purpose);
+        memset(&parser->output_stream, 0, sizeof(stream_wrapper_t));
+    }
+    if (parser->input_stream._impl) {
+        patch_release_user_stream(instance, parser->orig_file, &parser->input_stream, PATCH_STREAM_PURPOSE_INPUT);
+        memset(&parser->input_stream, 0, sizeof(stream_wrapper_t));
+    }
+}
+
+/* Ends the line being fed and reads it */
+static int parser_feed_line(patch_instance_data_t* instance, patch_parser_t* parser) {
+    parser->line[parser->length] = '\0';
+    parser->length = 0;
+    parser->cr = 0;
+    return parser_line(instance, parser, parser->line);
+}
+
+/* parser_feed:
+ *  Splits bytes of the patch into lines the way sw_fgets() does, and reads
+ *  every line as soon as it is complete. A line that is not complete yet is
+ *  kept for the next bytes, so the patch may come in any pieces.
+ *
+ * Returns 0 on success, non-0 on error (the patch cannot go on)
+ */
+static int parser_feed(patch_instance_data_t* instance, patch_parser_t* parser, const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        char ch = data[i];
+        if (parser->cr) {
+            /* a CRLF keeps its '\n' if there is room for it, a lone '\r' ends the line before this byte */
+            if (ch == '\n' && parser->length + 1 < MAX_LINE)
+                parser->line[parser->length++] = ch;
+            if (parser_feed_line(instance, parser) != 0)
+                return 1;
+            if (ch == '\n')
+                continue;
+        }
+
+        parser->line[parser->length++] = ch;
+        if (ch == '\r')
+            parser->cr = 1;
+        else if ((ch == '\n' || parser->length + 1 == MAX_LINE) && parser_feed_line(instance, parser) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+int apply_patch(void* self, stream_wrapper_t* sw) {
+    if (self == NULL)   /* Invalid instance pointer */
+        return 1;
+    patch_instance_data_t* instance = (patch_instance_data_t*)self;
+
+    if (sw == NULL) {
+        fprintf(stderr, "Invalid stream handle");
+        return 1;
+    }
+
+    patch_parser_t parser;
+    parser_begin(instance, &parser);
+
+    /* the patch is read in chunks and fed as patch_feed() feeds it */
+    char buf[MAX_LINE];
+    long got;
+    int stat = 0;
+    while (stat == 0 && (got = sw->read(sw, buf, 1, sizeof(buf))) > 0)
+        stat = parser_feed(instance, &parser, buf, (size_t)got);
+    if (stat == 0 && (parser.cr || parser.length > 0))
+        stat = parser_feed_line(instance, &parser);
+    if (stat == 0)
+        stat = parser_end(instance, &parser);
+    if (stat != 0)
+        parser_abort(instance, &parser);
+
+    sw->close(sw);
+    if (stat != 0)
+        return 1;
+    return instance->hunks_failed ? 1 : 0;
+}
+
+int patch_feed(void* self, const void* data, size_t size) {
+    if (self == NULL)   /* Invalid instance pointer */
+        return 1;
+    patch_instance_data_t* instance = (patch_instance_data_t*)self;
+
+    if (instance->parser == NULL) {
+        instance->parser = malloc(sizeof(patch_parser_t));
+        if (instance->parser == NULL) {
+            fprintf(stderr, "Out of memory while reading the patch\n");
+            return 1;
+        }
+        parser_begin(instance, instance->parser);
+    }
+    patch_parser_t* parser = instance->parser;
+    if (!parser->failed && parser_feed(instance, parser, (const char*)data, size) != 0)
+        parser->failed = 1;
+    return parser->failed;
+}
+
+int patch_finish(void* self) {
+    if (self == NULL)   /* Invalid instance pointer */
+        return 1;
+    patch_instance_data_t* instance = (patch_instance_data_t*)self;
+
+    /* a patch of no bytes at all */
+    if (instance->parser == NULL && patch_feed(self, "", 0) != 0)
+        return 1;
+    patch_parser_t* parser = instance->parser;
+    int stat = parser->failed;
+    if (stat == 0 && (parser->cr || parser->length > 0))
+        stat = parser_feed_line(instance, parser);
+    if (stat == 0)
+        stat = parser_end(instance, parser);
+    if (stat != 0)
+        parser_abort(instance, parser);
+
+    free(parser);
+    instance->parser = NULL;
+    if (stat != 0)
+        return 1;
+    return instance->hunks_failed ? 1 : 0;
+}
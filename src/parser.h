@@ -0,0 +1,37 @@
+#ifndef PARSER_H_
+#define PARSER_H_
+
+#include "gitsection.h"
+#include "instance.h"
+
+/* patch_parser_t.state */
+#define PARSER_HEADERS 0    /* between hunks */
+#define PARSER_HUNK    1    /* collecting the lines of a hunk */
+#define PARSER_MARKER  2    /* the hunk is complete, the marker of its last line may follow */
+
+/* State of a patch between the lines it is read by, see parser_line() and patch_feed() */
+struct patch_parser {
+    char orig_file[MAX_PATH_LEN];
+    char new_file[MAX_PATH_LEN];
+    stream_wrapper_t output_stream;
+    stream_wrapper_t input_stream;
+
+    int state;              /* PARSER_* */
+    int hunk_no;            /* number of the current hunk within its file (1-based) */
+    hunk_t* hunk;
+    git_section_t git;
+    int creating;           /* the file is created from /dev/null, see create_hunk() */
+    int failed;             /* an error ended the patch, the lines still fed are dropped */
+
+    char line[MAX_LINE];    /* the line being fed, split as sw_fgets() splits lines */
+    size_t length;
+    int cr;                 /* the line ends with a lone '\r' unless a '\n' comes next */
+};
+
+/*
+ * Drops the file a patch that ended on an error leaves open: its output is
+ * discarded, so a hunk that failed halfway through a file does not replace it.
+ */
+void parser_abort(patch_instance_data_t* instance, patch_parser_t* parser);
+
+#endif  /* PARSER_H_ */
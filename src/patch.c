@@ -1,34 +1,30 @@
 // patcher.c - Minimal unified diff patcher for Windows (C99 + WinAPI only)
-// Supports only basic unified diffs (-u or -urN) with hunk replacements
-// Limitations: No file creation/removal, no fuzzy matching, no context verification
+// Supports unified diffs (-u or -urN) with context verification, fuzz and git sections (see gitsection.c)
+// Limitations: no context (-c) or ed diffs, failed hunks are reported but not saved as rejects
 
 #define _CRT_SECURE_NO_WARNINGS
 #include <windows.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "binpatch.h"
+#include "blobhash.h"
 #include "csw.h"
+#include "gitsection.h"
+#include "instance.h"
+#include "lineidx.h"
+#include "parser.h"
 
 #include "patch.h"
+#include "resultcache.h"
 
 #ifdef _WIN32
 #include <io.h>
 #endif
 
-#define MAX_LINE 4096
-#define MAX_PATH_LEN 260
+#define MAX_BACK_OFFSET 1000    /* how many lines before its position a hunk may be found */
+#define MAX_STREAM_AHEAD 1000   /* ... and after it, in a stream read once, see apply_hunk() */
 
-typedef struct patch_options {
-    unsigned int inplace : 1;
-    unsigned int apply_dates : 1;
-    unsigned int verbose : 1;
-} patch_options_t;
-
-typedef struct patch_instance_data {
-    patch_options_t options;
-    patch_event_cbk_t* path_cbk;
-    void* path_cbk_userdata;
-} patch_instance_data_t;
 
 /* private */
 int patch_call_user_cbk(patch_instance_data_t* instance, patch_evt_t* evt) {
@@ -38,30 +34,108 @@ int patch_call_user_cbk(patch_instance_data_t* instance, patch_evt_t* evt) {
     return instance->path_cbk(evt);
 }
 
-/* private */
-int patch_acquire_user_stream(patch_instance_data_t* instance, char* path, stream_wrapper_t* sw_ptr, unsigned int purpose) {
+/* private
+ * index: receives the line index the user provided along with the stream, may be NULL
+ * size: size the output will have, -1 if not known
+ */
+int patch_acquire_user_stream(patch_instance_data_t* instance, char* path, stream_wrapper_t* sw_ptr, unsigned int purpose,
+                              const lineidx_t** index, long size) {
+    if (instance->script != NULL && purpose != PATCH_STREAM_PURPOSE_INPUT)
+        return script_file_begin(instance, path, sw_ptr);
+
     patch_evt_t event = { 0 };
     event.type = PATCH_EVT_STREAM_ACQUIRE;
     event.data.stream_event.path = path;
     event.data.stream_event.stream = sw_ptr;
     event.data.stream_event.purpose = purpose;
-    return patch_call_user_cbk(instance, &event);
+    event.data.stream_event.size = size;
+    int stat = patch_call_user_cbk(instance, &event);
+    if (index != NULL)
+        *index = event.data.stream_event.index;
+    if (purpose != PATCH_STREAM_PURPOSE_INPUT) {
+        snprintf(instance->output_path, MAX_PATH_LEN, "%s", path);
+        instance->output_purpose = purpose;
+    }
+    if (stat == 0 && instance->script != NULL)
+        stat = script_input(instance->script, path, sw_ptr);
+    return stat;
 }
 
 /* private */
 int patch_release_user_stream(patch_instance_data_t* instance, char* path, stream_wrapper_t* sw_ptr, unsigned int purpose) {
+    if (instance->script != NULL && purpose != PATCH_STREAM_PURPOSE_INPUT)
+        return script_file_end(instance, sw_ptr);
+
+    patch_evt_t event = { 0 };
+    event.type = PATCH_EVT_STREAM_RELEASE;
+    event.data.stream_event.path = path;
+    event.data.stream_event.stream = sw_ptr;
+    event.data.stream_event.purpose = purpose;
+    return patch_call_user_cbk(instance, &event);
+}
+
+/* private
+ *  Drops an output that must not replace its file: the user gets a RELEASE with
+ *  `discard` set. The null streams of a dry run or of an edit script being
+ *  resolved are the patcher's own, they are only closed.
+ */
+int patch_discard_user_stream(patch_instance_data_t* instance, char* path, stream_wrapper_t* sw_ptr,
+                              unsigned int purpose) {
+    if (instance->options.dry_run || instance->script != NULL)
+        return sw_ptr->close(sw_ptr);
+
     patch_evt_t event = { 0 };
     event.type = PATCH_EVT_STREAM_RELEASE;
     event.data.stream_event.path = path;
     event.data.stream_event.stream = sw_ptr;
     event.data.stream_event.purpose = purpose;
+    event.data.stream_event.discard = 1;
     return patch_call_user_cbk(instance, &event);
 }
 
+/* Reserves disk space for the file in one extent rather than as it grows, the file system may ignore it.
+ * The file size is left as it is; an allocation below it would cut the file, so `size` must not be.
+ * Returns 0 on success, non-0 if the space is not there */
+static int reserve_file_space(FILE* fp, long size) {
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = size;
+    return SetFileInformationByHandle((HANDLE)_get_osfhandle(_fileno(fp)), FileAllocationInfo, &info, sizeof(info))
+               ? 0
+               : -1;
+}
+
 int default_patch_evt_cbk(patch_evt_t* evt) {
     if (evt == NULL) /* Invalid evt */
         return -1;
 
+    if (evt->type == PATCH_EVT_HUNK_RESULT) {
+        /* failures are reported by the patcher itself, tell only where a hunk moved */
+        int offset = evt->data.hunk_event.offset;
+        int fuzz = evt->data.hunk_event.fuzz;
+        if (evt->data.hunk_event.status == PATCH_HUNK_ALREADY_APPLIED) {
+            printf("Hunk #%d already applied at %d.\n", evt->data.hunk_event.number, evt->data.hunk_event.line);
+            return 0;
+        }
+        if (evt->data.hunk_event.status != PATCH_HUNK_APPLIED || (offset == 0 && fuzz == 0))
+            return 0;
+
+        printf("Hunk #%d succeeded at %d", evt->data.hunk_event.number, evt->data.hunk_event.line);
+        if (fuzz != 0)
+            printf(" with fuzz %d", fuzz);
+        if (offset != 0)
+            printf(" (offset %d line%s)", offset, (offset == 1 || offset == -1) ? "" : "s");
+        printf(".\n");
+        return 0;
+    }
+
+    /* git file operations: one call each, the content is neither read nor written */
+    if (evt->type == PATCH_EVT_FILE_RENAME)
+        return MoveFileExA(evt->data.file_event.path, evt->data.file_event.new_path, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+    if (evt->type == PATCH_EVT_FILE_DELETE)
+        return DeleteFileA(evt->data.file_event.path) ? 0 : -1;
+    if (evt->type == PATCH_EVT_FILE_MODE)   /* Windows keeps only the write bit, as the read-only attribute */
+        return _chmod(evt->data.file_event.path, (int)evt->data.file_event.mode) == 0 ? 0 : -1;
+
     if (evt->type == PATCH_EVT_STREAM_ACQUIRE || evt->type == PATCH_EVT_STREAM_RELEASE) {
         char* path = evt->data.stream_event.path;
         stream_wrapper_t* sw = evt->data.stream_event.stream;
@@ -70,6 +144,34 @@ int default_patch_evt_cbk(patch_evt_t* evt) {
         if (sw == NULL) /* invalid stream wrapper provided */
             return -1;
 
+        if (purpose == PATCH_STREAM_PURPOSE_INPLACE) {
+            if (evt->type == PATCH_EVT_STREAM_ACQUIRE) {
+                FILE* fp = fopen(path, "r+b");
+                if (!fp)    /* Cannot open the file for update */
+                    return -1;
+                /* a file that grows gets its space before a byte of it is overwritten */
+                long size = evt->data.stream_event.size;
+                if (size > 0 && (fseek(fp, 0, SEEK_END) != 0 || (ftell(fp) < size && reserve_file_space(fp, size) != 0) ||
+                                 fseek(fp, 0, SEEK_SET) != 0)) {
+                    fprintf(stderr, "No space to write '%s' in place\n", path);
+                    fclose(fp);
+                    return -1;
+                }
+                return make_fdsw(sw, fp);
+            }
+            /* a discarded output leaves the file as it is */
+            if (evt->data.stream_event.discard)
+                return sw->close(sw);
+            /* cut the file where the output ends, the bytes after it are stale */
+            FILE* fp = (FILE*)sw->_impl;
+            if (fp == NULL || fflush(fp) != 0 || _chsize_s(_fileno(fp), sw->tellp(sw)) != 0) {
+                fprintf(stderr, "Failed to truncate '%s'\n", path);
+                sw->close(sw);
+                return -1;
+            }
+            return sw->close(sw);
+        }
+
         char actual_path[MAX_PATH] = {0};
         strcpy(actual_path, path);
         /* If it is output stream, add .tmp extension to create a temporary file */
@@ -85,13 +187,28 @@ int default_patch_evt_cbk(patch_evt_t* evt) {
             if (!fp) {  /* Cannot open the file at specified path */
                 return -1;
             }
+            /* an output of known size gets its blocks at once rather than as it grows */
+            if (purpose == PATCH_STREAM_PURPOSE_OUTPUT && evt->data.stream_event.size > 0)
+                reserve_file_space(fp, evt->data.stream_event.size);
             return make_fdsw(sw, fp);
         }
             break;
         case PATCH_EVT_STREAM_RELEASE: {
             /* close the file stream at release request */
 
+            if (purpose == PATCH_STREAM_PURPOSE_OUTPUT && evt->data.stream_event.discard) {
+                sw->close(sw);
+                return DeleteFileA(actual_path) ? 0 : -1;
+            }
             if (purpose == PATCH_STREAM_PURPOSE_OUTPUT) {
+                /* a reserved size the output did not reach is cut off */
+                FILE* fp = (FILE*)sw->_impl;
+                if (fp == NULL || fflush(fp) != 0 || _chsize_s(_fileno(fp), sw->tellp(sw)) != 0) {
+                    fprintf(stderr, "Failed to truncate '%s'\n", actual_path);
+                    sw->close(sw);
+                    DeleteFileA(actual_path);
+                    return -1;
+                }
                 sw->close(sw);  /* first close the tmp file */
                 /* move temp into place */
                 DeleteFileA(path); /* delete already existing target file to avoid errors */
@@ -100,6 +217,7 @@ int default_patch_evt_cbk(patch_evt_t* evt) {
                     DeleteFileA(actual_path);
                     return -1;
                 }
+                return 0;
             }
 
             return sw->close(sw);
@@ -120,9 +238,15 @@ char* sw_fgets(stream_wrapper_t* sw, char* line, int maxlen) {
 
     while (i + 1 < (size_t)maxlen) {
 
-        /* Read one byte */
+        /* Read one byte, the one read ahead by the last call first */
         char ch;
-        int stat = sw->read(sw, &ch, 1, 1);
+        int stat = 1;
+        if (sw->pushed_back) {
+            ch = sw->pushback;
+            sw->pushed_back = 0;
+        } else {
+            stat = sw->read(sw, &ch, 1, 1);
+        }
 
         if (stat < 0) {
             /* Read error → NULL (like fgets) */
@@ -151,8 +275,9 @@ char* sw_fgets(stream_wrapper_t* sw, char* line, int maxlen) {
                     if (i + 1 < (size_t)maxlen)
                         line[i++] = next; /* include LF */
                 } else {
-                    /* not LF → push back */
-                    sw->seekg(sw, -1, SEEK_CUR);
+                    /* not LF → kept for the next line, the stream need not seek */
+                    sw->pushback = next;
+                    sw->pushed_back = 1;
                 }
             }
 
@@ -194,6 +319,469 @@ void trim_newline(char* line) {
     }
 }
 
+/* private */
+int write_span(stream_wrapper_t* out_stream, const char* data, size_t length) {
+    if (length == 0)
+        return 0;
+    long written = out_stream->write(out_stream, (char*)data, 1, length);
+    return (written < 0 || (size_t)written != length) ? 1 : 0;
+}
+
+/* Appends to a table, growing it geometrically (dynmem_write grows to the exact
+ * size); returns the offset the bytes start at, sets `failed` if out of memory */
+uint64_t table_put(dynmem_t* table, const void* data, size_t length, int* failed) {
+    uint64_t offset = table->writepos;
+    if (table->writepos + length > table->size) {
+        size_t new_size = table->size ? table->size * 2 : 4096;
+        while (new_size < table->writepos + length)
+            new_size *= 2;
+        if (dynmem_resize(table, new_size) != 0) {
+            *failed = 1;
+            return offset;
+        }
+    }
+    if (length > 0 && dynmem_write(table, (const char*)data, 1, length) < 0)
+        *failed = 1;
+    return offset;
+}
+
+/* private */
+static void input_reset(patch_input_t* input) {
+    lineidx_clear(&input->buffer);
+    input->lines = &input->buffer;
+    input->shared = 0;
+    input->base_line = 1;
+    input->cur_line = 1;
+    input->offset = 0;
+    input->indexed = 0;
+    input->hunks = 0;
+    input->already_applied = 0;
+    input->inplace = 0;
+    input->in_bytes = 0;
+    input->out_bytes = 0;
+    input->eol = NULL;
+    input->convert = 0;
+    input->detect_eol = 0;
+    input->in_size = -1;
+    input->collect = 0;
+    input->out_pending = 0;
+    input->replay = 0;
+    input->in_hash.kinds = 0;
+    input->out_hash.kinds = 0;
+    input->cache = 0;
+    if (input->cache_fp != NULL)    /* left by a file given up on */
+        result_cache_store(input->cache_fp, input->cache_path, input->cache_temp, NULL, 0, 0);
+    input->cache_fp = NULL;
+    input->cache_failed = 0;
+}
+
+/* Length of the "\n" or "\r\n" that ends the line, 0 if it has none; a lone '\r' is left as it is */
+size_t line_eol_length(const char* line, size_t length) {
+    if (length == 0 || line[length - 1] != '\n')
+        return 0;
+    return length > 1 && line[length - 2] == '\r' ? 2 : 1;
+}
+
+/* Length of the line once its EOL is replaced by `eol`, NULL keeps it */
+size_t eol_converted_length(const char* line, size_t length, const char* eol) {
+    size_t old = eol != NULL ? line_eol_length(line, length) : 0;
+    return old > 0 ? length - old + strlen(eol) : length;
+}
+
+/* Takes the EOL of the file from the line, if it is the first one to end in
+ * "\n" or "\r\n". A file of lone '\r' EOLs has none, its lines stay as they are. */
+static void input_detect_eol(patch_input_t* input, const char* line, size_t length) {
+    if (!input->detect_eol)
+        return;
+    size_t old = line_eol_length(line, length);
+    if (old > 0)
+        input->eol = old == 2 ? "\r\n" : "\n";
+    if (old > 0 || (length > 0 && line[length - 1] == '\r'))
+        input->detect_eol = 0;
+}
+
+/* Reads the next input line, up to MAX_LINE bytes, see input_detect_eol() */
+static char* input_read_line(patch_input_t* input, stream_wrapper_t* in_stream, char* line) {
+    if (!sw_fgets(in_stream, line, MAX_LINE))
+        return NULL;
+    size_t length = strlen(line);
+    input_detect_eol(input, line, length);
+    blobhash_update(&input->in_hash, line, length);
+    return line;
+}
+
+/* Writes output bytes to the new cache entry too, if there is one */
+static void cache_write(patch_input_t* input, const char* data, size_t length) {
+    if (input->cache_fp != NULL && length > 0 && fwrite(data, 1, length, input->cache_fp) != length)
+        input->cache_failed = 1;
+}
+
+/* output_write:
+ *  Writes the line at the output position, with its EOL replaced by `eol`
+ *  unless that is NULL. In place the stream is moved there first, as bytes
+ *  kept where they are were not written.
+ */
+static int output_write(patch_input_t* input, stream_wrapper_t* out_stream, const char* data, size_t length,
+                        const char* eol) {
+    if (input->inplace && out_stream->tellp(out_stream) != input->out_bytes &&
+        out_stream->seekp(out_stream, (size_t)input->out_bytes, SEEK_SET) != 0)
+        return 1;
+    size_t old = eol != NULL ? line_eol_length(data, length) : 0;
+    blobhash_update(&input->out_hash, data, length - old);
+    cache_write(input, data, length - old);
+    if (old == 0)
+        return write_span(out_stream, data, length);
+    blobhash_update(&input->out_hash, eol, strlen(eol));
+    cache_write(input, eol, strlen(eol));
+    return write_span(out_stream, data, length - old) || write_span(out_stream, eol, strlen(eol));
+}
+
+/* output_copy:
+ *  Passes an input line to the output, unchanged unless it is converted to
+ *  another EOL. In place it already is in the file, at the very offset, as
+ *  long as no change has shifted the output against the input; only then, or
+ *  when its EOL changes, is it written.
+ */
+static int output_copy(patch_input_t* input, stream_wrapper_t* out_stream, const char* data, size_t length) {
+    const char* eol = input->convert ? input->eol : NULL;
+    size_t out_length = eol_converted_length(data, length, eol);
+    if (input->script != NULL && out_length == length)
+        script_span(input->script, EDIT_COPY, (uint64_t)input->in_bytes, length);
+    else if (input->script != NULL)
+        script_line(input->script, data, length, eol);
+    int stat = 0;
+    if (!input->inplace || input->in_bytes != input->out_bytes || out_length != length)
+        stat = output_write(input, out_stream, data, length, eol);
+    input->in_bytes += (long)length;
+    input->out_bytes += (long)out_length;
+    return stat;
+}
+
+/* Writes a line that is not in the input, with the EOL of the file once known */
+int output_insert(patch_input_t* input, stream_wrapper_t* out_stream, const char* data, size_t length) {
+    if (input->script != NULL)
+        script_line(input->script, data, length, input->eol);
+    int stat = output_write(input, out_stream, data, length, input->eol);
+    input->out_bytes += (long)eol_converted_length(data, length, input->eol);
+    return stat;
+}
+
+/* input_buffer_line:
+ *  Reads the next line of the input stream into the buffer.
+ *
+ * Returns 0 on success, 1 on EOF, -1 on error
+ */
+static int input_buffer_line(patch_input_t* input, stream_wrapper_t* in_stream) {
+    char file_line[MAX_LINE];
+    if (!input_read_line(input, in_stream, file_line))
+        return 1;
+    return lineidx_append(&input->buffer, file_line, strlen(file_line)) == 0 ? 0 : -1;
+}
+
+/* input_flush:
+ *  Writes the buffered input lines from the current line up to (not including) `upto`.
+ *
+ * Returns 0 on success, non-zero on write error
+ */
+static int input_flush(patch_input_t* input, stream_wrapper_t* out_stream, int upto) {
+    for (; input->cur_line < upto; ++input->cur_line) {
+        size_t n = (size_t)(input->cur_line - input->base_line);
+        if (n >= input->lines->count)
+            break;
+        if (output_copy(input, out_stream, lineidx_text(input->lines, n), input->lines->lines[n].length) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int apply_pending_hunks(patch_instance_data_t* instance, stream_wrapper_t* in_stream,
+                               stream_wrapper_t* out_stream, char* path);
+static int apply_hunk(patch_instance_data_t* instance, hunk_t* hunk, stream_wrapper_t* in_stream,
+                      stream_wrapper_t* out_stream, char* path);
+static int input_load_rest(patch_input_t* input, stream_wrapper_t* in_stream);
+
+/* In place, lines converted to a longer EOL would overwrite input not read yet */
+static int input_grows(const patch_input_t* input) {
+    return input->inplace && input->convert && strlen(input->eol) > 1;
+}
+
+/* Bytes the collected hunks add to the input: those of their added lines, less those of their deleted lines */
+static long pending_growth(const patch_instance_data_t* instance) {
+    long growth = 0;
+    for (size_t i = 0; i < instance->pending_count; ++i) {
+        const hunk_t* hunk = &instance->pending[i];
+        for (size_t n = 0; n < hunk->lines.count; ++n) {
+            if (hunk->kinds[n] == '+')
+                growth += (long)hunk->lines.lines[n].length;
+            else if (hunk->kinds[n] == '-')
+                growth -= (long)hunk->lines.lines[n].length;
+        }
+    }
+    return growth;
+}
+
+/* output_size:
+ *  Size the output of hunks known ahead will have: the input size and their
+ *  `growth`. It holds if they all apply; lines written with another EOL, or
+ *  compared ignoring whitespace, may not have the lengths the patch gives.
+ *
+ * Returns the size, -1 if it is not known ahead
+ */
+static long output_size(patch_instance_data_t* instance, stream_wrapper_t* in_stream, long growth) {
+    patch_input_t* input = &instance->input;
+    if (instance->options.stream || input->eol != NULL || input->detect_eol || input->buffer.flags != 0)
+        return -1;
+    if (input->in_size < 0 && (in_stream->seekg(in_stream, 0, SEEK_END) != 0 ||
+                               (input->in_size = in_stream->tellg(in_stream)) < 0 ||
+                               in_stream->seekg(in_stream, 0, SEEK_SET) != 0)) {
+        input->in_size = -1;
+        return -1;
+    }
+    long size = input->in_size + growth;
+    return size >= 0 ? size : -1;
+}
+
+/* output_open:
+ *  Acquires the output begin_file() left to open, with its size if known; a
+ *  dry run only counts the output bytes.
+ *
+ * Returns 0 on success, non-0 on error (reported)
+ */
+static int output_open(patch_instance_data_t* instance, stream_wrapper_t* out_stream, long size) {
+    patch_input_t* input = &instance->input;
+    if (!input->out_pending)
+        return 0;
+    input->out_pending = 0;
+    int stat = instance->options.dry_run
+                   ? make_nullsw(out_stream)
+                   : patch_acquire_user_stream(instance, input->out_path, out_stream,
+                                               input->inplace ? PATCH_STREAM_PURPOSE_INPLACE
+                                                              : PATCH_STREAM_PURPOSE_OUTPUT,
+                                               NULL, size);
+    if (stat != 0)
+        fprintf(stderr, "Cannot create resulted patched file: %s\n", input->out_path);
+    return stat;
+}
+
+/* Starts the output hash of a file whose hunks are all collected: the output
+ * is the input with their added lines in place of their deleted ones */
+static void index_output_begin(patch_instance_data_t* instance) {
+    patch_input_t* input = &instance->input;
+    long size = input->in_size + pending_growth(instance);
+    blobhash_begin(&input->out_hash, size > 0 ? (size_t)size : 0);
+}
+
+/* index_verify:
+ *  Ends the blob hashes of the file, read and written whole by now, and
+ *  compares them with its `index` line. The output is not checked if the
+ *  input is not the old blob already.
+ *
+ * Returns 0 if they match or are not verified, non-0 if not (reported)
+ */
+static int index_verify(patch_instance_data_t* instance, const char* in_path, const char* out_path) {
+    patch_input_t* input = &instance->input;
+    if (input->in_hash.kinds != 0 && blobhash_end(&input->in_hash) != 0) {
+        fprintf(stderr, "%s is not the file the patch was made from (index %s), it is not patched.\n", in_path,
+                input->in_hash.expect);
+        return 1;
+    }
+    if (input->out_hash.kinds != 0 && blobhash_end(&input->out_hash) != 0) {
+        fprintf(stderr, "Patching %s does not give the file the patch was made to (index %s), it is not written.\n",
+                out_path, input->out_hash.expect);
+        return 1;
+    }
+    return 0;
+}
+
+/* Git blob SHA-1 and size of the whole stream, which is left at its start */
+int stream_blob_hash(stream_wrapper_t* sw, char* hex, long* size_out) {
+    long size;
+    if (sw->seekg(sw, 0, SEEK_END) != 0 || (size = sw->tellg(sw)) < 0 || sw->seekg(sw, 0, SEEK_SET) != 0)
+        return 1;
+
+    blobhash_t hash;
+    blobhash_reset(&hash, BLOBHASH_SHA1);
+    blobhash_begin(&hash, (size_t)size);
+    char buf[MAX_LINE];
+    long got, total = 0;
+    while ((got = sw->read(sw, buf, 1, sizeof(buf))) > 0) {
+        blobhash_update(&hash, buf, (size_t)got);
+        total += got;
+    }
+    if (got < 0 || total != size || sw->seekg(sw, 0, SEEK_SET) != 0)
+        return 1;
+    blobhash_hex(&hash, BLOBHASH_SHA1, hex);
+    *size_out = size;
+    return 0;
+}
+
+/* Hash of what makes the output of the collected hunks out of an input: the
+ * options that place or shape them and the hunks, their ranges and lines */
+static void section_hash(patch_instance_data_t* instance, char* hex) {
+    const patch_options_t* options = &instance->options;
+    blobhash_t hash;
+    blobhash_reset(&hash, BLOBHASH_SHA1);
+
+    char text[128];
+    int length = snprintf(text, sizeof(text), "section ws %d eol %d %d%d%d fuzz %u unordered %d\n",
+                          options->ignore_whitespace, options->ignore_eol, options->eol_preserve, options->eol_lf,
+                          options->eol_crlf, instance->fuzz, options->unordered);
+    blobhash_update(&hash, text, (size_t)length);
+    for (size_t i = 0; i < instance->pending_count; ++i) {
+        const hunk_t* hunk = &instance->pending[i];
+        length = snprintf(text, sizeof(text), "@@ -%d,%d +%d,%d @@\n", hunk->start_old, hunk->len_old,
+                          hunk->start_new, hunk->len_new);
+        blobhash_update(&hash, text, (size_t)length);
+        for (size_t n = 0; n < hunk->lines.count; ++n) {
+            /* lines are prefixed with their kind and length, a line without EOL runs into nothing */
+            length = snprintf(text, sizeof(text), "%c%zu:", hunk->kinds[n], hunk->lines.lines[n].length);
+            blobhash_update(&hash, text, (size_t)length);
+            blobhash_update(&hash, lineidx_text(&hunk->lines, n), hunk->lines.lines[n].length);
+        }
+    }
+    blobhash_hex(&hash, BLOBHASH_SHA1, hex);
+}
+
+/* cache_lookup:
+ *  Looks the file up in the result cache once its hunks are collected. The
+ *  input is named by its content hash: the one remembered for the file as it
+ *  is now, or else the stream is hashed and rewound for the hunks. On a hit
+ *  the cached output is copied to the output stream and the hunks are not
+ *  placed at all, they are reported where the entry says they were placed;
+ *  on a miss the output goes to a new entry as well.
+ *
+ * Returns 0 on a hit, 1 on a miss, -1 on a write error
+ */
+static int cache_lookup(patch_instance_data_t* instance, stream_wrapper_t* in_stream, stream_wrapper_t* out_stream,
+                        char* in_path, char* out_path) {
+    patch_input_t* input = &instance->input;
+    const char* dir = instance->cache_dir;
+    char input_hash[RESULT_CACHE_HASH];
+    char output_key[RESULT_CACHE_HASH];
+
+    long size;
+    if (result_cache_recall(dir, in_path, input_hash) != 0) {
+        if (stream_blob_hash(in_stream, input_hash, &size) != 0)
+            return 1;   /* the input cannot be hashed and is patched as it is */
+        result_cache_remember(dir, in_path, input_hash);
+    }
+    section_hash(instance, output_key);
+
+    size_t count = instance->pending_count;
+    result_cache_hunk_t* placed = malloc((count > 0 ? count : 1) * sizeof(result_cache_hunk_t));
+    if (placed == NULL)
+        return 1;
+    long left;     /* bytes of the cached output still to copy */
+    FILE* fp = result_cache_open(dir, input_hash, output_key, placed, count, &left);
+    /* an entry that does not say where a hunk went consistently is not taken */
+    for (size_t i = 0; fp != NULL && i < count; ++i) {
+        if (placed[i].fuzz < 0 || placed[i].offset != placed[i].line - hunk_patch_line(&instance->pending[i])) {
+            fclose(fp);
+            fp = NULL;
+        }
+    }
+    if (fp == NULL) {
+        free(placed);
+        input->cache_fp = result_cache_create(dir, input_hash, output_key, input->cache_path, input->cache_temp);
+        return 1;
+    }
+
+    char buf[MAX_LINE];
+    int stat = 0;
+    while (stat == 0 && left > 0) {
+        size_t got = fread(buf, 1, left < (long)sizeof(buf) ? (size_t)left : sizeof(buf), fp);
+        stat = got == 0 || write_span(out_stream, buf, got) != 0;
+        left -= (long)got;
+    }
+    fclose(fp);
+    if (stat != 0) {
+        free(placed);
+        return -1;
+    }
+
+    if (instance->options.verbose)
+        printf("%s is taken from the cache\n", out_path);
+    for (size_t i = 0; i < count; ++i) {
+        hunk_t* hunk = &instance->pending[i];
+        hunk->line = placed[i].line;
+        hunk->head = placed[i].fuzz;
+        hunk->tail = 0;
+        hunk->status = PATCH_HUNK_APPLIED;
+        report_hunk(instance, out_path, hunk);
+    }
+    free(placed);
+    return 0;
+}
+
+/* Stores the new cache entry of the output, with where its hunks were placed,
+ * or drops it if the output is not complete. Only an output all hunks applied
+ * to is kept, a hit reports them so */
+void cache_end(patch_instance_data_t* instance, int keep) {
+    patch_input_t* input = &instance->input;
+    if (input->cache_fp == NULL)
+        return;
+    size_t count = instance->pending_count;
+    result_cache_hunk_t* placed = keep ? malloc((count > 0 ? count : 1) * sizeof(result_cache_hunk_t)) : NULL;
+    for (size_t i = 0; placed != NULL && i < count; ++i) {
+        const hunk_t* hunk = &instance->pending[i];
+        if (hunk->status != PATCH_HUNK_APPLIED) {
+            free(placed);
+            placed = NULL;
+            break;
+        }
+        placed[i].line = hunk->line;
+        placed[i].offset = hunk->line - hunk_patch_line(hunk);
+        placed[i].fuzz = hunk->head > hunk->tail ? hunk->head : hunk->tail;
+    }
+    result_cache_store(input->cache_fp, input->cache_path, input->cache_temp, placed, count,
+                       placed != NULL && !input->cache_failed);
+    free(placed);
+    input->cache_fp = NULL;
+}
+
+/* inplace_check:
+ *  Places the collected hunks of a file written in place before a byte of it
+ *  is, so a hunk that fails leaves the file as it was. They are applied to a
+ *  null output and reported, then the input is rewound for finalize_file() to
+ *  apply them again in place, unreported. `size` receives the size the file
+ *  will have, if the first pass tells it better than output_size().
+ *
+ * Returns 0 if they all apply, non-0 if not or on error (reported)
+ */
+static int inplace_check(patch_instance_data_t* instance, stream_wrapper_t* in_stream, char* path, long* size) {
+    patch_input_t* input = &instance->input;
+    patch_input_t start = *input;   /* rewound to, but for the lines buffered since */
+    input->inplace = 0;
+    input->in_hash.kinds = 0;
+    input->out_hash.kinds = 0;
+
+    stream_wrapper_t sink = { 0 };
+    make_nullsw(&sink);
+    int stat = 0;
+    for (size_t i = 0; stat == 0 && i < instance->pending_count; ++i)
+        stat = apply_hunk(instance, &instance->pending[i], in_stream, &sink, path);
+    sink.close(&sink);
+    long in_bytes = input->in_bytes, out_bytes = input->out_bytes;
+
+    start.buffer = input->buffer;
+    *input = start;
+    lineidx_clear(&input->buffer);
+    if (stat != 0)
+        return stat;
+
+    /* the bytes after the last hunk are kept as they are, unless converted */
+    long end;
+    if (!input->convert && in_stream->seekg(in_stream, 0, SEEK_END) == 0 &&
+        (end = in_stream->tellg(in_stream)) >= in_bytes)
+        *size = out_bytes + end - in_bytes;
+    if (in_stream->seekg(in_stream, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "Cannot rewind %s to write it in place\n", path);
+        return 1;
+    }
+    input->replay = 1;
+    return 0;
+}
+
 /* finalize currently open output: copy remainder (line-by-line) if both files open
  * requests the user to unref streams
  * Return 0 on success, non-zero on error.
@@ -202,19 +790,81 @@ int finalize_file(patch_instance_data_t* instance, stream_wrapper_t* in_stream,
     if (instance == NULL)   /* Invalid instance pointer */
         return 0;
 
-    /* If both input and output are open, copy remaining lines from input into output. */
-    if ((in_stream && in_stream->_impl) && (out_stream && out_stream->_impl)) {
-        char buf[MAX_LINE];
-        while (sw_fgets(in_stream, buf, sizeof(buf))) {
-            if (sw_fputs(out_stream, buf) <= 0) {
-                perror("Write error while copying remainder");
-                /* cleanup and remove temp */
-                patch_release_user_stream(instance, out_path, out_stream, PATCH_STREAM_PURPOSE_OUTPUT);
-                memset(out_stream, 0, sizeof(stream_wrapper_t));
-                patch_release_user_stream(instance, in_path, in_stream, PATCH_STREAM_PURPOSE_INPUT);
-                memset (in_stream, 0, sizeof(stream_wrapper_t));
-                return 1;
-            }
+    patch_input_t* input = &instance->input;
+    /* the hunks are all collected, the output gets the size they give it; in
+     * place, not before every one of them is placed, see inplace_check() */
+    long size = input->out_pending ? output_size(instance, in_stream, pending_growth(instance)) : -1;
+    if ((input->out_pending && input->inplace && !instance->options.unordered && instance->pending_count > 1 &&
+         inplace_check(instance, in_stream, out_path, &size) != 0) ||
+        (input->out_pending && output_open(instance, out_stream, size) != 0)) {
+        cache_end(instance, 0);
+        patch_release_user_stream(instance, in_path, in_stream, PATCH_STREAM_PURPOSE_INPUT);
+        memset(in_stream, 0, sizeof(stream_wrapper_t));
+        return 1;
+    }
+    int stat = 0;
+    int from_cache = 0;    /* the output is written whole from the cache */
+    if (input->cache) {
+        int found = cache_lookup(instance, in_stream, out_stream, in_path, out_path);
+        from_cache = found == 0;
+        stat = found < 0;
+    }
+    if (input->collect)
+        index_output_begin(instance);
+    if (from_cache || stat != 0) {
+        /* nothing left to apply */
+    } else if (instance->options.unordered && instance->pending_count > 0) {
+        stat = apply_pending_hunks(instance, in_stream, out_stream, out_path);
+    } else if (input->collect) {
+        /* collected only for the size of the output, they are applied as they came */
+        for (size_t i = 0; stat == 0 && i < instance->pending_count; ++i)
+            stat = apply_hunk(instance, &instance->pending[i], in_stream, out_stream, out_path);
+    }
+    if (stat != 0) {
+        /* the output is discarded, so it does not replace the file */
+        cache_end(instance, 0);
+        patch_discard_user_stream(instance, out_path, out_stream,
+                                  input->inplace ? PATCH_STREAM_PURPOSE_INPLACE : PATCH_STREAM_PURPOSE_OUTPUT);
+        memset(out_stream, 0, sizeof(stream_wrapper_t));
+        patch_release_user_stream(instance, in_path, in_stream, PATCH_STREAM_PURPOSE_INPUT);
+        memset(in_stream, 0, sizeof(stream_wrapper_t));
+        return 1;
+    }
+    if (input->hunks > 0 && input->already_applied == input->hunks)
+        printf("Reversed (or previously applied) patch detected for %s, its hunks were skipped.\n", out_path);
+
+    /* If both input and output are open, copy remaining lines from input into output; a dry run only to hash them */
+    int hashing = input->in_hash.kinds != 0 || input->out_hash.kinds != 0;
+    if ((in_stream && in_stream->_impl) && (out_stream && out_stream->_impl) && (!instance->options.dry_run || hashing) &&
+        !from_cache) {
+        if (input_grows(input) && !input->indexed)
+            stat = input_load_rest(input, in_stream);
+
+        /* buffered input lines first, then whatever is left in the stream */
+        if (stat == 0)
+            stat = input_flush(input, out_stream, input->base_line + (int)input->lines->count);
+        if (input->inplace && !input->convert && input->in_bytes == input->out_bytes) {
+            /* the rest of the file is where it belongs already, it is neither read nor written */
+            if (stat == 0 && out_stream->seekp(out_stream, 0, SEEK_END) != 0)
+                stat = 1;
+        } else {
+            char buf[MAX_LINE];
+            while (stat == 0 && !input->indexed && input_read_line(input, in_stream, buf))
+                stat = output_copy(input, out_stream, buf, strlen(buf));
+            /* the file is cut at the write position, which skipped bytes have not moved */
+            if (stat == 0 && input->inplace && out_stream->seekp(out_stream, (size_t)input->out_bytes, SEEK_SET) != 0)
+                stat = 1;
+        }
+        if (stat != 0) {
+            perror("Write error while copying remainder");
+            cache_end(instance, 0);
+            /* cleanup and remove temp; a file written in place is left as it is, not cut */
+            patch_discard_user_stream(instance, out_path, out_stream,
+                                      input->inplace ? PATCH_STREAM_PURPOSE_INPLACE : PATCH_STREAM_PURPOSE_OUTPUT);
+            memset(out_stream, 0, sizeof(stream_wrapper_t));
+            patch_release_user_stream(instance, in_path, in_stream, PATCH_STREAM_PURPOSE_INPUT);
+            memset(in_stream, 0, sizeof(stream_wrapper_t));
+            return 1;
         }
         /* TODO(csw):
         if (ferror(*inptr)) {
@@ -237,15 +887,38 @@ int finalize_file(patch_instance_data_t* instance, stream_wrapper_t* in_stream,
         */
     }
 
+    /* the file must have been the old blob, and must have become the new one */
+    if (hashing && index_verify(instance, in_path, out_path) != 0) {
+        ++instance->hunks_failed;
+        cache_end(instance, 0);
+        if (out_stream && out_stream->_impl) {
+            /* discarded, so it does not replace the file */
+            patch_discard_user_stream(instance, out_path, out_stream,
+                                      input->inplace ? PATCH_STREAM_PURPOSE_INPLACE : PATCH_STREAM_PURPOSE_OUTPUT);
+            memset(out_stream, 0, sizeof(stream_wrapper_t));
+        }
+        if (in_stream && in_stream->_impl) {
+            patch_release_user_stream(instance, in_path, in_stream, PATCH_STREAM_PURPOSE_INPUT);
+            memset(in_stream, 0, sizeof(stream_wrapper_t));
+        }
+        return instance->options.dry_run ? 0 : 1;
+    }
+    cache_end(instance, 1);
+
     /* Close input if open */
     if (in_stream && in_stream->_impl) {
         patch_release_user_stream(instance, in_path, in_stream, PATCH_STREAM_PURPOSE_INPUT);
         memset(in_stream, 0, sizeof(stream_wrapper_t));
     }
 
-    /* Close output if open */
+    /* Close output if open, a dry run has no user stream to release */
+    if (out_stream && out_stream->_impl && instance->options.dry_run) {
+        out_stream->close(out_stream);
+        memset(out_stream, 0, sizeof(stream_wrapper_t));
+    }
     if (out_stream && out_stream->_impl) {
-        patch_release_user_stream(instance, out_path, out_stream, PATCH_STREAM_PURPOSE_OUTPUT);
+        patch_release_user_stream(instance, out_path, out_stream,
+                                  input->inplace ? PATCH_STREAM_PURPOSE_INPLACE : PATCH_STREAM_PURPOSE_OUTPUT);
         memset(out_stream, 0, sizeof(stream_wrapper_t));
     }
 
@@ -259,7 +932,7 @@ int finalize_file(patch_instance_data_t* instance, stream_wrapper_t* in_stream,
  *
  * Returns: pointer within p just after the parsed filename (i.e. at the separator or NUL)
  */
-static const char* parse_header_filename(const char* p, char* out_fname, size_t out_len) {
+const char* parse_header_filename(const char* p, char* out_fname, size_t out_len) {
     /* skip spaces */
     while (*p == ' ' || *p == '\t')
         ++p;
@@ -302,217 +975,1072 @@ static const char* parse_header_filename(const char* p, char* out_fname, size_t
     return p;
 }
 
-int apply_patch(void* self, stream_wrapper_t* sw) {
-    if (self == NULL)   /* Invalid instance pointer */
-        return 1;
-    patch_instance_data_t* instance = (patch_instance_data_t*)self;
+/* header_is_epoch:
+ *  p: the rest of a '---' or '+++' line, after the filename
+ *
+ * Returns non-0 if the timestamp is the epoch, in any time zone: `diff -N`
+ * dates the missing side of a created or deleted file so
+ */
+int header_is_epoch(const char* p) {
+    int year, month, day, hour, minute, zone_hour = 0, zone_minute = 0;
+    double second;
+    char sign = '+';
+    if (sscanf(p, " %d-%d-%d %d:%d:%lf %c%2d%2d", &year, &month, &day, &hour, &minute, &second, &sign, &zone_hour,
+               &zone_minute) < 6)
+        return 0;
+    long days;
+    if (year == 1970 && month == 1 && day == 1)
+        days = 0;
+    else if (year == 1969 && month == 12 && day == 31)
+        days = -1;
+    else
+        return 0;
+    long zone = (zone_hour * 60L + zone_minute) * 60L * (sign == '-' ? -1 : 1);
+    return (((days * 24 + hour) * 60 + minute) * 60 + (long)second) - zone == 0 && second == (long)second;
+}
 
-    /* shorthand */
-    patch_options_t* options = &instance->options;
+/* private */
+void hunk_reset(hunk_t* hunk) {
+    lineidx_clear(&hunk->lines);
+    hunk->number = 0;
+    hunk->start_old = hunk->len_old = 0;
+    hunk->start_new = hunk->len_new = 0;
+    hunk->proc_old = hunk->proc_new = 0;
+}
 
-    if (sw == NULL) {
-        fprintf(stderr, "Invalid stream handle");
+/* private */
+void hunk_free(hunk_t* hunk) {
+    lineidx_free(&hunk->lines);
+    free(hunk->kinds);
+    hunk->kinds = NULL;
+    hunk->kinds_capacity = 0;
+}
+
+/* hunk_add_line:
+ *  line: line read from the patch, starting with ' ', '+' or '-'
+ *
+ * Returns 0 on success, non-0 on allocation failure
+ */
+int hunk_add_line(hunk_t* hunk, const char* line) {
+    size_t length = strlen(line + 1);
+    return hunk_add_hashed_line(hunk, line[0], line + 1, length, line_hash(line + 1, length, hunk->lines.flags));
+}
+
+/* hunk_add_hashed_line:
+ *  kind: ' ', '+' or '-'
+ *  text, length: the line without its kind, its hash computed ahead with the flags of the hunk lines
+ *
+ * Returns 0 on success, non-0 on allocation failure
+ */
+int hunk_add_hashed_line(hunk_t* hunk, char kind, const char* text, size_t length, uint64_t hash) {
+    if (lineidx_append_hashed(&hunk->lines, text, length, hash) != 0)
         return 1;
+
+    if (hunk->lines.capacity > hunk->kinds_capacity) {
+        char* new_kinds = realloc(hunk->kinds, hunk->lines.capacity);
+        if (new_kinds == NULL)
+            return 1;
+        hunk->kinds = new_kinds;
+        hunk->kinds_capacity = hunk->lines.capacity;
     }
-    if (options->verbose)
-        printf("Opened patch\n");
+    hunk->kinds[hunk->lines.count - 1] = kind;
 
-    char line[MAX_LINE];
-    char pushback[MAX_LINE];
-    int has_pushback = 0;
+    if (kind != '+')
+        ++hunk->proc_old;
+    if (kind != '-')
+        ++hunk->proc_new;
+    return 0;
+}
 
-    char orig_file[MAX_PATH_LEN] = {0};
-    char new_file[MAX_PATH_LEN] = {0};
-    stream_wrapper_t output_stream = { 0 };
-    stream_wrapper_t input_stream = { 0 };
+/* input_load_rest:
+ *  Loads the whole remainder of the input stream into the buffer and chains
+ *  the buffered lines by hash. From now on the file is patched from memory.
+ *
+ * Returns 0 on success, non-zero on error
+ */
+static int input_load_rest(patch_input_t* input, stream_wrapper_t* in_stream) {
+    int stat;
+    while ((stat = input_buffer_line(input, in_stream)) == 0)
+        ;
+    if (stat < 0 || lineidx_build_hash(&input->buffer) != 0)
+        return 1;
+    input->indexed = 1;
+    return 0;
+}
 
-    int cur_input_line = 1; /* track current line number in input file (1-based) */
+/* "\ No newline at end of file": the last line collected ends the file without a '\n'.
+ * The hash does not change, the '\n' never takes part in it. */
+void hunk_no_newline(hunk_t* hunk) {
+    if (hunk->lines.count == 0)
+        return;
+    line_ref_t* ref = &hunk->lines.lines[hunk->lines.count - 1];
+    if (ref->length > 0 && lineidx_text(&hunk->lines, hunk->lines.count - 1)[ref->length - 1] == '\n')
+        --ref->length;
+}
 
-    for (;;) {
-        /* Outer loop: prefer pushback line if available, else read from patch */
-        if (has_pushback) {
-            /* copy pushback into line and clear the flag */
-            strncpy(line, pushback, MAX_LINE);
-            line[MAX_LINE - 1] = '\0';
-            has_pushback = 0;
-        } else {
-            if (!sw_fgets(sw, line, MAX_LINE))
-                break;
-        }
+/* Image of the hunk: the pre-image is made of its context and deleted lines,
+ * the post-image of its context and added lines */
+/* private */
+int hunk_in_image(const hunk_t* hunk, size_t i, int image) {
+    return hunk->kinds[i] != (image == HUNK_POST_IMAGE ? '-' : '+');
+}
 
-        /* Note: lines read from patch may contain CRLF; trim_newline when parsing filenames later */
-        /* Trim newline for header parsing convenience */
-        char line_copy[MAX_LINE];
-        strncpy(line_copy, line, MAX_LINE);
-        trim_newline(line_copy);
+/* private */
+static int hunk_image_length(const hunk_t* hunk, int image) {
+    return image == HUNK_POST_IMAGE ? hunk->proc_new : hunk->proc_old;
+}
 
-        /* Note: lines read from patch may contain CRLF; trim_newline when parsing filenames later */
-        if (strncmp(line_copy, "--- ", 4) == 0) {
-            /* When starting a new diff, if we have currently open input/output finalize it first. */
+/* A hunk that only deletes has a post-image of context lines, found wherever
+ * that context is: it tells nothing about whether the hunk was applied */
+static int hunk_adds_lines(const hunk_t* hunk) {
+    return hunk->lines.count > 0 && memchr(hunk->kinds, '+', hunk->lines.count) != NULL;
+}
 
-            if (input_stream._impl || output_stream._impl) {
-                if (options->verbose)
-                    printf("Finalizing the previous file: %s\n", new_file);
-                if (finalize_file(instance, &input_stream, &output_stream, orig_file, new_file) != 0) {
-                    sw->close(sw);
-                    return 1;
-                }
-                /* reset filenames/timestamp */
-                *orig_file = *new_file = '\0';
-            }
-            /* parse original filename (token after '--- ') */
-            const char* after = parse_header_filename(line_copy + 4, orig_file, sizeof(orig_file));
-            if (options->verbose)
-                printf("Found orig: '%s'\n", orig_file);
-        } else if (strncmp(line_copy, "+++ ", 4) == 0) {
-            /* parse new filename */
-            const char* after = parse_header_filename(line_copy + 4, new_file, sizeof(new_file));
-            if (options->verbose)
-                printf("Found new: '%s'\n", new_file);
-            /* the rest of the line may be a timestamp. */
-
-            /* At this point we have both orig_file and new_file (or at least new_file). Open input and output */
-            if (input_stream._impl) {
-                input_stream.close(&input_stream);
-                memset(&input_stream, 0, sizeof(stream_wrapper_t));
-            }
-            if (output_stream._impl) {
-                output_stream.close(&output_stream);
-                memset(&output_stream, 0, sizeof(stream_wrapper_t));
-            }
+/* hunk_matches_at:
+ *  Checks whether the lines of the given image of the hunk are the buffered
+ *  input lines when the first image line sits at input line `line`. The first
+ *  `head` and the last `tail` image lines (context dropped by fuzz) are not
+ *  compared.
+ */
+static int hunk_matches_at(const hunk_t* hunk, const patch_input_t* input, int image, int line, int head, int tail) {
+    if (line + head < input->cur_line)
+        return 0;   /* already written out */
+    if (line + head < input->base_line)
+        return 0;   /* not buffered */
+
+    int length = hunk_image_length(hunk, image);
+    size_t n = (size_t)(line + head - input->base_line);
+    if (n + (size_t)(length - head - tail) > input->lines->count)
+        return 0;   /* past the end of the input */
+
+    const lineidx_t* in_lines = input->lines;
+    int old_no = 0;
+    for (size_t i = 0; i < hunk->lines.count; ++i) {
+        if (!hunk_in_image(hunk, i, image))
+            continue;
+        if (old_no++ < head || old_no > length - tail)
+            continue;
+        if (!line_equal(lineidx_text(in_lines, n), in_lines->lines[n].length, in_lines->lines[n].hash,
+                        lineidx_text(&hunk->lines, i), hunk->lines.lines[i].length, hunk->lines.lines[i].hash,
+                        in_lines->flags))
+            return 0;
+        ++n;
+    }
+    return 1;
+}
 
-            /* Determine where to read and where to write based on  */
-            int write_inplace = strcmp(orig_file, new_file) == 0;
-            const char* read_path = orig_file[0] ? orig_file : new_file;    /* fallback */
-            const char* write_path = write_inplace ? orig_file : new_file;
+/* hunk_locate:
+ *  Finds the input line nearest to `expected` where the image of the hunk
+ *  matches (see hunk_matches_at on `head` and `tail`). The rarest compared
+ *  line of the image is looked up in the input hash chains, so only the places
+ *  where that line occurs are tried. A stream read once has no index, only
+ *  the lines buffered around the hunk, which are tried one by one instead.
+ *
+ * Returns the input line of the first image line, or -1 when the image matches nowhere
+ */
+static int hunk_locate(const hunk_t* hunk, const patch_input_t* input, int image, int expected, int head, int tail) {
+    int length = hunk_image_length(hunk, image);
+    if (hunk_matches_at(hunk, input, image, expected, head, tail))
+        return expected;
+    if (length - head - tail <= 0)
+        return -1;  /* nothing to look up */
+
+    if (!input->indexed) {
+        /* nearest first, at equal distance forward */
+        int first = input->cur_line - head;
+        int end = input->base_line + (int)input->lines->count;
+        for (int dist = 1; expected + dist < end || expected - dist >= first; ++dist) {
+            if (hunk_matches_at(hunk, input, image, expected + dist, head, tail))
+                return expected + dist;
+            if (hunk_matches_at(hunk, input, image, expected - dist, head, tail))
+                return expected - dist;
+        }
+        return -1;
+    }
 
-            /* Open the target file in binary mode to preserve bytes */
-            int stat = patch_acquire_user_stream(instance, read_path, &input_stream, PATCH_STREAM_PURPOSE_INPUT);
-            if (stat != 0) {
-                fprintf(stderr, "Cannot open source file: %s\n", read_path);
-                sw->close(sw);
-                return 1;
+    /* pick the anchor: the compared line with the shortest hash chain */
+    size_t anchor = 0;      /* index within hunk lines */
+    int anchor_old = 0;     /* index within the old lines of the hunk */
+    size_t anchor_chain = (size_t)-1;
+    int old_no = 0;
+    for (size_t i = 0; i < hunk->lines.count; ++i) {
+        if (!hunk_in_image(hunk, i, image))
+            continue;
+        if (old_no >= head && old_no < length - tail) {
+            size_t chain = lineidx_chain_length(input->lines, hunk->lines.lines[i].hash);
+            if (chain < anchor_chain) {
+                anchor = i;
+                anchor_old = old_no;
+                anchor_chain = chain;
             }
+        }
+        ++old_no;
+    }
 
-            /* create temp path based on write_path */
-            stat = patch_acquire_user_stream(instance, write_path, &output_stream, PATCH_STREAM_PURPOSE_OUTPUT);
-            if (stat != 0) {
-                fprintf(stderr, "Cannot create resulted patched file: %s\n", write_path);
-                sw->close(sw);
-                return 1;
-            }
+    uint64_t hash = hunk->lines.lines[anchor].hash;
+    int best = -1;
+    int best_dist = 0;
+    for (size_t n = lineidx_first(input->lines, hash); n != LINEIDX_NONE; n = lineidx_next(input->lines, n)) {
+        if (input->lines->lines[n].hash != hash)
+            continue;   /* other line in the same bucket */
+
+        int line = input->base_line + (int)n - anchor_old;
+        int dist = line > expected ? line - expected : expected - line;
+        if (best >= 0 && dist > best_dist) {
+            if (line > expected)
+                break;  /* chains are ascending, the rest is only farther */
+            continue;
+        }
+        /* at equal distance the later (forward) place wins, like in GNU patch */
+        if (hunk_matches_at(hunk, input, image, line, head, tail)) {
+            best = line;
+            best_dist = dist;
+        }
+    }
+    return best;
+}
 
-            /* reset current input line tracking for this file */
-            cur_input_line = 1;
-        } else if (strncmp(line, "@@ ", 3) == 0) {
-            /* hunk header line */
-            int start_old = 0, len_old = 0, start_new = 0, len_new = 0;
-            int parsed = sscanf(line, "@@ -%d,%d +%d,%d @@", &start_old, &len_old, &start_new, &len_new);
-            if (parsed != 4) {
-                fprintf(stderr, "Malformed or unsupported hunk header (counts required): %s\n", line);
-                sw->close(sw);
+/* private */
+static void hunk_count_context(const hunk_t* hunk, int* ctx_head, int* ctx_tail) {
+    size_t i = 0;
+    while (i < hunk->lines.count && hunk->kinds[i] == ' ')
+        ++i;
+    *ctx_head = (int)i;
+
+    if (i == hunk->lines.count) {   /* context only, nothing to fuzz */
+        *ctx_head = *ctx_tail = 0;
+        return;
+    }
+
+    size_t j = hunk->lines.count;
+    while (j > i && hunk->kinds[j - 1] == ' ')
+        --j;
+    *ctx_tail = (int)(hunk->lines.count - j);
+}
+
+/* Line the hunk is expected at by the patch; a hunk without old lines adds its lines after line start_old */
+int hunk_patch_line(const hunk_t* hunk) {
+    return hunk->start_old + (hunk->proc_old == 0 ? 1 : 0);
+}
+
+/* Reports the placement of the hunk, see hunk_place() */
+void report_hunk(patch_instance_data_t* instance, char* path, const hunk_t* hunk) {
+    if (instance->input.replay)
+        return;
+    int offset = hunk->status == PATCH_HUNK_FAILED ? 0 : hunk->line - hunk_patch_line(hunk);
+    int fuzz = hunk->head > hunk->tail ? hunk->head : hunk->tail;
+
+    patch_evt_t event = { 0 };
+    event.type = PATCH_EVT_HUNK_RESULT;
+    event.data.hunk_event.path = path;
+    event.data.hunk_event.number = hunk->number;
+    event.data.hunk_event.status = hunk->status;
+    event.data.hunk_event.line = hunk->line;
+    event.data.hunk_event.offset = offset;
+    event.data.hunk_event.fuzz = fuzz;
+    patch_call_user_cbk(instance, &event);
+
+    if (hunk->status == PATCH_HUNK_FAILED)
+        ++instance->hunks_failed;
+
+    if (instance->result_count == instance->result_capacity) {
+        size_t new_capacity = instance->result_capacity ? instance->result_capacity * 2 : 16;
+        patch_hunk_result_t* new_results = realloc(instance->results, new_capacity * sizeof(patch_hunk_result_t));
+        if (new_results == NULL)
+            return; /* the event went out, only the summary misses the hunk */
+        instance->results = new_results;
+        instance->result_capacity = new_capacity;
+    }
+    patch_hunk_result_t* result = &instance->results[instance->result_count++];
+    snprintf(result->path, sizeof(result->path), "%s", path);
+    result->number = hunk->number;
+    result->status = hunk->status;
+    result->line = hunk->line;
+    result->offset = offset;
+    result->fuzz = fuzz;
+}
+
+/* hunk_place:
+ *  Finds the place of the hunk on the buffered input: at `line` if it is known
+ *  to match there already, else at the nearest place the input index gives,
+ *  else with up to `fuzz` outer context lines dropped, one more per round.
+ *  A hunk whose post-image is found instead was applied before.
+ *  The place is stored in the hunk, the offset the next hunk is expected at
+ *  in the input.
+ *
+ * Returns the PATCH_HUNK_* status of the hunk
+ */
+static unsigned int hunk_place(patch_instance_data_t* instance, hunk_t* hunk, int line) {
+    patch_input_t* input = &instance->input;
+    int patch_line = hunk_patch_line(hunk);
+    int expected = patch_line + input->offset;
+
+    int head = 0, tail = 0;     /* context lines dropped by fuzz */
+    if (line < 0)
+        line = hunk_locate(hunk, input, HUNK_PRE_IMAGE, expected, 0, 0);
+
+    /* Pre-image is missing, but the post-image is there: applied before */
+    if (line < 0 && hunk_adds_lines(hunk)) {
+        int applied_at = hunk_locate(hunk, input, HUNK_POST_IMAGE, expected, 0, 0);
+        if (applied_at >= 0) {
+            /* the input stays as it is; next hunks expect its growth too */
+            ++input->hunks;
+            ++input->already_applied;
+            input->offset = applied_at - patch_line + hunk->proc_new - hunk->proc_old;
+            hunk->line = applied_at;
+            hunk->head = hunk->tail = 0;
+            return hunk->status = PATCH_HUNK_ALREADY_APPLIED;
+        }
+    }
+
+    if (line < 0 && instance->fuzz > 0) {
+        int ctx_head, ctx_tail;
+        hunk_count_context(hunk, &ctx_head, &ctx_tail);
+        for (unsigned int fuzz = 1; fuzz <= instance->fuzz && line < 0; ++fuzz) {
+            int new_head = (int)fuzz < ctx_head ? (int)fuzz : ctx_head;
+            int new_tail = (int)fuzz < ctx_tail ? (int)fuzz : ctx_tail;
+            if (new_head == head && new_tail == tail)
+                break;  /* no more context to drop */
+            if (hunk->proc_old - new_head - new_tail <= 0)
+                break;  /* keep at least one line to verify */
+            head = new_head;
+            tail = new_tail;
+            line = hunk_locate(hunk, input, HUNK_PRE_IMAGE, expected, head, tail);
+        }
+    }
+
+    if (line < 0) {
+        fprintf(stderr, "Hunk #%d FAILED at %d.\n", hunk->number, expected);
+        hunk->line = expected;
+        hunk->head = hunk->tail = 0;
+        return hunk->status = PATCH_HUNK_FAILED;
+    }
+
+    input->offset = line - patch_line;
+    ++input->hunks;
+    hunk->line = line;
+    hunk->head = head;
+    hunk->tail = tail;
+    return hunk->status = PATCH_HUNK_APPLIED;
+}
+
+/* Bytes the hunk placed at `line` adds to the output less the input bytes it deletes */
+static long hunk_growth(const hunk_t* hunk, const patch_input_t* input, int line, int head, int tail) {
+    long growth = 0;
+    size_t n = (size_t)(line + head - input->base_line);
+    int old_no = 0;
+    for (size_t i = 0; i < hunk->lines.count; ++i) {
+        if (hunk->kinds[i] == '+') {
+            growth += (long)eol_converted_length(lineidx_text(&hunk->lines, i), hunk->lines.lines[i].length, input->eol);
+        } else if (old_no++ >= head && old_no <= hunk->proc_old - tail) {
+            const char* text = lineidx_text(input->lines, n);
+            size_t length = input->lines->lines[n].length;
+            if (hunk->kinds[i] == '-')
+                growth -= (long)length;
+            else if (input->convert)
+                growth += (long)eol_converted_length(text, length, input->eol) - (long)length;
+            ++n;
+        }
+    }
+    return growth;
+}
+
+/* Non-0 if the hunk only adds lines after its context, and has some context to check */
+static int hunk_appends(const hunk_t* hunk) {
+    size_t i = 0;
+    while (i < hunk->lines.count && hunk->kinds[i] == ' ')
+        ++i;
+    if (i == 0 || i == hunk->lines.count)
+        return 0;
+    for (; i < hunk->lines.count; ++i)
+        if (hunk->kinds[i] != '+')
+            return 0;
+    return 1;
+}
+
+/* append_hunk:
+ *  Fast path of a hunk that only adds lines after the end of the file, written
+ *  in place. Such a hunk has no trailing context, so its context must be the
+ *  last lines of the file. Only the tail of the input is read to check that,
+ *  backwards from the end until it holds as many lines, and only the added
+ *  lines are written, at the end of the file. The input in front of the tail
+ *  is neither read nor written, and finalize_file() finds nothing left to copy.
+ *
+ * Returns 0 if applied, 1 if the tail does not match (the input is rewound for
+ * the regular path), -1 on error
+ */
+static int append_hunk(patch_instance_data_t* instance, hunk_t* hunk, stream_wrapper_t* in_stream,
+                       stream_wrapper_t* out_stream, char* path) {
+    patch_input_t* input = &instance->input;
+    if (in_stream->seekg(in_stream, 0, SEEK_END) != 0)
+        return 1;
+    long size = in_stream->tellg(in_stream);
+    if (size <= 0)
+        return in_stream->seekg(in_stream, 0, SEEK_SET) == 0 ? 1 : -1;
+
+    dynmem_t tail;
+    if (make_dynmem(&tail, 0, 0) != 0)
+        return -1;
+
+    int stat = 0;
+    long chunk = MAX_LINE;
+    for (;;) {
+        long from = size > chunk ? size - chunk : 0;
+        size_t length = (size_t)(size - from);
+        if (dynmem_resize(&tail, length) != 0 || in_stream->seekg(in_stream, (size_t)from, SEEK_SET) != 0 ||
+            in_stream->read(in_stream, tail.buf, 1, length) != (long)length) {
+            stat = -1;
+            break;
+        }
+
+        /* a line starts after every '\n', the lines from there are cut as the stream would cut them */
+        const char* start = tail.buf;
+        if (from > 0 && (start = memchr(tail.buf, '\n', length)) != NULL)
+            ++start;
+        if (start != NULL) {
+            lineidx_clear(&input->buffer);
+            if (lineidx_append_text(&input->buffer, start, length - (size_t)(start - tail.buf), MAX_LINE) != 0) {
+                stat = -1;
+                break;
+            }
+            if (input->buffer.count >= (size_t)hunk->proc_old || from == 0)
+                break;
+        }
+        chunk *= 2;
+    }
+    dynmem_free(&tail);
+    if (stat < 0)
+        return -1;
+
+    /* the context has to be the last lines of the input, the last one complete */
+    const lineidx_t* in_lines = &input->buffer;
+    if (in_lines->count < (size_t)hunk->proc_old ||
+        lineidx_text(in_lines, in_lines->count - 1)[in_lines->lines[in_lines->count - 1].length - 1] != '\n')
+        stat = 1;
+    for (size_t i = 0; stat == 0 && i < (size_t)hunk->proc_old; ++i) {
+        size_t n = in_lines->count - (size_t)hunk->proc_old + i;
+        if (!line_equal(lineidx_text(in_lines, n), in_lines->lines[n].length, in_lines->lines[n].hash,
+                        lineidx_text(&hunk->lines, i), hunk->lines.lines[i].length, hunk->lines.lines[i].hash,
+                        in_lines->flags))
+            stat = 1;
+    }
+    if (stat == 0)
+        input_detect_eol(input, lineidx_text(in_lines, in_lines->count - 1), in_lines->lines[in_lines->count - 1].length);
+    lineidx_clear(&input->buffer);
+    if (stat != 0)
+        return in_stream->seekg(in_stream, 0, SEEK_SET) == 0 ? 1 : -1;
+
+    /* nothing of the input is left to read, the stream would only see the lines added below */
+    if (lineidx_build_hash(&input->buffer) != 0)
+        return -1;
+    input->indexed = 1;
+
+    /* the whole input stays where it is, the added lines go behind it */
+    input->in_bytes = input->out_bytes = size;
+    for (size_t i = (size_t)hunk->proc_old; i < hunk->lines.count; ++i) {
+        if (output_insert(input, out_stream, lineidx_text(&hunk->lines, i), hunk->lines.lines[i].length) != 0) {
+            fprintf(stderr, "Write error while applying hunk");
+            return -1;
+        }
+    }
+
+    /* the line count of the input is not known, the hunk is reported where the patch expects it */
+    ++input->hunks;
+    hunk->line = hunk_patch_line(hunk);
+    hunk->head = hunk->tail = 0;
+    hunk->status = PATCH_HUNK_APPLIED;
+    report_hunk(instance, path, hunk);
+    return 0;
+}
+
+/* input_keep_unwritten:
+ *  Drops the buffered lines that are written already; those a stream read
+ *  ahead past the last hunk stay, as the front of the buffer.
+ *
+ * Returns 0 on success, non-0 on allocation failure
+ */
+static int input_keep_unwritten(patch_input_t* input) {
+    size_t written = (size_t)(input->cur_line - input->base_line);
+    if (written >= input->buffer.count) {
+        lineidx_clear(&input->buffer);
+        input->base_line = input->cur_line;
+        return 0;
+    }
+    if (written == 0)
+        return 0;
+
+    lineidx_t rest;
+    if (make_lineidx(&rest) != 0)
+        return 1;
+    rest.flags = input->buffer.flags;
+    for (size_t n = written; n < input->buffer.count; ++n) {
+        if (lineidx_append_hashed(&rest, lineidx_text(&input->buffer, n), input->buffer.lines[n].length,
+                                  input->buffer.lines[n].hash) != 0) {
+            lineidx_free(&rest);
+            return 1;
+        }
+    }
+    lineidx_free(&input->buffer);
+    input->buffer = rest;
+    input->base_line = input->cur_line;
+    return 0;
+}
+
+/* apply_hunk:
+ *  Places the hunk on the input and writes the result. The hunk is expected
+ *  at its start_old line, shifted by the offset the previous hunk was found
+ *  at. The input in front of that place is streamed to the output, except the
+ *  last MAX_BACK_OFFSET lines, which are buffered together with the lines
+ *  under the hunk, so every context (' ') and deleted ('-') line is verified
+ *  before anything is written.
+ *
+ *  When the hunk does not match there, the rest of the input is loaded and
+ *  indexed by line hash, and the hunk is relocated to the nearest place where
+ *  it matches. The index is kept for the following hunks of the file.
+ *
+ *  If it matches nowhere, up to `fuzz` outer context lines on each side are
+ *  dropped, one more per round, and the index is searched again. The dropped
+ *  lines are left as they are in the input.
+ *
+ *  A stream read once (PATCH_OPTION_STREAM) is not loaded: up to
+ *  MAX_STREAM_AHEAD lines after the hunk are read ahead and searched along
+ *  with the buffered lines in front of it. Lines read ahead past the place of
+ *  the hunk stay buffered for the next one.
+ *
+ * Returns 0 on success, non-zero on error (mismatch is reported as a hunk failure).
+ */
+static int apply_hunk(patch_instance_data_t* instance, hunk_t* hunk, stream_wrapper_t* in_stream,
+                      stream_wrapper_t* out_stream, char* path) {
+    patch_input_t* input = &instance->input;
+
+    /* A first hunk that only appends to the file is checked against its tail */
+    if (input->inplace && !input->convert && input->hunks == 0 && input->cur_line == 1 && !input->indexed &&
+        !input->shared && hunk_appends(hunk)) {
+        int stat = append_hunk(instance, hunk, in_stream, out_stream, path);
+        if (stat <= 0)
+            return stat < 0 ? 1 : 0;
+    }
+
+    if (input_grows(input) && !input->indexed && input_load_rest(input, in_stream) != 0) {
+        fprintf(stderr, "Out of memory while loading input for hunk #%d\n", hunk->number);
+        return 1;
+    }
+
+    int expected = hunk_patch_line(hunk) + input->offset;
+    int line = -1;
+
+    if (!input->indexed) {
+        /* Lines a stream read ahead for the hunk before, then the input, that are too far in front of the hunk
+         * to be under it are streamed */
+        if (input_flush(input, out_stream, expected - MAX_BACK_OFFSET) != 0) {
+            fprintf(stderr, "Write error while copying pre-hunk lines");
+            return 1;
+        }
+        char file_line[MAX_LINE];
+        for (; input->cur_line < expected - MAX_BACK_OFFSET; ++input->cur_line) {
+            if (!input_read_line(input, in_stream, file_line))
+                break;
+            if (output_copy(input, out_stream, file_line, strlen(file_line)) != 0) {
+                fprintf(stderr, "Write error while copying pre-hunk lines");
                 return 1;
             }
+        }
 
-            if (!input_stream._impl || !output_stream._impl) {
-                fprintf(stderr, "Hunk encountered but no file opened for patching.\n");
-                sw->close(sw);
+        /* Buffer the rest up to the end of the hunk, after the lines still buffered */
+        if (input_keep_unwritten(input) != 0) {
+            fprintf(stderr, "Out of memory while applying hunk #%d\n", hunk->number);
+            return 1;
+        }
+        while (input->base_line + (int)input->lines->count < expected + hunk->proc_old) {
+            int stat = input_buffer_line(input, in_stream);
+            if (stat < 0) {
+                fprintf(stderr, "Out of memory while applying hunk #%d\n", hunk->number);
                 return 1;
             }
+            if (stat > 0)
+                break;  /* unexpected EOF in input; reported as mismatch below */
+        }
 
-            /* Write lines from input up to start_old - 1, but only the delta from current position */
-            char file_line[MAX_LINE];
-            int i;
-            for (i = cur_input_line; i < start_old; ++i) {
-                if (!sw_fgets(&input_stream, file_line, MAX_LINE))
-                    break;
-                if (sw_fputs(&output_stream, file_line) <= 0) {
-                    fprintf(stderr, "Write error while copying pre-hunk lines");
-                    sw->close(sw);
-                    return 1;
-                }
-                ++cur_input_line;
+        if (hunk_matches_at(hunk, input, HUNK_PRE_IMAGE, expected, 0, 0))
+            line = expected;
+        /* a stream read once is not loaded, the hunk is searched for up to MAX_STREAM_AHEAD lines past it */
+        while (line < 0 && instance->options.stream &&
+               input->base_line + (int)input->lines->count < expected + hunk->proc_old + MAX_STREAM_AHEAD) {
+            int stat = input_buffer_line(input, in_stream);
+            if (stat < 0) {
+                fprintf(stderr, "Out of memory while applying hunk #%d\n", hunk->number);
+                return 1;
+            }
+            if (stat > 0)
+                break;
+        }
+        /* the hunk is elsewhere, or no line read so far tells the EOL of the file */
+        if ((line < 0 || input->detect_eol) && !instance->options.stream) {
+            if (input_load_rest(input, in_stream) != 0) {
+                fprintf(stderr, "Out of memory while indexing input for hunk #%d\n", hunk->number);
+                return 1;
             }
+            if (line < 0 && instance->options.verbose && !input->replay)
+                printf("Hunk #%d not found at line %d, indexed %zu input lines\n", hunk->number, expected,
+                       input->lines->count);
+        }
+    }
 
-            /* Process hunk lines; Strictly track numbers of old/new lines processed
-             * from the @@ header (len_old, len_new). Treat any line that does not
-             * start with ' ', '+' or '-' as the start of the next header and push
-             * it back. If counts are not satisfied when the hunk ends, treat it
-             * as an error (malformed patch). */
-            int proc_old = 0;   /* how many old (input) lines consumed in this hunk */
-            int proc_new = 0;   /* how many new (output) lines consumed in this hunk */
-
-            while (proc_old < len_old || proc_new < len_new) {
-                if (!sw_fgets(sw, line, MAX_LINE)) {
-                    fprintf(stderr, "Unexpected EOF inside hunk header at file '%s'.\n", new_file);
-                    sw->close(sw);
-                    return 1;
-                }
+    unsigned int status = hunk_place(instance, hunk, line);
+    if (status == PATCH_HUNK_FAILED) {
+        report_hunk(instance, path, hunk);
+        return instance->options.dry_run ? 0 : 1;  /* a check goes on with the next hunk */
+    }
+    if (status == PATCH_HUNK_ALREADY_APPLIED) {
+        report_hunk(instance, path, hunk);
+        return 0;
+    }
 
-                /* Non-hunk-leading char → push back as next header/start and stop. */
-                if (line[0] != ' ' && line[0] != '+' && line[0] != '-') {
-                    strncpy(pushback, line, MAX_LINE);
-                    pushback[MAX_LINE - 1] = '\0';
-                    has_pushback = 1;
-                    break;
-                }
+    line = hunk->line;
+    int head = hunk->head, tail = hunk->tail;
 
-                if (line[0] == '-') {
-                    /* deleted line: consume one line from input but do not write it */
-                    if (sw_fgets(&input_stream, file_line, MAX_LINE)) {
-                        ++cur_input_line;
-                        ++proc_old;
-                    } else {
-                        /* unexpected EOF in input; count is as consumed for strictness */
-                        ++proc_old;
-                    }
-                } else if (line[0] == '+') {
-                    /* added line: write without consuming input; write everything after the '+' */
-                    if (sw_fputs(&output_stream, line + 1) <= 0) {
-                        fprintf(stderr, "Write error while applying hunk");
-                        sw->close(sw);
-                        return 1;
-                    }
-                    ++proc_new;
-                } else {    /* line[0] == ' ' */
-                    /* context line: copy from input to output */
-                    if (sw_fgets(&input_stream, file_line, MAX_LINE)) {
-                        if (sw_fputs(&output_stream, file_line) <= 0) {
-                            fprintf(stderr, "Write error while applying hunk");
-                            sw->close(sw);
-                            return 1;
-                        }
-                        ++cur_input_line;
-                        ++proc_old;
-                        ++proc_new;
-                    } else {
-                        /* unexpected EOF in input; write the provided context instead */
-                        if (sw_fputs(&output_stream, line + 1) <= 0) {
-                            fprintf(stderr, "Write error while applying hunk");
-                            sw->close(sw);
-                            return 1;
-                        }
-                        ++proc_new;
-                    }
-                }
+    /* Input lines in front of the hunk, including the context dropped by fuzz */
+    if (input_flush(input, out_stream, line + head) != 0) {
+        fprintf(stderr, "Write error while copying pre-hunk lines");
+        return 1;
+    }
+
+    /* In place, the output may not overtake the input that is still to be read */
+    if (input->inplace && !input->indexed &&
+        input->out_bytes + hunk_growth(hunk, input, line, head, tail) > input->in_bytes &&
+        input_load_rest(input, in_stream) != 0) {
+        fprintf(stderr, "Out of memory while loading input for hunk #%d\n", hunk->number);
+        return 1;
+    }
+
+    /* Emit: context lines come from the input, added lines from the patch */
+    size_t in_line = (size_t)(line + head - input->base_line);
+    int old_no = 0;
+    for (size_t i = 0; i < hunk->lines.count; ++i) {
+        int stat;
+        if (hunk->kinds[i] == '+') {
+            stat = output_insert(input, out_stream, lineidx_text(&hunk->lines, i), hunk->lines.lines[i].length);
+        } else {
+            if (old_no++ < head || old_no > hunk->proc_old - tail)
+                continue;   /* dropped context stays in the input */
+            size_t n = in_line++;
+            if (hunk->kinds[i] == '-') {
+                input->in_bytes += (long)input->lines->lines[n].length;
+                continue;
             }
+            stat = output_copy(input, out_stream, lineidx_text(input->lines, n), input->lines->lines[n].length);
+        }
+        if (stat != 0) {
+            fprintf(stderr, "Write error while applying hunk");
+            return 1;
+        }
+    }
+
+    input->cur_line = line + hunk->proc_old - tail;
+    report_hunk(instance, path, hunk);
+    return 0;
+}
+
+/* Appends a hunk to the pending hunks of the current file, the memory of
+ * hunks collected for earlier files is reused
+ *
+ * Returns the empty hunk, NULL on allocation failure
+ */
+static hunk_t* pending_add(patch_instance_data_t* instance) {
+    if (instance->pending_count == instance->pending_capacity) {
+        size_t new_capacity = instance->pending_capacity ? instance->pending_capacity * 2 : 16;
+        hunk_t* new_pending = realloc(instance->pending, new_capacity * sizeof(hunk_t));
+        if (new_pending == NULL)
+            return NULL;
+        memset(new_pending + instance->pending_capacity, 0,
+               (new_capacity - instance->pending_capacity) * sizeof(hunk_t));
+        for (size_t i = instance->pending_capacity; i < new_capacity; ++i)
+            make_lineidx(&new_pending[i].lines);
+        instance->pending = new_pending;
+        instance->pending_capacity = new_capacity;
+    }
+
+    hunk_t* hunk = &instance->pending[instance->pending_count++];
+    hunk_reset(hunk);
+    hunk->lines.flags = instance->hunk.lines.flags;
+    return hunk;
+}
+
+/* A placed hunk with where its changes and its verified lines lie on a doubled
+ * line axis: input line L is 2L, the gap in front of it 2L - 1 */
+typedef struct hunk_span {
+    hunk_t* hunk;
+    int change_lo, change_hi;   /* -1 if the hunk changes nothing */
+    int region_lo, region_hi;
+} hunk_span_t;
 
-            /* continue to outer loop which will consume the pushback if set */
+/* private */
+static void hunk_span(hunk_t* hunk, hunk_span_t* span) {
+    span->hunk = hunk;
+    span->change_lo = span->change_hi = -1;
+
+    int line = hunk->line;
+    for (size_t i = 0; i < hunk->lines.count; ++i) {
+        int at;
+        if (hunk->kinds[i] == ' ') {
+            ++line;
+            continue;
         }
-        /* other lines in patch are ignored (e.g., index lines, timestamps) */
+        if (hunk->kinds[i] == '-')
+            at = 2 * line++;
+        else
+            at = 2 * line - 1;
+        if (span->change_lo < 0)
+            span->change_lo = at;
+        span->change_hi = at;
     }
 
-    /* after loop, finalize any remaining open file */
-    if (input_stream._impl || output_stream._impl) {
-        if (options->verbose)
-            printf("Finalizing last file: %s\n", new_file);
-        if (finalize_file(instance, &input_stream, &output_stream, orig_file, new_file) != 0) {
-            sw->close(sw);
+    int first = hunk->line + hunk->head;
+    int end = hunk->line + hunk->proc_old - hunk->tail;
+    span->region_lo = end > first ? 2 * first : 2 * first - 1;
+    span->region_hi = end > first ? 2 * (end - 1) : 2 * first - 1;
+}
+
+/* private */
+static int compare_old_lines(const void* a, const void* b) {
+    const hunk_t* x = *(const hunk_t* const*)a;
+    const hunk_t* y = *(const hunk_t* const*)b;
+    if (x->start_old != y->start_old)
+        return x->start_old < y->start_old ? -1 : 1;
+    return x->number < y->number ? -1 : x->number > y->number;
+}
+
+/* private */
+static int compare_changes(const void* a, const void* b) {
+    const hunk_span_t* x = (const hunk_span_t*)a;
+    const hunk_span_t* y = (const hunk_span_t*)b;
+    if (x->change_lo != y->change_lo)
+        return x->change_lo < y->change_lo ? -1 : 1;
+    return x->hunk->number < y->hunk->number ? -1 : x->hunk->number > y->hunk->number;
+}
+
+/* hunk_write_changes:
+ *  Writes a hunk placed on the loaded input from its first change to its
+ *  last. The context around the changes is left in the input, so hunks may
+ *  share it.
+ *
+ * Returns 0 on success, non-zero on write error
+ */
+static int hunk_write_changes(patch_input_t* input, const hunk_t* hunk, stream_wrapper_t* out_stream) {
+    size_t first = 0, last = hunk->lines.count;
+    while (first < last && hunk->kinds[first] == ' ')
+        ++first;
+    while (last > first && hunk->kinds[last - 1] == ' ')
+        --last;
+
+    int line = hunk->line + (int)first;
+    if (input_flush(input, out_stream, line) != 0)
+        return 1;
+    for (size_t i = first; i < last; ++i) {
+        if (hunk->kinds[i] == '+') {
+            if (output_insert(input, out_stream, lineidx_text(&hunk->lines, i), hunk->lines.lines[i].length) != 0)
+                return 1;
+            continue;
+        }
+        size_t n = (size_t)(line++ - input->base_line);
+        if (hunk->kinds[i] == '-')
+            input->in_bytes += (long)input->lines->lines[n].length;
+        else if (output_copy(input, out_stream, lineidx_text(input->lines, n), input->lines->lines[n].length) != 0)
             return 1;
+    }
+    input->cur_line = line;
+    return 0;
+}
+
+/* apply_pending_hunks:
+ *  Applies the hunks collected for the file with PATCH_OPTION_UNORDERED. The
+ *  whole input is loaded and indexed, so every line can be reached. Hunks are
+ *  placed in order of their old lines, whatever their order in the patch,
+ *  each expected at the offset of the one before. Then they are checked
+ *  against each other: lines a hunk changes may not be among the lines another
+ *  hunk verified, but context may be shared. The changes are written in input
+ *  order and the results reported in patch order.
+ *
+ * Returns 0 on success, non-zero on error or if a hunk failed (a dry run goes on)
+ */
+static int apply_pending_hunks(patch_instance_data_t* instance, stream_wrapper_t* in_stream,
+                               stream_wrapper_t* out_stream, char* path) {
+    patch_input_t* input = &instance->input;
+    size_t count = instance->pending_count;
+
+    if (!input->indexed && input_load_rest(input, in_stream) != 0) {
+        fprintf(stderr, "Out of memory while indexing input of %s\n", path);
+        return 1;
+    }
+
+    hunk_t** order = malloc(count * sizeof(hunk_t*));
+    hunk_span_t* spans = malloc(count * sizeof(hunk_span_t));
+    if (order == NULL || spans == NULL) {
+        fprintf(stderr, "Out of memory while sorting hunks of %s\n", path);
+        free(order);
+        free(spans);
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        order[i] = &instance->pending[i];
+    qsort(order, count, sizeof(hunk_t*), &compare_old_lines);
+    for (size_t i = 0; i < count; ++i)
+        hunk_place(instance, order[i], -1);
+
+    size_t placed = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (instance->pending[i].status == PATCH_HUNK_APPLIED)
+            hunk_span(&instance->pending[i], &spans[placed++]);
+    }
+    qsort(spans, placed, sizeof(hunk_span_t), &compare_changes);
+
+    /* every hunk must change only lines no earlier hunk verified, and keep away from their changes */
+    const hunk_span_t* last_change = NULL;
+    const hunk_span_t* last_region = NULL;
+    for (size_t i = 0; i < placed; ++i) {
+        hunk_span_t* span = &spans[i];
+        if (span->change_lo < 0)
+            continue;   /* context only */
+        const hunk_span_t* other = NULL;
+        if (last_region != NULL && last_region->region_hi >= span->change_lo)
+            other = last_region;
+        else if (last_change != NULL && last_change->change_hi >= span->region_lo)
+            other = last_change;
+        if (other != NULL) {
+            fprintf(stderr, "Hunk #%d FAILED at %d, it overlaps hunk #%d.\n", span->hunk->number, span->hunk->line,
+                    other->hunk->number);
+            span->hunk->status = PATCH_HUNK_FAILED;
+            span->change_lo = -1;
+            continue;
         }
+        if (last_region == NULL || span->region_hi > last_region->region_hi)
+            last_region = span;
+        if (last_change == NULL || span->change_hi > last_change->change_hi)
+            last_change = span;
     }
 
-    sw->close(sw);
+    for (size_t i = 0; i < count; ++i)
+        report_hunk(instance, path, &instance->pending[i]);
+
+    int stat = 0;
+    for (size_t i = 0; i < count && !instance->options.dry_run; ++i)
+        stat |= instance->pending[i].status == PATCH_HUNK_FAILED;
+    for (size_t i = 0; i < placed && stat == 0; ++i) {
+        if (spans[i].change_lo >= 0 && hunk_write_changes(input, spans[i].hunk, out_stream) != 0) {
+            fprintf(stderr, "Write error while applying hunk");
+            stat = 1;
+        }
+    }
+
+    free(order);
+    free(spans);
+    return stat;
+}
+
+/* Resets the input tracking for the next file, with the EOL policy of the options */
+static void input_begin(patch_instance_data_t* instance, int inplace) {
+    patch_options_t* options = &instance->options;
+    input_reset(&instance->input);
+    instance->input.inplace = inplace;
+    instance->input.script = instance->script;
+    if (options->eol_crlf || options->eol_lf) {
+        instance->input.eol = options->eol_crlf ? "\r\n" : "\n";
+        instance->input.convert = 1;
+    } else {
+        instance->input.detect_eol = options->eol_preserve;
+    }
+    instance->pending_count = 0;
+}
+
+/* begin_file:
+ *  Opens the input stream of the next file and resets the input tracking; the
+ *  output is opened by output_open(), right away or, if the hunks are
+ *  collected, once they are and its size is known. With --force-inplace,
+ *  unless `allow_inplace` is 0, the output is the input file itself and
+ *  `new_file` becomes its path.
+ *
+ * Returns 0 on success, non-0 on error (reported)
+ */
+int begin_file(patch_instance_data_t* instance, char* orig_file, char* new_file, int allow_inplace,
+               stream_wrapper_t* input_stream) {
+    patch_options_t* options = &instance->options;
+
+    /* Determine where to read and where to write based on  */
+    int write_inplace = strcmp(orig_file, new_file) == 0;
+    const char* read_path = orig_file[0] ? orig_file : new_file;    /* fallback */
+    const char* write_path = write_inplace ? orig_file : new_file;
+
+    /* --force-inplace: the changes go right into the file that is read */
+    int inplace = options->inplace && !options->dry_run && allow_inplace;
+    if (inplace) {
+        if (read_path != new_file)
+            strcpy(new_file, read_path);
+        write_path = read_path;
+    }
+
+    /* Open the target file in binary mode to preserve bytes */
+    const lineidx_t* input_index = NULL;
+    int stat = patch_acquire_user_stream(instance, (char*)read_path, input_stream, PATCH_STREAM_PURPOSE_INPUT,
+                                         &input_index, -1);
+    if (stat != 0) {
+        fprintf(stderr, "Cannot open source file: %s\n", read_path);
+        return 1;
+    }
+
+    input_begin(instance, inplace);
+    instance->input.out_pending = 1;
+    snprintf(instance->input.out_path, MAX_PATH_LEN, "%s", write_path);
+
+    /* Use a ready index of the input if it is hashed the way we compare lines */
+    if (input_index != NULL && input_index->flags == instance->input.buffer.flags &&
+        input_index->bucket_mask != 0) {
+        instance->input.lines = input_index;
+        instance->input.shared = 1;
+        instance->input.indexed = 1;
+        for (size_t n = 0; n < input_index->count && instance->input.detect_eol; ++n)
+            input_detect_eol(&instance->input, lineidx_text(input_index, n), input_index->lines[n].length);
+    }
+    return 0;
+}
+
+/* index_begin:
+ *  Starts the blob hashes of the file with --verify-index, from the `index`
+ *  line of its section. Both need the size of the input, taken from the end
+ *  of its stream before it is read; a ready index of the input is hashed
+ *  right away, its stream is not read. The output hash needs the size of the
+ *  output too, so the hunks are collected and finalize_file() starts it. A
+ *  created file has no input, create_hunk() starts its output hash.
+ *
+ * Returns 0 on success, non-0 if the input size is not known (reported)
+ */
+static int index_begin(patch_instance_data_t* instance, const git_section_t* git, stream_wrapper_t* in_stream) {
+    patch_input_t* input = &instance->input;
+    if (!instance->options.verify_index || !git->active)
+        return 0;
+
+    int in = blobhash_init(&input->in_hash, git->old_index) == 0;
+    /* with another EOL the output is not the new blob */
+    int out = input->eol == NULL && !input->detect_eol && blobhash_init(&input->out_hash, git->new_index) == 0;
+    if (in_stream == NULL || (!in && !out))
+        return 0;
+
+    if (in_stream->seekg(in_stream, 0, SEEK_END) != 0 || (input->in_size = in_stream->tellg(in_stream)) < 0 ||
+        in_stream->seekg(in_stream, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "Cannot verify %s against its index line, its size is not known\n", git->old_path);
+        return 1;
+    }
+    blobhash_begin(&input->in_hash, (size_t)input->in_size);
+    for (size_t n = 0; input->shared && n < input->lines->count; ++n)
+        blobhash_update(&input->in_hash, lineidx_text(input->lines, n), input->lines->lines[n].length);
+    input->collect = out;
+    return 0;
+}
+
+/* open_section:
+ *  Opens the file of a section once both of its paths are known. A deleted
+ *  file is only noted, it is removed unread when the section ends; a created
+ *  one has no input; any other file gets its input and output streams. If
+ *  all hunks of the file are at hand (a compiled patch), `growth` gives the
+ *  bytes they add to it, so the output is acquired with its size; NULL if not.
+ *
+ * Returns 0 on success, non-0 on error (reported)
+ */
+int open_section(patch_instance_data_t* instance, git_section_t* git, char* orig_file, char* new_file,
+                 const long* growth, int* creating, stream_wrapper_t* in_stream,
+                 stream_wrapper_t* out_stream) {
+    patch_options_t* options = &instance->options;
+    if (in_stream->_impl) {
+        in_stream->close(in_stream);
+        memset(in_stream, 0, sizeof(stream_wrapper_t));
+    }
+    if (out_stream->_impl) {
+        out_stream->close(out_stream);
+        memset(out_stream, 0, sizeof(stream_wrapper_t));
+    }
+
+    /* a file deleted by a git section or a /dev/null output is removed whole, unread */
+    if (!git->active && strcmp(new_file, DEV_NULL) == 0 && strcmp(orig_file, DEV_NULL) != 0) {
+        memset(git, 0, sizeof(git_section_t));
+        git->active = 1;
+        git->deleted = 1;
+        snprintf(git->old_path, MAX_PATH_LEN, "%s", orig_file);
+    }
+    if (git->active && git->deleted) {
+        git->content = 1;
+        return 0;
+    }
+
+    /* a file created from /dev/null is written from its hunk alone, there is no input */
+    if (strcmp(orig_file, DEV_NULL) == 0 && strcmp(new_file, DEV_NULL) != 0) {
+        input_begin(instance, 0);
+        index_begin(instance, git, NULL);
+        *creating = 1;
+        git->content = 1;
+        git->inplace = 0;
+        return 0;
+    }
+
+    /* a copy or a new file has no input to write into, a file to verify is not written before it is */
+    int allow_inplace = !(git->active && (git->copy || git->created || (options->verify_index && git->old_index[0]))) &&
+                        instance->cache_dir == NULL && instance->script == NULL;
+    if (begin_file(instance, orig_file, new_file, allow_inplace, in_stream) != 0 ||
+        index_begin(instance, git, in_stream) != 0)
+        return 1;
+    /* outputs are cached by the hunks of the file, they are collected for it */
+    if (instance->cache_dir != NULL && instance->script == NULL && !options->dry_run && !options->stream &&
+        !instance->input.shared && instance->input.in_hash.kinds == 0 && instance->input.out_hash.kinds == 0) {
+        instance->input.cache = 1;
+        instance->input.collect = 1;
+    }
+    /* a file written in place is not touched before all of its hunks are at hand */
+    if (instance->input.inplace)
+        instance->input.collect = 1;
+    /* hunks applied as they are read are written right away */
+    if (!options->unordered && !instance->input.collect &&
+        output_open(instance, out_stream, growth != NULL ? output_size(instance, in_stream, *growth) : -1) != 0)
+        return 1;
+    git->content = 1;
+    git->inplace = instance->input.inplace;
+    return 0;
+}
+
+/* Empty hunk to collect the next hunk of the section into: a pending one if
+ * the hunks of the file are collected, NULL on error (reported) */
+hunk_t* section_hunk(patch_instance_data_t* instance, const git_section_t* git, int creating,
+                     const stream_wrapper_t* in_stream, const stream_wrapper_t* out_stream, int number) {
+    /* hunks of a deleted file are not applied, the file is removed unread */
+    int skipped = git->active && git->deleted;
+    if (!skipped && !creating && (!in_stream->_impl || (!out_stream->_impl && !instance->input.out_pending))) {
+        fprintf(stderr, "Hunk encountered but no file opened for patching.\n");
+        return NULL;
+    }
+
+    int collect = instance->options.unordered || instance->input.collect;
+    hunk_t* hunk = collect && !skipped && !creating ? pending_add(instance) : &instance->hunk;
+    if (hunk == NULL) {
+        fprintf(stderr, "Out of memory while reading hunk #%d\n", number);
+        return NULL;
+    }
+    hunk_reset(hunk);
+    return hunk;
+}
+
+/* take_hunk:
+ *  Takes a hunk of the section once it is collected. Unordered hunks, or
+ *  hunks of an output to hash or cache, wait for the rest of the file, see
+ *  finalize_file().
+ *
+ * Returns 0 on success, non-0 on error
+ */
+int take_hunk(patch_instance_data_t* instance, hunk_t* hunk, git_section_t* git, int creating,
+              stream_wrapper_t* in_stream, stream_wrapper_t* out_stream, char* path) {
+    if (git->active && git->deleted)
+        return delete_hunk(instance, hunk, git);
+    if (creating)
+        return create_hunk(instance, hunk, out_stream, path);
+    if (!instance->options.unordered && !instance->input.collect)
+        return apply_hunk(instance, hunk, in_stream, out_stream, path);
     return 0;
 }
 
@@ -520,6 +2048,9 @@ void* patch_init() {
     patch_instance_data_t* instance = calloc(1, sizeof(patch_instance_data_t));
 
     instance->path_cbk = &default_patch_evt_cbk;
+    make_lineidx(&instance->hunk.lines);
+    make_lineidx(&instance->input.buffer);
+    instance->input.lines = &instance->input.buffer;
 
     return instance;
 }
@@ -529,6 +2060,18 @@ int patch_destroy(void* self) {
         return -1;
     patch_instance_data_t* instance = (patch_instance_data_t*)self;
 
+    hunk_free(&instance->hunk);
+    for (size_t i = 0; i < instance->pending_capacity; ++i)
+        hunk_free(&instance->pending[i]);
+    free(instance->pending);
+    free(instance->results);
+    free(instance->cache_dir);
+    /* a patch fed but never finished */
+    if (instance->parser != NULL)
+        parser_abort(instance, instance->parser);
+    free(instance->parser);
+    binpatch_free(&instance->binary);
+    lineidx_free(&instance->input.buffer);
     free(self);
     return 0;
 }
@@ -547,10 +2090,84 @@ int patch_set_options(void* self, unsigned int opts) {
     if (opts & PATCH_OPTION_VERBOSE) {
         instance->options.verbose = 1;
     }
+    if (opts & PATCH_OPTION_IGNORE_WHITESPACE) {
+        instance->options.ignore_whitespace = 1;
+    }
+    if (opts & PATCH_OPTION_IGNORE_EOL) {
+        instance->options.ignore_eol = 1;
+    }
+    if (opts & PATCH_OPTION_REVERSE) {
+        instance->options.reverse = 1;
+    }
+    if (opts & PATCH_OPTION_DRY_RUN) {
+        instance->options.dry_run = 1;
+    }
+    if (opts & PATCH_OPTION_UNORDERED) {
+        instance->options.unordered = 1;
+    }
+    if (opts & PATCH_OPTION_EOL_PRESERVE) {
+        instance->options.eol_preserve = 1;
+    }
+    if (opts & PATCH_OPTION_EOL_LF) {
+        instance->options.eol_lf = 1;
+    }
+    if (opts & PATCH_OPTION_EOL_CRLF) {
+        instance->options.eol_crlf = 1;
+    }
+    if (opts & PATCH_OPTION_VERIFY_DELETE) {
+        instance->options.verify_delete = 1;
+    }
+    if (opts & PATCH_OPTION_VERIFY_INDEX) {
+        instance->options.verify_index = 1;
+    }
+    if (opts & PATCH_OPTION_STREAM) {
+        /* every option that seeks or reads a file twice is off */
+        instance->options.stream = 1;
+        instance->options.inplace = 0;
+        instance->options.unordered = 0;
+        instance->options.verify_index = 0;
+    }
+
+    /* Hunk and input lines must be hashed alike to be compared */
+    unsigned int match_flags = patch_line_flags((instance->options.ignore_whitespace ? PATCH_OPTION_IGNORE_WHITESPACE : 0) |
+                                                (instance->options.ignore_eol ? PATCH_OPTION_IGNORE_EOL : 0));
+    instance->hunk.lines.flags = match_flags;
+    instance->input.buffer.flags = match_flags;
 
     return 1;
 }
 
+unsigned int patch_line_flags(unsigned int opts) {
+    return ((opts & PATCH_OPTION_IGNORE_WHITESPACE) ? LINEIDX_IGNORE_WHITESPACE : 0) |
+           ((opts & PATCH_OPTION_IGNORE_EOL) ? LINEIDX_IGNORE_EOL : 0);
+}
+
+int patch_set_fuzz(void* self, unsigned int fuzz) {
+    if (self == NULL)   /* Invalid instance pointer */
+        return -1;
+    patch_instance_data_t* instance = (patch_instance_data_t*)self;
+
+    instance->fuzz = fuzz;
+    return 0;
+}
+
+int patch_set_cache_dir(void* self, const char* dir) {
+    if (self == NULL)   /* Invalid instance pointer */
+        return -1;
+    patch_instance_data_t* instance = (patch_instance_data_t*)self;
+
+    char* copy = NULL;
+    if (dir != NULL) {
+        size_t length = strlen(dir) + 1;
+        if ((copy = malloc(length)) == NULL)
+            return 1;
+        memcpy(copy, dir, length);
+    }
+    free(instance->cache_dir);
+    instance->cache_dir = copy;
+    return 0;
+}
+
 int patch_set_path_cbk(void* self, patch_event_cbk_t* new_cbk, void* userdata) {
     if (self == NULL) /* Invalid instance pointer */
         return -1;
@@ -561,3 +2178,119 @@ int patch_set_path_cbk(void* self, patch_event_cbk_t* new_cbk, void* userdata) {
 
     return 0;
 }
+
+int patch_scan_hunks(void* self, stream_wrapper_t* sw, patch_range_cbk_t* cbk, void* userdata) {
+    if (self == NULL)   /* Invalid instance pointer */
+        return 1;
+    patch_instance_data_t* instance = (patch_instance_data_t*)self;
+    if (sw == NULL || cbk == NULL)
+        return 1;
+
+    char line[MAX_LINE];
+    int has_line = 0;   /* `line` holds a line read ahead by the hunk body loop */
+    char orig_file[MAX_PATH_LEN] = {0};
+    char new_file[MAX_PATH_LEN] = {0};
+    int git = 0;        /* inside a `diff --git` section: 1 before its file headers, 2 after */
+    int stat = 0;
+
+    while (stat == 0 && (has_line || sw_fgets(sw, line, MAX_LINE))) {
+        has_line = 0;
+        /* the paths are read as apply_patch() reads them: a git section drops the a/ b/ prefixes of the file
+         * headers up to its content, a plain diff dates the missing side of a created or deleted file */
+        if (strncmp(line, "diff --git ", 11) == 0) {
+            git = 1;
+        } else if (strncmp(line, "Binary files ", 13) == 0) {
+            git = 0;
+        } else if (strncmp(line, "--- ", 4) == 0 || strncmp(line, "+++ ", 4) == 0) {
+            int old_side = line[0] == '-';
+            if (old_side) {
+                *orig_file = *new_file = '\0';
+                git = git == 1 ? 2 : 0;
+            }
+            char* path = old_side != instance->options.reverse ? orig_file : new_file;
+            const char* after = parse_header_filename(line + 4, path, MAX_PATH_LEN);
+            if (git)
+                git_strip_prefix(path);
+            else if (header_is_epoch(after))
+                strcpy(path, DEV_NULL);
+        } else if (strncmp(line, "@@ ", 3) == 0) {
+            int start_old = 0, len_old = 0, start_new = 0, len_new = 0;
+            if (patch_hunk_header(line, &start_old, &len_old, &start_new, &len_new) != 0) {
+                fprintf(stderr, "Malformed hunk header: %s\n", line);
+                stat = 1;
+                break;
+            }
+
+            /* the file apply_patch() would read, or the one it creates */
+            const char* path = orig_file[0] && strcmp(orig_file, DEV_NULL) != 0 ? orig_file : new_file;
+            if (instance->options.reverse)
+                stat = cbk(path, start_new, len_new, start_old, len_old, userdata);
+            else
+                stat = cbk(path, start_old, len_old, start_new, len_new, userdata);
+
+            /* skip the body, so its lines are not taken for headers */
+            int old_left = len_old, new_left = len_new;
+            while (old_left > 0 || new_left > 0) {
+                if (!sw_fgets(sw, line, MAX_LINE))
+                    break;
+                if (line[0] == '\\')
+                    continue;
+                if (line[0] != ' ' && line[0] != '+' && line[0] != '-') {
+                    has_line = 1;
+                    break;
+                }
+                old_left -= line[0] != '+';
+                new_left -= line[0] != '-';
+            }
+        }
+    }
+
+    sw->close(sw);
+    return stat;
+}
+
+const char* patch_header_path(const char* line, char* path, size_t len) {
+    if (line == NULL || (strncmp(line, "--- ", 4) != 0 && strncmp(line, "+++ ", 4) != 0))
+        return NULL;
+    return parse_header_filename(line + 4, path, len);
+}
+
+/* Parses "start[,count]" of a hunk header, an omitted count is 1 */
+static int parse_hunk_range(const char** p, int* start, int* count) {
+    char* end = NULL;
+    long value = strtol(*p, &end, 10);
+    if (end == *p || value < 0)
+        return 1;
+    *start = (int)value;
+    *count = 1;
+    if (*end == ',') {
+        const char* q = end + 1;
+        value = strtol(q, &end, 10);
+        if (end == q || value < 0)
+            return 1;
+        *count = (int)value;
+    }
+    *p = end;
+    return 0;
+}
+
+int patch_hunk_header(const char* line, int* start_old, int* len_old, int* start_new, int* len_new) {
+    if (line == NULL || strncmp(line, "@@ -", 4) != 0)
+        return 1;
+    const char* p = line + 4;
+    if (parse_hunk_range(&p, start_old, len_old) != 0 || strncmp(p, " +", 2) != 0)
+        return 1;
+    p += 2;
+    if (parse_hunk_range(&p, start_new, len_new) != 0 || strncmp(p, " @@", 3) != 0)
+        return 1;
+    return 0;
+}
+
+size_t patch_get_results(void* self, const patch_hunk_result_t** results) {
+    if (self == NULL || results == NULL)    /* Invalid instance or output pointer */
+        return 0;
+    patch_instance_data_t* instance = (patch_instance_data_t*)self;
+
+    *results = instance->results;
+    return instance->result_count;
+}
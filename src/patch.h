@@ -2,16 +2,45 @@
 #define PATCH_H_INCLUDED_
 
 #include "csw.h"
+#include "lineidx.h"
 
-#define PATCH_OPTION_INPLACE    0x1
+#define PATCH_OPTION_INPLACE    0x1         /* write into the file from the `---` line, only from the first change on */
 #define PATCH_OPTION_APPLYDATES 0x2
 #define PATCH_OPTION_VERBOSE    0x4
+#define PATCH_OPTION_IGNORE_WHITESPACE 0x8  /* blank runs match any blank run, trailing blanks are ignored */
+#define PATCH_OPTION_IGNORE_EOL 0x10        /* CRLF input lines match LF patch lines and vice versa */
+#define PATCH_OPTION_REVERSE    0x20        /* apply the patch as if its old and new sides were swapped */
+#define PATCH_OPTION_DRY_RUN    0x40        /* match every hunk, but acquire no output streams */
+#define PATCH_OPTION_UNORDERED  0x80        /* hunks of a file may come in any order, see apply_patch() */
+/* EOL of the output lines. By default every line keeps the EOL it comes with,
+ * from the input or from the patch. PRESERVE writes the added lines with the
+ * EOL of the first input line that has one; LF and CRLF write every line with
+ * that EOL (CRLF wins if both are set). A lone '\r' is never converted. */
+#define PATCH_OPTION_EOL_PRESERVE 0x100
+#define PATCH_OPTION_EOL_LF     0x200
+#define PATCH_OPTION_EOL_CRLF   0x400
+#define PATCH_OPTION_VERIFY_DELETE 0x800    /* delete a file only if it is the deleted lines, see apply_patch() */
+#define PATCH_OPTION_VERIFY_INDEX 0x1000    /* check files against the blob hashes of git `index` lines, see apply_patch() */
+#define PATCH_OPTION_STREAM     0x2000      /* read every stream once from the front, never seek, see apply_patch() */
 
 #define PATCH_EVT_STREAM_ACQUIRE 0x1
 #define PATCH_EVT_STREAM_RELEASE 0x2
+#define PATCH_EVT_HUNK_RESULT    0x3
+/* file operations of `diff --git` sections, done without touching the content */
+#define PATCH_EVT_FILE_RENAME    0x4    /* move file_event.path to file_event.new_path, replacing it */
+#define PATCH_EVT_FILE_DELETE    0x5    /* remove file_event.path */
+#define PATCH_EVT_FILE_MODE      0x6    /* set the permission bits of file_event.path to file_event.mode */
 
 #define PATCH_STREAM_PURPOSE_INPUT 0x1
 #define PATCH_STREAM_PURPOSE_OUTPUT 0x2
+/* output written into the input file itself (PATCH_OPTION_INPLACE): the stream is
+ * opened for update without truncating, written at the offsets set with seekp,
+ * and on release the file is cut at the stream's write position */
+#define PATCH_STREAM_PURPOSE_INPLACE 0x3
+
+#define PATCH_HUNK_APPLIED 0x1
+#define PATCH_HUNK_FAILED  0x2
+#define PATCH_HUNK_ALREADY_APPLIED 0x3  /* post-image found instead of the pre-image, skipped */
 
 typedef struct patch_evt {
     unsigned int type;
@@ -21,12 +50,52 @@ typedef struct patch_evt {
             char* path;
             stream_wrapper_t* stream;
             unsigned int purpose;
+            /* optional, set by the user on INPUT acquire: index of the whole stream content,
+             * hashed (lineidx_build_hash) with the matching flags of the patcher; the patcher
+             * then reads the lines from it and leaves the stream alone */
+            const lineidx_t* index;
+            /* OUTPUT or INPLACE acquire: the size the output will have, -1 if not known;
+             * the user may reserve the space, an OUTPUT is written from the start. A size
+             * taken from collected hunks holds if they all apply, the output ends where
+             * it is written to. An INPLACE file is acquired once its hunks are placed, so
+             * failing for want of space leaves it untouched */
+            long size;
+            /* RELEASE: the output is dropped, a hunk failed or the patch ended on an error;
+             * what was written must not replace the file (an OUTPUT is thrown away, an
+             * INPLACE file is left as it is, not cut), but the stream is released all the same */
+            int discard;
         } stream_event;
+        struct {
+            char* path;             /* file the hunk belongs to */
+            int number;             /* 1-based number of the hunk within the file */
+            unsigned int status;    /* PATCH_HUNK_* */
+            int line;               /* input line the hunk was placed at (expected at, if failed) */
+            int offset;             /* lines between the position from the patch and the actual one */
+            int fuzz;               /* outer context lines ignored to make the hunk match */
+        } hunk_event;
+        struct {
+            char* path;
+            char* new_path;         /* PATCH_EVT_FILE_RENAME only */
+            unsigned int mode;      /* PATCH_EVT_FILE_MODE only, git mode bits, e.g. 0755 */
+        } file_event;
     } data;
 } patch_evt_t;
 
 typedef int (patch_event_cbk_t)(patch_evt_t* evt);
 
+#define PATCH_MAX_PATH 260
+#define PATCH_MAX_LINE 4096     /* longer lines are read in pieces */
+
+/* Result of one hunk, same as its PATCH_EVT_HUNK_RESULT event */
+typedef struct patch_hunk_result {
+    char path[PATCH_MAX_PATH];
+    int number;
+    unsigned int status;    /* PATCH_HUNK_* */
+    int line;
+    int offset;
+    int fuzz;
+} patch_hunk_result_t;
+
 /* Init patcher instance
  *
  * returns pointer to the instance
@@ -45,6 +114,34 @@ int patch_destroy(void* self);
  */
 int patch_set_options(void* self, unsigned int opts);
 
+/* Get the LINEIDX_* flags lines are compared with under the given options,
+ * an index passed with an INPUT stream (see stream_event.index) must be hashed with them
+ */
+unsigned int patch_line_flags(unsigned int opts);
+
+/* Set how many leading and trailing context lines a hunk may lose when it
+ * matches nowhere as a whole (0, the default, disables fuzzy matching)
+ *
+ * returns 0 on success, non-0 on error
+ */
+int patch_set_fuzz(void* self, unsigned int fuzz);
+
+/* Set the directory of the on-disk result cache, NULL (the default) for none.
+ * A file whose input and hunks were patched before is not patched again, its
+ * output is copied from the cache; see apply_patch().
+ *
+ * returns 0 on success, non-0 on error
+ */
+int patch_set_cache_dir(void* self, const char* dir);
+
+/* The callback a new instance starts with: opens files on disk, writes the
+ * output to "<path>.tmp" and moves it into place on release (deletes it if the
+ * output is discarded), prints where hunks moved. Other callbacks may pass the events they do not handle on to it.
+ *
+ * returns 0 on success, non-0 on error
+ */
+int default_patch_evt_cbk(patch_evt_t* evt);
+
 /* Set callback for opening input and output files for patch
  *
  * returns 0 on success, non-0 on error
@@ -54,8 +151,252 @@ int patch_set_path_cbk(void* self, patch_event_cbk_t* new_cbk, void* userdata);
 /*
  * Load the diff from stream and do the work
  *
- * returns 0 on success, non-0 on error
+ * With PATCH_OPTION_DRY_RUN no output stream is acquired and a failed hunk does
+ * not stop the run, the remaining hunks are still checked.
+ *
+ * Hunks are applied as they are read, so they must come in order of their
+ * lines. With PATCH_OPTION_UNORDERED the hunks of a file are collected and
+ * applied together, in line order, once the file's section ends; hunks that
+ * change lines another one changes or verifies fail.
+ *
+ * With PATCH_OPTION_INPLACE the hunks of a file are collected too, and all of
+ * them are placed before the file is acquired for update: a file with a hunk
+ * that fails is left as it was. A file of more than one hunk is then read
+ * twice up to its last hunk, once to place them and once to write them.
+ *
+ * In `diff --git` sections the a/ and b/ path prefixes are dropped and the
+ * extended header lines are followed: a rename or copy reads the old path and
+ * writes the new one, a rename without content becomes a PATCH_EVT_FILE_RENAME,
+ * a deleted file a PATCH_EVT_FILE_DELETE (see below on its hunks), and a
+ * mode change a PATCH_EVT_FILE_MODE. A dry run sends none of these.
+ *
+ * A `/dev/null` input creates the file: no input stream is acquired, the added
+ * lines are written to an output acquired with their size. A `/dev/null` output
+ * deletes the file unread with a PATCH_EVT_FILE_DELETE; with
+ * PATCH_OPTION_VERIFY_DELETE the file is first compared with the deleted lines,
+ * and kept, failing the hunk, if it differs.
+ *
+ * A `GIT binary patch` is decoded as it is read: a literal hunk is written to
+ * an output acquired with its size, a delta hunk reads the spans it copies from
+ * an INPUT stream of the old path, which must be seekable. The output is
+ * released only once the hunk is complete and valid.
+ *
+ * With PATCH_OPTION_VERIFY_INDEX the git blob hashes of an `index` line are
+ * checked: the input is hashed as it is read and the output as it is written,
+ * and a file that is not the old blob, or a result that is not the new one,
+ * fails and its output is not released. The file is then read whole and never
+ * written in place. The hunks of the file are collected first, as the size of
+ * the output goes in front of its hash, and are applied in order once it ends.
+ * An abbreviated hash is compared with both the SHA-1 and the SHA-256; with an
+ * EOL option the output is not the new blob and only the input is checked.
+ *
+ * With a cache directory (patch_set_cache_dir()) the hunks of a file are
+ * collected too, then looked up by the content hash of the input and a hash of
+ * the hunks and the options. A hit copies the cached output and the hunks are
+ * reported applied where the patch puts them; a miss applies them and stores
+ * the output. Such a file is never written in place; a dry run, and a file
+ * verified against an `index` line, do not use the cache.
+ *
+ * With PATCH_OPTION_STREAM neither the patch nor an input is ever seeked, and
+ * an input is not held beyond the lines of the hunk at hand and the
+ * 1000 lines on either side of it: streams may be pipes, and memory does
+ * not grow with the size of the files. A hunk is then searched for, fuzzed or
+ * found applied already only within those lines, and fails if it is farther
+ * from the line it is expected at. The cache is not used,
+ * and PATCH_OPTION_INPLACE, PATCH_OPTION_UNORDERED and
+ * PATCH_OPTION_VERIFY_INDEX are turned off. PATCH_OPTION_EOL_PRESERVE takes
+ * the EOL from the input lines read so far. A delta binary hunk still needs a
+ * seekable input.
+ *
+ * returns 0 on success, non-0 on error or if any hunk failed
  */
 int apply_patch(void* self, stream_wrapper_t* sw);
 
+/*
+ * Feed the next bytes of a diff, in pieces of any size, as apply_patch()
+ * reads it: every line is read as soon as it is complete, and a hunk is
+ * applied as soon as the line after it arrives, so the first hunks are
+ * written before the rest of the patch is there. The call returns once the
+ * bytes are taken and never waits for more, an event loop may feed what a
+ * non-blocking read gave it. The input and output streams are acquired and
+ * used from within the call, as apply_patch() does.
+ *
+ * The first call starts a patch, patch_finish() ends it. apply_patch() is not
+ * called in between.
+ *
+ * returns 0 on success, non-0 on error; the bytes fed after an error are dropped
+ */
+int patch_feed(void* self, const void* data, size_t size);
+
+/*
+ * End the diff fed with patch_feed(): read its last line, if it has no EOL,
+ * take its last hunk and finalize its last file. The next patch_feed() starts
+ * another patch.
+ *
+ * returns 0 on success, non-0 on error or if any hunk failed, as apply_patch()
+ */
+int patch_finish(void* self);
+
+/*
+ * Compile the diff into tables of sections, hunks and lines, the lines with
+ * their lengths and hashes, to apply it again and again with
+ * apply_compiled_patch(); see compiled.h for the format. Lines are hashed with
+ * the line flags of `opts` (patch_line_flags()), any other option is taken when
+ * the patch is applied. GIT binary patches cannot be compiled. The compiled
+ * patch is written to `out`, which is left open.
+ *
+ * returns 0 on success, non-0 on error
+ */
+int patch_compile(stream_wrapper_t* sw, unsigned int opts, stream_wrapper_t* out);
+
+/*
+ * Apply a patch compiled by patch_compile() the way apply_patch() applies the
+ * diff, without parsing any text. `data` holds the whole compiled patch, aligned
+ * to 8 bytes (a mapped file or an allocation is); it is only read. Lines
+ * compared under other line flags than the patch was compiled with are hashed
+ * again. The hunks of a file are all at hand, so its output is acquired with
+ * the size the line table gives; they are applied one by one, not collected.
+ *
+ * returns 0 on success, non-0 on error, if the data is not a valid compiled
+ * patch or if any hunk failed
+ */
+int apply_compiled_patch(void* self, const void* data, size_t size);
+
+/*
+ * Resolve the diff against the files it applies to into an edit script (see
+ * editscript.h) written to `out`, which is left open: per file, the size and
+ * blob hash of its input and the byte spans of its output, copied from the
+ * input or inserted. Hunks are placed as apply_patch() places them, with the
+ * same options, but no file is written. Renames, copies, deletions, mode
+ * changes and GIT binary patches cannot be resolved.
+ *
+ * returns 0 on success, non-0 on error or if any hunk failed
+ */
+int patch_resolve(void* self, stream_wrapper_t* sw, stream_wrapper_t* out);
+
+/*
+ * Replay an edit script written by patch_resolve(): each output is written
+ * from its spans in one pass over its input, which is hashed on the way and
+ * must be the very input the script was resolved against; otherwise the
+ * output is dropped and the file counts as failed. No line is read and no
+ * hunk placed; the output size is given to the stream event ahead. `data` is
+ * aligned as for apply_compiled_patch().
+ *
+ * returns 0 on success, non-0 on error, if the data is not a valid edit
+ * script or if any input is not the one it names
+ */
+int apply_edit_script(void* self, const void* data, size_t size);
+
+/* Receives the ranges of one hunk, `path` is the file apply_patch() would read.
+ * Returning non-0 stops the scan. */
+typedef int (patch_range_cbk_t)(const char* path, int start_old, int len_old, int start_new, int len_new,
+                                void* userdata);
+
+/*
+ * Read only the file and hunk headers of the diff and pass the ranges of every
+ * hunk to `cbk`, in patch order. No file the patch names is opened.
+ * PATCH_OPTION_REVERSE swaps the sides as in apply_patch(). The path is the
+ * file apply_patch() would read, the one it creates for a /dev/null input,
+ * with the a/ b/ prefixes of a `diff --git` section dropped.
+ *
+ * returns 0 on success, non-0 on error or if `cbk` stopped the scan
+ */
+int patch_scan_hunks(void* self, stream_wrapper_t* sw, patch_range_cbk_t* cbk, void* userdata);
+
+/*
+ * Parse the path of a "--- " or "+++ " file header line, the way apply_patch()
+ * does (quotes and escapes handled, the timestamp left out).
+ *
+ * returns pointer just past the path in `line`, NULL if `line` is not a file header
+ */
+const char* patch_header_path(const char* line, char* path, size_t len);
+
+/*
+ * Parse a "@@ -start_old[,len_old] +start_new[,len_new] @@" hunk header line,
+ * an omitted count is 1 (as git writes one-line ranges)
+ *
+ * returns 0 on success, non-0 if `line` is not a well-formed hunk header
+ */
+int patch_hunk_header(const char* line, int* start_old, int* len_old, int* start_new, int* len_new);
+
+/*
+ * Get the results of every hunk of the last apply_patch() call, in patch order.
+ * The array stays valid until the next apply_patch() or patch_destroy().
+ *
+ * returns the number of results
+ */
+size_t patch_get_results(void* self, const patch_hunk_result_t** results);
+
+#define PATCH_CHECK_OK     0x1  /* every hunk applies, or is applied already */
+#define PATCH_CHECK_FAILED 0x2  /* some hunk does not apply */
+#define PATCH_CHECK_ERROR  0x3  /* the patch cannot be read or names a file that cannot be read */
+
+/* Outcome of one patch of patch_check_many() */
+typedef struct patch_check_result {
+    unsigned int status;    /* PATCH_CHECK_* */
+    size_t hunks_ok;        /* hunks that apply */
+    size_t hunks_applied;   /* hunks found already applied */
+    size_t hunks_failed;    /* hunks that do not apply */
+} patch_check_result_t;
+
+/*
+ * Check whether each of the patches applies, without writing anything (see
+ * PATCH_OPTION_DRY_RUN). Every input file is read and indexed once, into a
+ * cache shared by all the patches, and the patches are checked on `threads`
+ * threads at once (0 for one per processor).
+ *
+ * results: receives `count` results, one per patch, in the order of `patch_paths`
+ *
+ * returns 0 if every patch applies, 1 if some does not, -1 on error
+ */
+int patch_check_many(const char* const* patch_paths, size_t count, unsigned int opts, unsigned int fuzz,
+                     unsigned int threads, patch_check_result_t* results);
+
+/* Two patches that change overlapping lines of a file */
+typedef struct patch_conflict {
+    size_t first;       /* index of the patch in the list, first < second */
+    size_t second;
+    char path[PATCH_MAX_PATH];
+} patch_conflict_t;
+
+/*
+ * Find the pairs of patches whose hunks overlap in the old lines of some file.
+ * Only the patches are read, not the files they change. A pair is reported
+ * once per file, sorted by file (in order of appearance), then by patch.
+ *
+ * conflicts: receives an array to release with free(), NULL if there are none
+ *
+ * returns 0 on success, -1 on error (a patch cannot be read or parsed)
+ */
+int patch_find_conflicts(const char* const* patch_paths, size_t count, unsigned int opts,
+                         patch_conflict_t** conflicts, size_t* conflict_count);
+
+/*
+ * Apply the patches one after another, like applying them one at a time, but
+ * every file is read once and written once: a patch reads what the earlier
+ * ones wrote from memory, and all files are written when the whole series
+ * applies. A file a patch deletes is gone for the later ones, and removed
+ * with the rest; renames and mode changes are made then too. If some patch
+ * does not apply, no file is written.
+ * With PATCH_OPTION_DRY_RUN nothing is written either way.
+ *
+ * returns 0 on success, non-0 on error or if some patch does not apply
+ */
+int patch_apply_series(const char* const* patch_paths, size_t count, unsigned int opts, unsigned int fuzz);
+
+/*
+ * Compose two patches, the second made against the result of the first, into
+ * one patch that takes the files of the first straight to the result of the
+ * second. Only the patches are read: hunks that touch the same lines are merged
+ * by their line numbers in the intermediate files, the others are renumbered.
+ * The second patch must fit the first one's result exactly, with no offset or
+ * fuzz. Files of git sections match on their paths without the a/ and b/
+ * prefixes, and keep their `diff --git` and extended header lines. The
+ * composed patch is written to `out`, which is left open.
+ *
+ * returns 0 on success, 1 if the second patch does not fit the first one's
+ * result, -1 on error
+ */
+int patch_compose(const char* first_path, const char* second_path, stream_wrapper_t* out);
+
 #endif  /* PATCH_H_INLCUDED_ */
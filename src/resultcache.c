@@ -0,0 +1,139 @@
+// resultcache.c - on-disk cache of patched files, by input content and section (C99 + WinAPI only)
+
+#define _CRT_SECURE_NO_WARNINGS
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "resultcache.h"
+
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+/* file_key:
+ *  Names the file as it is now: its volume, file index, last write time and
+ *  size. Any write to the file changes the time or the size, a new file of
+ *  the same name has another index.
+ *
+ * Returns 0 on success, non-0 if the file cannot be opened
+ */
+static int file_key(const char* path, char* key, size_t len) {
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return 1;
+    BY_HANDLE_FILE_INFORMATION info;
+    int stat = GetFileInformationByHandle((HANDLE)_get_osfhandle(_fileno(fp)), &info) ? 0 : 1;
+    fclose(fp);
+    if (stat == 0)
+        snprintf(key, len, "%08lx%08lx%08lx-%08lx%08lx-%08lx%08lx", (unsigned long)info.dwVolumeSerialNumber,
+                 (unsigned long)info.nFileIndexHigh, (unsigned long)info.nFileIndexLow,
+                 (unsigned long)info.ftLastWriteTime.dwHighDateTime, (unsigned long)info.ftLastWriteTime.dwLowDateTime,
+                 (unsigned long)info.nFileSizeHigh, (unsigned long)info.nFileSizeLow);
+    return stat;
+}
+
+/* Names the entry `name` of the directory, `prefix`-`name`; returns 0 on success, non-0 if it does not fit */
+static int entry_path(char* path, const char* dir, const char* prefix, const char* name) {
+    int length = snprintf(path, RESULT_CACHE_MAX_PATH, "%s/%s-%s", dir, prefix, name);
+    return length < 0 || length >= RESULT_CACHE_MAX_PATH;
+}
+
+/* A name no other thread or process writes to at the same time; returns 0 on success, non-0 if it does not fit */
+static int temp_name(char* temp_path, const char* path) {
+    int length = snprintf(temp_path, RESULT_CACHE_MAX_PATH, "%s.%lu.%lu.tmp", path,
+                          (unsigned long)GetCurrentProcessId(), (unsigned long)GetCurrentThreadId());
+    return length < 0 || length >= RESULT_CACHE_MAX_PATH;
+}
+
+/* Moves a complete file in place, over an entry another run may have stored meanwhile */
+static int move_in_place(const char* temp_path, const char* path) {
+    if (MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING))
+        return 0;
+    DeleteFileA(temp_path);
+    return 1;
+}
+
+/*
+ *  PUBLIC API
+ */
+
+int result_cache_recall(const char* dir, const char* path, char* hash) {
+    char key[64];
+    char stat_path[RESULT_CACHE_MAX_PATH];
+    if (file_key(path, key, sizeof(key)) != 0 || entry_path(stat_path, dir, "stat", key) != 0)
+        return 1;
+
+    FILE* fp = fopen(stat_path, "rb");
+    if (fp == NULL)
+        return 1;
+    size_t got = fread(hash, 1, RESULT_CACHE_HASH - 1, fp);
+    fclose(fp);
+    hash[got] = '\0';
+    return got == RESULT_CACHE_HASH - 1 && strspn(hash, "0123456789abcdef") == got ? 0 : 1;
+}
+
+void result_cache_remember(const char* dir, const char* path, const char* hash) {
+    char key[64];
+    char stat_path[RESULT_CACHE_MAX_PATH];
+    char temp_path[RESULT_CACHE_MAX_PATH];
+    if (file_key(path, key, sizeof(key)) != 0 || entry_path(stat_path, dir, "stat", key) != 0 ||
+        temp_name(temp_path, stat_path) != 0)
+        return;
+    CreateDirectoryA(dir, NULL);    /* fails if it is there already */
+
+    FILE* fp = fopen(temp_path, "wb");
+    if (fp == NULL)
+        return;
+    int stat = fwrite(hash, 1, RESULT_CACHE_HASH - 1, fp) != RESULT_CACHE_HASH - 1;
+    stat |= fclose(fp) != 0;
+    if (stat != 0)
+        DeleteFileA(temp_path);
+    else
+        move_in_place(temp_path, stat_path);
+}
+
+FILE* result_cache_open(const char* dir, const char* input_hash, const char* section_hash, result_cache_hunk_t* hunks,
+                        size_t count, long* size) {
+    char path[RESULT_CACHE_MAX_PATH];
+    if (entry_path(path, dir, input_hash, section_hash) != 0)
+        return NULL;
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return NULL;
+
+    /* the hunks are at the end, after the output */
+    uint32_t stored = 0;
+    long trailer = (long)(count * sizeof(result_cache_hunk_t) + sizeof(stored));
+    long end;
+    if (fseek(fp, 0, SEEK_END) != 0 || (end = ftell(fp)) < trailer || fseek(fp, end - trailer, SEEK_SET) != 0 ||
+        (count > 0 && fread(hunks, sizeof(result_cache_hunk_t), count, fp) != count) ||
+        fread(&stored, sizeof(stored), 1, fp) != 1 ||
+        stored != count || fseek(fp, 0, SEEK_SET) != 0) {
+        fclose(fp);
+        return NULL;
+    }
+    *size = end - trailer;
+    return fp;
+}
+
+FILE* result_cache_create(const char* dir, const char* input_hash, const char* section_hash, char* path,
+                          char* temp_path) {
+    if (entry_path(path, dir, input_hash, section_hash) != 0 || temp_name(temp_path, path) != 0)
+        return NULL;
+    CreateDirectoryA(dir, NULL);
+    return fopen(temp_path, "wb");
+}
+
+int result_cache_store(FILE* fp, const char* path, const char* temp_path, const result_cache_hunk_t* hunks,
+                       size_t count, int keep) {
+    uint32_t stored = (uint32_t)count;
+    int stat = keep && ((count > 0 && fwrite(hunks, sizeof(result_cache_hunk_t), count, fp) != count) ||
+                        fwrite(&stored, sizeof(stored), 1, fp) != 1);
+    stat |= fclose(fp) != 0;
+    if (!keep || stat != 0) {
+        DeleteFileA(temp_path);
+        return 1;
+    }
+    return move_in_place(temp_path, path);
+}
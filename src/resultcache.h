@@ -0,0 +1,80 @@
+#ifndef RESULTCACHE_H_
+#define RESULTCACHE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define RESULT_CACHE_HASH     41    /* SHA-1 hex the cache names things by, and its NUL */
+#define RESULT_CACHE_MAX_PATH 260
+
+/*
+ * On-disk cache of patched files, in a directory of flat files:
+ *
+ *   <input hash>-<section hash>   the output of a section applied to an input
+ *   stat-<file key>               the content hash of an input as it was seen
+ *
+ * The input hash is the git blob SHA-1 of the input, the section hash one of
+ * the hunks and the options that shape the output. The file key is the volume,
+ * file index, last write time and size of the file, so an input that did not
+ * change since is not read to be hashed again. Entries are written under a
+ * temporary name and moved in place whole, concurrent runs may share the
+ * directory.
+ *
+ * An output entry ends with where its hunks were placed: a result_cache_hunk_t
+ * per hunk, then their count as a uint32_t, in the byte order of the machine
+ * that wrote it.
+ */
+
+/* Where a hunk of a cached output was placed, as it was reported */
+typedef struct result_cache_hunk {
+    int32_t line;
+    int32_t offset;
+    int32_t fuzz;
+} result_cache_hunk_t;
+
+/*
+ * Looks up the content hash remembered for the file as it is now.
+ *
+ * returns 0 and the hash on success, non-0 if it is not remembered
+ */
+int result_cache_recall(const char* dir, const char* path, char* hash);
+
+/*
+ * Remembers the content hash of the file as it is now, if the directory
+ * can take it.
+ */
+void result_cache_remember(const char* dir, const char* path, const char* hash);
+
+/*
+ * Opens the output cached for the section applied to the input: `hunks`
+ * receives where its `count` hunks were placed and `size` the size of the
+ * output, the file is left at its start.
+ *
+ * returns the file open for reading, NULL if there is none or it does not
+ * have `count` hunks
+ */
+FILE* result_cache_open(const char* dir, const char* input_hash, const char* section_hash, result_cache_hunk_t* hunks,
+                        size_t count, long* size);
+
+/*
+ * Creates a new entry for the section applied to the input, under a
+ * temporary name: `path` receives the name of the entry and `temp_path` the
+ * temporary one (RESULT_CACHE_MAX_PATH bytes each).
+ *
+ * returns the file open for writing, NULL on error or if a name does not fit
+ */
+FILE* result_cache_create(const char* dir, const char* input_hash, const char* section_hash, char* path,
+                          char* temp_path);
+
+/*
+ * Closes a new entry and moves it from `temp_path` in place at `path`, as
+ * result_cache_create() named them, if `keep` is non-0 (the output is
+ * complete); deletes it otherwise. A kept entry gets where its `count`
+ * `hunks` were placed appended.
+ *
+ * returns 0 on success, non-0 if the entry is not stored
+ */
+int result_cache_store(FILE* fp, const char* path, const char* temp_path, const result_cache_hunk_t* hunks,
+                       size_t count, int keep);
+
+#endif  /* RESULTCACHE_H_ */
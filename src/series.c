@@ -0,0 +1,363 @@
+// series.c - Applying a series of patches with one read and one write per file (C99 + WinAPI only)
+// Every patch reads the result of the previous ones from memory
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csw.h"
+#include "dynmem.h"
+#include "patch.h"
+
+/* Content of a file as the patches so far have left it */
+typedef struct series_file {
+    char path[PATCH_MAX_PATH];
+    dynmem_t* content;      /* NULL until a patch writes the file */
+    char from[PATCH_MAX_PATH];  /* file on disk renamed to this one without content, "" if none */
+    unsigned int mode;      /* permission bits a patch set, 0 if none */
+    int deleted;            /* a patch deleted the file, it is removed when the series is written */
+} series_file_t;
+
+typedef struct series {
+    series_file_t* files;
+    size_t count;
+    size_t capacity;
+} series_t;
+
+/* private */
+static series_file_t* series_find(series_t* series, const char* path) {
+    for (size_t i = 0; i < series->count; ++i) {
+        if (strcmp(series->files[i].path, path) == 0)
+            return &series->files[i];
+    }
+    return NULL;
+}
+
+/* private */
+static series_file_t* series_add(series_t* series, const char* path) {
+    series_file_t* file = series_find(series, path);
+    if (file != NULL)
+        return file;
+
+    if (series->count == series->capacity) {
+        size_t new_capacity = series->capacity ? series->capacity * 2 : 16;
+        series_file_t* new_files = realloc(series->files, new_capacity * sizeof(series_file_t));
+        if (new_files == NULL)
+            return NULL;
+        series->files = new_files;
+        series->capacity = new_capacity;
+    }
+
+    file = &series->files[series->count++];
+    snprintf(file->path, sizeof(file->path), "%s", path);
+    file->content = NULL;
+    file->from[0] = '\0';
+    file->mode = 0;
+    file->deleted = 0;
+    return file;
+}
+
+/* private
+ *  Entry of a file the patches so far have left in place, added for one that
+ *  is only on disk; NULL if a patch deleted it or it is nowhere.
+ */
+static series_file_t* series_existing(series_t* series, const char* path) {
+    series_file_t* file = series_find(series, path);
+    if (file != NULL)
+        return file->deleted ? NULL : file;
+    if (GetFileAttributesA(path) == INVALID_FILE_ATTRIBUTES)
+        return NULL;
+    return series_add(series, path);
+}
+
+/* private */
+static void series_drop_content(series_file_t* file) {
+    if (file->content != NULL) {
+        dynmem_free(file->content);
+        free(file->content);
+        file->content = NULL;
+    }
+}
+
+/* series_evt_cbk:
+ *  Inputs written by an earlier patch of the series are read from memory,
+ *  the others from disk. Outputs go to memory and replace the file content.
+ *  A deleted file is only marked so: later patches cannot read it, and it is
+ *  removed from disk when the series is written. A rename moves the entry, a
+ *  file still on disk is moved when the series is written, and so are mode
+ *  changes set.
+ */
+static int series_evt_cbk(patch_evt_t* evt) {
+    if (evt == NULL || evt->userdata == NULL)   /* Invalid evt or userdata */
+        return -1;
+    series_t* series = (series_t*)evt->userdata;
+
+    if (evt->type == PATCH_EVT_HUNK_RESULT)
+        return default_patch_evt_cbk(evt);
+
+    /* a file must be there to be deleted, renamed or have its mode set, in memory or on disk */
+    if (evt->type == PATCH_EVT_FILE_DELETE) {
+        series_file_t* file = series_existing(series, evt->data.file_event.path);
+        if (file == NULL)
+            return -1;
+        series_drop_content(file);
+        file->from[0] = '\0';
+        file->mode = 0;
+        file->deleted = 1;
+        return 0;
+    }
+    if (evt->type == PATCH_EVT_FILE_RENAME) {
+        char* path = evt->data.file_event.path;
+        char* new_path = evt->data.file_event.new_path;
+        if (series_existing(series, path) == NULL)
+            return -1;
+        if (strcmp(path, new_path) == 0)
+            return 0;
+        series_file_t* to = series_add(series, new_path);
+        series_file_t* file = series_find(series, path);    /* the entries may have moved */
+        if (to == NULL)
+            return -1;
+        series_drop_content(to);
+        to->content = file->content;
+        if (to->content != NULL)
+            to->from[0] = '\0';
+        else
+            snprintf(to->from, sizeof(to->from), "%s", file->from[0] ? file->from : file->path);
+        to->mode = file->mode;
+        to->deleted = 0;
+        file->content = NULL;
+        file->from[0] = '\0';
+        file->mode = 0;
+        file->deleted = 1;
+        return 0;
+    }
+    if (evt->type == PATCH_EVT_FILE_MODE) {
+        series_file_t* file = series_existing(series, evt->data.file_event.path);
+        if (file == NULL)
+            return -1;
+        file->mode = evt->data.file_event.mode;
+        return 0;
+    }
+
+    char* path = evt->data.stream_event.path;
+    stream_wrapper_t* sw = evt->data.stream_event.stream;
+    unsigned int purpose = evt->data.stream_event.purpose;
+    if (sw == NULL) /* invalid stream wrapper provided */
+        return -1;
+
+    switch (evt->type) {
+    case PATCH_EVT_STREAM_ACQUIRE: {
+        if (purpose == PATCH_STREAM_PURPOSE_INPUT) {
+            series_file_t* file = series_find(series, path);
+            if (file != NULL && file->deleted)  /* deleted by an earlier patch */
+                return -1;
+            if (file != NULL && file->content != NULL)
+                return make_viewsw(sw, file->content);
+            FILE* fp = fopen(file != NULL && file->from[0] ? file->from : path, "rb");
+            if (!fp)    /* Cannot open the file at specified path */
+                return -1;
+            return make_fdsw(sw, fp);
+        }
+
+        /* an output of known size is allocated once rather than line by line */
+        dynmem_t* content = calloc(1, sizeof(dynmem_t));
+        long size = evt->data.stream_event.size;
+        if (content == NULL || make_dynmem(content, 0, 0) != 0 ||
+            (size > 0 && dynmem_reserve(content, (size_t)size) != 0)) {
+            free(content);
+            return -1;
+        }
+        if (make_memsw(sw, content) != 0) {
+            dynmem_free(content);
+            free(content);
+            return -1;
+        }
+        return 0;
+    }
+    case PATCH_EVT_STREAM_RELEASE: {
+        if (purpose == PATCH_STREAM_PURPOSE_INPUT)
+            return sw->close(sw);
+
+        /* the output becomes the content later patches read; the input is already released.
+         * A discarded output is freed, the file keeps the content it had */
+        dynmem_t* content = (dynmem_t*)sw->_impl;
+        sw->_impl = NULL;
+        series_file_t* file = evt->data.stream_event.discard ? NULL : series_add(series, path);
+        if (file == NULL) {
+            dynmem_free(content);
+            free(content);
+            return evt->data.stream_event.discard ? 0 : -1;
+        }
+        if (file->content != NULL) {
+            dynmem_free(file->content);
+            free(file->content);
+        }
+        file->content = content;
+        file->from[0] = '\0';
+        file->deleted = 0;
+        return 0;
+    }
+    }
+
+    return -1;  /* Unknown event, return error */
+}
+
+/* series_temp_path:
+ *  Names the temporary file a file is written to, or moved through, on its
+ *  way into place.
+ *
+ * Returns 0 on success, non-0 if the name does not fit
+ */
+static int series_temp_path(char temp_path[MAX_PATH], const char* path) {
+    int length = snprintf(temp_path, MAX_PATH, "%s.tmp", path);
+    if (length < 0 || length >= MAX_PATH) {
+        fprintf(stderr, "Path too long for a temporary file: %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+/* series_file_event:
+ *  Passes a rename or a mode change on to the default callback, reports a failure.
+ *
+ * Returns 0 on success, non-0 on error
+ */
+static int series_file_event(unsigned int type, char* path, char* new_path, unsigned int mode) {
+    patch_evt_t event = { 0 };
+    event.type = type;
+    event.data.file_event.path = path;
+    event.data.file_event.new_path = new_path;
+    event.data.file_event.mode = mode;
+    if (default_patch_evt_cbk(&event) == 0)
+        return 0;
+
+    if (type == PATCH_EVT_FILE_RENAME)
+        fprintf(stderr, "Cannot rename %s to %s (err %lu)\n", path, new_path, GetLastError());
+    else
+        fprintf(stderr, "Cannot set the mode of %s\n", path);
+    return 1;
+}
+
+/* series_write_file:
+ *  Writes the content to a temporary file and moves it into place.
+ *
+ * Returns 0 on success, non-0 on error
+ */
+static int series_write_file(const series_file_t* file) {
+    char temp_path[MAX_PATH] = {0};
+    if (series_temp_path(temp_path, file->path) != 0)
+        return 1;
+
+    FILE* fp = fopen(temp_path, "wb");
+    if (!fp) {
+        fprintf(stderr, "Cannot create resulted patched file: %s\n", file->path);
+        return 1;
+    }
+    size_t size = file->content->writepos;
+    int stat = (size > 0 && fwrite(file->content->buf, 1, size, fp) != size);
+    stat |= fclose(fp) != 0;
+    if (stat) {
+        fprintf(stderr, "Write error while writing %s\n", temp_path);
+        DeleteFileA(temp_path);
+        return 1;
+    }
+
+    DeleteFileA(file->path); /* delete already existing target file to avoid errors */
+    if (!MoveFileA(temp_path, file->path)) {
+        fprintf(stderr, "Failed to move temp '%s' -> '%s' (err %lu)\n", temp_path, file->path, GetLastError());
+        DeleteFileA(temp_path);
+        return 1;
+    }
+    return 0;
+}
+
+/* series_delete_file:
+ *  Removes a file a patch deleted. A file that never reached the disk, created
+ *  and deleted within the series, is not there to remove.
+ *
+ * Returns 0 on success, non-0 on error
+ */
+static int series_delete_file(const series_file_t* file) {
+    if (!DeleteFileA(file->path) && GetFileAttributesA(file->path) != INVALID_FILE_ATTRIBUTES) {
+        fprintf(stderr, "Cannot delete %s (err %lu)\n", file->path, GetLastError());
+        return 1;
+    }
+    return 0;
+}
+
+/* series_write:
+ *  Writes every file the series left, in two passes. The files renamed on disk
+ *  are first moved aside to their temporary names, since one may be renamed to
+ *  the old name of another. Then each file is written, moved from aside,
+ *  or deleted, and its mode set.
+ *
+ * Returns 0 on success, non-0 on error
+ */
+static int series_write(series_t* series) {
+    char temp_path[MAX_PATH] = {0};
+    for (size_t i = 0; i < series->count; ++i) {
+        series_file_t* file = &series->files[i];
+        if (file->from[0] && (series_temp_path(temp_path, file->path) != 0 ||
+                              series_file_event(PATCH_EVT_FILE_RENAME, file->from, temp_path, 0) != 0))
+            return 1;
+    }
+
+    for (size_t i = 0; i < series->count; ++i) {
+        series_file_t* file = &series->files[i];
+        int stat = 0;
+        if (file->deleted)
+            stat = series_delete_file(file);
+        else if (file->content != NULL)
+            stat = series_write_file(file);
+        else if (file->from[0])
+            stat = series_temp_path(temp_path, file->path) != 0 ||
+                   series_file_event(PATCH_EVT_FILE_RENAME, temp_path, file->path, 0) != 0;
+        if (stat == 0 && !file->deleted && file->mode != 0)
+            stat = series_file_event(PATCH_EVT_FILE_MODE, file->path, NULL, file->mode);
+        if (stat != 0)
+            return 1;
+    }
+    return 0;
+}
+
+int patch_apply_series(const char* const* patch_paths, size_t count, unsigned int opts, unsigned int fuzz) {
+    if (patch_paths == NULL && count > 0)
+        return -1;
+
+    series_t series = { 0 };
+    void* patcher = patch_init();
+    if (patcher == NULL)
+        return -1;
+
+    /* the outputs only go to memory, a dry run just does not write them out */
+    patch_set_options(patcher, opts & ~(PATCH_OPTION_DRY_RUN | PATCH_OPTION_INPLACE));
+    patch_set_fuzz(patcher, fuzz);
+    patch_set_path_cbk(patcher, &series_evt_cbk, &series);
+
+    int stat = 0;
+    for (size_t i = 0; i < count && stat == 0; ++i) {
+        FILE* fp = fopen(patch_paths[i], "rb");
+        if (!fp) {
+            fprintf(stderr, "Cannot open %s\n", patch_paths[i]);
+            stat = 1;
+            break;
+        }
+        stream_wrapper_t sw = { 0 };
+        make_fdsw(&sw, fp);
+        if (apply_patch(patcher, &sw) != 0) {   /* closes the stream */
+            fprintf(stderr, "Patch %s does not apply, no file is written\n", patch_paths[i]);
+            stat = 1;
+        }
+    }
+    patch_destroy(patcher);
+
+    if (stat == 0 && !(opts & PATCH_OPTION_DRY_RUN) && series_write(&series) != 0)
+        stat = 1;
+    for (size_t i = 0; i < series.count; ++i) {
+        dynmem_free(series.files[i].content);
+        free(series.files[i].content);
+    }
+    free(series.files);
+    return stat;
+}
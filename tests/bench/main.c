@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../src/patch.h"
+
+#define BENCH_INPUT_LINES 200000
+#define BENCH_HUNK_STRIDE 40    /* one hunk every N input lines */
+#define BENCH_CONTEXT     3     /* context lines on each side of the change */
+#define BENCH_RUNS        10
+
+typedef struct bench_data {
+    dynmem_t input;
+    dynmem_t output;
+} bench_data_t;
+
+int bench_cbk(patch_evt_t* evt) {
+    if (evt == NULL || evt->userdata == NULL)
+        return -1;
+    bench_data_t* dat = (bench_data_t*)evt->userdata;
+
+    if (evt->type == PATCH_EVT_STREAM_ACQUIRE) {
+        stream_wrapper_t* sw = evt->data.stream_event.stream;
+        memset(sw, 0, sizeof(stream_wrapper_t));
+        if (evt->data.stream_event.purpose == PATCH_STREAM_PURPOSE_INPUT) {
+            dat->input.readpos = 0;
+            return make_memsw(sw, &dat->input);
+        }
+        dat->output.writepos = 0;   /* keep the allocation between runs */
+        return make_memsw(sw, &dat->output);
+    }
+    if (evt->type == PATCH_EVT_STREAM_RELEASE)
+        return 0;   /* buffers are owned by the benchmark */
+
+    return -1;
+}
+
+static void make_input(dynmem_t* dm) {
+    char line[128];
+    make_dynmem(dm, 0, 0);
+    for (int i = 1; i <= BENCH_INPUT_LINES; ++i) {
+        int n = snprintf(line, sizeof(line), "line %d: the quick brown fox jumps over the lazy dog\n", i);
+        dynmem_write(dm, line, 1, (size_t)n);
+    }
+}
+
+/* with_context == 0 makes the hunks carry no context lines, so only the
+ * replaced line is verified */
+static void make_patch(dynmem_t* dm, int with_context) {
+    char line[160];
+    int ctx = with_context ? BENCH_CONTEXT : 0;
+    make_dynmem(dm, 0, 0);
+    dynmem_write(dm, "--- in.txt\n+++ out.txt\n", 1, 22);
+    for (int at = BENCH_HUNK_STRIDE; at + ctx < BENCH_INPUT_LINES; at += BENCH_HUNK_STRIDE) {
+        int n = snprintf(line, sizeof(line), "@@ -%d,%d +%d,%d @@\n", at - ctx, 2 * ctx + 1, at - ctx, 2 * ctx + 1);
+        dynmem_write(dm, line, 1, (size_t)n);
+        for (int i = at - ctx; i <= at + ctx; ++i) {
+            if (i == at) {
+                n = snprintf(line, sizeof(line), "-line %d: the quick brown fox jumps over the lazy dog\n", i);
+                dynmem_write(dm, line, 1, (size_t)n);
+                n = snprintf(line, sizeof(line), "+line %d: the quick brown fox jumps over the lazy cat\n", i);
+            } else {
+                n = snprintf(line, sizeof(line), " line %d: the quick brown fox jumps over the lazy dog\n", i);
+            }
+            dynmem_write(dm, line, 1, (size_t)n);
+        }
+    }
+}
+
+static double run(const char* name, bench_data_t* dat, const dynmem_t* patch) {
+    double best = 1e30;
+    for (int r = 0; r < BENCH_RUNS; ++r) {
+        dynmem_t patch_copy;
+        stream_wrapper_t patch_sw = {0};
+        make_dynmem_as_copy(&patch_copy, patch->buf, 1, patch->writepos);
+        make_memsw(&patch_sw, &patch_copy);
+
+        void* patcher = patch_init();
+        patch_set_path_cbk(patcher, (patch_event_cbk_t*)&bench_cbk, (void*)dat);
+
+        clock_t start = clock();
+        int stat = apply_patch(patcher, &patch_sw);
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        patch_destroy(patcher);
+
+        if (stat != 0) {
+            fprintf(stderr, "%s: apply_patch failed\n", name);
+            exit(1);
+        }
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    double mb = (double)dat->input.writepos / (1024.0 * 1024.0);
+    printf("%-24s %8.3f s  %8.1f MB/s\n", name, best, best > 0 ? mb / best : 0.0);
+    return best;
+}
+
+/* The algorithm the patcher started from, kept as the unverified reference:
+ * input lines are copied up to each hunk, its deleted lines are skipped and its
+ * context lines copied without being compared. Streams are read a byte at a
+ * time and lines written one by one, as the patcher does. */
+static char* unverified_gets(stream_wrapper_t* sw, char* line, size_t maxlen) {
+    size_t i = 0;
+    char ch;
+    while (i + 1 < maxlen && sw->read(sw, &ch, 1, 1) == 1) {
+        line[i++] = ch;
+        if (ch == '\n')
+            break;
+    }
+    line[i] = '\0';
+    return i > 0 ? line : NULL;
+}
+
+static int unverified_puts(stream_wrapper_t* sw, const char* s) {
+    size_t len = strlen(s);
+    return len == 0 || sw->write(sw, (char*)s, 1, len) == (long)len ? 0 : -1;
+}
+
+static int apply_unverified(stream_wrapper_t* patch_sw, stream_wrapper_t* in, stream_wrapper_t* out) {
+    char line[PATCH_MAX_LINE];
+    char file_line[PATCH_MAX_LINE];
+    int cur_line = 1;
+    int stat = 0;
+    while (stat == 0 && unverified_gets(patch_sw, line, sizeof(line))) {
+        int start_old, len_old, start_new, len_new;
+        if (sscanf(line, "@@ -%d,%d +%d,%d @@", &start_old, &len_old, &start_new, &len_new) != 4)
+            continue;   /* file headers */
+        for (; stat == 0 && cur_line < start_old && unverified_gets(in, file_line, sizeof(file_line)); ++cur_line)
+            stat = unverified_puts(out, file_line);
+        for (int old = 0, new = 0; stat == 0 && (old < len_old || new < len_new);) {
+            if (!unverified_gets(patch_sw, line, sizeof(line)))
+                return -1;
+            if (line[0] == '+') {
+                stat = unverified_puts(out, line + 1);
+                ++new;
+                continue;
+            }
+            if (unverified_gets(in, file_line, sizeof(file_line)))
+                ++cur_line;
+            ++old;
+            if (line[0] == ' ') {
+                stat = unverified_puts(out, file_line);
+                ++new;
+            }
+        }
+    }
+    while (stat == 0 && unverified_gets(in, file_line, sizeof(file_line)))
+        stat = unverified_puts(out, file_line);
+    return stat;
+}
+
+static double run_unverified(const char* name, bench_data_t* dat, const dynmem_t* patch) {
+    double best = 1e30;
+    for (int r = 0; r < BENCH_RUNS; ++r) {
+        dynmem_t patch_copy;
+        stream_wrapper_t patch_sw = {0};
+        stream_wrapper_t in = {0};
+        stream_wrapper_t out = {0};
+        make_dynmem_as_copy(&patch_copy, patch->buf, 1, patch->writepos);
+        make_memsw(&patch_sw, &patch_copy);
+        dat->input.readpos = 0;
+        dat->output.writepos = 0;
+        make_memsw(&in, &dat->input);
+        make_memsw(&out, &dat->output);
+
+        clock_t start = clock();
+        int stat = apply_unverified(&patch_sw, &in, &out);
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        patch_sw.close(&patch_sw);
+
+        if (stat != 0) {
+            fprintf(stderr, "%s: apply_unverified failed\n", name);
+            exit(1);
+        }
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    double mb = (double)dat->input.writepos / (1024.0 * 1024.0);
+    printf("%-24s %8.3f s  %8.1f MB/s\n", name, best, best > 0 ? mb / best : 0.0);
+    return best;
+}
+
+/* The patch compiled once, then applied with no text parsing */
+static double run_compiled(const char* name, bench_data_t* dat, const dynmem_t* patch) {
+    dynmem_t patch_copy, compiled;
+    stream_wrapper_t patch_sw = {0};
+    stream_wrapper_t compiled_sw = {0};
+    make_dynmem_as_copy(&patch_copy, patch->buf, 1, patch->writepos);
+    make_memsw(&patch_sw, &patch_copy);
+    make_dynmem(&compiled, 0, 0);
+    make_memsw(&compiled_sw, &compiled);
+    if (patch_compile(&patch_sw, 0, &compiled_sw) != 0) {
+        fprintf(stderr, "%s: patch_compile failed\n", name);
+        exit(1);
+    }
+
+    double best = 1e30;
+    for (int r = 0; r < BENCH_RUNS; ++r) {
+        void* patcher = patch_init();
+        patch_set_path_cbk(patcher, (patch_event_cbk_t*)&bench_cbk, (void*)dat);
+
+        clock_t start = clock();
+        int stat = apply_compiled_patch(patcher, compiled.buf, compiled.writepos);
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        patch_destroy(patcher);
+
+        if (stat != 0) {
+            fprintf(stderr, "%s: apply_compiled_patch failed\n", name);
+            exit(1);
+        }
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    double mb = (double)dat->input.writepos / (1024.0 * 1024.0);
+    printf("%-24s %8.3f s  %8.1f MB/s  (%zu bytes compiled from %zu)\n", name, best, best > 0 ? mb / best : 0.0,
+           compiled.writepos, patch->writepos);
+    dynmem_free(&compiled);
+    return best;
+}
+
+/* The patch resolved once against the input, then replayed as byte spans */
+static double run_resolved(const char* name, bench_data_t* dat, const dynmem_t* patch) {
+    dynmem_t patch_copy, script;
+    stream_wrapper_t patch_sw = {0};
+    stream_wrapper_t script_sw = {0};
+    make_dynmem_as_copy(&patch_copy, patch->buf, 1, patch->writepos);
+    make_memsw(&patch_sw, &patch_copy);
+    make_dynmem(&script, 0, 0);
+    make_memsw(&script_sw, &script);
+    void* resolver = patch_init();
+    patch_set_path_cbk(resolver, (patch_event_cbk_t*)&bench_cbk, (void*)dat);
+    int resolved = patch_resolve(resolver, &patch_sw, &script_sw);
+    patch_destroy(resolver);
+    if (resolved != 0) {
+        fprintf(stderr, "%s: patch_resolve failed\n", name);
+        exit(1);
+    }
+
+    double best = 1e30;
+    for (int r = 0; r < BENCH_RUNS; ++r) {
+        void* patcher = patch_init();
+        patch_set_path_cbk(patcher, (patch_event_cbk_t*)&bench_cbk, (void*)dat);
+
+        clock_t start = clock();
+        int stat = apply_edit_script(patcher, script.buf, script.writepos);
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        patch_destroy(patcher);
+
+        if (stat != 0) {
+            fprintf(stderr, "%s: apply_edit_script failed\n", name);
+            exit(1);
+        }
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    double mb = (double)dat->input.writepos / (1024.0 * 1024.0);
+    printf("%-24s %8.3f s  %8.1f MB/s  (%zu bytes of edit script)\n", name, best, best > 0 ? mb / best : 0.0,
+           script.writepos);
+    dynmem_free(&script);
+    return best;
+}
+
+int main() {
+    bench_data_t dat;
+    dynmem_t header_only, changes_only, with_context;
+
+    make_input(&dat.input);
+    make_dynmem(&dat.output, 0, 0);
+
+    /* A section without hunks is a plain copy of the input: the upper bound */
+    make_dynmem_as_copy(&header_only, "--- in.txt\n+++ out.txt\n", 1, 22);
+    make_patch(&changes_only, 0);
+    make_patch(&with_context, 1);
+
+    printf("input: %d lines, %zu bytes, hunk every %d lines\n", BENCH_INPUT_LINES, dat.input.writepos,
+           BENCH_HUNK_STRIDE);
+
+    double copy = run("copy", &dat, &header_only);
+    /* the deleted line of every hunk is still verified */
+    double bare = run("hunks, no context", &dat, &changes_only);
+    double verified = run("hunks, verified context", &dat, &with_context);
+    double unverified = run_unverified("hunks, unverified", &dat, &with_context);
+    double compiled = run_compiled("compiled, verified", &dat, &with_context);
+    double replayed = run_resolved("edit script replayed", &dat, &with_context);
+
+    printf("verified vs unverified:         %+.1f%%\n", unverified > 0 ? (verified / unverified - 1.0) * 100.0 : 0.0);
+    printf("verified context vs no context: %+.1f%%\n", bare > 0 ? (verified / bare - 1.0) * 100.0 : 0.0);
+    printf("verified context vs copy:       %+.1f%%\n", copy > 0 ? (verified / copy - 1.0) * 100.0 : 0.0);
+    printf("compiled vs parsed:             %+.1f%%\n", verified > 0 ? (compiled / verified - 1.0) * 100.0 : 0.0);
+    printf("edit script vs parsed:          %+.1f%%\n", verified > 0 ? (replayed / verified - 1.0) * 100.0 : 0.0);
+
+    dynmem_free(&dat.input);
+    dynmem_free(&dat.output);
+    dynmem_free(&header_only);
+    dynmem_free(&changes_only);
+    dynmem_free(&with_context);
+    return 0;
+}
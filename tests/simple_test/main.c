@@ -1,4 +1,6 @@
+#include <windows.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "../../src/patch.h"
@@ -16,9 +18,18 @@ typedef struct vtf_wrapper {
 } vtf_wrapper_t;
 
 typedef struct test_case_data {
+    const char* name;
     const vtf_wrapper_t* input;
     const vtf_wrapper_t* diff;
     const vtf_wrapper_t* expected;
+    int expect_failure; /* apply_patch must report an error */
+    unsigned int options; /* PATCH_OPTION_* on top of PATCH_OPTION_VERBOSE */
+    int shared_index;   /* pass a ready line index along with the input stream */
+    int compiled;       /* compile the diff and apply the compiled patch */
+    int resolved;       /* resolve the diff to an edit script and replay it */
+    int unseekable;     /* the diff and the input fail every seek, as pipes do */
+    size_t fed;         /* feed the diff in pieces of this many bytes, see patch_feed() */
+    unsigned int fuzz;  /* outer context lines a hunk may lose, see patch_set_fuzz() */
 } test_case_data_t;
 
 typedef struct simple_test_data {
@@ -26,6 +37,8 @@ typedef struct simple_test_data {
     owned_dynmem_stream_t diff_owned_stream;
     owned_dynmem_stream_t infile_owned_stream;
     owned_dynmem_stream_t outfile_owned_stream;
+    lineidx_t input_index;
+    long output_size;   /* size the output was acquired with, -1 if not known */
 } simple_test_data_t;
 
 /* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
@@ -70,9 +83,10 @@ static const vtf_wrapper_t g_test_case_naugty__expected = {
 };
 
 static const test_case_data_t g_test_case_naughty = {
+    .name = "naughty",
     .input = &g_test_case_naughty__input,
     .diff = &g_test_case_naughty__diff,
-    .expected = &g_test_case_naugty__expected, 
+    .expected = &g_test_case_naugty__expected,
 };
 
 /* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
@@ -118,11 +132,1333 @@ static const vtf_wrapper_t g_test_case_normal__expected = {
 };
 
 static const test_case_data_t g_test_case_normal = {
+    .name = "normal",
     .input = &g_test_case_normal__input,
     .diff = &g_test_case_normal__diff,
     .expected = &g_test_case_normal__expected,
 };
 
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_mismatch__input = {
+    .path = "./tests/data/input.txt",
+    .data =
+        "int main(void) {\r\n"
+        "  return 0;\r\n"
+        "}\r\n"
+        "\r\n",
+    .length = 36,
+};
+
+/* the normal diff against a different version of the input: context does not match */
+static const test_case_data_t g_test_case_mismatch = {
+    .name = "mismatch",
+    .input = &g_test_case_mismatch__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_normal__expected,
+    .expect_failure = 1,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_offset__input = {
+    .path = "./tests/data/input.txt",
+    .data =
+        "// drifted\r\n"
+        "// by three\r\n"
+        "// lines\r\n"
+        "int main() {\r\n"
+        "  return 0;\r\n"
+        "}\r\n"
+        "\r\n",
+    .length = 67,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_offset__expected = {
+    .path = "./tests/data/output.txt",
+    .data =
+        "// drifted\r\n"
+        "// by three\r\n"
+        "// lines\r\n"
+        "#include <stdio.h>\r\n"
+        "\r\n"
+        "int main() {\r\n"
+        "  printf(\"Hello, my world!\");\r\n"
+        "  return 0;\r\n"
+        "}\r\n"
+        "\r\n",
+    .length = 120,
+};
+
+/* the normal diff against an input that has grown in front of the hunk */
+static const test_case_data_t g_test_case_offset = {
+    .name = "offset",
+    .input = &g_test_case_offset__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_offset__expected,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_fuzz__input = {
+    .path = "./tests/data/input.txt",
+    .data =
+        "int main() {\r\n"
+        "  return 0;\r\n"
+        "}\r\n"
+        "// end\r\n",
+    .length = 38,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_fuzz__expected = {
+    .path = "./tests/data/output.txt",
+    .data =
+        "#include <stdio.h>\r\n"
+        "\r\n"
+        "int main() {\r\n"
+        "  printf(\"Hello, my world!\");\r\n"
+        "  return 0;\r\n"
+        "}\r\n"
+        "// end\r\n",
+    .length = 91,
+};
+
+/* the normal diff against an input whose last context line differs: applies once that line may be dropped */
+static const test_case_data_t g_test_case_fuzz = {
+    .name = "fuzz",
+    .input = &g_test_case_fuzz__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_fuzz__expected,
+    .fuzz = 1,
+};
+
+static const test_case_data_t g_test_case_no_fuzz = {
+    .name = "no fuzz",
+    .input = &g_test_case_fuzz__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_fuzz__expected,
+    .expect_failure = 1,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_whitespace__input = {
+    .path = "./tests/data/input.txt",
+    .data =
+        "int main()  {\n"
+        "  return 0; \t\n"
+        "}\n"
+        "\n",
+    .length = 31,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_whitespace__expected = {
+    .path = "./tests/data/output.txt",
+    .data =
+        "#include <stdio.h>\r\n"
+        "\r\n"
+        "int main()  {\n"
+        "  printf(\"Hello, my world!\");\r\n"
+        "  return 0; \t\n"
+        "}\n"
+        "\n",
+    .length = 84,
+};
+
+/* the normal (CRLF) diff against an LF input with other blanks: context lines keep their input bytes */
+static const test_case_data_t g_test_case_whitespace = {
+    .name = "whitespace",
+    .input = &g_test_case_whitespace__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_whitespace__expected,
+    .options = PATCH_OPTION_IGNORE_WHITESPACE | PATCH_OPTION_IGNORE_EOL,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_eol__expected = {
+    .path = "./tests/data/output.txt",
+    .data =
+        "#include <stdio.h>\n"
+        "\n"
+        "int main()  {\n"
+        "  printf(\"Hello, my world!\");\n"
+        "  return 0; \t\n"
+        "}\n"
+        "\n",
+    .length = 81,
+};
+
+/* as `whitespace`, but the added lines get the LF of the input instead of the CRLF of the diff */
+static const test_case_data_t g_test_case_eol = {
+    .name = "eol",
+    .input = &g_test_case_whitespace__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_eol__expected,
+    .options = PATCH_OPTION_IGNORE_WHITESPACE | PATCH_OPTION_IGNORE_EOL | PATCH_OPTION_EOL_PRESERVE,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_applied__input = {
+    .path = "./tests/data/input.txt",
+    .data =
+        "#include <stdio.h>\r\n"
+        "\r\n"
+        "int main() {\r\n"
+        "  printf(\"Hello, my world!\");\r\n"
+        "  return 0;\r\n"
+        "}\r\n"
+        "\r\n",
+    .length = 85,
+};
+
+/* the normal diff against its own result: the hunk is skipped, the input is kept */
+static const test_case_data_t g_test_case_applied = {
+    .name = "applied",
+    .input = &g_test_case_applied__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_normal__expected,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_deleted__input = {
+    .path = "./tests/data/input.txt",
+    .data =
+        "a\r\n"
+        "B\r\n"
+        "c\r\n"
+        "a\r\n"
+        "c\r\n",
+    .length = 15,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_deleted__diff = {
+    .path = "./tests/data/deleted.diff",
+    .data =
+        "--- ./tests/data/input.txt\r\n"
+        "+++ ./tests/data/output.txt\r\n"
+        "@@ -1,3 +1,2 @@\r\n"
+        " a\r\n"
+        "-b\r\n"
+        " c\r\n",
+    .length = 86,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_deleted__expected = {
+    .path = "./tests/data/output.txt",
+    .data =
+        "a\r\n"
+        "B\r\n"
+        "c\r\n"
+        "a\r\n"
+        "c\r\n",
+    .length = 15,
+};
+
+/* a hunk that only deletes, against an input that has its context lines elsewhere: not taken as applied */
+static const test_case_data_t g_test_case_deleted = {
+    .name = "deleted",
+    .input = &g_test_case_deleted__input,
+    .diff = &g_test_case_deleted__diff,
+    .expected = &g_test_case_deleted__expected,
+    .expect_failure = 1,
+};
+
+/* the normal diff reversed: turns the expected file back into the input */
+static const test_case_data_t g_test_case_reverse = {
+    .name = "reverse",
+    .input = &g_test_case_normal__expected,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_normal__input,
+    .options = PATCH_OPTION_REVERSE,
+};
+
+static const vtf_wrapper_t g_test_case_dry_run__expected = {
+    .path = "./tests/data/output.txt",
+    .data = "",
+    .length = 0,
+};
+
+/* the normal diff checked only: nothing may be written */
+static const test_case_data_t g_test_case_dry_run = {
+    .name = "dry_run",
+    .input = &g_test_case_normal__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_dry_run__expected,
+    .options = PATCH_OPTION_DRY_RUN,
+};
+
+/* the offset case with the input handed over as a ready index */
+static const test_case_data_t g_test_case_shared_index = {
+    .name = "shared_index",
+    .input = &g_test_case_offset__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_offset__expected,
+    .shared_index = 1,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_unordered__diff = {
+    .path = "./tests/data/unordered.diff",
+    .data =
+        "--- ./tests/data/input.txt\r\n"
+        "+++ ./tests/data/output.txt\r\n"
+        "@@ -1,2 +3,3 @@\r\n"
+        " int main() {\r\n"
+        "+  printf(\"Hello, my world!\");\r\n"
+        "   return 0;\r\n"
+        "@@ -1,1 +1,3 @@\r\n"
+        "+#include <stdio.h>\r\n"
+        "+\r\n"
+        " int main() {\r\n",
+    .length = 191,
+};
+
+/* the normal change split into two hunks that come in reverse order and share a context line */
+static const test_case_data_t g_test_case_unordered = {
+    .name = "unordered",
+    .input = &g_test_case_normal__input,
+    .diff = &g_test_case_unordered__diff,
+    .expected = &g_test_case_normal__expected,
+    .options = PATCH_OPTION_UNORDERED,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_create__diff = {
+    .path = "./tests/data/create.diff",
+    .data =
+        "--- /dev/null\r\n"
+        "+++ ./tests/data/output.txt\r\n"
+        "@@ -0,0 +1,7 @@\r\n"
+        "+#include <stdio.h>\r\n"
+        "+\r\n"
+        "+int main() {\r\n"
+        "+  printf(\"Hello, my world!\");\r\n"
+        "+  return 0;\r\n"
+        "+}\r\n"
+        "+\r\n",
+    .length = 153,
+};
+
+/* the output is created from the patch alone, the input is never requested */
+static const test_case_data_t g_test_case_create = {
+    .name = "create",
+    .input = &g_test_case_normal__input,
+    .diff = &g_test_case_create__diff,
+    .expected = &g_test_case_normal__expected,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_binary__diff = {
+    .path = "./tests/data/binary.diff",
+    .data =
+        "diff --git a/./tests/data/input.txt b/./tests/data/output.txt\n"
+        "GIT binary patch\n"
+        "delta 63\n"
+        "zc-m746;sa4OU@}xNmZ~ZE=kGE*UPZu<>KX<$iOGBpioehnOBmgq2!U8lasHbkXxxx\n"
+        "Ro?n!cqNt>44OGG>1OQ4_5zGJp\n"
+        "\n"
+        "literal 32\n"
+        "nc-qU%D^bWz%*@l!RH)|VQcx&LEh#O^Q!udR<*Mc7;^hJWooxs~\n"
+        "\n",
+    .length = 247,
+};
+
+/* the normal change as a GIT binary patch delta, copying the unchanged spans from the input */
+static const test_case_data_t g_test_case_binary = {
+    .name = "binary",
+    .input = &g_test_case_normal__input,
+    .diff = &g_test_case_binary__diff,
+    .expected = &g_test_case_normal__expected,
+};
+
+/* generated. Do not edit, use ./scripts/generate_vtf_from_file.py */
+static const vtf_wrapper_t g_test_case_index__diff = {
+    .path = "./tests/data/index.diff",
+    .data =
+        "diff --git a/./tests/data/input.txt b/./tests/data/output.txt\n"
+        "index bf57ee2..f39d141 100644\n"
+        "--- a/./tests/data/input.txt\r\n"
+        "+++ b/./tests/data/output.txt\r\n"
+        "@@ -1,4 +1,7 @@\r\n"
+        "+#include <stdio.h>\r\n"
+        "+\r\n"
+        " int main() {\r\n"
+        "+  printf(\"Hello, my world!\");\r\n"
+        "   return 0;\r\n"
+        " }\r\n"
+        " \r\n",
+    .length = 262,
+};
+
+/* the normal change with the blob hashes of both files, computed as they are read and written */
+static const test_case_data_t g_test_case_index = {
+    .name = "index",
+    .input = &g_test_case_normal__input,
+    .diff = &g_test_case_index__diff,
+    .expected = &g_test_case_normal__expected,
+    .options = PATCH_OPTION_VERIFY_INDEX,
+};
+
+/* round trips through a compiled patch: the lines keep the hashes they were compiled with,
+ * are swapped by the reversed patch, and are hashed again to be compared ignoring whitespace */
+static const test_case_data_t g_test_case_compiled = {
+    .name = "compiled",
+    .input = &g_test_case_normal__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_normal__expected,
+    .compiled = 1,
+};
+
+static const test_case_data_t g_test_case_compiled_reverse = {
+    .name = "compiled reverse",
+    .input = &g_test_case_normal__expected,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_normal__input,
+    .options = PATCH_OPTION_REVERSE,
+    .compiled = 1,
+};
+
+static const test_case_data_t g_test_case_compiled_whitespace = {
+    .name = "compiled whitespace",
+    .input = &g_test_case_whitespace__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_whitespace__expected,
+    .options = PATCH_OPTION_IGNORE_WHITESPACE | PATCH_OPTION_IGNORE_EOL,
+    .compiled = 1,
+};
+
+/* round trips through an edit script: copied spans of the input, and inserted ones for lines whose EOL changes */
+static const test_case_data_t g_test_case_resolved = {
+    .name = "resolved",
+    .input = &g_test_case_normal__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_normal__expected,
+    .resolved = 1,
+};
+
+static const test_case_data_t g_test_case_resolved_eol = {
+    .name = "resolved eol",
+    .input = &g_test_case_whitespace__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_eol__expected,
+    .options = PATCH_OPTION_IGNORE_WHITESPACE | PATCH_OPTION_IGNORE_EOL | PATCH_OPTION_EOL_PRESERVE,
+    .resolved = 1,
+};
+
+/* read once through streams that cannot seek; a hunk away from its line is searched for in the lines read ahead */
+static const test_case_data_t g_test_case_stream = {
+    .name = "stream",
+    .input = &g_test_case_normal__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_normal__expected,
+    .options = PATCH_OPTION_STREAM,
+    .unseekable = 1,
+};
+
+static const test_case_data_t g_test_case_stream_offset = {
+    .name = "stream offset",
+    .input = &g_test_case_offset__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_offset__expected,
+    .options = PATCH_OPTION_STREAM,
+    .unseekable = 1,
+};
+
+static const test_case_data_t g_test_case_stream_fuzz = {
+    .name = "stream fuzz",
+    .input = &g_test_case_fuzz__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_fuzz__expected,
+    .fuzz = 1,
+    .options = PATCH_OPTION_STREAM,
+    .unseekable = 1,
+};
+
+/* fed byte by byte, and with CRLF lines split between pieces */
+static const test_case_data_t g_test_case_fed = {
+    .name = "fed",
+    .input = &g_test_case_normal__input,
+    .diff = &g_test_case_normal__diff,
+    .expected = &g_test_case_normal__expected,
+    .fed = 1,
+};
+
+static const test_case_data_t g_test_case_fed_naughty = {
+    .name = "fed naughty",
+    .input = &g_test_case_naughty__input,
+    .diff = &g_test_case_naughty__diff,
+    .expected = &g_test_case_naugty__expected,
+    .fed = 3,
+};
+
+/* Cases that need real files (patches read by path, files written by the
+ * default stream callback) work in a directory of their own under the temp
+ * directory, removed with everything in it when the case is done */
+typedef struct file_case {
+    const char* name;
+    int (*run)(const char* dir);    /* returns 0 if the case passed */
+} file_case_t;
+
+static int make_temp_dir(char dir[MAX_PATH]) {
+    char temp[MAX_PATH];
+    if (GetTempPathA(MAX_PATH, temp) == 0 || GetTempFileNameA(temp, "pt", 0, dir) == 0)
+        return -1;
+    /* the name is unique while its file exists, the directory takes its place */
+    DeleteFileA(dir);
+    return CreateDirectoryA(dir, NULL) ? 0 : -1;
+}
+
+/* returns 0 if `dir`/`name` fits in `path` */
+static int join_path(char path[MAX_PATH], const char* dir, const char* name) {
+    int length = snprintf(path, MAX_PATH, "%s/%s", dir, name);
+    return length < 0 || length >= MAX_PATH ? -1 : 0;
+}
+
+static void remove_tree(const char* dir) {
+    char pattern[MAX_PATH];
+    WIN32_FIND_DATAA found;
+    if (join_path(pattern, dir, "*") != 0)
+        return;
+    HANDLE find = FindFirstFileA(pattern, &found);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            char path[MAX_PATH];
+            if (strcmp(found.cFileName, ".") == 0 || strcmp(found.cFileName, "..") == 0)
+                continue;
+            if (join_path(path, dir, found.cFileName) != 0)
+                continue;
+            if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                remove_tree(path);
+            else
+                DeleteFileA(path);
+        } while (FindNextFileA(find, &found));
+        FindClose(find);
+    }
+    RemoveDirectoryA(dir);
+}
+
+static int write_file(const char* dir, const char* name, const char* data, size_t length) {
+    char path[MAX_PATH];
+    if (join_path(path, dir, name) != 0)
+        return -1;
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL)
+        return -1;
+    size_t written = fwrite(data, 1, length, fp);
+    return fclose(fp) != 0 || written != length ? -1 : 0;
+}
+
+/* Opens a quoted patch path in `dir`: a '"', then `dir` with its backslashes
+ * escaped; the file name and the closing '"' are to follow */
+static void quote_dir(char quoted[2 * MAX_PATH + 3], const char* dir) {
+    size_t n = 0;
+    quoted[n++] = '"';
+    for (const char* p = dir; *p; ++p) {
+        if (*p == '\\' || *p == '"')
+            quoted[n++] = '\\';
+        quoted[n++] = *p;
+    }
+    quoted[n] = '\0';
+}
+
+/* Writes the patch of `target` in `dir`: file headers naming it by its full
+ * path, quoted with its backslashes escaped, then the hunks */
+static int write_diff(const char* dir, const char* name, const char* target, const char* hunks) {
+    char quoted[2 * MAX_PATH + 3];
+    char text[4096];
+    quote_dir(quoted, dir);
+    int length = snprintf(text, sizeof(text), "--- %s/%s\"\n+++ %s/%s\"\n%s", quoted, target, quoted, target, hunks);
+    if (length < 0 || (size_t)length >= sizeof(text))
+        return -1;
+    return write_file(dir, name, text, (size_t)length);
+}
+
+/* returns 1 if the file holds exactly `data` */
+static int file_equals(const char* dir, const char* name, const char* data) {
+    char path[MAX_PATH];
+    char buf[4096];
+    if (join_path(path, dir, name) != 0)
+        return 0;
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return 0;
+    size_t read = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return read == strlen(data) && memcmp(buf, data, read) == 0;
+}
+
+static int file_exists(const char* dir, const char* name) {
+    char path[MAX_PATH];
+    if (join_path(path, dir, name) != 0)
+        return 0;
+    FILE* fp = fopen(path, "rb");
+    if (fp != NULL)
+        fclose(fp);
+    return fp != NULL;
+}
+
+/* Applies the patch file `name` with the default stream callback; returns the status of apply_patch() */
+static int apply_file(const char* dir, const char* name, unsigned int options) {
+    char path[MAX_PATH];
+    if (join_path(path, dir, name) != 0)
+        return -1;
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+    stream_wrapper_t sw = {0};
+    make_fdsw(&sw, fp);
+    void* patcher = patch_init();
+    patch_set_options(patcher, PATCH_OPTION_VERBOSE | options);
+    int stat = apply_patch(patcher, &sw);   /* closes the stream */
+    patch_destroy(patcher);
+    return stat;
+}
+
+/* two patches of one file, on lines 1-3 and 3-4 */
+static const char g_conflict_first[] =
+    "--- f.txt\n"
+    "+++ f.txt\n"
+    "@@ -1,3 +1,3 @@\n"
+    " a\n"
+    "-b\n"
+    "+B\n"
+    " c\n";
+
+static const char g_conflict_overlapping[] =
+    "--- f.txt\n"
+    "+++ f.txt\n"
+    "@@ -3,2 +3,2 @@\n"
+    " c\n"
+    "-d\n"
+    "+D\n";
+
+static const char g_conflict_apart[] =
+    "--- f.txt\n"
+    "+++ f.txt\n"
+    "@@ -10,2 +10,2 @@\n"
+    " j\n"
+    "-k\n"
+    "+K\n";
+
+/* the overlapping patch as a git section */
+static const char g_conflict_git[] =
+    "diff --git a/f.txt b/f.txt\n"
+    "index 1111111..2222222 100644\n"
+    "--- a/f.txt\n"
+    "+++ b/f.txt\n"
+    "@@ -3,2 +3,2 @@\n"
+    " c\n"
+    "-d\n"
+    "+D\n";
+
+/* two patches creating two files, on the same lines of nothing */
+static const char g_conflict_create_a[] =
+    "--- /dev/null\n"
+    "+++ a.txt\n"
+    "@@ -0,0 +1 @@\n"
+    "+a\n";
+
+static const char g_conflict_create_b[] =
+    "--- /dev/null\n"
+    "+++ b.txt\n"
+    "@@ -0,0 +1 @@\n"
+    "+b\n";
+
+/* Finds the conflicts of `first` and `second`; returns 0 if there are `expected` of them, all in f.txt */
+static int find_conflicts(const char* dir, const char* first, const char* second, size_t expected) {
+    char first_path[MAX_PATH], second_path[MAX_PATH];
+    if (join_path(first_path, dir, "first.diff") != 0 || join_path(second_path, dir, "second.diff") != 0 ||
+        write_file(dir, "first.diff", first, strlen(first)) != 0 ||
+        write_file(dir, "second.diff", second, strlen(second)) != 0)
+        return -1;
+
+    const char* paths[] = {first_path, second_path};
+    patch_conflict_t* conflicts = NULL;
+    size_t count = 0;
+    if (patch_find_conflicts(paths, 2, 0, &conflicts, &count) != 0)
+        return -1;
+    int stat = count == expected ? 0 : -1;
+    for (size_t i = 0; i < count; ++i) {
+        if (conflicts[i].first != 0 || conflicts[i].second != 1 || strcmp(conflicts[i].path, "f.txt") != 0)
+            stat = -1;
+    }
+    free(conflicts);
+    return stat;
+}
+
+static int run_conflicts_overlapping(const char* dir) {
+    return find_conflicts(dir, g_conflict_first, g_conflict_overlapping, 1);
+}
+
+static int run_conflicts_apart(const char* dir) {
+    return find_conflicts(dir, g_conflict_first, g_conflict_apart, 0);
+}
+
+/* a git patch and a plain one of the same file are compared without the a/ b/ prefixes */
+static int run_conflicts_git(const char* dir) {
+    return find_conflicts(dir, g_conflict_first, g_conflict_git, 1);
+}
+
+/* created files are told apart by their new paths, not all taken for /dev/null */
+static int run_conflicts_created(const char* dir) {
+    return find_conflicts(dir, g_conflict_create_a, g_conflict_create_b, 0);
+}
+
+/* two hunks of one file, the second against lines the file does not have */
+static const char g_two_hunks_input[] =
+    "1\n2\n3\n4\n5\n6\n7\n8\n9\n10\n11\n12\n";
+
+static const char g_two_hunks_failing[] =
+    "@@ -1,3 +1,3 @@\n"
+    " 1\n"
+    "-2\n"
+    "+two\n"
+    " 3\n"
+    "@@ -9,3 +9,3 @@\n"
+    " 9\n"
+    "-ten\n"
+    "+TEN\n"
+    " 11\n";
+
+/* the output is written up to the failed hunk, then discarded: no temporary file is left behind */
+static int run_failed_hunk(const char* dir) {
+    if (write_file(dir, "f.txt", g_two_hunks_input, sizeof(g_two_hunks_input) - 1) != 0 ||
+        write_diff(dir, "p.diff", "f.txt", g_two_hunks_failing) != 0 || apply_file(dir, "p.diff", 0) == 0)
+        return -1;
+    return file_equals(dir, "f.txt", g_two_hunks_input) && !file_exists(dir, "f.txt.tmp") ? 0 : -1;
+}
+
+/* Compiles the patch file `name` and applies it compiled with the default stream callback;
+ * returns the status of apply_compiled_patch() */
+static int apply_compiled(const char* dir, const char* name) {
+    char path[MAX_PATH];
+    if (join_path(path, dir, name) != 0)
+        return -1;
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+    stream_wrapper_t sw = {0};
+    make_fdsw(&sw, fp);
+    dynmem_t compiled;
+    make_dynmem(&compiled, 0, 0);
+    stream_wrapper_t out = {0};
+    make_memsw(&out, &compiled);
+    int stat = patch_compile(&sw, 0, &out);   /* closes `sw` */
+    if (stat == 0) {
+        void* patcher = patch_init();
+        patch_set_options(patcher, PATCH_OPTION_VERBOSE);
+        stat = apply_compiled_patch(patcher, compiled.buf, compiled.writepos);
+        patch_destroy(patcher);
+    } else {
+        stat = -1;
+    }
+    dynmem_free(&compiled);
+    return stat;
+}
+
+/* a compiled patch that fails drops its output as the text does */
+static int run_compiled_failed_hunk(const char* dir) {
+    if (write_file(dir, "f.txt", g_two_hunks_input, sizeof(g_two_hunks_input) - 1) != 0 ||
+        write_diff(dir, "p.diff", "f.txt", g_two_hunks_failing) != 0 || apply_compiled(dir, "p.diff") <= 0)
+        return -1;
+    return file_equals(dir, "f.txt", g_two_hunks_input) && !file_exists(dir, "f.txt.tmp") ? 0 : -1;
+}
+
+/* the first hunk grows the file, the second shrinks it back by more */
+static const char g_two_hunks_applying[] =
+    "@@ -1,3 +1,3 @@\n"
+    " 1\n"
+    "-2\n"
+    "+two\n"
+    " 3\n"
+    "@@ -9,3 +9,2 @@\n"
+    " 9\n"
+    "-10\n"
+    "-11\n"
+    "+x\n";
+
+static const char g_two_hunks_expected[] =
+    "1\ntwo\n3\n4\n5\n6\n7\n8\n9\nx\n12\n";
+
+/* an edit script replayed on an input other than the one it was resolved against leaves the file as it is */
+static int run_script_mismatch(const char* dir) {
+    static const char changed[] = "changed since the script was resolved\n";
+    char path[MAX_PATH];
+    if (write_file(dir, "f.txt", g_two_hunks_input, sizeof(g_two_hunks_input) - 1) != 0 ||
+        write_diff(dir, "p.diff", "f.txt", g_two_hunks_applying) != 0 || join_path(path, dir, "p.diff") != 0)
+        return -1;
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+    stream_wrapper_t sw = {0};
+    make_fdsw(&sw, fp);
+    dynmem_t script;
+    make_dynmem(&script, 0, 0);
+    stream_wrapper_t out = {0};
+    make_memsw(&out, &script);
+    void* patcher = patch_init();
+    patch_set_options(patcher, PATCH_OPTION_VERBOSE);
+    int stat = patch_resolve(patcher, &sw, &out) == 0 &&   /* closes `sw` */
+               write_file(dir, "f.txt", changed, sizeof(changed) - 1) == 0 &&
+               apply_edit_script(patcher, script.buf, script.writepos) != 0
+        ? 0
+        : -1;
+    patch_destroy(patcher);
+    dynmem_free(&script);
+    return stat == 0 && file_equals(dir, "f.txt", changed) && !file_exists(dir, "f.txt.tmp") ? 0 : -1;
+}
+
+/* same-size changes: only their bytes are written, the rest of the file stays where it is */
+static const char g_same_size_hunks[] =
+    "@@ -1,3 +1,3 @@\n"
+    " 1\n"
+    "-2\n"
+    "+b\n"
+    " 3\n"
+    "@@ -9,3 +9,3 @@\n"
+    " 9\n"
+    "-10\n"
+    "+XY\n"
+    " 11\n";
+
+static const char g_same_size_expected[] =
+    "1\nb\n3\n4\n5\n6\n7\n8\n9\nXY\n11\n12\n";
+
+static int run_inplace_same_size(const char* dir) {
+    if (write_file(dir, "f.txt", g_two_hunks_input, sizeof(g_two_hunks_input) - 1) != 0 ||
+        write_diff(dir, "p.diff", "f.txt", g_same_size_hunks) != 0 ||
+        apply_file(dir, "p.diff", PATCH_OPTION_INPLACE) != 0)
+        return -1;
+    return file_equals(dir, "f.txt", g_same_size_expected) && !file_exists(dir, "f.txt.tmp") ? 0 : -1;
+}
+
+/* in place every hunk is placed before the file is opened: a later hunk that fails leaves it as it was */
+static int run_inplace_failed_hunk(const char* dir) {
+    if (write_file(dir, "f.txt", g_two_hunks_input, sizeof(g_two_hunks_input) - 1) != 0 ||
+        write_diff(dir, "p.diff", "f.txt", g_two_hunks_failing) != 0 ||
+        apply_file(dir, "p.diff", PATCH_OPTION_INPLACE) == 0)
+        return -1;
+    return file_equals(dir, "f.txt", g_two_hunks_input) ? 0 : -1;
+}
+
+static int run_inplace(const char* dir) {
+    if (write_file(dir, "f.txt", g_two_hunks_input, sizeof(g_two_hunks_input) - 1) != 0 ||
+        write_diff(dir, "p.diff", "f.txt", g_two_hunks_applying) != 0 ||
+        apply_file(dir, "p.diff", PATCH_OPTION_INPLACE) != 0)
+        return -1;
+    return file_equals(dir, "f.txt", g_two_hunks_expected) && !file_exists(dir, "f.txt.tmp") ? 0 : -1;
+}
+
+/* a change two lines below where the patch puts it */
+static const char g_cache_input[] =
+    "x\ny\n1\n2\n3\n4\n";
+
+static const char g_cache_hunk[] =
+    "@@ -1,3 +1,3 @@\n"
+    " 1\n"
+    "-2\n"
+    "+two\n"
+    " 3\n";
+
+static const char g_cache_expected[] =
+    "x\ny\n1\ntwo\n3\n4\n";
+
+/* Applies the patch file `name` with a result cache in `dir`/cache; `offset`
+ * receives the offset its one hunk was reported at */
+static int apply_cached(const char* dir, const char* name, int* offset) {
+    char path[MAX_PATH], cache[MAX_PATH];
+    if (join_path(path, dir, name) != 0 || join_path(cache, dir, "cache") != 0)
+        return -1;
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+    stream_wrapper_t sw = {0};
+    make_fdsw(&sw, fp);
+    void* patcher = patch_init();
+    patch_set_options(patcher, PATCH_OPTION_VERBOSE);
+    patch_set_cache_dir(patcher, cache);
+    int stat = apply_patch(patcher, &sw);   /* closes the stream */
+    const patch_hunk_result_t* results = NULL;
+    if (patch_get_results(patcher, &results) == 1)
+        *offset = results[0].offset;
+    else
+        stat = -1;
+    patch_destroy(patcher);
+    return stat;
+}
+
+/* the cached output of g_cache_input, marked by its first byte */
+static const char g_cache_marked[] =
+    "X\ny\n1\ntwo\n3\n4\n";
+
+/* Marks the one output entry of the result cache in `dir`/cache: its first
+ * byte becomes an 'X', which only a hit copies. Returns 0 on success */
+static int mark_cache_entry(const char* dir) {
+    char cache[MAX_PATH], pattern[MAX_PATH], path[MAX_PATH];
+    WIN32_FIND_DATAA found;
+    if (join_path(cache, dir, "cache") != 0 || join_path(pattern, cache, "*") != 0)
+        return -1;
+    HANDLE find = FindFirstFileA(pattern, &found);
+    if (find == INVALID_HANDLE_VALUE)
+        return -1;
+    int marked = 0;
+    do {
+        if (found.cFileName[0] == '.' || strncmp(found.cFileName, "stat-", 5) == 0 ||
+            join_path(path, cache, found.cFileName) != 0)
+            continue;
+        FILE* fp = fopen(path, "r+b");
+        if (fp != NULL) {
+            marked += fputc('X', fp) == 'X';
+            fclose(fp);
+        }
+    } while (FindNextFileA(find, &found));
+    FindClose(find);
+    return marked == 1 ? 0 : -1;
+}
+
+/* the first run places the hunk two lines down and stores the output; the
+ * second, on the same input, copies it from the cache, and reports the hunk
+ * where the first run placed it */
+static int run_cache(const char* dir) {
+    int placed = 0, cached = 0;
+    if (write_file(dir, "f.txt", g_cache_input, sizeof(g_cache_input) - 1) != 0 ||
+        write_diff(dir, "p.diff", "f.txt", g_cache_hunk) != 0 || apply_cached(dir, "p.diff", &placed) != 0 ||
+        !file_equals(dir, "f.txt", g_cache_expected) || mark_cache_entry(dir) != 0)
+        return -1;
+    if (write_file(dir, "f.txt", g_cache_input, sizeof(g_cache_input) - 1) != 0 ||
+        apply_cached(dir, "p.diff", &cached) != 0)
+        return -1;
+    return placed == 2 && cached == 2 && file_equals(dir, "f.txt", g_cache_marked) ? 0 : -1;
+}
+
+/* a series of two patches, the second made against the result of the first */
+static const char g_series_input[] =
+    "one\n"
+    "two\n"
+    "three\n";
+
+static const char g_series_first[] =
+    "@@ -1,3 +1,3 @@\n"
+    " one\n"
+    "-two\n"
+    "+TWO\n"
+    " three\n";
+
+static const char g_series_second[] =
+    "@@ -2,2 +2,3 @@\n"
+    " TWO\n"
+    "-three\n"
+    "+THREE\n"
+    "+four\n";
+
+/* made against the input, not against the result of the first patch */
+static const char g_series_stale[] =
+    "@@ -2,2 +2,2 @@\n"
+    " two\n"
+    "-three\n"
+    "+THREE\n";
+
+static const char g_series_expected[] =
+    "one\n"
+    "TWO\n"
+    "THREE\n"
+    "four\n";
+
+/* Applies g_series_first, then `second` as a series; returns the status of patch_apply_series() */
+static int apply_series(const char* dir, const char* second) {
+    char first_path[MAX_PATH], second_path[MAX_PATH];
+    if (join_path(first_path, dir, "first.diff") != 0 || join_path(second_path, dir, "second.diff") != 0 ||
+        write_file(dir, "f.txt", g_series_input, sizeof(g_series_input) - 1) != 0 ||
+        write_diff(dir, "first.diff", "f.txt", g_series_first) != 0 ||
+        write_diff(dir, "second.diff", "f.txt", second) != 0)
+        return -1;
+
+    const char* paths[] = {first_path, second_path};
+    return patch_apply_series(paths, 2, PATCH_OPTION_VERBOSE, 0);
+}
+
+static int run_series(const char* dir) {
+    if (apply_series(dir, g_series_second) != 0)
+        return -1;
+    return file_equals(dir, "f.txt", g_series_expected) && !file_exists(dir, "f.txt.tmp") ? 0 : -1;
+}
+
+/* the second patch does not apply: nothing may be written */
+static int run_series_failing(const char* dir) {
+    if (apply_series(dir, g_series_stale) == 0)
+        return -1;
+    return file_equals(dir, "f.txt", g_series_input) && !file_exists(dir, "f.txt.tmp") ? 0 : -1;
+}
+
+/* Writes `name` in `dir`, a patch that deletes f.txt as g_series_first leaves it */
+static int write_series_delete(const char* dir, const char* name) {
+    char quoted[2 * MAX_PATH + 3];
+    char text[1024];
+    quote_dir(quoted, dir);
+    int length = snprintf(text, sizeof(text), "--- %s/f.txt\"\n+++ /dev/null\n@@ -1,3 +0,0 @@\n-one\n-TWO\n-three\n",
+                          quoted);
+    if (length < 0 || (size_t)length >= sizeof(text))
+        return -1;
+    return write_file(dir, name, text, (size_t)length);
+}
+
+/* Applies the patch files `first` and `second` in `dir` on g_series_input as a series;
+ * returns the status of patch_apply_series() */
+static int apply_series_files(const char* dir, const char* first, const char* second) {
+    char first_path[MAX_PATH], second_path[MAX_PATH];
+    if (join_path(first_path, dir, first) != 0 || join_path(second_path, dir, second) != 0 ||
+        write_file(dir, "f.txt", g_series_input, sizeof(g_series_input) - 1) != 0)
+        return -1;
+    const char* paths[] = {first_path, second_path};
+    return patch_apply_series(paths, 2, PATCH_OPTION_VERBOSE, 0);
+}
+
+/* a file the second patch deletes is removed when the series is written */
+static int run_series_delete(const char* dir) {
+    if (write_diff(dir, "first.diff", "f.txt", g_series_first) != 0 || write_series_delete(dir, "delete.diff") != 0 ||
+        apply_series_files(dir, "first.diff", "delete.diff") != 0)
+        return -1;
+    return !file_exists(dir, "f.txt") && !file_exists(dir, "f.txt.tmp") ? 0 : -1;
+}
+
+/* a file an earlier patch deleted cannot be patched: the series fails and the file stays */
+static int run_series_deleted_input(const char* dir) {
+    if (write_diff(dir, "first.diff", "f.txt", g_series_first) != 0 || write_series_delete(dir, "delete.diff") != 0 ||
+        apply_series_files(dir, "delete.diff", "first.diff") == 0)
+        return -1;
+    return file_equals(dir, "f.txt", g_series_input) ? 0 : -1;
+}
+
+/* hunks that only add lines at the end of g_two_hunks_input, written in place after
+ * only its tail is read; the second one leaves the file without a final newline */
+static const char g_append_hunk[] =
+    "@@ -11,2 +11,4 @@\n"
+    " 11\n"
+    " 12\n"
+    "+13\n"
+    "+14\n";
+
+static const char g_append_expected[] =
+    "1\n2\n3\n4\n5\n6\n7\n8\n9\n10\n11\n12\n13\n14\n";
+
+static const char g_append_no_newline_hunk[] =
+    "@@ -11,2 +11,3 @@\n"
+    " 11\n"
+    " 12\n"
+    "+13\n"
+    "\\ No newline at end of file\n";
+
+static const char g_append_no_newline_expected[] =
+    "1\n2\n3\n4\n5\n6\n7\n8\n9\n10\n11\n12\n13";
+
+/* a file without a final newline is not appended to: its last line is completed first */
+static const char g_append_after_no_newline_input[] =
+    "1\n2\n3";
+
+static const char g_append_after_no_newline_hunk[] =
+    "@@ -2,2 +2,3 @@\n"
+    " 2\n"
+    "-3\n"
+    "\\ No newline at end of file\n"
+    "+3\n"
+    "+4\n";
+
+static const char g_append_after_no_newline_expected[] =
+    "1\n2\n3\n4\n";
+
+/* Applies `hunk` to `input` in place; returns 0 if the file becomes `expected` */
+static int append_in_place(const char* dir, const char* input, const char* hunk, const char* expected) {
+    if (write_file(dir, "f.txt", input, strlen(input)) != 0 || write_diff(dir, "p.diff", "f.txt", hunk) != 0 ||
+        apply_file(dir, "p.diff", PATCH_OPTION_INPLACE) != 0)
+        return -1;
+    return file_equals(dir, "f.txt", expected) ? 0 : -1;
+}
+
+static int run_append(const char* dir) {
+    return append_in_place(dir, g_two_hunks_input, g_append_hunk, g_append_expected);
+}
+
+static int run_append_no_newline(const char* dir) {
+    return append_in_place(dir, g_two_hunks_input, g_append_no_newline_hunk, g_append_no_newline_expected);
+}
+
+static int run_append_after_no_newline(const char* dir) {
+    return append_in_place(dir, g_append_after_no_newline_input, g_append_after_no_newline_hunk,
+                           g_append_after_no_newline_expected);
+}
+
+/* file events seen while applying a git patch, each then done by the default callback */
+typedef struct file_events {
+    unsigned int types[8];
+    size_t count;
+    unsigned int mode;
+} file_events_t;
+
+static int record_file_evt_cbk(patch_evt_t* evt) {
+    file_events_t* events = (file_events_t*)evt->userdata;
+    if (evt->type >= PATCH_EVT_FILE_RENAME && evt->type <= PATCH_EVT_FILE_MODE) {
+        if (events->count < sizeof(events->types) / sizeof(*events->types))
+            events->types[events->count] = evt->type;
+        ++events->count;
+        if (evt->type == PATCH_EVT_FILE_MODE)
+            events->mode = evt->data.file_event.mode;
+    }
+    return default_patch_evt_cbk(evt);
+}
+
+/* Writes the patch `name` in `dir`, a `diff --git` section of `old_name` and
+ * `new_name`: the header names them by their full paths, quoted, then come
+ * `extended` lines, in which each %s is `dir` quoted, then `body` (file
+ * headers and hunks) formatted alike */
+static int write_git_diff(const char* dir, const char* name, const char* old_name, const char* new_name,
+                          const char* extended, const char* body) {
+    char quoted[2 * MAX_PATH + 3];
+    char ext[1024], rest[2048], text[4096];
+    quote_dir(quoted, dir);
+    /* the a/ b/ prefixes are given inside the quotes, so the directory is quoted after them */
+    const char* q = quoted + 1;
+    int length = snprintf(ext, sizeof(ext), extended, q, q);
+    if (length < 0 || (size_t)length >= sizeof(ext))
+        return -1;
+    length = snprintf(rest, sizeof(rest), body, q, q);
+    if (length < 0 || (size_t)length >= sizeof(rest))
+        return -1;
+    length = snprintf(text, sizeof(text), "diff --git \"a/%s/%s\" \"b/%s/%s\"\n%s%s", q, old_name, q, new_name,
+                      ext, rest);
+    if (length < 0 || (size_t)length >= sizeof(text))
+        return -1;
+    return write_file(dir, name, text, (size_t)length);
+}
+
+/* Applies p.diff in `dir`, recording the file events into `events` */
+static int apply_git(const char* dir, file_events_t* events) {
+    char path[MAX_PATH];
+    if (join_path(path, dir, "p.diff") != 0)
+        return -1;
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+    stream_wrapper_t sw = {0};
+    make_fdsw(&sw, fp);
+    void* patcher = patch_init();
+    patch_set_options(patcher, PATCH_OPTION_VERBOSE);
+    patch_set_path_cbk(patcher, &record_file_evt_cbk, events);
+    int stat = apply_patch(patcher, &sw);   /* closes the stream */
+    patch_destroy(patcher);
+    return stat;
+}
+
+/* returns 1 if exactly one file event of `type` was seen */
+static int only_event(const file_events_t* events, unsigned int type) {
+    return events->count == 1 && events->types[0] == type;
+}
+
+static const char g_git_hunk[] =
+    "--- \"a/%s/old.txt\"\n"
+    "+++ \"b/%s/new.txt\"\n"
+    "@@ -1,3 +1,3 @@\n"
+    " 1\n"
+    "-2\n"
+    "+two\n"
+    " 3\n";
+
+static const char g_git_input[] = "1\n2\n3\n";
+static const char g_git_expected[] = "1\ntwo\n3\n";
+
+static int run_git_rename(const char* dir) {
+    file_events_t events = {0};
+    if (write_file(dir, "old.txt", g_git_input, strlen(g_git_input)) != 0 ||
+        write_git_diff(dir, "p.diff", "old.txt", "new.txt",
+                       "similarity index 100%%\nrename from \"%s/old.txt\"\nrename to \"%s/new.txt\"\n", "") != 0 ||
+        apply_git(dir, &events) != 0)
+        return -1;
+    return only_event(&events, PATCH_EVT_FILE_RENAME) && !file_exists(dir, "old.txt") &&
+           file_equals(dir, "new.txt", g_git_input) ? 0 : -1;
+}
+
+static int run_git_rename_hunk(const char* dir) {
+    file_events_t events = {0};
+    if (write_file(dir, "old.txt", g_git_input, strlen(g_git_input)) != 0 ||
+        write_git_diff(dir, "p.diff", "old.txt", "new.txt",
+                       "similarity index 60%%\nrename from \"%s/old.txt\"\nrename to \"%s/new.txt\"\n",
+                       g_git_hunk) != 0 ||
+        apply_git(dir, &events) != 0)
+        return -1;
+    return only_event(&events, PATCH_EVT_FILE_DELETE) && !file_exists(dir, "old.txt") &&
+           file_equals(dir, "new.txt", g_git_expected) ? 0 : -1;
+}
+
+static int run_git_copy(const char* dir) {
+    file_events_t events = {0};
+    if (write_file(dir, "old.txt", g_git_input, strlen(g_git_input)) != 0 ||
+        write_git_diff(dir, "p.diff", "old.txt", "new.txt",
+                       "similarity index 60%%\ncopy from \"%s/old.txt\"\ncopy to \"%s/new.txt\"\n", g_git_hunk) != 0 ||
+        apply_git(dir, &events) != 0)
+        return -1;
+    return events.count == 0 && file_equals(dir, "old.txt", g_git_input) &&
+           file_equals(dir, "new.txt", g_git_expected) ? 0 : -1;
+}
+
+static int run_git_mode(const char* dir) {
+    file_events_t events = {0};
+    if (write_file(dir, "f.txt", g_git_input, strlen(g_git_input)) != 0 ||
+        write_git_diff(dir, "p.diff", "f.txt", "f.txt", "old mode 100644\nnew mode 100755\n", "") != 0 ||
+        apply_git(dir, &events) != 0)
+        return -1;
+    return only_event(&events, PATCH_EVT_FILE_MODE) && events.mode == 0755 &&
+           file_equals(dir, "f.txt", g_git_input) ? 0 : -1;
+}
+
+static int run_git_delete(const char* dir) {
+    file_events_t events = {0};
+    if (write_file(dir, "f.txt", g_git_input, strlen(g_git_input)) != 0 ||
+        write_git_diff(dir, "p.diff", "f.txt", "f.txt", "deleted file mode 100644\n",
+                       "--- \"a/%s/f.txt\"\n+++ /dev/null\n@@ -1,3 +0,0 @@\n-1\n-2\n-3\n") != 0 ||
+        apply_git(dir, &events) != 0)
+        return -1;
+    return only_event(&events, PATCH_EVT_FILE_DELETE) && !file_exists(dir, "f.txt") ? 0 : -1;
+}
+
+/* g_series_input after g_series_first */
+static const char g_series_first_expected[] =
+    "one\n"
+    "TWO\n"
+    "three\n";
+
+/* Writes `name` in `dir`, a git patch that renames f.txt to g.txt and makes it executable */
+static int write_series_rename(const char* dir, const char* name) {
+    return write_git_diff(dir, name, "f.txt", "g.txt",
+                          "old mode 100644\nnew mode 100755\nsimilarity index 100%%\n"
+                          "rename from \"%s/f.txt\"\nrename to \"%s/g.txt\"\n",
+                          "");
+}
+
+/* a renamed file is read from its old path until the series is written, then moved */
+static int run_series_rename(const char* dir) {
+    if (write_series_rename(dir, "rename.diff") != 0 || write_diff(dir, "first.diff", "g.txt", g_series_first) != 0 ||
+        apply_series_files(dir, "rename.diff", "first.diff") != 0)
+        return -1;
+    return !file_exists(dir, "f.txt") && file_equals(dir, "g.txt", g_series_first_expected) &&
+           !file_exists(dir, "g.txt.tmp") ? 0 : -1;
+}
+
+/* a file written in memory takes its content along when renamed */
+static int run_series_rename_written(const char* dir) {
+    if (write_diff(dir, "first.diff", "f.txt", g_series_first) != 0 || write_series_rename(dir, "rename.diff") != 0 ||
+        apply_series_files(dir, "first.diff", "rename.diff") != 0)
+        return -1;
+    return !file_exists(dir, "f.txt") && file_equals(dir, "g.txt", g_series_first_expected) ? 0 : -1;
+}
+
+/* three patches checked on two threads: one applies, one has a hunk that fails, one is applied already */
+static int run_check_many(const char* dir) {
+    char paths[3][MAX_PATH];
+    if (write_file(dir, "f.txt", g_two_hunks_input, sizeof(g_two_hunks_input) - 1) != 0 ||
+        write_file(dir, "g.txt", g_series_first_expected, sizeof(g_series_first_expected) - 1) != 0 ||
+        write_diff(dir, "applying.diff", "f.txt", g_two_hunks_applying) != 0 ||
+        write_diff(dir, "failing.diff", "f.txt", g_two_hunks_failing) != 0 ||
+        write_diff(dir, "applied.diff", "g.txt", g_series_first) != 0 ||
+        join_path(paths[0], dir, "applying.diff") != 0 || join_path(paths[1], dir, "failing.diff") != 0 ||
+        join_path(paths[2], dir, "applied.diff") != 0)
+        return -1;
+
+    const char* patch_paths[] = {paths[0], paths[1], paths[2]};
+    patch_check_result_t results[3] = {0};
+    if (patch_check_many(patch_paths, 3, 0, 0, 2, results) != 1)
+        return -1;
+    const patch_check_result_t* r = results;
+    return r[0].status == PATCH_CHECK_OK && r[0].hunks_ok == 2 && r[0].hunks_applied == 0 && r[0].hunks_failed == 0 &&
+           r[1].status == PATCH_CHECK_FAILED && r[1].hunks_ok == 1 && r[1].hunks_applied == 0 &&
+           r[1].hunks_failed == 1 &&
+           r[2].status == PATCH_CHECK_OK && r[2].hunks_ok == 0 && r[2].hunks_applied == 1 && r[2].hunks_failed == 0 &&
+           file_equals(dir, "f.txt", g_two_hunks_input) ? 0 : -1;
+}
+
+/* two patches of g_two_hunks_input, the second made against the result of the first:
+ * its first hunk changes a line the first one added, its second one is apart */
+static const char g_compose_first[] =
+    "@@ -1,3 +1,3 @@\n"
+    " 1\n"
+    "-2\n"
+    "+two\n"
+    " 3\n"
+    "@@ -9,3 +9,4 @@\n"
+    " 9\n"
+    "-10\n"
+    "+ten\n"
+    "+ten and a half\n"
+    " 11\n";
+
+static const char g_compose_second[] =
+    "@@ -1,3 +1,3 @@\n"
+    " 1\n"
+    "-two\n"
+    "+TWO\n"
+    " 3\n"
+    "@@ -5,3 +5,3 @@\n"
+    " 5\n"
+    "-6\n"
+    "+six\n"
+    " 7\n"
+    "@@ -10,3 +10,2 @@\n"
+    " ten\n"
+    "-ten and a half\n"
+    " 11\n";
+
+static const char g_compose_expected[] =
+    "1\nTWO\n3\n4\n5\nsix\n7\n8\n9\nten\n11\n12\n";
+
+/* composes `first` and `second` in `dir` into composed.diff */
+static int compose_files(const char* dir, const char* first, const char* second) {
+    char first_path[MAX_PATH], second_path[MAX_PATH], composed_path[MAX_PATH];
+    if (join_path(first_path, dir, first) != 0 || join_path(second_path, dir, second) != 0 ||
+        join_path(composed_path, dir, "composed.diff") != 0)
+        return -1;
+    FILE* fp = fopen(composed_path, "wb");
+    if (fp == NULL)
+        return -1;
+    stream_wrapper_t sw = {0};
+    make_fdsw(&sw, fp);
+    int stat = patch_compose(first_path, second_path, &sw);
+    return sw.close(&sw) != 0 || stat != 0 ? -1 : 0;
+}
+
+/* the composed patch gives what the two patches give applied one after the other */
+static int run_compose(const char* dir) {
+    if (write_diff(dir, "first.diff", "f.txt", g_compose_first) != 0 ||
+        write_diff(dir, "second.diff", "f.txt", g_compose_second) != 0 ||
+        compose_files(dir, "first.diff", "second.diff") != 0)
+        return -1;
+
+    if (write_file(dir, "f.txt", g_two_hunks_input, sizeof(g_two_hunks_input) - 1) != 0 ||
+        apply_file(dir, "first.diff", 0) != 0 || apply_file(dir, "second.diff", 0) != 0 ||
+        !file_equals(dir, "f.txt", g_compose_expected))
+        return -1;
+    if (write_file(dir, "f.txt", g_two_hunks_input, sizeof(g_two_hunks_input) - 1) != 0 ||
+        apply_file(dir, "composed.diff", 0) != 0)
+        return -1;
+    return file_equals(dir, "f.txt", g_compose_expected) ? 0 : -1;
+}
+
+/* git patches of the same steps, the second also renaming the file: the files
+ * match without their a/ b/ prefixes, and the rename is composed along */
+static int run_compose_git(const char* dir) {
+    char first[1024], second[1024];
+    snprintf(first, sizeof(first), "--- \"a/%%s/f.txt\"\n+++ \"b/%%s/f.txt\"\n%s", g_compose_first);
+    snprintf(second, sizeof(second), "--- \"a/%%s/f.txt\"\n+++ \"b/%%s/g.txt\"\n%s", g_compose_second);
+    if (write_git_diff(dir, "first.diff", "f.txt", "f.txt", "index 1111111..2222222 100644\n", first) != 0 ||
+        write_git_diff(dir, "second.diff", "f.txt", "g.txt",
+                       "similarity index 80%%\nrename from \"%s/f.txt\"\nrename to \"%s/g.txt\"\n", second) != 0 ||
+        compose_files(dir, "first.diff", "second.diff") != 0)
+        return -1;
+
+    if (write_file(dir, "f.txt", g_two_hunks_input, sizeof(g_two_hunks_input) - 1) != 0 ||
+        apply_file(dir, "composed.diff", 0) != 0)
+        return -1;
+    return !file_exists(dir, "f.txt") && file_equals(dir, "g.txt", g_compose_expected) ? 0 : -1;
+}
+
 int test_cbk(patch_evt_t* evt) {
     if (evt == NULL) /* Invalid evt */
         return -1;
@@ -141,11 +1477,24 @@ int test_cbk(patch_evt_t* evt) {
 
         switch (evt->type) {
         case PATCH_EVT_STREAM_ACQUIRE: {
+            if (strcmp(path, dat->case_data->input->path) == 0 && dat->case_data->shared_index) {
+                const vtf_wrapper_t* input = dat->case_data->input;
+                lineidx_clear(&dat->input_index);
+                dat->input_index.flags = patch_line_flags(dat->case_data->options);
+                if (lineidx_append_text(&dat->input_index, input->data, input->length, PATCH_MAX_LINE) != 0 ||
+                    lineidx_build_hash(&dat->input_index) != 0)
+                    return -1;
+                evt->data.stream_event.index = &dat->input_index;
+                return make_viewsw(sw, &dat->input_index.mem);
+            }
             if (strcmp(path, dat->case_data->input->path) == 0) {
                 memcpy(sw, &dat->infile_owned_stream.stream, sizeof(stream_wrapper_t));
                 return 0;
             }
             if (strcmp(path, dat->case_data->expected->path) == 0) {
+                dat->output_size = evt->data.stream_event.size;
+                if (dat->output_size > 0 && dynmem_reserve(&dat->outfile_owned_stream.mem, (size_t)dat->output_size) != 0)
+                    return -1;
                 memcpy(sw, &dat->outfile_owned_stream.stream, sizeof(stream_wrapper_t));
                 return 0;
             }
@@ -168,6 +1517,8 @@ int init_test_context(simple_test_data_t* context_data, const test_case_data_t*
         return -1;
 
     context_data->case_data = case_data;
+    context_data->output_size = -1;
+    make_lineidx(&context_data->input_index);
 
     /* Populate dynmems */
     dynmem_write(&context_data->diff_owned_stream.mem, case_data->diff->data, case_data->diff->length, 1);
@@ -179,14 +1530,44 @@ int init_test_context(simple_test_data_t* context_data, const test_case_data_t*
     make_memsw(&context_data->diff_owned_stream.stream, &context_data->diff_owned_stream.mem);
     make_memsw(&context_data->infile_owned_stream.stream, &context_data->infile_owned_stream.mem);
     make_memsw(&context_data->outfile_owned_stream.stream, &context_data->outfile_owned_stream.mem);
+    if (case_data->unseekable) {
+        context_data->diff_owned_stream.stream.seekg = &nullsw_seek;
+        context_data->infile_owned_stream.stream.seekg = &nullsw_seek;
+    }
 }
 
 int main() {
 
-    test_case_data_t* test_cases[] = {
+    const test_case_data_t* test_cases[] = {
         &g_test_case_normal,
         &g_test_case_naughty,
+        &g_test_case_mismatch,
+        &g_test_case_offset,
+        &g_test_case_fuzz,
+        &g_test_case_no_fuzz,
+        &g_test_case_whitespace,
+        &g_test_case_applied,
+        &g_test_case_deleted,
+        &g_test_case_reverse,
+        &g_test_case_dry_run,
+        &g_test_case_shared_index,
+        &g_test_case_unordered,
+        &g_test_case_eol,
+        &g_test_case_create,
+        &g_test_case_binary,
+        &g_test_case_index,
+        &g_test_case_compiled,
+        &g_test_case_compiled_reverse,
+        &g_test_case_compiled_whitespace,
+        &g_test_case_resolved,
+        &g_test_case_resolved_eol,
+        &g_test_case_stream,
+        &g_test_case_stream_offset,
+        &g_test_case_stream_fuzz,
+        &g_test_case_fed,
+        &g_test_case_fed_naughty,
     };
+    int failed = 0;
 
     for (size_t i = 0; i < sizeof(test_cases) / sizeof(*test_cases); ++i) {
         simple_test_data_t test_data = {0};
@@ -194,15 +1575,99 @@ int main() {
         init_test_context(&test_data, test_cases[i]);
 
         void* patcher = patch_init();
-        patch_set_options(patcher, PATCH_OPTION_VERBOSE);
+        patch_set_options(patcher, PATCH_OPTION_VERBOSE | test_cases[i]->options);
+        patch_set_fuzz(patcher, test_cases[i]->fuzz);
         patch_set_path_cbk(patcher, (patch_event_cbk_t*)&test_cbk, (void*)&test_data);
-        apply_patch(patcher, &test_data.diff_owned_stream.stream);
+        int stat;
+        if (test_cases[i]->compiled) {
+            dynmem_t compiled;
+            stream_wrapper_t compiled_sw = {0};
+            make_dynmem(&compiled, 0, 0);
+            make_memsw(&compiled_sw, &compiled);
+            stat = patch_compile(&test_data.diff_owned_stream.stream, 0, &compiled_sw);
+            if (stat == 0)
+                stat = apply_compiled_patch(patcher, compiled.buf, compiled.writepos);
+            dynmem_free(&compiled);
+        } else if (test_cases[i]->resolved) {
+            dynmem_t script;
+            stream_wrapper_t script_sw = {0};
+            make_dynmem(&script, 0, 0);
+            make_memsw(&script_sw, &script);
+            stat = patch_resolve(patcher, &test_data.diff_owned_stream.stream, &script_sw);
+            if (stat == 0)
+                stat = apply_edit_script(patcher, script.buf, script.writepos);
+            dynmem_free(&script);
+        } else if (test_cases[i]->fed) {
+            const vtf_wrapper_t* diff = test_cases[i]->diff;
+            stat = 0;
+            for (size_t at = 0; at < diff->length; at += test_cases[i]->fed) {
+                size_t left = diff->length - at;
+                stat |= patch_feed(patcher, diff->data + at, left < test_cases[i]->fed ? left : test_cases[i]->fed);
+            }
+            stat |= patch_finish(patcher);
+        } else {
+            stat = apply_patch(patcher, &test_data.diff_owned_stream.stream);
+        }
+
+        const dynmem_t* out = &test_data.outfile_owned_stream.mem;
+        const vtf_wrapper_t* expected = test_cases[i]->expected;
+        int passed = test_cases[i]->expect_failure
+            ? stat != 0
+            : stat == 0 && out->writepos == expected->length && memcmp(out->buf, expected->data, expected->length) == 0 &&
+              (test_data.output_size < 0 || (size_t)test_data.output_size == expected->length);
+        if (!passed)
+            ++failed;
 
         dynmem_write(&test_data.outfile_owned_stream.mem, "\0", sizeof(char), 1);
         printf("%s", test_data.outfile_owned_stream.mem.buf);
+        printf("[%s] %s\n", passed ? "PASS" : "FAIL", test_cases[i]->name);
 
         patch_destroy(patcher);
+        lineidx_free(&test_data.input_index);
+    }
+
+    const file_case_t file_cases[] = {
+        {"conflicts overlapping", &run_conflicts_overlapping},
+        {"conflicts apart", &run_conflicts_apart},
+        {"conflicts git and plain", &run_conflicts_git},
+        {"conflicts created files", &run_conflicts_created},
+        {"series", &run_series},
+        {"series failing", &run_series_failing},
+        {"series delete", &run_series_delete},
+        {"series deleted input", &run_series_deleted_input},
+        {"series rename", &run_series_rename},
+        {"series rename written", &run_series_rename_written},
+        {"check many", &run_check_many},
+        {"failed hunk", &run_failed_hunk},
+        {"compiled failed hunk", &run_compiled_failed_hunk},
+        {"edit script mismatch", &run_script_mismatch},
+        {"cache", &run_cache},
+        {"compose", &run_compose},
+        {"compose git", &run_compose_git},
+        {"in place", &run_inplace},
+        {"in place same size", &run_inplace_same_size},
+        {"in place failed hunk", &run_inplace_failed_hunk},
+        {"append", &run_append},
+        {"append no newline", &run_append_no_newline},
+        {"append after no newline", &run_append_after_no_newline},
+        {"git rename", &run_git_rename},
+        {"git rename with a hunk", &run_git_rename_hunk},
+        {"git copy", &run_git_copy},
+        {"git mode", &run_git_mode},
+        {"git delete", &run_git_delete},
+    };
+
+    for (size_t i = 0; i < sizeof(file_cases) / sizeof(*file_cases); ++i) {
+        char dir[MAX_PATH];
+        int passed = 0;
+        if (make_temp_dir(dir) == 0) {
+            passed = file_cases[i].run(dir) == 0;
+            remove_tree(dir);
+        }
+        if (!passed)
+            ++failed;
+        printf("[%s] %s\n", passed ? "PASS" : "FAIL", file_cases[i].name);
     }
 
-    return 0;
+    return failed;
 }